@@ -0,0 +1,498 @@
+#include "allocator.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t order_for_size(VkDeviceSize size) {
+    VkDeviceSize units = (size + (1ull << ALLOCATOR_MIN_ORDER) - 1) >> ALLOCATOR_MIN_ORDER;
+    uint32_t order = 0;
+    while ((1ull << order) < units) {
+        order++;
+    }
+    return order;
+}
+
+static int push_free(gpu_block* block, uint32_t order, uint32_t offset) {
+    if (block->free_count[order] == block->free_capacity[order]) {
+        uint32_t capacity = block->free_capacity[order] ? block->free_capacity[order] * 2 : 8;
+        uint32_t* list = realloc(block->free_lists[order], capacity * sizeof(uint32_t));
+        if (!list) {
+            return 0;
+        }
+        block->free_lists[order] = list;
+        block->free_capacity[order] = capacity;
+    }
+    
+    block->free_lists[order][block->free_count[order]++] = offset;
+    return 1;
+}
+
+static int remove_free(gpu_block* block, uint32_t order, uint32_t offset) {
+    for (uint32_t i = 0; i < block->free_count[order]; i++) {
+        if (block->free_lists[order][i] == offset) {
+            block->free_lists[order][i] = block->free_lists[order][--block->free_count[order]];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int buddy_alloc(gpu_block* block, uint32_t order, uint32_t* offset) {
+    uint32_t found = order;
+    while (found < block->orders && block->free_count[found] == 0) {
+        found++;
+    }
+    
+    if (found >= block->orders) {
+        return 0;
+    }
+    
+    uint32_t start = block->free_lists[found][--block->free_count[found]];
+    
+    // Split down, keeping the upper half of each split free
+    while (found > order) {
+        found--;
+        if (!push_free(block, found, start + (1u << found))) {
+            return 0;
+        }
+    }
+    
+    *offset = start;
+    return 1;
+}
+
+static void buddy_free(gpu_block* block, uint32_t order, uint32_t offset) {
+    while (order + 1 < block->orders) {
+        uint32_t buddy = offset ^ (1u << order);
+        if (!remove_free(block, order, buddy)) {
+            break;
+        }
+        offset = offset < buddy ? offset : buddy;
+        order++;
+    }
+    
+    push_free(block, order, offset);
+}
+
+static void release_block(gpu_allocator* allocator, gpu_block* block) {
+    uint32_t heap = allocator->memory_properties.memoryTypes[block->memory_type].heapIndex;
+    
+    vkFreeMemory(allocator->device, block->memory, NULL);
+    for (uint32_t i = 0; i < ALLOCATOR_MAX_ORDERS; i++) {
+        free(block->free_lists[i]);
+    }
+    
+    allocator->heap_tracked[heap] -= block->size;
+    allocator->stats.heap_usage[heap] -= block->size;
+    allocator->stats.block_bytes -= block->size;
+    allocator->stats.block_count--;
+    allocator->stats.device_allocation_count--;
+    memset(block, 0, sizeof(*block));
+}
+
+static int budget_allows(gpu_allocator* allocator, uint32_t memory_type, VkDeviceSize size) {
+    uint32_t heap = allocator->memory_properties.memoryTypes[memory_type].heapIndex;
+    
+    if (allocator->stats.device_allocation_count >= allocator->stats.max_device_allocation_count) {
+        return 0;
+    }
+    
+    return allocator->stats.heap_usage[heap] + size <= allocator->stats.heap_budget[heap];
+}
+
+static int allocate_device_memory(gpu_allocator* allocator, uint32_t memory_type, VkDeviceSize size,
+                                  VkDeviceMemory* memory, void** mapped) {
+    if (!budget_allows(allocator, memory_type, size)) {
+        return 0;
+    }
+    
+    VkMemoryAllocateInfo alloc_info = {0};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = size;
+    alloc_info.memoryTypeIndex = memory_type;
+    
+    if (vkAllocateMemory(allocator->device, &alloc_info, NULL, memory) != VK_SUCCESS) {
+        return 0;
+    }
+    
+    // Host-visible memory stays mapped for its whole lifetime
+    *mapped = NULL;
+    if (allocator->memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (vkMapMemory(allocator->device, *memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+            vkFreeMemory(allocator->device, *memory, NULL);
+            return 0;
+        }
+    }
+    
+    uint32_t heap = allocator->memory_properties.memoryTypes[memory_type].heapIndex;
+    allocator->heap_tracked[heap] += size;
+    allocator->stats.heap_usage[heap] += size;
+    allocator->stats.device_allocation_count++;
+    return 1;
+}
+
+static gpu_block* create_block(gpu_allocator* allocator, uint32_t memory_type, gpu_resource_kind kind,
+                               VkDeviceSize min_size) {
+    gpu_block* block = NULL;
+    uint32_t index = 0;
+    for (; index < ALLOCATOR_MAX_BLOCKS; index++) {
+        if (allocator->blocks[index].memory == VK_NULL_HANDLE) {
+            block = &allocator->blocks[index];
+            break;
+        }
+    }
+    
+    if (!block) {
+        return NULL;
+    }
+    
+    // Near the budget, settle for a smaller block that still fits the request
+    uint32_t heap = allocator->memory_properties.memoryTypes[memory_type].heapIndex;
+    VkDeviceSize size = allocator->block_size[heap];
+    while (!allocate_device_memory(allocator, memory_type, size, &block->memory, &block->mapped)) {
+        if (size / 2 < min_size || size / 2 < ALLOCATOR_MIN_BLOCK_SIZE) {
+            return NULL;
+        }
+        size /= 2;
+    }
+    
+    block->size = size;
+    block->memory_type = memory_type;
+    block->kind = kind;
+    block->orders = order_for_size(size) + 1;
+    block->used = 0;
+    push_free(block, block->orders - 1, 0);
+    
+    if (index >= allocator->block_count) {
+        allocator->block_count = index + 1;
+    }
+    allocator->stats.block_count++;
+    allocator->stats.block_bytes += size;
+    return block;
+}
+
+static int allocate_from_type(gpu_allocator* allocator, uint32_t memory_type, VkDeviceSize size,
+                              VkDeviceSize alignment, gpu_resource_kind kind, gpu_allocation* allocation) {
+    uint32_t heap = allocator->memory_properties.memoryTypes[memory_type].heapIndex;
+    
+    // Anything bigger than half a block gets its own allocation; buddy
+    // rounding would waste too much of a block on it. Lazily allocated
+    // memory is only committed on demand, so a shared block buys nothing.
+    VkMemoryPropertyFlags flags = allocator->memory_properties.memoryTypes[memory_type].propertyFlags;
+    if (size > allocator->block_size[heap] / 2 || (flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+        if (!allocate_device_memory(allocator, memory_type, size, &allocation->memory, &allocation->mapped)) {
+            return 0;
+        }
+        allocation->offset = 0;
+        allocation->size = size;
+        allocation->memory_type = memory_type;
+        allocation->block = GPU_ALLOCATION_DEDICATED;
+        allocation->order = 0;
+        allocator->stats.dedicated_count++;
+        allocator->stats.dedicated_bytes += size;
+        return 1;
+    }
+    
+    // Buddy blocks are aligned to their own size, so alignment only rounds up the order
+    uint32_t order = order_for_size(size > alignment ? size : alignment);
+    uint32_t offset = 0;
+    gpu_block* block = NULL;
+    
+    for (uint32_t i = 0; i < allocator->block_count; i++) {
+        gpu_block* candidate = &allocator->blocks[i];
+        if (candidate->memory != VK_NULL_HANDLE && candidate->memory_type == memory_type &&
+            candidate->kind == kind && order < candidate->orders && buddy_alloc(candidate, order, &offset)) {
+            block = candidate;
+            break;
+        }
+    }
+    
+    if (!block) {
+        block = create_block(allocator, memory_type, kind, 1ull << (order + ALLOCATOR_MIN_ORDER));
+        if (!block || order >= block->orders || !buddy_alloc(block, order, &offset)) {
+            return 0;
+        }
+    }
+    
+    VkDeviceSize byte_size = 1ull << (order + ALLOCATOR_MIN_ORDER);
+    block->used += byte_size;
+    
+    allocation->memory = block->memory;
+    allocation->offset = (VkDeviceSize)offset << ALLOCATOR_MIN_ORDER;
+    allocation->size = byte_size;
+    allocation->mapped = block->mapped ? (char*)block->mapped + allocation->offset : NULL;
+    allocation->memory_type = memory_type;
+    allocation->block = (uint32_t)(block - allocator->blocks);
+    allocation->order = order;
+    return 1;
+}
+
+static void query_budget(gpu_allocator* allocator) {
+    VkPhysicalDeviceMemoryProperties* props = &allocator->memory_properties;
+    allocator->stats.heap_count = props->memoryHeapCount;
+    
+    if (allocator->stats.budget_supported) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {0};
+        budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        
+        VkPhysicalDeviceMemoryProperties2 props2 = {0};
+        props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        props2.pNext = &budget;
+        allocator->get_memory_properties2(allocator->physical_device, &props2);
+        
+        for (uint32_t i = 0; i < props->memoryHeapCount; i++) {
+            allocator->stats.heap_budget[i] = budget.heapBudget[i];
+            allocator->stats.heap_usage[i] = budget.heapUsage[i];
+        }
+        return;
+    }
+    
+    // Without the extension only our own allocations are visible
+    for (uint32_t i = 0; i < props->memoryHeapCount; i++) {
+        allocator->stats.heap_budget[i] = (uint64_t)(props->memoryHeaps[i].size * ALLOCATOR_FALLBACK_BUDGET);
+        allocator->stats.heap_usage[i] = allocator->heap_tracked[i];
+    }
+}
+
+gpu_allocator* gpu_allocator_create(VkInstance instance, VkPhysicalDevice physical_device, VkDevice device,
+                                    int budget_supported) {
+    gpu_allocator* allocator = calloc(1, sizeof(gpu_allocator));
+    if (!allocator) {
+        return NULL;
+    }
+    
+    allocator->device = device;
+    allocator->physical_device = physical_device;
+    pthread_mutex_init(&allocator->lock, NULL);
+    
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &allocator->memory_properties);
+    
+    VkPhysicalDeviceProperties device_props;
+    vkGetPhysicalDeviceProperties(physical_device, &device_props);
+    allocator->stats.max_device_allocation_count = device_props.limits.maxMemoryAllocationCount;
+    
+    if (budget_supported) {
+        allocator->get_memory_properties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2)
+            vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2");
+        allocator->stats.budget_supported = allocator->get_memory_properties2 != NULL;
+    }
+    
+    // Small heaps (typical of mobile host-visible heaps) get smaller blocks
+    for (uint32_t i = 0; i < allocator->memory_properties.memoryHeapCount; i++) {
+        VkDeviceSize size = ALLOCATOR_BLOCK_SIZE;
+        while (size > ALLOCATOR_MIN_BLOCK_SIZE && size > allocator->memory_properties.memoryHeaps[i].size / 8) {
+            size /= 2;
+        }
+        allocator->block_size[i] = size;
+    }
+    
+    query_budget(allocator);
+    return allocator;
+}
+
+void gpu_allocator_destroy(gpu_allocator* allocator) {
+    if (!allocator) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < allocator->block_count; i++) {
+        if (allocator->blocks[i].memory != VK_NULL_HANDLE) {
+            release_block(allocator, &allocator->blocks[i]);
+        }
+    }
+    
+    pthread_mutex_destroy(&allocator->lock);
+    free(allocator);
+}
+
+int gpu_alloc(gpu_allocator* allocator, const VkMemoryRequirements* requirements,
+              VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+              gpu_resource_kind kind, gpu_allocation* allocation) {
+    memset(allocation, 0, sizeof(*allocation));
+    
+    pthread_mutex_lock(&allocator->lock);
+    
+    // First pass insists on the preferred flags, second settles for required
+    VkMemoryPropertyFlags passes[2] = {required | preferred, required};
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1 && passes[1] == passes[0]) {
+            break;
+        }
+        
+        for (uint32_t i = 0; i < allocator->memory_properties.memoryTypeCount; i++) {
+            VkMemoryPropertyFlags flags = allocator->memory_properties.memoryTypes[i].propertyFlags;
+            if ((requirements->memoryTypeBits & (1u << i)) && (flags & passes[pass]) == passes[pass] &&
+                allocate_from_type(allocator, i, requirements->size, requirements->alignment, kind, allocation)) {
+                allocator->stats.allocation_count++;
+                allocator->stats.used_bytes += allocation->size;
+                pthread_mutex_unlock(&allocator->lock);
+                return 1;
+            }
+        }
+    }
+    
+    allocator->stats.failed_allocations++;
+    pthread_mutex_unlock(&allocator->lock);
+    return 0;
+}
+
+void gpu_free(gpu_allocator* allocator, gpu_allocation* allocation) {
+    if (allocation->memory == VK_NULL_HANDLE) {
+        return;
+    }
+    
+    pthread_mutex_lock(&allocator->lock);
+    
+    allocator->stats.allocation_count--;
+    allocator->stats.used_bytes -= allocation->size;
+    
+    if (allocation->block == GPU_ALLOCATION_DEDICATED) {
+        uint32_t heap = allocator->memory_properties.memoryTypes[allocation->memory_type].heapIndex;
+        vkFreeMemory(allocator->device, allocation->memory, NULL);
+        allocator->heap_tracked[heap] -= allocation->size;
+        allocator->stats.heap_usage[heap] -= allocation->size;
+        allocator->stats.dedicated_count--;
+        allocator->stats.dedicated_bytes -= allocation->size;
+        allocator->stats.device_allocation_count--;
+    } else {
+        gpu_block* block = &allocator->blocks[allocation->block];
+        buddy_free(block, allocation->order, (uint32_t)(allocation->offset >> ALLOCATOR_MIN_ORDER));
+        block->used -= allocation->size;
+        
+        // Keep one empty block per type and kind around to avoid churn
+        if (block->used == 0) {
+            for (uint32_t i = 0; i < allocator->block_count; i++) {
+                gpu_block* other = &allocator->blocks[i];
+                if (other != block && other->memory != VK_NULL_HANDLE &&
+                    other->memory_type == block->memory_type && other->kind == block->kind) {
+                    release_block(allocator, block);
+                    break;
+                }
+            }
+        }
+    }
+    
+    pthread_mutex_unlock(&allocator->lock);
+    memset(allocation, 0, sizeof(*allocation));
+}
+
+int gpu_create_buffer(gpu_allocator* allocator, const VkBufferCreateInfo* info,
+                      VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+                      VkBuffer* buffer, gpu_allocation* allocation) {
+    if (vkCreateBuffer(allocator->device, info, NULL, buffer) != VK_SUCCESS) {
+        return 0;
+    }
+    
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(allocator->device, *buffer, &requirements);
+    
+    if (!gpu_alloc(allocator, &requirements, required, preferred, GPU_RESOURCE_LINEAR, allocation)) {
+        vkDestroyBuffer(allocator->device, *buffer, NULL);
+        *buffer = VK_NULL_HANDLE;
+        return 0;
+    }
+    
+    if (vkBindBufferMemory(allocator->device, *buffer, allocation->memory, allocation->offset) != VK_SUCCESS) {
+        gpu_destroy_buffer(allocator, *buffer, allocation);
+        *buffer = VK_NULL_HANDLE;
+        return 0;
+    }
+    
+    return 1;
+}
+
+void gpu_destroy_buffer(gpu_allocator* allocator, VkBuffer buffer, gpu_allocation* allocation) {
+    if (buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(allocator->device, buffer, NULL);
+    }
+    gpu_free(allocator, allocation);
+}
+
+int gpu_create_image(gpu_allocator* allocator, const VkImageCreateInfo* info,
+                     VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+                     VkImage* image, gpu_allocation* allocation) {
+    if (vkCreateImage(allocator->device, info, NULL, image) != VK_SUCCESS) {
+        return 0;
+    }
+    
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(allocator->device, *image, &requirements);
+    
+    gpu_resource_kind kind = info->tiling == VK_IMAGE_TILING_OPTIMAL ? GPU_RESOURCE_OPTIMAL : GPU_RESOURCE_LINEAR;
+    if (!gpu_alloc(allocator, &requirements, required, preferred, kind, allocation)) {
+        vkDestroyImage(allocator->device, *image, NULL);
+        *image = VK_NULL_HANDLE;
+        return 0;
+    }
+    
+    if (vkBindImageMemory(allocator->device, *image, allocation->memory, allocation->offset) != VK_SUCCESS) {
+        gpu_destroy_image(allocator, *image, allocation);
+        *image = VK_NULL_HANDLE;
+        return 0;
+    }
+    
+    return 1;
+}
+
+void gpu_destroy_image(gpu_allocator* allocator, VkImage image, gpu_allocation* allocation) {
+    if (image != VK_NULL_HANDLE) {
+        vkDestroyImage(allocator->device, image, NULL);
+    }
+    gpu_free(allocator, allocation);
+}
+
+int gpu_linear_pool_create(gpu_allocator* allocator, VkDeviceSize size, VkBufferUsageFlags usage,
+                           gpu_linear_pool* pool) {
+    memset(pool, 0, sizeof(*pool));
+    
+    VkBufferCreateInfo buffer_info = {0};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = size;
+    buffer_info.usage = usage;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    
+    // Device-local host-visible memory (unified memory on mobile) when available
+    if (!gpu_create_buffer(allocator, &buffer_info,
+                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pool->buffer, &pool->allocation)) {
+        return 0;
+    }
+    
+    pool->capacity = size;
+    return 1;
+}
+
+void gpu_linear_pool_destroy(gpu_allocator* allocator, gpu_linear_pool* pool) {
+    gpu_destroy_buffer(allocator, pool->buffer, &pool->allocation);
+    memset(pool, 0, sizeof(*pool));
+}
+
+void gpu_linear_pool_reset(gpu_linear_pool* pool) {
+    pool->head = 0;
+}
+
+void* gpu_linear_pool_alloc(gpu_linear_pool* pool, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset) {
+    if (alignment == 0) {
+        alignment = 1;
+    }
+    
+    VkDeviceSize start = (pool->head + alignment - 1) / alignment * alignment;
+    if (!pool->allocation.mapped || start + size > pool->capacity) {
+        return NULL;
+    }
+    
+    pool->head = start + size;
+    *offset = start;
+    return (char*)pool->allocation.mapped + start;
+}
+
+void gpu_allocator_update_budget(gpu_allocator* allocator) {
+    pthread_mutex_lock(&allocator->lock);
+    query_budget(allocator);
+    pthread_mutex_unlock(&allocator->lock);
+}
+
+void gpu_allocator_get_stats(gpu_allocator* allocator, gpu_allocator_stats* stats) {
+    pthread_mutex_lock(&allocator->lock);
+    *stats = allocator->stats;
+    pthread_mutex_unlock(&allocator->lock);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "platform.h"
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#define ALLOCATOR_BLOCK_SIZE (64ull << 20)
+#define ALLOCATOR_MIN_BLOCK_SIZE (4ull << 20)
+#define ALLOCATOR_MIN_ORDER 8
+#define ALLOCATOR_MAX_ORDERS 24
+#define ALLOCATOR_MAX_BLOCKS 64
+
+// Share of a heap we allow ourselves when VK_EXT_memory_budget is missing
+#define ALLOCATOR_FALLBACK_BUDGET 0.8
+
+// Linear (buffers, linear images) and optimal-tiling resources get separate
+// blocks so bufferImageGranularity never has to be honored inside a block
+typedef enum {
+    GPU_RESOURCE_LINEAR,
+    GPU_RESOURCE_OPTIMAL,
+    GPU_RESOURCE_KIND_COUNT
+} gpu_resource_kind;
+
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void* mapped;
+    uint32_t memory_type;
+    uint32_t block;
+    uint32_t order;
+} gpu_allocation;
+
+#define GPU_ALLOCATION_DEDICATED UINT32_MAX
+
+// Buddy allocator over one vkAllocateMemory. Free lists hold offsets in
+// units of the minimum allocation size.
+typedef struct {
+    VkDeviceMemory memory;
+    void* mapped;
+    VkDeviceSize size;
+    uint32_t memory_type;
+    gpu_resource_kind kind;
+    uint32_t orders;
+    uint32_t* free_lists[ALLOCATOR_MAX_ORDERS];
+    uint32_t free_count[ALLOCATOR_MAX_ORDERS];
+    uint32_t free_capacity[ALLOCATOR_MAX_ORDERS];
+    VkDeviceSize used;
+} gpu_block;
+
+// Bump allocator over one buffer, rewound once the GPU is done with a frame
+typedef struct {
+    VkBuffer buffer;
+    gpu_allocation allocation;
+    VkDeviceSize head;
+    VkDeviceSize capacity;
+} gpu_linear_pool;
+
+typedef struct {
+    uint32_t block_count;
+    uint32_t dedicated_count;
+    uint32_t allocation_count;
+    uint32_t device_allocation_count;
+    uint32_t max_device_allocation_count;
+    uint64_t block_bytes;
+    uint64_t dedicated_bytes;
+    uint64_t used_bytes;
+    uint64_t failed_allocations;
+    int budget_supported;
+    uint32_t heap_count;
+    uint64_t heap_budget[VK_MAX_MEMORY_HEAPS];
+    uint64_t heap_usage[VK_MAX_MEMORY_HEAPS];
+} gpu_allocator_stats;
+
+typedef struct gpu_allocator {
+    VkDevice device;
+    VkPhysicalDevice physical_device;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    PFN_vkGetPhysicalDeviceMemoryProperties2 get_memory_properties2;
+    VkDeviceSize block_size[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize heap_tracked[VK_MAX_MEMORY_HEAPS];
+    gpu_block blocks[ALLOCATOR_MAX_BLOCKS];
+    uint32_t block_count;
+    pthread_mutex_t lock;
+    gpu_allocator_stats stats;
+} gpu_allocator;
+
+gpu_allocator* gpu_allocator_create(VkInstance instance, VkPhysicalDevice physical_device, VkDevice device,
+                                    int budget_supported);
+void gpu_allocator_destroy(gpu_allocator* allocator);
+
+int gpu_alloc(gpu_allocator* allocator, const VkMemoryRequirements* requirements,
+              VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+              gpu_resource_kind kind, gpu_allocation* allocation);
+void gpu_free(gpu_allocator* allocator, gpu_allocation* allocation);
+
+int gpu_create_buffer(gpu_allocator* allocator, const VkBufferCreateInfo* info,
+                      VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+                      VkBuffer* buffer, gpu_allocation* allocation);
+void gpu_destroy_buffer(gpu_allocator* allocator, VkBuffer buffer, gpu_allocation* allocation);
+int gpu_create_image(gpu_allocator* allocator, const VkImageCreateInfo* info,
+                     VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+                     VkImage* image, gpu_allocation* allocation);
+void gpu_destroy_image(gpu_allocator* allocator, VkImage image, gpu_allocation* allocation);
+
+int gpu_linear_pool_create(gpu_allocator* allocator, VkDeviceSize size, VkBufferUsageFlags usage,
+                           gpu_linear_pool* pool);
+void gpu_linear_pool_destroy(gpu_allocator* allocator, gpu_linear_pool* pool);
+void gpu_linear_pool_reset(gpu_linear_pool* pool);
+void* gpu_linear_pool_alloc(gpu_linear_pool* pool, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+
+void gpu_allocator_update_budget(gpu_allocator* allocator);
+void gpu_allocator_get_stats(gpu_allocator* allocator, gpu_allocator_stats* stats);
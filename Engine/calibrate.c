@@ -0,0 +1,164 @@
+#include "calibrate.h"
+#include "sprite.h"
+#include "flags.h"
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_TAG "vm_engine"
+
+#define FRAME_BUDGET_60_NS 16666666ull
+#define FRAME_BUDGET_30_NS 33333333ull
+
+// Leave headroom for game logic on top of the calibration workload
+#define BUDGET_HEADROOM 0.75
+
+typedef struct {
+    int width;
+    int height;
+    int msaa;
+} quality_level;
+
+// Candidates from best to cheapest
+static const quality_level quality_levels[] = {
+    {1920, 1080, 4},
+    {1920, 1080, 2},
+    {1600, 900, 4},
+    {1600, 900, 2},
+    {1280, 720, 4},
+    {1280, 720, 2},
+    {1280, 720, 1},
+    {960, 540, 2},
+    {960, 540, 1},
+};
+
+#define QUALITY_LEVEL_COUNT (sizeof(quality_levels) / sizeof(quality_levels[0]))
+
+// The sample counts the candidates use, each measured on its own
+static const int sample_counts[] = {4, 2, 1};
+
+#define SAMPLE_COUNT_COUNT (sizeof(sample_counts) / sizeof(sample_counts[0]))
+
+static const char* const calibration_flags[] = {
+    "msaa", "resolution_width", "resolution_height", "limitfps30", "calibration_device",
+};
+
+void calibrate_device_key(vulkan_context* ctx, char* key, size_t size) {
+    snprintf(key, size, "%08x:%08x:%08x %ux%u", ctx->caps.vendor_id, ctx->caps.device_id,
+             ctx->caps.driver_version, ctx->swap_chain_extent.width, ctx->swap_chain_extent.height);
+}
+
+// A level larger than the surface renders at the surface size
+static uint64_t predict_frame_ns(double ns_per_pixel, const quality_level* level, double surface_pixels) {
+    double pixels = (double)level->width * (double)level->height;
+    return (uint64_t)(ns_per_pixel * (pixels < surface_pixels ? pixels : surface_pixels));
+}
+
+// The frames are already drawn at this sample count, so the cost per pixel
+// needs no MSAA factor on top. Leaves ns_per_pixel at 0 when the device
+// lacks the count.
+static bool measure_sample_count(vulkan_context* ctx, const renderer_config* base, int samples, int frame_count,
+                                 double* ns_per_pixel, uint64_t* cpu_frame_ns, uint64_t* gpu_frame_ns) {
+    renderer_config config = *base;
+    config.width = ctx->swap_chain_extent.width;
+    config.height = ctx->swap_chain_extent.height;
+    config.msaa_samples = (uint32_t)samples;
+    config.render_width = 0;
+    config.render_height = 0;
+    config.dynamic_resolution = 0;
+    
+    vulkan_context offscreen = {0};
+    renderer_init(&offscreen, NULL, &config);
+    if (offscreen.device == VK_NULL_HANDLE) {
+        return false;
+    }
+    
+    *ns_per_pixel = 0.0;
+    if ((int)offscreen.msaa_samples != samples) {
+        renderer_cleanup(&offscreen);
+        return true;
+    }
+    
+    sprite_benchmark_result bench;
+    int measured = sprite_benchmark(&offscreen, CALIBRATION_SPRITES, (uint32_t)frame_count, &bench);
+    renderer_cleanup(&offscreen);
+    if (!measured || bench.gpu_frame_ns == 0) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "calibration needs GPU timestamps");
+        return false;
+    }
+    
+    double pixels = (double)config.width * (double)config.height;
+    *ns_per_pixel = (double)bench.gpu_frame_ns / pixels;
+    *cpu_frame_ns = bench.cpu_frame_ns;
+    *gpu_frame_ns = bench.gpu_frame_ns;
+    return true;
+}
+
+bool calibrate_run(vulkan_context* ctx, const renderer_config* base, int frame_count, calibration_result* result) {
+    memset(result, 0, sizeof(*result));
+    if (ctx->device == VK_NULL_HANDLE || frame_count <= 0) {
+        return false;
+    }
+    
+    double surface_pixels = (double)ctx->swap_chain_extent.width * (double)ctx->swap_chain_extent.height;
+    double ns_per_pixel[SAMPLE_COUNT_COUNT];
+    uint64_t cpu_frame_ns[SAMPLE_COUNT_COUNT] = {0};
+    uint64_t gpu_frame_ns[SAMPLE_COUNT_COUNT] = {0};
+    for (size_t i = 0; i < SAMPLE_COUNT_COUNT; i++) {
+        if (!measure_sample_count(ctx, base, sample_counts[i], frame_count, &ns_per_pixel[i],
+                                  &cpu_frame_ns[i], &gpu_frame_ns[i])) {
+            return false;
+        }
+    }
+    calibrate_device_key(ctx, result->device_key, sizeof(result->device_key));
+    
+    // Prefer 60 fps at the best quality; drop to 30 fps only if nothing fits
+    const uint64_t budgets[] = {FRAME_BUDGET_60_NS, FRAME_BUDGET_30_NS};
+    for (int b = 0; b < 2; b++) {
+        uint64_t budget = (uint64_t)(budgets[b] * BUDGET_HEADROOM);
+        
+        for (size_t i = 0; i < QUALITY_LEVEL_COUNT; i++) {
+            size_t s = 0;
+            while (sample_counts[s] != quality_levels[i].msaa) {
+                s++;
+            }
+            if (ns_per_pixel[s] == 0.0 || cpu_frame_ns[s] > budget ||
+                predict_frame_ns(ns_per_pixel[s], &quality_levels[i], surface_pixels) > budget) {
+                continue;
+            }
+            
+            result->resolution_width = quality_levels[i].width;
+            result->resolution_height = quality_levels[i].height;
+            result->msaa = quality_levels[i].msaa;
+            result->limitfps30 = b == 1;
+            result->cpu_frame_ns = cpu_frame_ns[s];
+            result->gpu_frame_ns = gpu_frame_ns[s];
+            return true;
+        }
+    }
+    
+    // Every device renders single-sampled, so the cheapest level was measured
+    const quality_level* lowest = &quality_levels[QUALITY_LEVEL_COUNT - 1];
+    result->resolution_width = lowest->width;
+    result->resolution_height = lowest->height;
+    result->msaa = lowest->msaa;
+    result->limitfps30 = true;
+    result->cpu_frame_ns = cpu_frame_ns[SAMPLE_COUNT_COUNT - 1];
+    result->gpu_frame_ns = gpu_frame_ns[SAMPLE_COUNT_COUNT - 1];
+    return true;
+}
+
+bool calibrate_apply(const calibration_result* result) {
+    flag_set_int("msaa", result->msaa);
+    flag_set_int("resolution_width", result->resolution_width);
+    flag_set_int("resolution_height", result->resolution_height);
+    flag_set_bool("limitfps30", result->limitfps30);
+    flag_set_string("calibration_device", result->device_key);
+    
+    int count = (int)(sizeof(calibration_flags) / sizeof(calibration_flags[0]));
+    if (!flags_save_config(calibration_flags, count)) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "no flags config to keep the calibration in");
+        return false;
+    }
+    return true;
+}
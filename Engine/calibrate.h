@@ -0,0 +1,38 @@
+#pragma once
+#include "renderer.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CALIBRATION_FRAMES 60
+
+// Sprites per calibration frame, about what a busy scene submits
+#define CALIBRATION_SPRITES 20000
+
+#define CALIBRATION_KEY_SIZE 64
+
+typedef struct {
+    int msaa;
+    int resolution_width;
+    int resolution_height;
+    bool limitfps30;
+    
+    // Measured at the surface size and the chosen sample count
+    uint64_t cpu_frame_ns;
+    uint64_t gpu_frame_ns;
+    char device_key[CALIBRATION_KEY_SIZE];
+} calibration_result;
+
+// Names the device, driver and surface size settings were chosen for; the
+// calibration_device flag holds the one the config's settings belong to
+void calibrate_device_key(vulkan_context* ctx, char* key, size_t size);
+
+// Renders sprite frames offscreen at ctx's surface size, once per sample
+// count the candidates use, times them with the GPU profiler and picks the
+// best settings that fit the frame budget. The offscreen contexts start
+// from base. Fails without GPU timestamps.
+bool calibrate_run(vulkan_context* ctx, const renderer_config* base, int frame_count, calibration_result* result);
+
+// Sets the flags and writes them into the flags config, so later launches
+// start with them; VM thread only
+bool calibrate_apply(const calibration_result* result);
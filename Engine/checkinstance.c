@@ -1,5 +1,5 @@
 #include "checkinstance.h"
-#include <android/log.h>
+#include "platform.h"
 #include <stdlib.h>
 #include <pthread.h>
 
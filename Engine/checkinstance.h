@@ -1,5 +1,5 @@
 #pragma once
-#include <android/native_window.h>
+#include "platform.h"
 
 void check_instance_init(void);
 int check_instance_register(ANativeWindow* window);
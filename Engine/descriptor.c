@@ -0,0 +1,350 @@
+#include "descriptor.h"
+#include "pipeline.h"
+#include "timeline.h"
+#include "platform.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int create_frame(vulkan_context* ctx, descriptor_system* system, descriptor_frame* frame) {
+    if (!gpu_linear_pool_create(ctx->allocator, DESCRIPTOR_UNIFORM_RING_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                &frame->uniform_ring)) {
+        return 0;
+    }
+    
+    VkDescriptorSetLayout draw_layout = pipeline_get_draw_set_layout(ctx);
+    
+    VkDescriptorSetAllocateInfo set_info = {0};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.descriptorPool = system->draw_pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &draw_layout;
+    
+    if (vkAllocateDescriptorSets(ctx->device, &set_info, &frame->draw_set) != VK_SUCCESS) {
+        return 0;
+    }
+    
+    // The range is the largest block a draw may have; the dynamic offset
+    // picks the draw's block within the ring
+    VkDescriptorBufferInfo uniform_info = {0};
+    uniform_info.buffer = frame->uniform_ring.buffer;
+    uniform_info.offset = 0;
+    uniform_info.range = DESCRIPTOR_DRAW_UNIFORM_MAX;
+    
+    VkWriteDescriptorSet write = {0};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = frame->draw_set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write.pBufferInfo = &uniform_info;
+    vkUpdateDescriptorSets(ctx->device, 1, &write, 0, NULL);
+    
+    VkDescriptorPoolSize pool_sizes[3] = {{0}};
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    pool_sizes[0].descriptorCount = DESCRIPTOR_FRAME_POOL_DESCRIPTORS;
+    pool_sizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    pool_sizes[1].descriptorCount = DESCRIPTOR_FRAME_POOL_DESCRIPTORS;
+    pool_sizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_sizes[2].descriptorCount = DESCRIPTOR_FRAME_POOL_DESCRIPTORS;
+    
+    // No FREE_DESCRIPTOR_SET_BIT: sets are never freed one by one, which
+    // lets the driver allocate them linearly
+    VkDescriptorPoolCreateInfo pool_info = {0};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets = DESCRIPTOR_FRAME_POOL_SETS;
+    pool_info.poolSizeCount = 3;
+    pool_info.pPoolSizes = pool_sizes;
+    
+    return vkCreateDescriptorPool(ctx->device, &pool_info, NULL, &frame->pool) == VK_SUCCESS;
+}
+
+// One set whose slots are filled as textures arrive; unwritten slots are
+// fine as long as shaders don't index them
+static int create_bindless(vulkan_context* ctx, descriptor_system* system) {
+    VkDescriptorPoolSize pool_size = {0};
+    pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    pool_size.descriptorCount = system->bindless_capacity;
+    
+    VkDescriptorPoolCreateInfo pool_info = {0};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    
+    if (vkCreateDescriptorPool(ctx->device, &pool_info, NULL, &system->bindless_pool) != VK_SUCCESS) {
+        return 0;
+    }
+    
+    VkDescriptorSetLayout layout = pipeline_get_bindless_set_layout(ctx);
+    
+    VkDescriptorSetAllocateInfo set_info = {0};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.descriptorPool = system->bindless_pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &layout;
+    
+    return vkAllocateDescriptorSets(ctx->device, &set_info, &system->bindless_set) == VK_SUCCESS;
+}
+
+int descriptor_init(vulkan_context* ctx) {
+    descriptor_system* system = calloc(1, sizeof(descriptor_system));
+    if (!system) {
+        return 0;
+    }
+    ctx->descriptors = system;
+    
+    system->frame_count = ctx->frame_count;
+    system->uniform_alignment = ctx->caps.min_uniform_alignment ? ctx->caps.min_uniform_alignment : 1;
+    
+    VkDescriptorPoolSize pool_size = {0};
+    pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    pool_size.descriptorCount = system->frame_count;
+    
+    VkDescriptorPoolCreateInfo pool_info = {0};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets = system->frame_count;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    
+    if (vkCreateDescriptorPool(ctx->device, &pool_info, NULL, &system->draw_pool) != VK_SUCCESS) {
+        return 0;
+    }
+    
+    for (uint32_t i = 0; i < system->frame_count; i++) {
+        if (!create_frame(ctx, system, &system->frames[i])) {
+            return 0;
+        }
+    }
+    system->current = &system->frames[0];
+    
+    if (pipeline_get_bindless_set_layout(ctx) != VK_NULL_HANDLE) {
+        system->bindless_capacity = ctx->caps.max_bindless_textures < DESCRIPTOR_BINDLESS_MAX ?
+                                    ctx->caps.max_bindless_textures : DESCRIPTOR_BINDLESS_MAX;
+        system->retired_slots = malloc(system->bindless_capacity * sizeof(uint32_t));
+        system->retired_values = malloc(system->bindless_capacity * sizeof(uint64_t));
+        if (!system->retired_slots || !system->retired_values || !create_bindless(ctx, system)) {
+            return 0;
+        }
+    }
+    
+    system->stats.bindless = system->bindless_set != VK_NULL_HANDLE;
+    system->stats.bindless_capacity = system->bindless_capacity;
+    return 1;
+}
+
+void descriptor_shutdown(vulkan_context* ctx) {
+    descriptor_system* system = ctx->descriptors;
+    if (!system) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < system->frame_count; i++) {
+        descriptor_frame* frame = &system->frames[i];
+        if (frame->pool != VK_NULL_HANDLE) {
+            vkDestroyDescriptorPool(ctx->device, frame->pool, NULL);
+        }
+        gpu_linear_pool_destroy(ctx->allocator, &frame->uniform_ring);
+    }
+    
+    if (system->draw_pool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(ctx->device, system->draw_pool, NULL);
+    }
+    if (system->bindless_pool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(ctx->device, system->bindless_pool, NULL);
+    }
+    
+    free(system->retired_slots);
+    free(system->retired_values);
+    free(system->staging);
+    free(system);
+    ctx->descriptors = NULL;
+}
+
+int descriptor_stage_uniforms(vulkan_context* ctx, const void* data, uint32_t size, uint32_t* offset) {
+    descriptor_system* system = ctx->descriptors;
+    if (!system || size == 0 || size > DESCRIPTOR_DRAW_UNIFORM_MAX) {
+        return 0;
+    }
+    
+    // Offsets are relative to the start of the ring, where begin_frame puts
+    // the staged block; the bound range must still fit behind the last one
+    uint32_t start = (uint32_t)((system->staging_size + system->uniform_alignment - 1) /
+                                system->uniform_alignment * system->uniform_alignment);
+    if (start + DESCRIPTOR_DRAW_UNIFORM_MAX > DESCRIPTOR_UNIFORM_RING_SIZE) {
+        system->stats.rejected_uniforms++;
+        return 0;
+    }
+    
+    if (start + size > system->staging_capacity) {
+        uint32_t capacity = system->staging_capacity ? system->staging_capacity : DESCRIPTOR_STAGING_INITIAL;
+        while (capacity < start + size) {
+            capacity *= 2;
+        }
+        uint8_t* staging = realloc(system->staging, capacity);
+        if (!staging) {
+            return 0;
+        }
+        system->staging = staging;
+        system->staging_capacity = capacity;
+    }
+    
+    memcpy(system->staging + start, data, size);
+    system->staging_size = start + size;
+    system->staging_draws++;
+    *offset = start;
+    return 1;
+}
+
+void descriptor_begin_frame(vulkan_context* ctx, frame_context* frame) {
+    descriptor_system* system = ctx->descriptors;
+    if (!system) {
+        return;
+    }
+    
+    descriptor_frame* current = &system->frames[frame - ctx->frames];
+    system->current = current;
+    
+    // Resetting returns every set at once; untouched pools skip the call
+    if (current->set_count > 0) {
+        vkResetDescriptorPool(ctx->device, current->pool, 0);
+        current->set_count = 0;
+        system->stats.pool_resets++;
+    }
+    
+    gpu_linear_pool_reset(&current->uniform_ring);
+    
+    // Rewound, so this lands at offset 0 and the staged offsets hold as they are
+    VkDeviceSize ring_offset;
+    void* ring = system->staging_size > 0 ?
+                 gpu_linear_pool_alloc(&current->uniform_ring, system->staging_size, system->uniform_alignment,
+                                       &ring_offset) : NULL;
+    if (ring) {
+        memcpy(ring, system->staging, system->staging_size);
+    }
+    
+    system->stats.uniform_draws = system->staging_draws;
+    system->stats.uniform_bytes = system->staging_size;
+    system->stats.frame_sets = 0;
+    system->staging_size = 0;
+    system->staging_draws = 0;
+}
+
+void descriptor_discard(vulkan_context* ctx) {
+    descriptor_system* system = ctx->descriptors;
+    if (system) {
+        system->staging_size = 0;
+        system->staging_draws = 0;
+    }
+}
+
+VkDescriptorSet descriptor_draw_set(vulkan_context* ctx) {
+    return ctx->descriptors ? ctx->descriptors->current->draw_set : VK_NULL_HANDLE;
+}
+
+void* descriptor_frame_uniforms(vulkan_context* ctx, uint32_t size, uint32_t* offset) {
+    descriptor_system* system = ctx->descriptors;
+    if (!system || size == 0 || size > DESCRIPTOR_DRAW_UNIFORM_MAX) {
+        return NULL;
+    }
+    
+    gpu_linear_pool* ring = &system->current->uniform_ring;
+    VkDeviceSize ring_offset;
+    void* data = gpu_linear_pool_alloc(ring, DESCRIPTOR_DRAW_UNIFORM_MAX, system->uniform_alignment, &ring_offset);
+    if (!data) {
+        system->stats.rejected_uniforms++;
+        return NULL;
+    }
+    
+    // The whole bound range was reserved; give back what the caller won't use
+    ring->head = ring_offset + size;
+    *offset = (uint32_t)ring_offset;
+    return data;
+}
+
+VkDescriptorSet descriptor_alloc_frame_set(vulkan_context* ctx, VkDescriptorSetLayout layout) {
+    descriptor_system* system = ctx->descriptors;
+    if (!system) {
+        return VK_NULL_HANDLE;
+    }
+    
+    VkDescriptorSetAllocateInfo set_info = {0};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.descriptorPool = system->current->pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &layout;
+    
+    VkDescriptorSet set;
+    if (vkAllocateDescriptorSets(ctx->device, &set_info, &set) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+    
+    system->current->set_count++;
+    system->stats.frame_sets++;
+    return set;
+}
+
+uint32_t descriptor_bindless_add(vulkan_context* ctx, VkImageView view, VkSampler sampler) {
+    descriptor_system* system = ctx->descriptors;
+    if (!system || system->bindless_set == VK_NULL_HANDLE) {
+        return DESCRIPTOR_BINDLESS_NONE;
+    }
+    
+    // Fresh slots first, so a retired one has the longest time to drain
+    uint32_t slot;
+    if (system->bindless_count < system->bindless_capacity) {
+        slot = system->bindless_count++;
+    } else if (system->retired_count > 0 &&
+               gpu_timeline_completed(ctx->timeline) >= system->retired_values[system->retired_head]) {
+        slot = system->retired_slots[system->retired_head];
+        system->retired_head = (system->retired_head + 1) % system->bindless_capacity;
+        system->retired_count--;
+    } else {
+        return DESCRIPTOR_BINDLESS_NONE;
+    }
+    
+    VkDescriptorImageInfo image_info = {0};
+    image_info.sampler = sampler;
+    image_info.imageView = view;
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    
+    VkWriteDescriptorSet write = {0};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = system->bindless_set;
+    write.dstBinding = 0;
+    write.dstArrayElement = slot;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &image_info;
+    vkUpdateDescriptorSets(ctx->device, 1, &write, 0, NULL);
+    
+    system->stats.bindless_count = system->bindless_count - system->retired_count;
+    system->stats.bindless_retired = system->retired_count;
+    return slot;
+}
+
+void descriptor_bindless_remove(vulkan_context* ctx, uint32_t slot) {
+    descriptor_system* system = ctx->descriptors;
+    if (!system || slot >= system->bindless_count || system->retired_count >= system->bindless_capacity) {
+        return;
+    }
+    
+    uint32_t tail = (system->retired_head + system->retired_count) % system->bindless_capacity;
+    system->retired_slots[tail] = slot;
+    system->retired_values[tail] = gpu_timeline_last_submitted(ctx->timeline);
+    system->retired_count++;
+    system->stats.bindless_count = system->bindless_count - system->retired_count;
+    system->stats.bindless_retired = system->retired_count;
+}
+
+VkDescriptorSet descriptor_bindless_set(vulkan_context* ctx) {
+    return ctx->descriptors ? ctx->descriptors->bindless_set : VK_NULL_HANDLE;
+}
+
+void descriptor_get_stats(vulkan_context* ctx, descriptor_stats* stats) {
+    if (!ctx->descriptors) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = ctx->descriptors->stats;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "renderer.h"
+#include <stdint.h>
+
+// Per-draw uniforms live in a ring per frame in flight and are bound
+// through one dynamic uniform set with a different offset per draw
+#define DESCRIPTOR_UNIFORM_RING_SIZE (1u << 20)
+#define DESCRIPTOR_DRAW_UNIFORM_MAX 256
+#define DESCRIPTOR_STAGING_INITIAL 4096
+
+// Per-frame pool for sets that only live for one frame, reset wholesale
+// once the frame's submit has completed
+#define DESCRIPTOR_FRAME_POOL_SETS 64
+#define DESCRIPTOR_FRAME_POOL_DESCRIPTORS 128
+
+#define DESCRIPTOR_BINDLESS_MAX 4096
+#define DESCRIPTOR_BINDLESS_NONE UINT32_MAX
+
+typedef struct {
+    gpu_linear_pool uniform_ring;
+    VkDescriptorSet draw_set;
+    VkDescriptorPool pool;
+    uint32_t set_count;
+} descriptor_frame;
+
+typedef struct {
+    uint32_t uniform_draws;
+    uint64_t uniform_bytes;
+    uint64_t rejected_uniforms;
+    uint32_t frame_sets;
+    uint64_t pool_resets;
+    int bindless;
+    uint32_t bindless_count;
+    uint32_t bindless_retired;
+    uint32_t bindless_capacity;
+} descriptor_stats;
+
+typedef struct descriptor_system {
+    VkDescriptorPool draw_pool;
+    descriptor_frame frames[MAX_FRAMES_IN_FLIGHT];
+    uint32_t frame_count;
+    descriptor_frame* current;
+    VkDeviceSize uniform_alignment;
+    
+    // Draws are submitted before their frame's ring is free, so their
+    // uniforms collect here and go over in one copy when it is
+    uint8_t* staging;
+    uint32_t staging_size;
+    uint32_t staging_capacity;
+    uint32_t staging_draws;
+    
+    VkDescriptorPool bindless_pool;
+    VkDescriptorSet bindless_set;
+    uint32_t bindless_capacity;
+    uint32_t bindless_count;
+    
+    // Removed slots, oldest first, each with the last submit that could
+    // still sample it; a slot is handed out again once that has completed
+    uint32_t* retired_slots;
+    uint64_t* retired_values;
+    uint32_t retired_head;
+    uint32_t retired_count;
+    descriptor_stats stats;
+} descriptor_system;
+
+// After the pipeline system, which owns the set layouts
+int descriptor_init(vulkan_context* ctx);
+void descriptor_shutdown(vulkan_context* ctx);
+
+// Copies size bytes for a draw of the next frame; offset is its dynamic
+// offset into the draw set. Fails past DESCRIPTOR_DRAW_UNIFORM_MAX or when
+// the frame's ring is full.
+int descriptor_stage_uniforms(vulkan_context* ctx, const void* data, uint32_t size, uint32_t* offset);
+
+// Render thread only, once the frame's submit has completed: rewinds its
+// ring and pool and moves the staged uniforms in
+void descriptor_begin_frame(vulkan_context* ctx, frame_context* frame);
+void descriptor_discard(vulkan_context* ctx);
+
+// The current frame's dynamic uniform set
+VkDescriptorSet descriptor_draw_set(vulkan_context* ctx);
+
+// Ring space written directly by the render thread after begin_frame
+void* descriptor_frame_uniforms(vulkan_context* ctx, uint32_t size, uint32_t* offset);
+
+// A set that is valid until this frame slot comes around again
+VkDescriptorSet descriptor_alloc_frame_set(vulkan_context* ctx, VkDescriptorSetLayout layout);
+
+// Slot in the bindless texture table, or DESCRIPTOR_BINDLESS_NONE when the
+// device has no descriptor indexing or the table is full. Slots can be
+// written while frames that bound the table are in flight.
+uint32_t descriptor_bindless_add(vulkan_context* ctx, VkImageView view, VkSampler sampler);
+
+// Render thread only. The slot keeps its view until every frame submitted
+// so far has completed and is reused after that.
+void descriptor_bindless_remove(vulkan_context* ctx, uint32_t slot);
+
+// VK_NULL_HANDLE without descriptor indexing
+VkDescriptorSet descriptor_bindless_set(vulkan_context* ctx);
+
+void descriptor_get_stats(vulkan_context* ctx, descriptor_stats* stats);
@@ -0,0 +1,468 @@
+#include "device.h"
+#include "hash.h"
+#include "timing.h"
+#include "platform.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_TAG "vm_engine"
+
+static const struct {
+    const char* name;
+    device_extension bit;
+} known_extensions[] = {
+    {"VK_KHR_swapchain", DEVICE_EXT_SWAPCHAIN},
+    {"VK_EXT_memory_budget", DEVICE_EXT_MEMORY_BUDGET},
+    {"VK_KHR_timeline_semaphore", DEVICE_EXT_TIMELINE_SEMAPHORE},
+    {"VK_KHR_draw_indirect_count", DEVICE_EXT_DRAW_INDIRECT_COUNT},
+    {"VK_EXT_descriptor_indexing", DEVICE_EXT_DESCRIPTOR_INDEXING},
+};
+
+// One enumeration for all the extensions we care about
+static uint32_t probe_extensions(VkPhysicalDevice physical_device) {
+    uint32_t count = 0;
+    vkEnumerateDeviceExtensionProperties(physical_device, NULL, &count, NULL);
+    if (count == 0) {
+        return 0;
+    }
+    
+    VkExtensionProperties* properties = malloc(sizeof(VkExtensionProperties) * count);
+    if (!properties) {
+        return 0;
+    }
+    
+    vkEnumerateDeviceExtensionProperties(physical_device, NULL, &count, properties);
+    
+    uint32_t extensions = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        for (uint32_t k = 0; k < sizeof(known_extensions) / sizeof(known_extensions[0]); k++) {
+            if (strcmp(properties[i].extensionName, known_extensions[k].name) == 0) {
+                extensions |= known_extensions[k].bit;
+            }
+        }
+    }
+    free(properties);
+    
+    return extensions;
+}
+
+// Graphics must also present when there is a surface. Dedicated compute and
+// transfer families map to the async compute and copy engines.
+static void probe_queue_families(VkPhysicalDevice physical_device, VkSurfaceKHR surface, device_caps* caps) {
+    caps->graphics_family = DEVICE_NO_FAMILY;
+    caps->compute_family = DEVICE_NO_FAMILY;
+    caps->transfer_family = DEVICE_NO_FAMILY;
+    
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, NULL);
+    VkQueueFamilyProperties* families = family_count ? malloc(sizeof(VkQueueFamilyProperties) * family_count) : NULL;
+    if (!families) {
+        return;
+    }
+    
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, families);
+    
+    for (uint32_t i = 0; i < family_count; i++) {
+        VkQueueFlags flags = families[i].queueFlags;
+        
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) && caps->graphics_family == DEVICE_NO_FAMILY) {
+            VkBool32 present_support = VK_TRUE;
+            if (surface != VK_NULL_HANDLE) {
+                vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, i, surface, &present_support);
+            }
+            if (present_support) {
+                caps->graphics_family = i;
+                caps->timestamp_valid_bits = families[i].timestampValidBits;
+            }
+        }
+        
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) &&
+            caps->compute_family == DEVICE_NO_FAMILY) {
+            caps->compute_family = i;
+        }
+        
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+            caps->transfer_family == DEVICE_NO_FAMILY) {
+            caps->transfer_family = i;
+        }
+    }
+    free(families);
+}
+
+static void probe_memory(VkPhysicalDevice physical_device, device_caps* caps) {
+    VkPhysicalDeviceMemoryProperties memory;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory);
+    
+    for (uint32_t i = 0; i < memory.memoryHeapCount; i++) {
+        if (memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            caps->device_local_bytes += memory.memoryHeaps[i].size;
+        }
+    }
+    
+    // Unified memory, or a mappable window into VRAM: uploads can skip staging
+    VkMemoryPropertyFlags mappable = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    for (uint32_t i = 0; i < memory.memoryTypeCount; i++) {
+        if ((memory.memoryTypes[i].propertyFlags & mappable) == mappable) {
+            caps->host_visible_device_local = 1;
+        }
+    }
+}
+
+// Core in 1.2 and an extension before that; the query itself needs 1.1
+static void probe_timeline(VkInstance instance, VkPhysicalDevice physical_device, uint32_t instance_api_version,
+                           device_caps* caps) {
+    int core = instance_api_version >= VK_API_VERSION_1_2 && caps->api_version >= VK_API_VERSION_1_2;
+    if (instance_api_version < VK_API_VERSION_1_1 ||
+        (!core && !device_has_extension(caps, DEVICE_EXT_TIMELINE_SEMAPHORE))) {
+        return;
+    }
+    
+    PFN_vkGetPhysicalDeviceFeatures2 get_features2 =
+        (PFN_vkGetPhysicalDeviceFeatures2)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2");
+    if (!get_features2) {
+        return;
+    }
+    
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features = {0};
+    timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    
+    VkPhysicalDeviceFeatures2 features = {0};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &timeline_features;
+    get_features2(physical_device, &features);
+    
+    caps->timeline_semaphore = timeline_features.timelineSemaphore == VK_TRUE;
+}
+
+// Core in 1.2 and an extension before that, which itself needs 1.1
+static void probe_descriptor_indexing(VkInstance instance, VkPhysicalDevice physical_device,
+                                      uint32_t instance_api_version, device_caps* caps) {
+    int core = instance_api_version >= VK_API_VERSION_1_2 && caps->api_version >= VK_API_VERSION_1_2;
+    if (instance_api_version < VK_API_VERSION_1_1 || caps->api_version < VK_API_VERSION_1_1 ||
+        (!core && !device_has_extension(caps, DEVICE_EXT_DESCRIPTOR_INDEXING))) {
+        return;
+    }
+    
+    PFN_vkGetPhysicalDeviceFeatures2 get_features2 =
+        (PFN_vkGetPhysicalDeviceFeatures2)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2");
+    PFN_vkGetPhysicalDeviceProperties2 get_properties2 =
+        (PFN_vkGetPhysicalDeviceProperties2)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2");
+    if (!get_features2 || !get_properties2) {
+        return;
+    }
+    
+    VkPhysicalDeviceDescriptorIndexingFeatures indexing_features = {0};
+    indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    
+    VkPhysicalDeviceFeatures2 features = {0};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &indexing_features;
+    get_features2(physical_device, &features);
+    
+    VkPhysicalDeviceDescriptorIndexingProperties indexing_props = {0};
+    indexing_props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+    
+    VkPhysicalDeviceProperties2 props = {0};
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props.pNext = &indexing_props;
+    get_properties2(physical_device, &props);
+    
+    caps->descriptor_indexing = indexing_features.runtimeDescriptorArray == VK_TRUE &&
+                                indexing_features.descriptorBindingPartiallyBound == VK_TRUE &&
+                                indexing_features.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE &&
+                                indexing_features.descriptorBindingUpdateUnusedWhilePending == VK_TRUE &&
+                                indexing_features.shaderSampledImageArrayNonUniformIndexing == VK_TRUE;
+    
+    // Combined image samplers count against both the image and the sampler limits
+    uint32_t limit = indexing_props.maxPerStageDescriptorUpdateAfterBindSampledImages;
+    if (indexing_props.maxPerStageDescriptorUpdateAfterBindSamplers < limit) {
+        limit = indexing_props.maxPerStageDescriptorUpdateAfterBindSamplers;
+    }
+    if (indexing_props.maxDescriptorSetUpdateAfterBindSampledImages < limit) {
+        limit = indexing_props.maxDescriptorSetUpdateAfterBindSampledImages;
+    }
+    caps->max_bindless_textures = caps->descriptor_indexing ? limit : 0;
+}
+
+static VkFormat probe_depth_format(VkPhysicalDevice physical_device) {
+    // D16 is the only depth format every implementation must support
+    VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM};
+    for (uint32_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(physical_device, candidates[i], &props);
+        if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+            return candidates[i];
+        }
+    }
+    return VK_FORMAT_D16_UNORM;
+}
+
+// Lists longer than the arrays are cut short; the formats we look for come first
+static void probe_surface(VkPhysicalDevice physical_device, VkSurfaceKHR surface, device_caps* caps) {
+    caps->surface_probed = 1;
+    
+    caps->surface_format_count = DEVICE_MAX_SURFACE_FORMATS;
+    if (vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &caps->surface_format_count,
+                                             caps->surface_formats) < VK_SUCCESS) {
+        caps->surface_format_count = 0;
+    }
+    
+    caps->present_mode_count = DEVICE_MAX_PRESENT_MODES;
+    if (vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &caps->present_mode_count,
+                                                  caps->present_modes) < VK_SUCCESS) {
+        caps->present_mode_count = 0;
+    }
+}
+
+static int32_t score_device(const device_caps* caps, VkSurfaceKHR surface) {
+    if (caps->graphics_family == DEVICE_NO_FAMILY) {
+        return 0;
+    }
+    if (surface != VK_NULL_HANDLE &&
+        (!device_has_extension(caps, DEVICE_EXT_SWAPCHAIN) || caps->surface_format_count == 0)) {
+        return 0;
+    }
+    
+    int32_t score;
+    switch (caps->device_type) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+            score = DEVICE_SCORE_DISCRETE;
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+            score = DEVICE_SCORE_INTEGRATED;
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+            score = DEVICE_SCORE_VIRTUAL;
+            break;
+        default:
+            score = DEVICE_SCORE_OTHER;
+            break;
+    }
+    
+    if (caps->timeline_semaphore) score += DEVICE_SCORE_TIMELINE;
+    if (caps->compute_family != DEVICE_NO_FAMILY) score += DEVICE_SCORE_ASYNC_COMPUTE;
+    if (caps->transfer_family != DEVICE_NO_FAMILY) score += DEVICE_SCORE_TRANSFER;
+    if (device_has_extension(caps, DEVICE_EXT_MEMORY_BUDGET)) score += DEVICE_SCORE_MEMORY_BUDGET;
+    
+    uint64_t gib = caps->device_local_bytes >> 30;
+    score += (int32_t)(gib < DEVICE_SCORE_MAX_GIB ? gib : DEVICE_SCORE_MAX_GIB) * DEVICE_SCORE_PER_GIB;
+    
+    for (uint32_t samples = VK_SAMPLE_COUNT_2_BIT; samples <= VK_SAMPLE_COUNT_64_BIT; samples <<= 1) {
+        if (caps->sample_counts & samples) {
+            score += DEVICE_SCORE_PER_MSAA_STEP;
+        }
+    }
+    
+    return score;
+}
+
+int device_has_extension(const device_caps* caps, device_extension extension) {
+    return (caps->extensions & extension) != 0;
+}
+
+// Everything but the surface-dependent fields, which is what the cache keeps
+static void probe_device(VkInstance instance, VkPhysicalDevice physical_device, uint32_t instance_api_version,
+                         device_caps* caps) {
+    memset(caps, 0, sizeof(*caps));
+    
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physical_device, &props);
+    
+    caps->vendor_id = props.vendorID;
+    caps->device_id = props.deviceID;
+    caps->driver_version = props.driverVersion;
+    caps->api_version = props.apiVersion;
+    memcpy(caps->device_name, props.deviceName, sizeof(caps->device_name));
+    caps->device_name[sizeof(caps->device_name) - 1] = '\0';
+    caps->device_type = props.deviceType;
+    caps->timestamp_period = props.limits.timestampPeriod;
+    
+    // Color and depth must agree, since the scene target has both
+    caps->sample_counts = props.limits.framebufferColorSampleCounts & props.limits.framebufferDepthSampleCounts;
+    caps->max_image_dimension_2d = props.limits.maxImageDimension2D;
+    caps->max_push_constants_size = props.limits.maxPushConstantsSize;
+    caps->max_draw_indirect_count = props.limits.maxDrawIndirectCount;
+    caps->max_compute_invocations = props.limits.maxComputeWorkGroupInvocations;
+    caps->max_sampler_anisotropy = props.limits.maxSamplerAnisotropy;
+    caps->min_uniform_alignment = props.limits.minUniformBufferOffsetAlignment;
+    
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(physical_device, &features);
+    caps->sampler_anisotropy = features.samplerAnisotropy == VK_TRUE;
+    caps->multi_draw_indirect = features.multiDrawIndirect == VK_TRUE;
+    caps->draw_indirect_first_instance = features.drawIndirectFirstInstance == VK_TRUE;
+    caps->texture_compression_etc2 = features.textureCompressionETC2 == VK_TRUE;
+    caps->texture_compression_astc = features.textureCompressionASTC_LDR == VK_TRUE;
+    caps->texture_compression_bc = features.textureCompressionBC == VK_TRUE;
+    
+    caps->extensions = probe_extensions(physical_device);
+    probe_memory(physical_device, caps);
+    probe_timeline(instance, physical_device, instance_api_version, caps);
+    probe_descriptor_indexing(instance, physical_device, instance_api_version, caps);
+    caps->depth_format = probe_depth_format(physical_device);
+}
+
+// The surface-dependent fields, cached caps or not: present support and the
+// surface lists belong to this launch's surface
+static void probe_presentation(VkPhysicalDevice physical_device, VkSurfaceKHR surface, device_caps* caps) {
+    caps->surface_probed = 0;
+    caps->surface_format_count = 0;
+    caps->present_mode_count = 0;
+    probe_queue_families(physical_device, surface, caps);
+    
+    if (surface != VK_NULL_HANDLE && device_has_extension(caps, DEVICE_EXT_SWAPCHAIN)) {
+        probe_surface(physical_device, surface, caps);
+    }
+    
+    caps->score = score_device(caps, surface);
+}
+
+void device_probe(VkInstance instance, VkPhysicalDevice physical_device, VkSurfaceKHR surface,
+                  uint32_t instance_api_version, device_caps* caps) {
+    probe_device(instance, physical_device, instance_api_version, caps);
+    probe_presentation(physical_device, surface, caps);
+}
+
+// Returns the cached entries when the file is intact and was written
+// through the same instance version, else NULL
+static device_caps* load_cache(const char* cache_filename, uint32_t instance_api_version, uint32_t* count) {
+    FILE* file = fopen(cache_filename, "rb");
+    if (!file) {
+        return NULL;
+    }
+    
+    device_caps_header header;
+    device_caps* entries = NULL;
+    
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == DEVICE_CAPS_MAGIC && header.version == DEVICE_CAPS_VERSION &&
+        header.instance_api_version == instance_api_version &&
+        header.count > 0 && header.count <= DEVICE_MAX_PHYSICAL_DEVICES) {
+        entries = malloc(sizeof(device_caps) * header.count);
+        if (entries && fread(entries, sizeof(device_caps), header.count, file) == header.count &&
+            hash_fnv1a64(entries, sizeof(device_caps) * header.count, HASH_FNV1A64_SEED) == header.checksum) {
+            *count = header.count;
+        } else {
+            free(entries);
+            entries = NULL;
+        }
+    }
+    
+    fclose(file);
+    
+    if (!entries) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "discarding stale device caps %s", cache_filename);
+    }
+    
+    return entries;
+}
+
+// Strips the surface-dependent fields, which the next launch probes again
+static void save_cache(const char* cache_filename, uint32_t instance_api_version,
+                       const device_caps* probed, uint32_t count) {
+    device_caps entries[DEVICE_MAX_PHYSICAL_DEVICES];
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i] = probed[i];
+        memset(&entries[i].surface_probed, 0, sizeof(device_caps) - offsetof(device_caps, surface_probed));
+    }
+    
+    device_caps_header header = {0};
+    header.magic = DEVICE_CAPS_MAGIC;
+    header.version = DEVICE_CAPS_VERSION;
+    header.instance_api_version = instance_api_version;
+    header.count = count;
+    header.checksum = hash_fnv1a64(entries, sizeof(device_caps) * count, HASH_FNV1A64_SEED);
+    
+    // Write beside the real file and rename so a crash never leaves half a cache
+    char temp_filename[520];
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", cache_filename);
+    
+    FILE* file = fopen(temp_filename, "wb");
+    int ok = file != NULL;
+    if (ok) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(entries, sizeof(device_caps), count, file) == count;
+        ok = fclose(file) == 0 && ok;
+    }
+    ok = ok && rename(temp_filename, cache_filename) == 0;
+    
+    if (!ok) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "could not write device caps %s", cache_filename);
+        remove(temp_filename);
+    }
+}
+
+// A driver update changes driverVersion, which retires the entry
+static const device_caps* find_cached(const device_caps* cached, uint32_t cached_count,
+                                      const VkPhysicalDeviceProperties* props) {
+    for (uint32_t i = 0; i < cached_count; i++) {
+        const device_caps* entry = &cached[i];
+        if (entry->vendor_id == props->vendorID && entry->device_id == props->deviceID &&
+            entry->driver_version == props->driverVersion && entry->api_version == props->apiVersion &&
+            strncmp(entry->device_name, props->deviceName, sizeof(entry->device_name)) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int device_select(VkInstance instance, VkSurfaceKHR surface, uint32_t instance_api_version,
+                  const char* cache_filename, VkPhysicalDevice* physical_device, device_caps* caps,
+                  device_select_stats* stats) {
+    uint64_t start = timing_now_ns();
+    memset(stats, 0, sizeof(*stats));
+    
+    VkPhysicalDevice devices[DEVICE_MAX_PHYSICAL_DEVICES];
+    uint32_t device_count = DEVICE_MAX_PHYSICAL_DEVICES;
+    if (vkEnumeratePhysicalDevices(instance, &device_count, devices) < VK_SUCCESS || device_count == 0) {
+        return 0;
+    }
+    
+    uint32_t cached_count = 0;
+    device_caps* cached = cache_filename ? load_cache(cache_filename, instance_api_version, &cached_count) : NULL;
+    
+    device_caps entries[DEVICE_MAX_PHYSICAL_DEVICES];
+    int best = -1;
+    
+    for (uint32_t i = 0; i < device_count; i++) {
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(devices[i], &props);
+        
+        const device_caps* entry = find_cached(cached, cached_count, &props);
+        if (entry) {
+            entries[i] = *entry;
+            stats->cached_count++;
+        } else {
+            probe_device(instance, devices[i], instance_api_version, &entries[i]);
+            stats->probed_count++;
+        }
+        probe_presentation(devices[i], surface, &entries[i]);
+        
+        // Ties go to the first device, as the driver lists its preferred one first
+        if (entries[i].score > 0 && (best < 0 || entries[i].score > entries[best].score)) {
+            best = (int)i;
+        }
+    }
+    free(cached);
+    
+    if (cache_filename && stats->probed_count > 0) {
+        save_cache(cache_filename, instance_api_version, entries, device_count);
+    }
+    
+    stats->device_count = device_count;
+    stats->select_ns = timing_now_ns() - start;
+    
+    if (best < 0) {
+        return 0;
+    }
+    
+    *physical_device = devices[best];
+    *caps = entries[best];
+    
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+                        "device %s (score %d, %u of %u from cache) selected in %.2f ms",
+                        caps->device_name, (int)caps->score, stats->cached_count, device_count,
+                        stats->select_ns / 1e6);
+    return 1;
+}
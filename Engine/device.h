@@ -0,0 +1,118 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+#define DEVICE_CAPS_MAGIC 0x53504143u
+#define DEVICE_CAPS_VERSION 3
+#define DEVICE_MAX_PHYSICAL_DEVICES 8
+#define DEVICE_MAX_SURFACE_FORMATS 16
+#define DEVICE_MAX_PRESENT_MODES 8
+#define DEVICE_NO_FAMILY UINT32_MAX
+
+// Selection score: the device type dominates, the rest breaks ties
+// between devices of the same kind
+#define DEVICE_SCORE_DISCRETE 1000
+#define DEVICE_SCORE_INTEGRATED 500
+#define DEVICE_SCORE_VIRTUAL 250
+#define DEVICE_SCORE_OTHER 100
+#define DEVICE_SCORE_TIMELINE 40
+#define DEVICE_SCORE_ASYNC_COMPUTE 20
+#define DEVICE_SCORE_TRANSFER 20
+#define DEVICE_SCORE_MEMORY_BUDGET 10
+#define DEVICE_SCORE_PER_GIB 5
+#define DEVICE_SCORE_MAX_GIB 16
+#define DEVICE_SCORE_PER_MSAA_STEP 5
+
+// Device extensions the engine can use, as a bitmask in device_caps
+typedef enum {
+    DEVICE_EXT_SWAPCHAIN = 1 << 0,
+    DEVICE_EXT_MEMORY_BUDGET = 1 << 1,
+    DEVICE_EXT_TIMELINE_SEMAPHORE = 1 << 2,
+    DEVICE_EXT_DRAW_INDIRECT_COUNT = 1 << 3,
+    DEVICE_EXT_DESCRIPTOR_INDEXING = 1 << 4
+} device_extension;
+
+// Everything startup needs to know about one physical device. Plain data,
+// written to disk as is; the identity fields up front are the cache key.
+// The fields at the end depend on the surface and are probed again on
+// every launch, since the window can differ from the last one.
+typedef struct {
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint32_t api_version;
+    char device_name[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE];
+    
+    VkPhysicalDeviceType device_type;
+    uint32_t compute_family;
+    uint32_t transfer_family;
+    float timestamp_period;
+    
+    uint64_t device_local_bytes;
+    uint32_t host_visible_device_local;
+    
+    uint32_t extensions;
+    uint32_t timeline_semaphore;
+    uint32_t sampler_anisotropy;
+    uint32_t multi_draw_indirect;
+    uint32_t draw_indirect_first_instance;
+    uint32_t texture_compression_etc2;
+    uint32_t texture_compression_astc;
+    uint32_t texture_compression_bc;
+    
+    // Everything a bindless texture table needs: runtime-sized, partially
+    // bound, updated after bind and indexed non-uniformly
+    uint32_t descriptor_indexing;
+    uint32_t max_bindless_textures;
+    
+    VkSampleCountFlags sample_counts;
+    VkFormat depth_format;
+    uint32_t max_image_dimension_2d;
+    uint32_t max_push_constants_size;
+    uint32_t max_draw_indirect_count;
+    uint32_t max_compute_invocations;
+    float max_sampler_anisotropy;
+    VkDeviceSize min_uniform_alignment;
+    
+    // Probed against a surface: present support and the surface lists are valid
+    uint32_t surface_probed;
+    int32_t score;
+    uint32_t graphics_family;
+    uint32_t timestamp_valid_bits;
+    uint32_t surface_format_count;
+    VkSurfaceFormatKHR surface_formats[DEVICE_MAX_SURFACE_FORMATS];
+    uint32_t present_mode_count;
+    VkPresentModeKHR present_modes[DEVICE_MAX_PRESENT_MODES];
+} device_caps;
+
+// On-disk layout: this header, then count device_caps
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t instance_api_version;
+    uint32_t count;
+    uint64_t checksum;
+} device_caps_header;
+
+typedef struct {
+    uint32_t device_count;
+    uint32_t probed_count;
+    uint32_t cached_count;
+    uint64_t select_ns;
+} device_select_stats;
+
+// Probes every device, or reuses the cached caps of those whose driver is
+// unchanged, checks presentation against surface, and picks the highest
+// score. instance_api_version limits the queries; surface may be
+// VK_NULL_HANDLE for offscreen rendering. A NULL cache_filename skips the
+// cache. Returns 0 when no device can render.
+int device_select(VkInstance instance, VkSurfaceKHR surface, uint32_t instance_api_version,
+                  const char* cache_filename, VkPhysicalDevice* physical_device, device_caps* caps,
+                  device_select_stats* stats);
+
+// Fills caps from the driver; the score is left at 0 for unusable devices
+void device_probe(VkInstance instance, VkPhysicalDevice physical_device, VkSurfaceKHR surface,
+                  uint32_t instance_api_version, device_caps* caps);
+
+int device_has_extension(const device_caps* caps, device_extension extension);
@@ -0,0 +1,669 @@
+#include "ecs.h"
+#include "jobs.h"
+#include "timing.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ECS_INITIAL_RECORDS 1024
+
+// A run of chunks of one archetype for one system
+typedef struct {
+    const ecs_system* system;
+    const ecs_archetype* archetype;
+    uint32_t first_chunk;
+    uint32_t chunk_count;
+    float dt;
+    job_counter* counter;
+} ecs_work;
+
+static uint32_t entity_index(ecs_entity entity) {
+    return (uint32_t)entity;
+}
+
+static uint32_t entity_generation(ecs_entity entity) {
+    return (uint32_t)(entity >> 32);
+}
+
+static uint32_t align_line(uint32_t size) {
+    return (size + ECS_CACHE_LINE - 1) & ~(uint32_t)(ECS_CACHE_LINE - 1);
+}
+
+ecs_world* ecs_create_world(void) {
+    ecs_world* world = calloc(1, sizeof(ecs_world));
+    if (!world) {
+        return NULL;
+    }
+    
+    world->records = malloc(ECS_INITIAL_RECORDS * sizeof(ecs_record));
+    world->free_records = malloc(ECS_INITIAL_RECORDS * sizeof(uint32_t));
+    if (!world->records || !world->free_records) {
+        ecs_destroy_world(world);
+        return NULL;
+    }
+    world->record_capacity = ECS_INITIAL_RECORDS;
+    
+    // Index 0 is never handed out, so entity 0 stays invalid
+    world->records[0].generation = 0;
+    world->record_count = 1;
+    return world;
+}
+
+void ecs_destroy_world(ecs_world* world) {
+    if (!world) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < world->archetype_count; i++) {
+        ecs_archetype* archetype = &world->archetypes[i];
+        for (uint32_t chunk = 0; chunk < archetype->chunk_count; chunk++) {
+            free(archetype->chunks[chunk].data);
+        }
+        free(archetype->chunks);
+    }
+    free(world->records);
+    free(world->free_records);
+    free(world);
+}
+
+uint32_t ecs_register_component(ecs_world* world, uint32_t size) {
+    if (world->component_count >= ECS_MAX_COMPONENTS || size == 0) {
+        return ECS_COMPONENT_NONE;
+    }
+    
+    world->component_sizes[world->component_count] = size;
+    return world->component_count++;
+}
+
+static uint32_t chunk_bytes(const ecs_world* world, ecs_mask mask, uint32_t rows) {
+    uint32_t bytes = align_line(rows * (uint32_t)sizeof(ecs_entity));
+    for (uint32_t i = 0; i < world->component_count; i++) {
+        if (mask & ECS_BIT(i)) {
+            bytes += align_line(rows * world->component_sizes[i]);
+        }
+    }
+    return bytes;
+}
+
+// A bit past the registered components would have no column, so its
+// accesses would land in the entity ids
+static int mask_registered(const ecs_world* world, ecs_mask mask) {
+    ecs_mask registered = world->component_count >= ECS_MAX_COMPONENTS ? ~(ecs_mask)0
+                                                                        : ECS_BIT(world->component_count) - 1;
+    return (mask & ~registered) == 0;
+}
+
+// Linear, but there are few archetypes and the last one hit usually hits again
+static uint32_t find_archetype(ecs_world* world, ecs_mask mask) {
+    if (!mask_registered(world, mask)) {
+        return UINT32_MAX;
+    }
+    
+    for (uint32_t i = 0; i < world->archetype_count; i++) {
+        if (world->archetypes[i].mask == mask) {
+            return i;
+        }
+    }
+    
+    if (world->archetype_count >= ECS_MAX_ARCHETYPES) {
+        return UINT32_MAX;
+    }
+    
+    // As many rows as fit once every column is padded to a cache line
+    uint32_t row_bytes = sizeof(ecs_entity);
+    for (uint32_t i = 0; i < world->component_count; i++) {
+        if (mask & ECS_BIT(i)) {
+            row_bytes += world->component_sizes[i];
+        }
+    }
+    uint32_t capacity = ECS_CHUNK_SIZE / row_bytes;
+    while (capacity > 0 && chunk_bytes(world, mask, capacity) > ECS_CHUNK_SIZE) {
+        capacity--;
+    }
+    if (capacity == 0) {
+        return UINT32_MAX;
+    }
+    
+    ecs_archetype* archetype = &world->archetypes[world->archetype_count];
+    memset(archetype, 0, sizeof(*archetype));
+    archetype->mask = mask;
+    archetype->capacity = capacity;
+    
+    uint32_t offset = align_line(capacity * (uint32_t)sizeof(ecs_entity));
+    for (uint32_t i = 0; i < world->component_count; i++) {
+        if (mask & ECS_BIT(i)) {
+            archetype->offsets[i] = offset;
+            offset += align_line(capacity * world->component_sizes[i]);
+        }
+    }
+    return world->archetype_count++;
+}
+
+static uint8_t* row_column(const ecs_world* world, const ecs_archetype* archetype, uint32_t chunk, uint32_t row,
+                           uint32_t component) {
+    return archetype->chunks[chunk].data + archetype->offsets[component] + row * world->component_sizes[component];
+}
+
+// Appends a zeroed row at the end of the archetype's last chunk
+static int push_row(ecs_world* world, uint32_t archetype_index, ecs_entity entity, uint32_t* chunk_index,
+                    uint32_t* row) {
+    ecs_archetype* archetype = &world->archetypes[archetype_index];
+    if (archetype->chunk_count == 0 || archetype->chunks[archetype->chunk_count - 1].count == archetype->capacity) {
+        if (archetype->chunk_count == archetype->chunk_capacity) {
+            uint32_t capacity = archetype->chunk_capacity ? archetype->chunk_capacity * 2 : 4;
+            ecs_chunk* chunks = realloc(archetype->chunks, capacity * sizeof(ecs_chunk));
+            if (!chunks) {
+                return 0;
+            }
+            archetype->chunks = chunks;
+            archetype->chunk_capacity = capacity;
+        }
+        
+        void* data;
+        if (posix_memalign(&data, ECS_CACHE_LINE, ECS_CHUNK_SIZE) != 0) {
+            return 0;
+        }
+        archetype->chunks[archetype->chunk_count].data = data;
+        archetype->chunks[archetype->chunk_count].count = 0;
+        archetype->chunk_count++;
+        world->stats.chunk_count++;
+    }
+    
+    *chunk_index = archetype->chunk_count - 1;
+    ecs_chunk* chunk = &archetype->chunks[*chunk_index];
+    *row = chunk->count++;
+    ((ecs_entity*)chunk->data)[*row] = entity;
+    for (uint32_t i = 0; i < world->component_count; i++) {
+        if (archetype->mask & ECS_BIT(i)) {
+            memset(row_column(world, archetype, *chunk_index, *row, i), 0, world->component_sizes[i]);
+        }
+    }
+    archetype->entity_count++;
+    return 1;
+}
+
+// Fills the hole with the archetype's last row so the chunks stay packed,
+// and frees the last chunk once it is empty
+static void remove_row(ecs_world* world, uint32_t archetype_index, uint32_t chunk_index, uint32_t row) {
+    ecs_archetype* archetype = &world->archetypes[archetype_index];
+    uint32_t last_chunk = archetype->chunk_count - 1;
+    ecs_chunk* tail = &archetype->chunks[last_chunk];
+    uint32_t last_row = tail->count - 1;
+    
+    if (last_chunk != chunk_index || last_row != row) {
+        ecs_entity moved = ((ecs_entity*)tail->data)[last_row];
+        ((ecs_entity*)archetype->chunks[chunk_index].data)[row] = moved;
+        for (uint32_t i = 0; i < world->component_count; i++) {
+            if (archetype->mask & ECS_BIT(i)) {
+                memcpy(row_column(world, archetype, chunk_index, row, i),
+                       row_column(world, archetype, last_chunk, last_row, i), world->component_sizes[i]);
+            }
+        }
+        
+        ecs_record* record = &world->records[entity_index(moved)];
+        record->chunk = chunk_index;
+        record->row = row;
+    }
+    
+    tail->count--;
+    archetype->entity_count--;
+    if (tail->count == 0) {
+        free(tail->data);
+        archetype->chunk_count--;
+        world->stats.chunk_count--;
+    }
+}
+
+static ecs_record* live_record(const ecs_world* world, ecs_entity entity) {
+    uint32_t index = entity_index(entity);
+    if (index == 0 || index >= world->record_count) {
+        return NULL;
+    }
+    
+    ecs_record* record = &world->records[index];
+    return record->generation == entity_generation(entity) && record->archetype != UINT32_MAX ? record : NULL;
+}
+
+ecs_entity ecs_create(ecs_world* world, ecs_mask components) {
+    uint32_t archetype = find_archetype(world, components);
+    if (archetype == UINT32_MAX) {
+        return 0;
+    }
+    
+    uint32_t index;
+    if (world->free_count > 0) {
+        index = world->free_records[--world->free_count];
+    } else {
+        if (world->record_count == world->record_capacity) {
+            uint32_t capacity = world->record_capacity * 2;
+            ecs_record* records = realloc(world->records, capacity * sizeof(ecs_record));
+            if (!records) {
+                return 0;
+            }
+            world->records = records;
+            
+            uint32_t* free_records = realloc(world->free_records, capacity * sizeof(uint32_t));
+            if (!free_records) {
+                return 0;
+            }
+            world->free_records = free_records;
+            world->record_capacity = capacity;
+        }
+        index = world->record_count++;
+        world->records[index].generation = 0;
+    }
+    
+    ecs_record* record = &world->records[index];
+    record->generation++;
+    ecs_entity entity = (ecs_entity)record->generation << 32 | index;
+    if (!push_row(world, archetype, entity, &record->chunk, &record->row)) {
+        record->archetype = UINT32_MAX;
+        world->free_records[world->free_count++] = index;
+        return 0;
+    }
+    
+    record->archetype = archetype;
+    world->stats.entity_count++;
+    return entity;
+}
+
+void ecs_destroy(ecs_world* world, ecs_entity entity) {
+    ecs_record* record = live_record(world, entity);
+    if (!record) {
+        return;
+    }
+    
+    remove_row(world, record->archetype, record->chunk, record->row);
+    record->archetype = UINT32_MAX;
+    world->free_records[world->free_count++] = entity_index(entity);
+    world->stats.entity_count--;
+}
+
+int ecs_alive(const ecs_world* world, ecs_entity entity) {
+    return live_record(world, entity) != NULL;
+}
+
+// Copies the components both archetypes have; the rest start zeroed
+static int move_entity(ecs_world* world, ecs_entity entity, ecs_record* record, ecs_mask mask) {
+    uint32_t target = find_archetype(world, mask);
+    uint32_t chunk;
+    uint32_t row;
+    if (target == UINT32_MAX || !push_row(world, target, entity, &chunk, &row)) {
+        return 0;
+    }
+    
+    const ecs_archetype* from = &world->archetypes[record->archetype];
+    const ecs_archetype* to = &world->archetypes[target];
+    ecs_mask shared = from->mask & to->mask;
+    for (uint32_t i = 0; i < world->component_count; i++) {
+        if (shared & ECS_BIT(i)) {
+            memcpy(row_column(world, to, chunk, row, i), row_column(world, from, record->chunk, record->row, i),
+                   world->component_sizes[i]);
+        }
+    }
+    
+    remove_row(world, record->archetype, record->chunk, record->row);
+    record->archetype = target;
+    record->chunk = chunk;
+    record->row = row;
+    return 1;
+}
+
+int ecs_add(ecs_world* world, ecs_entity entity, uint32_t component) {
+    ecs_record* record = live_record(world, entity);
+    if (!record || component >= world->component_count) {
+        return 0;
+    }
+    
+    ecs_mask mask = world->archetypes[record->archetype].mask;
+    return (mask & ECS_BIT(component)) || move_entity(world, entity, record, mask | ECS_BIT(component));
+}
+
+int ecs_remove(ecs_world* world, ecs_entity entity, uint32_t component) {
+    ecs_record* record = live_record(world, entity);
+    if (!record || component >= world->component_count) {
+        return 0;
+    }
+    
+    ecs_mask mask = world->archetypes[record->archetype].mask;
+    return !(mask & ECS_BIT(component)) || move_entity(world, entity, record, mask & ~ECS_BIT(component));
+}
+
+void* ecs_get(ecs_world* world, ecs_entity entity, uint32_t component) {
+    ecs_record* record = live_record(world, entity);
+    if (!record || component >= world->component_count) {
+        return NULL;
+    }
+    
+    const ecs_archetype* archetype = &world->archetypes[record->archetype];
+    if (!(archetype->mask & ECS_BIT(component))) {
+        return NULL;
+    }
+    return row_column(world, archetype, record->chunk, record->row, component);
+}
+
+void* ecs_view_column(const ecs_view* view, uint32_t component) {
+    return component < ECS_MAX_COMPONENTS && (view->archetype->mask & ECS_BIT(component))
+               ? view->data + view->archetype->offsets[component] : NULL;
+}
+
+const ecs_entity* ecs_view_entities(const ecs_view* view) {
+    return (const ecs_entity*)view->data;
+}
+
+void ecs_query_init(ecs_query* query, ecs_world* world, ecs_mask all, ecs_mask none) {
+    memset(query, 0, sizeof(*query));
+    query->world = world;
+    query->all = all;
+    query->none = none;
+}
+
+int ecs_query_next(ecs_query* query) {
+    ecs_world* world = query->world;
+    for (; query->archetype < world->archetype_count; query->archetype++, query->chunk = 0) {
+        const ecs_archetype* archetype = &world->archetypes[query->archetype];
+        if ((archetype->mask & query->all) != query->all || (archetype->mask & query->none) ||
+            query->chunk >= archetype->chunk_count) {
+            continue;
+        }
+        
+        const ecs_chunk* chunk = &archetype->chunks[query->chunk++];
+        query->view.archetype = archetype;
+        query->view.data = chunk->data;
+        query->view.count = chunk->count;
+        query->view.dt = 0.0f;
+        return 1;
+    }
+    return 0;
+}
+
+// One system conflicts with another when either writes what the other
+// touches; reads alone never conflict
+static int systems_conflict(const ecs_system* a, const ecs_system* b) {
+    return (a->write & (b->read | b->write)) || (b->write & a->read);
+}
+
+int ecs_register_system(ecs_world* world, const ecs_system* system) {
+    if (world->system_count >= ECS_MAX_SYSTEMS || !system->run ||
+        !mask_registered(world, system->read) || !mask_registered(world, system->write)) {
+        return 0;
+    }
+    
+    // Each system goes in the wave after the last earlier one it conflicts
+    // with, which keeps registration order wherever it matters
+    ecs_system* added = &world->systems[world->system_count];
+    *added = *system;
+    added->wave = 0;
+    for (uint32_t i = 0; i < world->system_count; i++) {
+        const ecs_system* earlier = &world->systems[i];
+        if (systems_conflict(earlier, added) && earlier->wave + 1 > added->wave) {
+            added->wave = earlier->wave + 1;
+        }
+    }
+    
+    if (added->wave + 1 > world->wave_count) {
+        world->wave_count = added->wave + 1;
+    }
+    world->system_count++;
+    world->stats.system_count = world->system_count;
+    world->stats.waves = world->wave_count;
+    return 1;
+}
+
+static void run_work(const ecs_work* work) {
+    ecs_view view;
+    view.archetype = work->archetype;
+    view.dt = work->dt;
+    for (uint32_t i = 0; i < work->chunk_count; i++) {
+        const ecs_chunk* chunk = &work->archetype->chunks[work->first_chunk + i];
+        view.data = chunk->data;
+        view.count = chunk->count;
+        work->system->run(&view, work->system->user);
+    }
+}
+
+static void work_job_run(void* data) {
+    ecs_work* work = data;
+    run_work(work);
+    job_counter_done(work->counter);
+}
+
+// Splits one wave into runs of chunks; returns how many were written, or
+// how many are needed when that is more than capacity
+static uint32_t collect_wave(ecs_world* world, uint32_t wave, float dt, ecs_work* work, uint32_t capacity) {
+    uint32_t count = 0;
+    for (uint32_t s = 0; s < world->system_count; s++) {
+        const ecs_system* system = &world->systems[s];
+        if (system->wave != wave) {
+            continue;
+        }
+        
+        ecs_mask needed = system->read | system->write;
+        for (uint32_t a = 0; a < world->archetype_count; a++) {
+            const ecs_archetype* archetype = &world->archetypes[a];
+            if ((archetype->mask & needed) != needed) {
+                continue;
+            }
+            
+            for (uint32_t first = 0; first < archetype->chunk_count; first += ECS_JOB_CHUNKS) {
+                if (count < capacity) {
+                    ecs_work* piece = &work[count];
+                    piece->system = system;
+                    piece->archetype = archetype;
+                    piece->first_chunk = first;
+                    piece->chunk_count = archetype->chunk_count - first < ECS_JOB_CHUNKS
+                                             ? archetype->chunk_count - first : ECS_JOB_CHUNKS;
+                    piece->dt = dt;
+                    piece->counter = NULL;
+                }
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+// Without parallel every run of chunks goes on the calling thread
+static void run_systems(ecs_world* world, float dt, int parallel) {
+    uint64_t begin = timing_now_ns();
+    uint32_t jobs = 0;
+    
+    ecs_work* work = NULL;
+    uint32_t capacity = 0;
+    for (uint32_t wave = 0; wave < world->wave_count; wave++) {
+        uint32_t count = collect_wave(world, wave, dt, work, capacity);
+        if (count > capacity) {
+            ecs_work* grown = realloc(work, count * sizeof(ecs_work));
+            if (!grown) {
+                break;
+            }
+            work = grown;
+            capacity = count;
+            collect_wave(world, wave, dt, work, capacity);
+        }
+        if (count == 0) {
+            continue;
+        }
+        
+        if (!parallel) {
+            for (uint32_t i = 0; i < count; i++) {
+                run_work(&work[i]);
+            }
+            continue;
+        }
+        
+        // The wave has to finish before the next one reads what it wrote
+        job_counter counter;
+        job_counter_init(&counter);
+        job_counter_add(&counter, (int)(count - 1));
+        
+        for (uint32_t i = 1; i < count; i++) {
+            work[i].counter = &counter;
+            job* piece = job_create_custom(&work[i], work_job_run);
+            if (piece) {
+                job_queue_add_worker(piece);
+            } else {
+                work_job_run(&work[i]);
+            }
+        }
+        
+        run_work(&work[0]);
+        job_counter_wait(&counter);
+        job_counter_destroy(&counter);
+        jobs += count - 1;
+    }
+    free(work);
+    
+    world->stats.jobs = jobs;
+    world->stats.update_ns = timing_now_ns() - begin;
+    world->stats.updates++;
+}
+
+void ecs_update(ecs_world* world, float dt) {
+    run_systems(world, dt, 1);
+}
+
+void ecs_get_stats(ecs_world* world, ecs_stats* stats) {
+    *stats = world->stats;
+    stats->archetype_count = world->archetype_count;
+}
+
+typedef struct {
+    float position[2];
+    float velocity[2];
+    float lifetime;
+    uint32_t color;
+} benchmark_particle;
+
+typedef struct {
+    uint32_t position;
+    uint32_t velocity;
+    uint32_t lifetime;
+} benchmark_components;
+
+static void benchmark_gravity(const ecs_view* view, void* user) {
+    const benchmark_components* components = user;
+    float* velocity = ecs_view_column(view, components->velocity);
+    for (uint32_t i = 0; i < view->count; i++) {
+        velocity[i * 2 + 1] -= 9.8f * view->dt;
+    }
+}
+
+static void benchmark_move(const ecs_view* view, void* user) {
+    const benchmark_components* components = user;
+    float* position = ecs_view_column(view, components->position);
+    const float* velocity = ecs_view_column(view, components->velocity);
+    for (uint32_t i = 0; i < view->count * 2; i++) {
+        position[i] += velocity[i] * view->dt;
+    }
+}
+
+static void benchmark_age(const ecs_view* view, void* user) {
+    const benchmark_components* components = user;
+    float* lifetime = ecs_view_column(view, components->lifetime);
+    for (uint32_t i = 0; i < view->count; i++) {
+        lifetime[i] = lifetime[i] > view->dt ? lifetime[i] - view->dt : 0.0f;
+    }
+}
+
+// The same three updates over the same fields, one particle at a time
+static void benchmark_aos(benchmark_particle* particles, uint32_t count, float dt) {
+    for (uint32_t i = 0; i < count; i++) {
+        particles[i].velocity[1] -= 9.8f * dt;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        particles[i].position[0] += particles[i].velocity[0] * dt;
+        particles[i].position[1] += particles[i].velocity[1] * dt;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        particles[i].lifetime = particles[i].lifetime > dt ? particles[i].lifetime - dt : 0.0f;
+    }
+}
+
+int ecs_benchmark(uint32_t entity_count, ecs_benchmark_result* result) {
+    memset(result, 0, sizeof(*result));
+    ecs_world* world = ecs_create_world();
+    benchmark_particle* particles = calloc(entity_count, sizeof(benchmark_particle));
+    if (!world || !particles) {
+        ecs_destroy_world(world);
+        free(particles);
+        return 0;
+    }
+    
+    benchmark_components components;
+    components.position = ecs_register_component(world, 2 * sizeof(float));
+    components.velocity = ecs_register_component(world, 2 * sizeof(float));
+    components.lifetime = ecs_register_component(world, sizeof(float));
+    uint32_t color = ecs_register_component(world, sizeof(uint32_t));
+    
+    // Half the particles carry a color the systems don't touch, so they
+    // iterate two archetypes
+    ecs_mask particle = ECS_BIT(components.position) | ECS_BIT(components.velocity) | ECS_BIT(components.lifetime);
+    uint64_t begin = timing_now_ns();
+    for (uint32_t i = 0; i < entity_count; i++) {
+        ecs_entity entity = ecs_create(world, i & 1 ? particle | ECS_BIT(color) : particle);
+        float* velocity = ecs_get(world, entity, components.velocity);
+        float* lifetime = ecs_get(world, entity, components.lifetime);
+        if (!velocity || !lifetime) {
+            ecs_destroy_world(world);
+            free(particles);
+            return 0;
+        }
+        velocity[0] = (float)(i % 17) - 8.0f;
+        velocity[1] = (float)(i % 13);
+        *lifetime = 5.0f;
+        particles[i].velocity[0] = velocity[0];
+        particles[i].velocity[1] = velocity[1];
+        particles[i].lifetime = 5.0f;
+    }
+    result->create_ns = timing_now_ns() - begin;
+    
+    ecs_system system = {0};
+    system.user = &components;
+    system.name = "gravity";
+    system.write = ECS_BIT(components.velocity);
+    system.run = benchmark_gravity;
+    ecs_register_system(world, &system);
+    
+    system.name = "move";
+    system.read = ECS_BIT(components.velocity);
+    system.write = ECS_BIT(components.position);
+    system.run = benchmark_move;
+    ecs_register_system(world, &system);
+    
+    system.name = "age";
+    system.read = 0;
+    system.write = ECS_BIT(components.lifetime);
+    system.run = benchmark_age;
+    ecs_register_system(world, &system);
+    
+    // Best frame of each, after one warm-up pass
+    const float dt = 1.0f / 60.0f;
+    uint64_t best[3] = {UINT64_MAX, UINT64_MAX, UINT64_MAX};
+    for (uint32_t frame = 0; frame <= ECS_BENCHMARK_FRAMES; frame++) {
+        uint64_t start = timing_now_ns();
+        benchmark_aos(particles, entity_count, dt);
+        uint64_t aos = timing_now_ns();
+        run_systems(world, dt, 0);
+        uint64_t serial = timing_now_ns();
+        run_systems(world, dt, 1);
+        uint64_t parallel = timing_now_ns();
+        
+        if (frame > 0) {
+            best[0] = aos - start < best[0] ? aos - start : best[0];
+            best[1] = serial - aos < best[1] ? serial - aos : best[1];
+            best[2] = parallel - serial < best[2] ? parallel - serial : best[2];
+        }
+    }
+    
+    result->entity_count = world->stats.entity_count;
+    result->chunk_count = world->stats.chunk_count;
+    result->workers = (uint32_t)jobs_worker_count();
+    result->waves = world->wave_count;
+    result->aos_ns = best[0];
+    result->serial_ns = best[1];
+    result->parallel_ns = best[2];
+    
+    ecs_destroy_world(world);
+    free(particles);
+    return 1;
+}
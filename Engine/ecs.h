@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stdint.h>
+
+// Entities with the same set of components share an archetype, whose rows
+// live in fixed-size chunks: the entity ids, then one cache-line aligned
+// column per component
+#define ECS_CHUNK_SIZE (16u << 10)
+#define ECS_CACHE_LINE 64
+#define ECS_MAX_COMPONENTS 64
+#define ECS_MAX_ARCHETYPES 256
+#define ECS_MAX_SYSTEMS 64
+#define ECS_COMPONENT_NONE UINT32_MAX
+
+// Chunks per job when a system is spread over the workers; 8 chunks of
+// small components is a few thousand entities
+#define ECS_JOB_CHUNKS 8
+
+#define ECS_BENCHMARK_FRAMES 30
+
+#define ECS_BIT(component) (1ull << (component))
+
+// Index in the low half, generation in the high half; a destroyed index is
+// reused with the next generation, so stale handles don't resolve. 0 is
+// never a live entity.
+typedef uint64_t ecs_entity;
+typedef uint64_t ecs_mask;
+
+typedef struct {
+    uint8_t* data;
+    uint32_t count;
+} ecs_chunk;
+
+typedef struct {
+    ecs_mask mask;
+    uint32_t capacity;
+    uint32_t offsets[ECS_MAX_COMPONENTS];
+    ecs_chunk* chunks;
+    uint32_t chunk_count;
+    uint32_t chunk_capacity;
+    uint32_t entity_count;
+} ecs_archetype;
+
+typedef struct {
+    uint32_t generation;
+    uint32_t archetype;
+    uint32_t chunk;
+    uint32_t row;
+} ecs_record;
+
+// One chunk's rows as a system or query sees them
+typedef struct {
+    const ecs_archetype* archetype;
+    uint8_t* data;
+    uint32_t count;
+    float dt;
+} ecs_view;
+
+typedef void (*ecs_system_func)(const ecs_view* view, void* user);
+
+// Runs once per chunk of every archetype that has all of read and write.
+// Systems registered later see the writes of earlier ones they conflict
+// with; everything else may run at the same time.
+typedef struct {
+    const char* name;
+    ecs_mask read;
+    ecs_mask write;
+    ecs_system_func run;
+    void* user;
+    uint32_t wave;
+} ecs_system;
+
+typedef struct {
+    uint32_t entity_count;
+    uint32_t archetype_count;
+    uint32_t chunk_count;
+    uint32_t system_count;
+    uint32_t waves;
+    uint32_t jobs;
+    uint64_t update_ns;
+    uint64_t updates;
+} ecs_stats;
+
+typedef struct ecs_world {
+    uint32_t component_sizes[ECS_MAX_COMPONENTS];
+    uint32_t component_count;
+    ecs_archetype archetypes[ECS_MAX_ARCHETYPES];
+    uint32_t archetype_count;
+    
+    ecs_record* records;
+    uint32_t record_count;
+    uint32_t record_capacity;
+    uint32_t* free_records;
+    uint32_t free_count;
+    
+    ecs_system systems[ECS_MAX_SYSTEMS];
+    uint32_t system_count;
+    uint32_t wave_count;
+    ecs_stats stats;
+} ecs_world;
+
+// Iterates the chunks of every archetype with all of the components in
+// all and none of those in none
+typedef struct {
+    ecs_world* world;
+    ecs_mask all;
+    ecs_mask none;
+    uint32_t archetype;
+    uint32_t chunk;
+    ecs_view view;
+} ecs_query;
+
+typedef struct {
+    uint32_t entity_count;
+    uint32_t chunk_count;
+    uint32_t workers;
+    uint32_t waves;
+    uint64_t create_ns;
+    
+    // Per update of the same three systems: a plain array of structs, the
+    // chunks on one thread, and the chunks scheduled over the job workers
+    uint64_t aos_ns;
+    uint64_t serial_ns;
+    uint64_t parallel_ns;
+} ecs_benchmark_result;
+
+ecs_world* ecs_create_world(void);
+void ecs_destroy_world(ecs_world* world);
+
+// Components are plain data of a fixed size, zeroed when added. Returns
+// ECS_COMPONENT_NONE when the world is full.
+uint32_t ecs_register_component(ecs_world* world, uint32_t size);
+
+// Everything below changes the chunks and must not run during ecs_update.
+// ecs_create returns 0 for a mask with unregistered components.
+ecs_entity ecs_create(ecs_world* world, ecs_mask components);
+void ecs_destroy(ecs_world* world, ecs_entity entity);
+int ecs_add(ecs_world* world, ecs_entity entity, uint32_t component);
+int ecs_remove(ecs_world* world, ecs_entity entity, uint32_t component);
+int ecs_alive(const ecs_world* world, ecs_entity entity);
+
+// NULL when the entity is gone or lacks the component; valid until the
+// next structural change
+void* ecs_get(ecs_world* world, ecs_entity entity, uint32_t component);
+
+void* ecs_view_column(const ecs_view* view, uint32_t component);
+const ecs_entity* ecs_view_entities(const ecs_view* view);
+
+void ecs_query_init(ecs_query* query, ecs_world* world, ecs_mask all, ecs_mask none);
+
+// Moves to the next chunk with rows in it; 0 at the end
+int ecs_query_next(ecs_query* query);
+
+// Returns 0 when the system table is full or a mask has unregistered
+// components
+int ecs_register_system(ecs_world* world, const ecs_system* system);
+
+// Runs the systems in conflict-free waves, each wave's chunks spread over
+// the job workers and the calling thread. Blocks until done; not from a worker.
+void ecs_update(ecs_world* world, float dt);
+
+void ecs_get_stats(ecs_world* world, ecs_stats* stats);
+
+// Needs no device, only the job workers
+int ecs_benchmark(uint32_t entity_count, ecs_benchmark_result* result);
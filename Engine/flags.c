@@ -1,14 +1,38 @@
 #include "flags.h"
+#include "hash.h"
+#include "timing.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // Array of flags
 static flag flags[MAX_FLAGS];
 static int flag_count = 0;
 static bool initialized = false;
 
+// Mapped binary config blob that string flags may point into
+static void* blob_mapping = NULL;
+static size_t blob_mapping_size = 0;
+static flags_load_stats load_stats;
+
+// The config flags_load_config last read, for flags_save_config
+static char config_filename[256];
+static char config_blob_filename[256];
+
+// Free a string value unless it lives in the mapped blob
+static void release_string_value(flag* f) {
+    if (f->value.string_value != NULL && !f->mapped) {
+        free(f->value.string_value);
+    }
+    f->value.string_value = NULL;
+    f->mapped = false;
+}
+
 // Initialize the flags system
 void flags_init() {
     if (!initialized) {
@@ -22,8 +46,8 @@ void flags_init() {
 void flags_cleanup() {
     if (initialized) {
         for (int i = 0; i < flag_count; i++) {
-            if (flags[i].type == FLAG_TYPE_STRING && flags[i].value.string_value != NULL) {
-                free(flags[i].value.string_value);
+            if (flags[i].type == FLAG_TYPE_STRING) {
+                release_string_value(&flags[i]);
             }
             if (flags[i].type == FLAG_TYPE_STRING && flags[i].default_value.string_value != NULL) {
                 free(flags[i].default_value.string_value);
@@ -32,6 +56,12 @@ void flags_cleanup() {
         memset(flags, 0, sizeof(flags));
         flag_count = 0;
         initialized = false;
+        
+        if (blob_mapping != NULL) {
+            munmap(blob_mapping, blob_mapping_size);
+            blob_mapping = NULL;
+            blob_mapping_size = 0;
+        }
     }
 }
 
@@ -208,9 +238,7 @@ bool flag_set_string(const char* name, const char* value) {
         return false;
     }
     
-    if (flags[index].value.string_value != NULL) {
-        free(flags[index].value.string_value);
-    }
+    release_string_value(&flags[index]);
     
     if (value != NULL) {
         flags[index].value.string_value = strdup(value);
@@ -296,9 +324,7 @@ void flags_parse_args(int argc, char** argv) {
                             flags[index].value.float_value = (float)atof(value);
                             break;
                         case FLAG_TYPE_STRING:
-                            if (flags[index].value.string_value != NULL) {
-                                free(flags[index].value.string_value);
-                            }
+                            release_string_value(&flags[index]);
                             flags[index].value.string_value = strdup(value);
                             break;
                     }
@@ -379,9 +405,7 @@ bool flags_parse_file(const char* filename) {
                         flags[index].value.float_value = (float)atof(value);
                         break;
                     case FLAG_TYPE_STRING:
-                        if (flags[index].value.string_value != NULL) {
-                            free(flags[index].value.string_value);
-                        }
+                        release_string_value(&flags[index]);
                         flags[index].value.string_value = strdup(value);
                         break;
                 }
@@ -393,6 +417,388 @@ bool flags_parse_file(const char* filename) {
     return true;
 }
 
+// Hash the registered flag names, types and defaults; a blob built for a
+// different set of flags must not be applied index by index
+static uint64_t compute_schema_hash(void) {
+    uint64_t hash = HASH_FNV1A64_SEED;
+    
+    for (int i = 0; i < flag_count; i++) {
+        uint32_t type = (uint32_t)flags[i].type;
+        hash = hash_fnv1a64(flags[i].name, strlen(flags[i].name) + 1, hash);
+        hash = hash_fnv1a64(&type, sizeof(type), hash);
+        
+        switch (flags[i].type) {
+            case FLAG_TYPE_BOOL: {
+                uint32_t value = flags[i].default_value.bool_value ? 1 : 0;
+                hash = hash_fnv1a64(&value, sizeof(value), hash);
+                break;
+            }
+            case FLAG_TYPE_INT:
+                hash = hash_fnv1a64(&flags[i].default_value.int_value, sizeof(int), hash);
+                break;
+            case FLAG_TYPE_FLOAT:
+                hash = hash_fnv1a64(&flags[i].default_value.float_value, sizeof(float), hash);
+                break;
+            case FLAG_TYPE_STRING:
+                if (flags[i].default_value.string_value != NULL) {
+                    hash = hash_fnv1a64(flags[i].default_value.string_value,
+                                        strlen(flags[i].default_value.string_value) + 1, hash);
+                }
+                break;
+        }
+    }
+    
+    return hash;
+}
+
+// Get the modification time and size of the text config, if it exists
+static bool stat_source(const char* source_filename, uint64_t* mtime, uint64_t* size) {
+    struct stat st;
+    if (source_filename == NULL || stat(source_filename, &st) != 0) {
+        return false;
+    }
+    
+    *mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+    *size = (uint64_t)st.st_size;
+    return true;
+}
+
+// Write the current flag values to a binary config blob
+bool flags_compile_blob(const char* blob_filename, const char* source_filename) {
+    uint64_t start = timing_now_ns();
+    
+    size_t strings_offset = sizeof(flags_blob_header) + sizeof(flags_blob_entry) * flag_count;
+    size_t total_size = strings_offset;
+    for (int i = 0; i < flag_count; i++) {
+        if (flags[i].type == FLAG_TYPE_STRING && flags[i].value.string_value != NULL) {
+            total_size += strlen(flags[i].value.string_value) + 1;
+        }
+    }
+    
+    unsigned char* blob = calloc(1, total_size);
+    if (blob == NULL) {
+        return false;
+    }
+    
+    flags_blob_header* header = (flags_blob_header*)blob;
+    flags_blob_entry* entries = (flags_blob_entry*)(blob + sizeof(flags_blob_header));
+    size_t string_cursor = strings_offset;
+    
+    for (int i = 0; i < flag_count; i++) {
+        entries[i].type = (uint32_t)flags[i].type;
+        switch (flags[i].type) {
+            case FLAG_TYPE_BOOL:
+                entries[i].value.bool_value = flags[i].value.bool_value ? 1 : 0;
+                break;
+            case FLAG_TYPE_INT:
+                entries[i].value.int_value = flags[i].value.int_value;
+                break;
+            case FLAG_TYPE_FLOAT:
+                entries[i].value.float_value = flags[i].value.float_value;
+                break;
+            case FLAG_TYPE_STRING:
+                // Offset 0 is the header, so it doubles as the NULL string
+                entries[i].value.string_offset = 0;
+                if (flags[i].value.string_value != NULL) {
+                    size_t len = strlen(flags[i].value.string_value) + 1;
+                    memcpy(blob + string_cursor, flags[i].value.string_value, len);
+                    entries[i].value.string_offset = (uint32_t)string_cursor;
+                    string_cursor += len;
+                }
+                break;
+        }
+    }
+    
+    header->magic = FLAGS_BLOB_MAGIC;
+    header->version = FLAGS_BLOB_VERSION;
+    header->schema_hash = compute_schema_hash();
+    stat_source(source_filename, &header->source_mtime, &header->source_size);
+    header->flag_count = (uint32_t)flag_count;
+    header->total_size = (uint32_t)total_size;
+    header->checksum = hash_fnv1a64(blob + sizeof(flags_blob_header),
+                                    total_size - sizeof(flags_blob_header), HASH_FNV1A64_SEED);
+    
+    // Write to a temporary file and rename so a reader never maps a partial blob
+    char tmp_filename[512];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", blob_filename);
+    
+    FILE* file = fopen(tmp_filename, "wb");
+    if (file == NULL) {
+        free(blob);
+        return false;
+    }
+    
+    bool written = fwrite(blob, 1, total_size, file) == total_size;
+    written = fclose(file) == 0 && written;
+    free(blob);
+    
+    if (!written || rename(tmp_filename, blob_filename) != 0) {
+        remove(tmp_filename);
+        return false;
+    }
+    
+    load_stats.blob_compile_ns = timing_now_ns() - start;
+    return true;
+}
+
+// Check that a mapped blob matches the registered flags and its text config
+static bool blob_is_current(const unsigned char* blob, size_t size, const char* source_filename) {
+    const flags_blob_header* header = (const flags_blob_header*)blob;
+    
+    if (size < sizeof(flags_blob_header) ||
+        header->magic != FLAGS_BLOB_MAGIC ||
+        header->version != FLAGS_BLOB_VERSION ||
+        header->flag_count != (uint32_t)flag_count ||
+        header->total_size != size ||
+        size < sizeof(flags_blob_header) + sizeof(flags_blob_entry) * flag_count) {
+        return false;
+    }
+    
+    if (header->schema_hash != compute_schema_hash()) {
+        return false;
+    }
+    
+    // A missing text config is fine (blob shipped on its own); an edited one is not
+    uint64_t mtime, source_size;
+    if (stat_source(source_filename, &mtime, &source_size) &&
+        (mtime != header->source_mtime || source_size != header->source_size)) {
+        return false;
+    }
+    
+    if (header->checksum != hash_fnv1a64(blob + sizeof(flags_blob_header),
+                                         size - sizeof(flags_blob_header), HASH_FNV1A64_SEED)) {
+        return false;
+    }
+    
+    size_t strings_offset = sizeof(flags_blob_header) + sizeof(flags_blob_entry) * flag_count;
+    const flags_blob_entry* entries = (const flags_blob_entry*)(blob + sizeof(flags_blob_header));
+    for (int i = 0; i < flag_count; i++) {
+        if (entries[i].type != (uint32_t)flags[i].type) {
+            return false;
+        }
+        if (entries[i].type == FLAG_TYPE_STRING && entries[i].value.string_offset != 0 &&
+            (entries[i].value.string_offset < strings_offset ||
+             entries[i].value.string_offset >= size || blob[size - 1] != '\0')) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// Map a binary config blob and point flag storage into it
+bool flags_load_blob(const char* blob_filename, const char* source_filename) {
+    uint64_t start = timing_now_ns();
+    
+    int fd = open(blob_filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(flags_blob_header)) {
+        close(fd);
+        return false;
+    }
+    
+    size_t size = (size_t)st.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    
+    const unsigned char* blob = (const unsigned char*)mapping;
+    if (!blob_is_current(blob, size, source_filename)) {
+        munmap(mapping, size);
+        return false;
+    }
+    
+    const flags_blob_entry* entries = (const flags_blob_entry*)(blob + sizeof(flags_blob_header));
+    for (int i = 0; i < flag_count; i++) {
+        switch (flags[i].type) {
+            case FLAG_TYPE_BOOL:
+                flags[i].value.bool_value = entries[i].value.bool_value != 0;
+                break;
+            case FLAG_TYPE_INT:
+                flags[i].value.int_value = entries[i].value.int_value;
+                break;
+            case FLAG_TYPE_FLOAT:
+                flags[i].value.float_value = entries[i].value.float_value;
+                break;
+            case FLAG_TYPE_STRING:
+                release_string_value(&flags[i]);
+                if (entries[i].value.string_offset != 0) {
+                    flags[i].value.string_value = (char*)(blob + entries[i].value.string_offset);
+                    flags[i].mapped = true;
+                }
+                break;
+        }
+    }
+    
+    // Every string flag has been repointed, so the previous mapping is unused
+    if (blob_mapping != NULL) {
+        munmap(blob_mapping, blob_mapping_size);
+    }
+    blob_mapping = mapping;
+    blob_mapping_size = size;
+    
+    load_stats.blob_load_ns = timing_now_ns() - start;
+    return true;
+}
+
+// Load a config from its blob, falling back to the text config
+bool flags_load_config(const char* filename, const char* blob_filename) {
+    snprintf(config_filename, sizeof(config_filename), "%s", filename);
+    snprintf(config_blob_filename, sizeof(config_blob_filename), "%s", blob_filename ? blob_filename : "");
+    
+    load_stats.used_blob = false;
+    load_stats.blob_load_ns = 0;
+    load_stats.text_parse_ns = 0;
+    load_stats.blob_compile_ns = 0;
+    
+    if (blob_filename != NULL && flags_load_blob(blob_filename, filename)) {
+        load_stats.used_blob = true;
+        return true;
+    }
+    
+    uint64_t start = timing_now_ns();
+    if (!flags_parse_file(filename)) {
+        return false;
+    }
+    load_stats.text_parse_ns = timing_now_ns() - start;
+    
+    if (blob_filename != NULL) {
+        flags_compile_blob(blob_filename, filename);
+    }
+    
+    return true;
+}
+
+// Index of the flag a "flag_name = value" line sets, or -1
+static int line_flag(const char* line) {
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    
+    const char* equals = strchr(line, '=');
+    if (line[0] == '#' || equals == NULL) {
+        return -1;
+    }
+    
+    size_t length = (size_t)(equals - line);
+    while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t')) {
+        length--;
+    }
+    
+    char name[MAX_FLAG_NAME_LENGTH];
+    if (length == 0 || length >= sizeof(name)) {
+        return -1;
+    }
+    memcpy(name, line, length);
+    name[length] = '\0';
+    return find_flag(name);
+}
+
+// Write a flag in the format flags_parse_file reads
+static void write_flag_line(FILE* file, int index) {
+    switch (flags[index].type) {
+        case FLAG_TYPE_BOOL:
+            fprintf(file, "%s = %s\n", flags[index].name, flags[index].value.bool_value ? "true" : "false");
+            break;
+        case FLAG_TYPE_INT:
+            fprintf(file, "%s = %d\n", flags[index].name, flags[index].value.int_value);
+            break;
+        case FLAG_TYPE_FLOAT:
+            // Enough digits to read back the same float
+            fprintf(file, "%s = %.9g\n", flags[index].name, flags[index].value.float_value);
+            break;
+        case FLAG_TYPE_STRING:
+            fprintf(file, "%s = %s\n", flags[index].name,
+                    flags[index].value.string_value ? flags[index].value.string_value : "");
+            break;
+    }
+}
+
+// Write the named flags back into the loaded config and rebuild its blob
+bool flags_save_config(const char* const* names, int count) {
+    if (config_filename[0] == '\0' || count > MAX_FLAGS) {
+        return false;
+    }
+    
+    int indices[MAX_FLAGS];
+    bool written[MAX_FLAGS] = {false};
+    for (int i = 0; i < count; i++) {
+        indices[i] = find_flag(names[i]);
+        if (indices[i] == -1) {
+            return false;
+        }
+    }
+    
+    // Write beside the config and rename so a crash never leaves half of it
+    char temp_filename[264];
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", config_filename);
+    FILE* output = fopen(temp_filename, "w");
+    if (output == NULL) {
+        return false;
+    }
+    
+    // Every other line is kept as it was, however long
+    bool line_ended = true;
+    FILE* input = fopen(config_filename, "r");
+    if (input != NULL) {
+        char* line = NULL;
+        size_t line_capacity = 0;
+        ssize_t length;
+        while ((length = getline(&line, &line_capacity, input)) > 0) {
+            int index = line_flag(line);
+            int name = -1;
+            for (int i = 0; i < count && index != -1; i++) {
+                if (indices[i] == index) {
+                    name = i;
+                }
+            }
+            
+            if (name == -1) {
+                fwrite(line, 1, (size_t)length, output);
+                line_ended = line[length - 1] == '\n';
+            } else if (!written[name]) {
+                write_flag_line(output, index);
+                written[name] = true;
+                line_ended = true;
+            }
+        }
+        free(line);
+        fclose(input);
+    }
+    if (!line_ended) {
+        fputc('\n', output);
+    }
+    
+    for (int i = 0; i < count; i++) {
+        if (!written[i]) {
+            write_flag_line(output, indices[i]);
+        }
+    }
+    
+    bool ok = fclose(output) == 0 && rename(temp_filename, config_filename) == 0;
+    if (!ok) {
+        remove(temp_filename);
+        return false;
+    }
+    
+    // The text is newer than the blob now, so the old blob would be refused
+    if (config_blob_filename[0] != '\0') {
+        flags_compile_blob(config_blob_filename, config_filename);
+    }
+    return true;
+}
+
+// Get the timings of the most recent config load
+void flags_get_load_stats(flags_load_stats* stats) {
+    *stats = load_stats;
+}
+
 // Reset a flag to its default value
 bool flag_reset(const char* name) {
     int index = find_flag(name);
@@ -411,9 +817,7 @@ bool flag_reset(const char* name) {
             flags[index].value.float_value = flags[index].default_value.float_value;
             break;
         case FLAG_TYPE_STRING:
-            if (flags[index].value.string_value != NULL) {
-                free(flags[index].value.string_value);
-            }
+            release_string_value(&flags[index]);
             if (flags[index].default_value.string_value != NULL) {
                 flags[index].value.string_value = strdup(flags[index].default_value.string_value);
             } else {
@@ -439,9 +843,7 @@ void flags_reset_all() {
                 flags[i].value.float_value = flags[i].default_value.float_value;
                 break;
             case FLAG_TYPE_STRING:
-                if (flags[i].value.string_value != NULL) {
-                    free(flags[i].value.string_value);
-                }
+                release_string_value(&flags[i]);
                 if (flags[i].default_value.string_value != NULL) {
                     flags[i].value.string_value = strdup(flags[i].default_value.string_value);
                 } else {
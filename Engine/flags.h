@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 // Maximum number of flags that can be registered
@@ -9,6 +10,10 @@
 // Maximum length of flag name
 #define MAX_FLAG_NAME_LENGTH 32
 
+// Binary config blob identification
+#define FLAGS_BLOB_MAGIC 0x42464d56u  // "VMFB"
+#define FLAGS_BLOB_VERSION 1
+
 // Flag types
 typedef enum {
     FLAG_TYPE_BOOL,
@@ -32,8 +37,41 @@ typedef struct {
     flag_value value;
     flag_value default_value;
     bool initialized;
+    bool mapped;  // string_value points into the mapped config blob
 } flag;
 
+// Binary config blob header, followed by one flag_blob_entry per
+// registered flag (in registration order) and a string table
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t schema_hash;    // names, types and defaults of the registered flags
+    uint64_t source_mtime;   // modification time (ns) of the text config it was built from
+    uint64_t source_size;
+    uint64_t checksum;       // FNV-1a over everything after the header
+    uint32_t flag_count;
+    uint32_t total_size;
+} flags_blob_header;
+
+// Binary config blob entry; strings store an offset from the blob start
+typedef struct {
+    uint32_t type;
+    union {
+        uint32_t bool_value;
+        int32_t int_value;
+        float float_value;
+        uint32_t string_offset;
+    } value;
+} flags_blob_entry;
+
+// Timings of the most recent config load
+typedef struct {
+    bool used_blob;
+    uint64_t blob_load_ns;
+    uint64_t text_parse_ns;
+    uint64_t blob_compile_ns;
+} flags_load_stats;
+
 // Initialize the flags system
 void flags_init();
 
@@ -85,6 +123,26 @@ void flags_parse_args(int argc, char** argv);
 // Parse flags from a configuration file
 bool flags_parse_file(const char* filename);
 
+// Write the current flag values to a binary config blob; source_filename
+// is the text config the values came from and may be NULL
+bool flags_compile_blob(const char* blob_filename, const char* source_filename);
+
+// Map a binary config blob and point flag storage into it; fails if the
+// blob is stale for the registered flags or for source_filename
+bool flags_load_blob(const char* blob_filename, const char* source_filename);
+
+// Load a config from its blob, or parse the text and recompile the blob
+// when the blob is missing or stale. Call before flags_parse_args
+bool flags_load_config(const char* filename, const char* blob_filename);
+
+// Write the current values of the named flags back into the config last
+// loaded with flags_load_config, replacing their lines and appending the
+// rest, then rebuild its blob. Fails when no config was loaded.
+bool flags_save_config(const char* const* names, int count);
+
+// Get the timings of the most recent config load
+void flags_get_load_stats(flags_load_stats* stats);
+
 // Reset a flag to its default value
 bool flag_reset(const char* name);
 
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// FNV-1a offset basis, used as the seed for a fresh hash
+#define HASH_FNV1A64_SEED 0xcbf29ce484222325ull
+
+// 64-bit FNV-1a over a byte range, chainable through the seed
+static inline uint64_t hash_fnv1a64(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
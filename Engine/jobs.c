@@ -1,9 +1,19 @@
 #include "jobs.h"
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 static job_queue queue;
 
+static job_queue worker_queue;
+static pthread_t workers[MAX_JOB_WORKERS];
+static int worker_count;
+static int worker_busy;
+static bool workers_stopping;
+static pthread_mutex_t worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t worker_idle = PTHREAD_COND_INITIALIZER;
+
 void jobs_init() {
     queue.head = NULL;
     queue.tail = NULL;
@@ -108,6 +118,22 @@ static void process_custom_job(job* job) {
     job->completed = true;
 }
 
+static void run_job(job* job) {
+    switch (job->type) {
+        case JOB_TYPE_RENDER:
+            process_render_job(job);
+            break;
+            
+        case JOB_TYPE_DATA:
+            process_data_job(job);
+            break;
+            
+        case JOB_TYPE_CUSTOM:
+            process_custom_job(job);
+            break;
+    }
+}
+
 void job_queue_process() {
     if (queue.running || queue.head == NULL) {
         return;
@@ -119,19 +145,7 @@ void job_queue_process() {
     job* prev = NULL;
     
     while (current != NULL) {
-        switch (current->type) {
-            case JOB_TYPE_RENDER:
-                process_render_job(current);
-                break;
-                
-            case JOB_TYPE_DATA:
-                process_data_job(current);
-                break;
-                
-            case JOB_TYPE_CUSTOM:
-                process_custom_job(current);
-                break;
-        }
+        run_job(current);
         
         // If job is completed and marked for auto-release, remove it from the queue
         if (current->completed) {
@@ -169,8 +183,8 @@ bool job_is_completed(job* job) {
     return job != NULL && job->completed;
 }
 
-void job_release(job* job) {
-    if (job == NULL) {
+void job_release(struct job* target) {
+    if (target == NULL) {
         return;
     }
     
@@ -179,7 +193,7 @@ void job_release(job* job) {
     job* prev = NULL;
     
     while (current != NULL) {
-        if (current == job) {
+        if (current == target) {
             if (prev == NULL) {
                 queue.head = current->next;
             } else {
@@ -190,7 +204,7 @@ void job_release(job* job) {
                 queue.tail = prev;
             }
             
-            free(job);
+            free(target);
             queue.count--;
             return;
         }
@@ -200,6 +214,149 @@ void job_release(job* job) {
     }
 }
 
+static void* worker_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&worker_lock);
+    
+    for (;;) {
+        while (worker_queue.head == NULL && !workers_stopping) {
+            pthread_cond_wait(&worker_wake, &worker_lock);
+        }
+        
+        // Drain what is queued before honoring a stop request
+        if (worker_queue.head == NULL) {
+            break;
+        }
+        
+        job* current = worker_queue.head;
+        worker_queue.head = current->next;
+        if (worker_queue.head == NULL) {
+            worker_queue.tail = NULL;
+        }
+        worker_queue.count--;
+        worker_busy++;
+        
+        pthread_mutex_unlock(&worker_lock);
+        run_job(current);
+        free(current);
+        pthread_mutex_lock(&worker_lock);
+        
+        worker_busy--;
+        if (worker_queue.head == NULL && worker_busy == 0) {
+            pthread_cond_broadcast(&worker_idle);
+        }
+    }
+    
+    pthread_mutex_unlock(&worker_lock);
+    return NULL;
+}
+
+void jobs_start_workers(int count) {
+    if (count > MAX_JOB_WORKERS) {
+        count = MAX_JOB_WORKERS;
+    }
+    
+    pthread_mutex_lock(&worker_lock);
+    workers_stopping = false;
+    pthread_mutex_unlock(&worker_lock);
+    
+    while (worker_count < count) {
+        if (pthread_create(&workers[worker_count], NULL, worker_main, NULL) != 0) {
+            break;
+        }
+        worker_count++;
+    }
+    
+    worker_queue.running = worker_count > 0;
+}
+
+void jobs_stop_workers() {
+    pthread_mutex_lock(&worker_lock);
+    workers_stopping = true;
+    pthread_cond_broadcast(&worker_wake);
+    pthread_mutex_unlock(&worker_lock);
+    
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    
+    worker_count = 0;
+    worker_queue.running = false;
+}
+
+int jobs_worker_count() {
+    return worker_count;
+}
+
+void job_queue_add_worker(job* job) {
+    if (job == NULL) {
+        return;
+    }
+    
+    // Without workers the job still runs, just on the caller's thread
+    if (worker_count == 0) {
+        run_job(job);
+        free(job);
+        return;
+    }
+    
+    job->next = NULL;
+    
+    pthread_mutex_lock(&worker_lock);
+    if (worker_queue.head == NULL) {
+        worker_queue.head = job;
+        worker_queue.tail = job;
+    } else {
+        worker_queue.tail->next = job;
+        worker_queue.tail = job;
+    }
+    worker_queue.count++;
+    pthread_cond_signal(&worker_wake);
+    pthread_mutex_unlock(&worker_lock);
+}
+
+void jobs_wait_workers() {
+    pthread_mutex_lock(&worker_lock);
+    while (worker_queue.head != NULL || worker_busy > 0) {
+        pthread_cond_wait(&worker_idle, &worker_lock);
+    }
+    pthread_mutex_unlock(&worker_lock);
+}
+
+void job_counter_init(job_counter* counter) {
+    pthread_mutex_init(&counter->lock, NULL);
+    pthread_cond_init(&counter->done, NULL);
+    counter->pending = 0;
+}
+
+void job_counter_destroy(job_counter* counter) {
+    pthread_mutex_destroy(&counter->lock);
+    pthread_cond_destroy(&counter->done);
+}
+
+void job_counter_add(job_counter* counter, int count) {
+    pthread_mutex_lock(&counter->lock);
+    counter->pending += count;
+    pthread_mutex_unlock(&counter->lock);
+}
+
+void job_counter_done(job_counter* counter) {
+    pthread_mutex_lock(&counter->lock);
+    counter->pending--;
+    if (counter->pending == 0) {
+        pthread_cond_broadcast(&counter->done);
+    }
+    pthread_mutex_unlock(&counter->lock);
+}
+
+void job_counter_wait(job_counter* counter) {
+    pthread_mutex_lock(&counter->lock);
+    while (counter->pending > 0) {
+        pthread_cond_wait(&counter->done, &counter->lock);
+    }
+    pthread_mutex_unlock(&counter->lock);
+}
+
 int job_queue_get_count() {
     return queue.count;
 }
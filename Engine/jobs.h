@@ -1,8 +1,12 @@
 #pragma once
 
 #include "vm_engine.h"
+#include <pthread.h>
 #include <stdbool.h>
 
+#define MAX_JOB_WORKERS 8
+#define DEFAULT_JOB_WORKERS 2
+
 typedef enum {
     JOB_TYPE_RENDER,
     JOB_TYPE_DATA,
@@ -42,6 +46,14 @@ struct job {
     job* next;
 };
 
+// Counts a caller's outstanding worker jobs so it can wait for just those,
+// not for everything else queued on the workers
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int pending;
+} job_counter;
+
 typedef struct {
     job* head;
     job* tail;
@@ -63,6 +75,19 @@ void job_queue_wait_completion();
 bool job_is_completed(job* job);
 void job_release(job* job);
 
+// Worker threads run jobs off the main thread; worker jobs are freed once run
+void jobs_start_workers(int count);
+void jobs_stop_workers();
+int jobs_worker_count();
+void job_queue_add_worker(job* job);
+void jobs_wait_workers();
+
+void job_counter_init(job_counter* counter);
+void job_counter_destroy(job_counter* counter);
+void job_counter_add(job_counter* counter, int count);
+void job_counter_done(job_counter* counter);
+void job_counter_wait(job_counter* counter);
+
 int job_queue_get_count();
 bool job_queue_is_empty();
 bool job_queue_is_running();
@@ -0,0 +1,685 @@
+#include "pack.h"
+#include "upload.h"
+#include "hash.h"
+#include "timing.h"
+#include "platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOG_TAG "vm_engine"
+
+// LZ4 block format: matches of at least 4 bytes within 64 KiB, the last
+// 5 bytes always literals and no match starting in the last 12
+#define LZ4_HASH_BITS 12
+#define LZ4_MIN_MATCH 4
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_LIMIT 12
+#define LZ4_BOUND(size) ((size) + (size) / 255 + 16)
+
+typedef struct {
+    uint64_t hash;
+    uint32_t index;
+} pack_order;
+
+static uint32_t read_u32(const uint8_t* bytes) {
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static uint8_t* lz4_write_length(uint8_t* op, uint32_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+static uint8_t* lz4_write_sequence(uint8_t* op, const uint8_t* literals, uint32_t literal_count,
+                                   uint32_t offset, uint32_t match_length) {
+    uint32_t match_code = match_length ? match_length - LZ4_MIN_MATCH : 0;
+    *op++ = (uint8_t)(((literal_count < 15 ? literal_count : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (literal_count >= 15) {
+        op = lz4_write_length(op, literal_count - 15);
+    }
+    memcpy(op, literals, literal_count);
+    op += literal_count;
+    
+    // The final sequence is literals only
+    if (match_length) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        if (match_code >= 15) {
+            op = lz4_write_length(op, match_code - 15);
+        }
+    }
+    return op;
+}
+
+// Greedy single-probe matcher; dst must hold LZ4_BOUND(size) bytes
+static uint32_t lz4_compress(const uint8_t* src, uint32_t size, uint8_t* dst) {
+    uint32_t table[1u << LZ4_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    
+    uint8_t* op = dst;
+    uint32_t anchor = 0;
+    uint32_t pos = 0;
+    while (size > LZ4_MATCH_LIMIT && pos < size - LZ4_MATCH_LIMIT) {
+        uint32_t sequence = read_u32(src + pos);
+        uint32_t slot = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        
+        // Positions are stored plus one so 0 means empty
+        uint32_t candidate = table[slot];
+        table[slot] = pos + 1;
+        if (!candidate || pos - (candidate - 1) > LZ4_MAX_OFFSET || read_u32(src + candidate - 1) != sequence) {
+            pos++;
+            continue;
+        }
+        
+        uint32_t match = candidate - 1;
+        uint32_t length = LZ4_MIN_MATCH;
+        while (pos + length < size - LZ4_LAST_LITERALS && src[match + length] == src[pos + length]) {
+            length++;
+        }
+        
+        op = lz4_write_sequence(op, src + anchor, pos - anchor, pos - match, length);
+        pos += length;
+        anchor = pos;
+    }
+    
+    op = lz4_write_sequence(op, src + anchor, size - anchor, 0, 0);
+    return (uint32_t)(op - dst);
+}
+
+// Fails on anything that would read or write out of bounds or doesn't
+// fill dst exactly
+static int lz4_decompress(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t dst_size) {
+    const uint8_t* ip = src;
+    const uint8_t* input_end = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* output_end = dst + dst_size;
+    
+    while (ip < input_end) {
+        uint32_t token = *ip++;
+        uint32_t literal_count = token >> 4;
+        if (literal_count == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= input_end) {
+                    return 0;
+                }
+                extra = *ip++;
+                literal_count += extra;
+            } while (extra == 255);
+        }
+        if (literal_count > (uint32_t)(input_end - ip) || literal_count > (uint32_t)(output_end - op)) {
+            return 0;
+        }
+        memcpy(op, ip, literal_count);
+        op += literal_count;
+        ip += literal_count;
+        
+        if (ip == input_end) {
+            break;
+        }
+        
+        if (input_end - ip < 2) {
+            return 0;
+        }
+        uint32_t offset = (uint32_t)ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        
+        uint32_t length = token & 15;
+        if (length == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= input_end) {
+                    return 0;
+                }
+                extra = *ip++;
+                length += extra;
+            } while (extra == 255);
+        }
+        length += LZ4_MIN_MATCH;
+        
+        if (offset == 0 || offset > (uint32_t)(op - dst) || length > (uint32_t)(output_end - op)) {
+            return 0;
+        }
+        
+        // An overlapping match repeats its last offset bytes; each copy
+        // doubles the repeated run, so the next can be twice as long
+        const uint8_t* match = op - offset;
+        while (length > 0) {
+            uint32_t step = (uint32_t)(op - match) < length ? (uint32_t)(op - match) : length;
+            memcpy(op, match, step);
+            op += step;
+            length -= step;
+        }
+    }
+    return op == output_end;
+}
+
+static int compare_order(const void* a, const void* b) {
+    const pack_order* left = a;
+    const pack_order* right = b;
+    return left->hash < right->hash ? -1 : (left->hash > right->hash ? 1 : 0);
+}
+
+static uint32_t chunk_count(uint64_t size) {
+    return (uint32_t)((size + PACK_CHUNK_SIZE - 1) / PACK_CHUNK_SIZE);
+}
+
+static int write_padding(FILE* file, uint64_t* offset) {
+    static const uint8_t zeros[PACK_BLOB_ALIGNMENT] = {0};
+    uint64_t padding = (PACK_BLOB_ALIGNMENT - *offset % PACK_BLOB_ALIGNMENT) % PACK_BLOB_ALIGNMENT;
+    *offset += padding;
+    return fwrite(zeros, 1, padding, file) == padding;
+}
+
+// Chunks that don't shrink are stored raw
+static int write_compressed(FILE* file, const pack_source* source, pack_entry* entry, pack_chunk* chunks,
+                            uint8_t* scratch) {
+    const uint8_t* data = source->data;
+    uint32_t count = chunk_count(source->size);
+    uint64_t stored = 0;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t begin = (uint64_t)i * PACK_CHUNK_SIZE;
+        uint32_t size = (uint32_t)(source->size - begin < PACK_CHUNK_SIZE ? source->size - begin : PACK_CHUNK_SIZE);
+        uint32_t compressed = lz4_compress(data + begin, size, scratch);
+        
+        const uint8_t* out = compressed < size ? scratch : data + begin;
+        uint32_t out_size = compressed < size ? compressed : size;
+        if (fwrite(out, 1, out_size, file) != out_size) {
+            return 0;
+        }
+        
+        chunks[entry->first_chunk + i].offset = (uint32_t)stored;
+        chunks[entry->first_chunk + i].size = out_size;
+        stored += out_size;
+    }
+    
+    entry->stored_size = stored;
+    return 1;
+}
+
+int pack_write(const char* filename, const pack_source* sources, uint32_t count) {
+    pack_order* order = malloc(count * sizeof(pack_order) + 1);
+    pack_entry* entries = calloc(count + 1, sizeof(pack_entry));
+    uint8_t* scratch = malloc(LZ4_BOUND(PACK_CHUNK_SIZE));
+    pack_chunk* chunks = NULL;
+    char* names = NULL;
+    FILE* file = NULL;
+    int ok = 0;
+    
+    uint32_t total_chunks = 0;
+    uint64_t names_size = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        total_chunks += sources[i].compression == PACK_COMPRESSION_LZ4 ? chunk_count(sources[i].size) : 0;
+        names_size += strlen(sources[i].name) + 1;
+    }
+    chunks = malloc(total_chunks * sizeof(pack_chunk) + 1);
+    names = malloc(names_size + 1);
+    
+    char temp_filename[520];
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", filename);
+    
+    if (!order || !entries || !scratch || !chunks || !names) {
+        goto done;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        order[i].hash = hash_fnv1a64(sources[i].name, strlen(sources[i].name), HASH_FNV1A64_SEED);
+        order[i].index = i;
+    }
+    qsort(order, count, sizeof(pack_order), compare_order);
+    
+    file = fopen(temp_filename, "wb");
+    pack_header header = {0};
+    if (!file || fwrite(&header, sizeof(header), 1, file) != 1) {
+        goto done;
+    }
+    
+    uint64_t offset = sizeof(header);
+    uint32_t chunk_cursor = 0;
+    uint32_t name_cursor = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const pack_source* source = &sources[order[i].index];
+        pack_entry* entry = &entries[i];
+        uint32_t name_length = (uint32_t)strlen(source->name);
+        
+        // Sorted by hash, so a repeated name sits next to its twin
+        if (i > 0 && order[i].hash == order[i - 1].hash &&
+            strcmp(source->name, sources[order[i - 1].index].name) == 0) {
+            __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "pack: %s is listed twice", source->name);
+            goto done;
+        }
+        
+        if (!write_padding(file, &offset)) {
+            goto done;
+        }
+        
+        entry->hash = order[i].hash;
+        entry->offset = offset;
+        entry->size = source->size;
+        entry->name_offset = name_cursor;
+        entry->name_length = name_length;
+        entry->compression = source->compression;
+        entry->first_chunk = chunk_cursor;
+        memcpy(names + name_cursor, source->name, name_length + 1);
+        name_cursor += name_length + 1;
+        
+        if (source->compression == PACK_COMPRESSION_LZ4) {
+            if (!write_compressed(file, source, entry, chunks, scratch)) {
+                goto done;
+            }
+            chunk_cursor += chunk_count(source->size);
+        } else {
+            entry->stored_size = source->size;
+            if (fwrite(source->data, 1, source->size, file) != source->size) {
+                goto done;
+            }
+        }
+        offset += entry->stored_size;
+    }
+    
+    if (!write_padding(file, &offset)) {
+        goto done;
+    }
+    
+    header.magic = PACK_MAGIC;
+    header.version = PACK_VERSION;
+    header.entry_count = count;
+    header.chunk_count = total_chunks;
+    header.toc_offset = offset;
+    header.names_size = names_size;
+    header.checksum = hash_fnv1a64(entries, count * sizeof(pack_entry), HASH_FNV1A64_SEED);
+    header.checksum = hash_fnv1a64(chunks, total_chunks * sizeof(pack_chunk), header.checksum);
+    header.checksum = hash_fnv1a64(names, names_size, header.checksum);
+    
+    ok = fwrite(entries, sizeof(pack_entry), count, file) == count &&
+         fwrite(chunks, sizeof(pack_chunk), total_chunks, file) == total_chunks &&
+         fwrite(names, 1, names_size, file) == names_size &&
+         fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+
+done:
+    if (file) {
+        ok = fclose(file) == 0 && ok;
+    }
+    ok = ok && rename(temp_filename, filename) == 0;
+    if (!ok) {
+        remove(temp_filename);
+    }
+    
+    free(order);
+    free(entries);
+    free(scratch);
+    free(chunks);
+    free(names);
+    return ok;
+}
+
+// Every entry, chunk and name must lie inside the file before anything
+// trusts the table
+static int pack_validate(asset_pack* pack) {
+    const pack_header* header = pack->header;
+    uint64_t table_size = (uint64_t)header->entry_count * sizeof(pack_entry) +
+                          (uint64_t)header->chunk_count * sizeof(pack_chunk) + header->names_size;
+    if (header->magic != PACK_MAGIC || header->version != PACK_VERSION ||
+        header->toc_offset < sizeof(pack_header) || header->toc_offset > pack->size ||
+        table_size != pack->size - header->toc_offset || header->toc_offset % PACK_BLOB_ALIGNMENT != 0) {
+        return 0;
+    }
+    
+    pack->entries = (const pack_entry*)(pack->base + header->toc_offset);
+    pack->chunks = (const pack_chunk*)(pack->entries + header->entry_count);
+    pack->names = (const char*)(pack->chunks + header->chunk_count);
+    if (hash_fnv1a64(pack->base + header->toc_offset, table_size, HASH_FNV1A64_SEED) != header->checksum) {
+        return 0;
+    }
+    
+    for (uint32_t i = 0; i < header->entry_count; i++) {
+        const pack_entry* entry = &pack->entries[i];
+        if (entry->offset > header->toc_offset || entry->stored_size > header->toc_offset - entry->offset ||
+            (uint64_t)entry->name_offset + entry->name_length >= header->names_size ||
+            (i > 0 && entry->hash < pack->entries[i - 1].hash)) {
+            return 0;
+        }
+        
+        if (entry->compression == PACK_COMPRESSION_NONE) {
+            if (entry->stored_size != entry->size) {
+                return 0;
+            }
+        } else if (entry->compression == PACK_COMPRESSION_LZ4) {
+            uint32_t count = chunk_count(entry->size);
+            if ((uint64_t)entry->first_chunk + count > header->chunk_count) {
+                return 0;
+            }
+            for (uint32_t c = 0; c < count; c++) {
+                const pack_chunk* chunk = &pack->chunks[entry->first_chunk + c];
+                if ((uint64_t)chunk->offset + chunk->size > entry->stored_size) {
+                    return 0;
+                }
+            }
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int pack_open(const char* filename, asset_pack* pack) {
+    memset(pack, 0, sizeof(*pack));
+    
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(pack_header)) {
+        close(fd);
+        return 0;
+    }
+    
+    size_t size = (size_t)st.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return 0;
+    }
+    
+    pack->base = mapping;
+    pack->size = size;
+    pack->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    pack->header = mapping;
+    
+    // Assets are read a few at a time all over the file, where the default
+    // readahead would mostly pull in neighbours nobody asked for; the
+    // table is read whole right away
+    madvise(mapping, size, MADV_RANDOM);
+    size_t toc_page = (size_t)pack->header->toc_offset & ~(pack->page_size - 1);
+    if (pack->header->toc_offset <= size) {
+        madvise((uint8_t*)mapping + toc_page, size - toc_page, MADV_WILLNEED);
+    }
+    
+    if (!pack_validate(pack)) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "pack: %s is damaged or from another version", filename);
+        pack_close(pack);
+        return 0;
+    }
+    return 1;
+}
+
+void pack_close(asset_pack* pack) {
+    if (pack->base) {
+        munmap((void*)pack->base, pack->size);
+    }
+    memset(pack, 0, sizeof(*pack));
+}
+
+const pack_entry* pack_find(const asset_pack* pack, const char* name) {
+    size_t length = strlen(name);
+    uint64_t hash = hash_fnv1a64(name, length, HASH_FNV1A64_SEED);
+    
+    // First entry with this hash, then past any colliding names
+    uint32_t low = 0;
+    uint32_t high = pack->header->entry_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (pack->entries[mid].hash < hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    
+    for (uint32_t i = low; i < pack->header->entry_count && pack->entries[i].hash == hash; i++) {
+        const pack_entry* entry = &pack->entries[i];
+        if (entry->name_length == length && memcmp(pack->names + entry->name_offset, name, length) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+const void* pack_data(const asset_pack* pack, const pack_entry* entry) {
+    return entry->compression == PACK_COMPRESSION_NONE ? pack->base + entry->offset : NULL;
+}
+
+void pack_prefetch(const asset_pack* pack, const pack_entry* entry) {
+    size_t begin = (size_t)entry->offset & ~(pack->page_size - 1);
+    size_t end = (size_t)(entry->offset + entry->stored_size);
+    if (end > begin) {
+        madvise((uint8_t*)pack->base + begin, end - begin, MADV_WILLNEED);
+    }
+}
+
+int pack_read(const asset_pack* pack, const pack_entry* entry, void* dst) {
+    const uint8_t* blob = pack->base + entry->offset;
+    if (entry->compression == PACK_COMPRESSION_NONE) {
+        memcpy(dst, blob, entry->size);
+        return 1;
+    }
+    
+    uint8_t* out = dst;
+    uint32_t count = chunk_count(entry->size);
+    for (uint32_t i = 0; i < count; i++) {
+        const pack_chunk* chunk = &pack->chunks[entry->first_chunk + i];
+        uint64_t begin = (uint64_t)i * PACK_CHUNK_SIZE;
+        uint32_t size = (uint32_t)(entry->size - begin < PACK_CHUNK_SIZE ? entry->size - begin : PACK_CHUNK_SIZE);
+        if (chunk->size == size) {
+            memcpy(out + begin, blob + chunk->offset, size);
+        } else if (!lz4_decompress(blob + chunk->offset, chunk->size, out + begin, size)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+uint64_t pack_upload_buffer(vulkan_context* ctx, const asset_pack* pack, const pack_entry* entry,
+                            VkBuffer dst, VkDeviceSize dst_offset) {
+    const void* data = pack_data(pack, entry);
+    if (data) {
+        return upload_buffer(ctx, dst, dst_offset, data, entry->size);
+    }
+    
+    void* scratch = malloc(entry->size);
+    uint64_t ticket = 0;
+    if (scratch && pack_read(pack, entry, scratch)) {
+        ticket = upload_buffer(ctx, dst, dst_offset, scratch, entry->size);
+    }
+    free(scratch);
+    return ticket;
+}
+
+// Stands in for whatever parses the asset, so every way pays the same
+// for touching the bytes
+static uint64_t consume(const uint8_t* data, uint64_t size) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < size; i += 64) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+// Drops the file's clean pages from the page cache so the next read
+// comes from storage
+static int evict(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return ok;
+}
+
+static int write_loose(const char* filename, const void* data, uint64_t size) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        return 0;
+    }
+    int ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+// Short runs with some noise, so LZ4 finds matches in every chunk but
+// has to work for them
+static void fill_asset(uint8_t* data, uint64_t size, uint32_t seed) {
+    uint64_t i = 0;
+    while (i < size) {
+        seed = seed * 1664525u + 1013904223u;
+        uint32_t run = 1 + ((seed >> 8) & 31);
+        uint8_t value = (uint8_t)(seed >> 24) & 0xf0;
+        for (uint32_t r = 0; r < run && i < size; r++, i++) {
+            data[i] = (seed & 3) == 0 ? (uint8_t)(seed >> (r & 15)) : value;
+        }
+    }
+}
+
+int pack_benchmark(const char* dir, uint32_t asset_count, pack_benchmark_result* result) {
+    memset(result, 0, sizeof(*result));
+    if (asset_count == 0) {
+        return 0;
+    }
+    
+    char loose_dir[512];
+    char pack_filename[512];
+    char lz4_filename[512];
+    snprintf(loose_dir, sizeof(loose_dir), "%s/pack_benchmark", dir);
+    snprintf(pack_filename, sizeof(pack_filename), "%s/pack_benchmark.pack", dir);
+    snprintf(lz4_filename, sizeof(lz4_filename), "%s/pack_benchmark_lz4.pack", dir);
+    
+    pack_source* sources = calloc(asset_count, sizeof(pack_source));
+    char (*names)[32] = calloc(asset_count, sizeof(*names));
+    uint32_t* order = malloc(asset_count * sizeof(uint32_t));
+    uint8_t* buffer = malloc(PACK_BENCHMARK_MAX_ASSET);
+    int ok = sources && names && order && buffer && (mkdir(loose_dir, 0755) == 0 || access(loose_dir, W_OK) == 0);
+    
+    uint32_t seed = 0x9e3779b9u;
+    for (uint32_t i = 0; ok && i < asset_count; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        uint64_t size = PACK_BENCHMARK_MIN_ASSET + seed % (PACK_BENCHMARK_MAX_ASSET - PACK_BENCHMARK_MIN_ASSET);
+        uint8_t* data = malloc(size);
+        snprintf(names[i], sizeof(names[i]), "asset_%05u.bin", i);
+        sources[i].name = names[i];
+        sources[i].data = data;
+        sources[i].size = size;
+        ok = data != NULL;
+        if (ok) {
+            fill_asset(data, size, seed);
+            result->total_bytes += size;
+        }
+    }
+    
+    // Everything written up front, so the timed part only reads
+    char path[600];
+    for (uint32_t i = 0; ok && i < asset_count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", loose_dir, names[i]);
+        ok = write_loose(path, sources[i].data, sources[i].size);
+    }
+    ok = ok && pack_write(pack_filename, sources, asset_count);
+    for (uint32_t i = 0; ok && i < asset_count; i++) {
+        sources[i].compression = PACK_COMPRESSION_LZ4;
+    }
+    ok = ok && pack_write(lz4_filename, sources, asset_count);
+    
+    // Same shuffled order for every way
+    for (uint32_t i = 0; ok && i < asset_count; i++) {
+        order[i] = i;
+    }
+    for (uint32_t i = asset_count - 1; ok && i > 0; i--) {
+        seed = seed * 1664525u + 1013904223u;
+        uint32_t j = seed % (i + 1);
+        uint32_t swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    
+    uint64_t sums[3] = {0};
+    if (ok) {
+        result->asset_count = asset_count;
+        result->cold = 1;
+        for (uint32_t i = 0; i < asset_count; i++) {
+            snprintf(path, sizeof(path), "%s/%s", loose_dir, names[i]);
+            result->cold = evict(path) && result->cold;
+        }
+        
+        uint64_t begin = timing_now_ns();
+        for (uint32_t i = 0; ok && i < asset_count; i++) {
+            snprintf(path, sizeof(path), "%s/%s", loose_dir, names[order[i]]);
+            FILE* file = fopen(path, "rb");
+            uint64_t size = sources[order[i]].size;
+            ok = file && fread(buffer, 1, size, file) == size;
+            if (file) {
+                fclose(file);
+            }
+            sums[0] += consume(buffer, size);
+        }
+        result->loose_ns = timing_now_ns() - begin;
+    }
+    
+    if (ok) {
+        result->cold = evict(pack_filename) && result->cold;
+        uint64_t begin = timing_now_ns();
+        asset_pack pack;
+        ok = pack_open(pack_filename, &pack);
+        for (uint32_t i = 0; ok && i < asset_count; i++) {
+            const pack_entry* entry = pack_find(&pack, names[order[i]]);
+            ok = entry != NULL;
+            if (ok) {
+                pack_prefetch(&pack, entry);
+                sums[1] += consume(pack_data(&pack, entry), entry->size);
+            }
+        }
+        if (ok) {
+            pack_close(&pack);
+        }
+        result->pack_ns = timing_now_ns() - begin;
+    }
+    
+    if (ok) {
+        result->cold = evict(lz4_filename) && result->cold;
+        uint64_t begin = timing_now_ns();
+        asset_pack pack;
+        ok = pack_open(lz4_filename, &pack);
+        for (uint32_t i = 0; ok && i < asset_count; i++) {
+            const pack_entry* entry = pack_find(&pack, names[order[i]]);
+            ok = entry != NULL && pack_read(&pack, entry, buffer);
+            if (ok) {
+                result->lz4_bytes += entry->stored_size;
+                sums[2] += consume(buffer, entry->size);
+            }
+        }
+        if (ok) {
+            pack_close(&pack);
+        }
+        result->pack_lz4_ns = timing_now_ns() - begin;
+    }
+    
+    // Each way must have seen the same bytes
+    ok = ok && sums[0] == sums[1] && sums[0] == sums[2];
+    
+    for (uint32_t i = 0; sources && names && i < asset_count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", loose_dir, names[i]);
+        remove(path);
+        free((void*)sources[i].data);
+    }
+    rmdir(loose_dir);
+    remove(pack_filename);
+    remove(lz4_filename);
+    
+    free(sources);
+    free(names);
+    free(order);
+    free(buffer);
+    return ok;
+}
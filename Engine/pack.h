@@ -0,0 +1,112 @@
+#pragma once
+
+#include "renderer.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define PACK_MAGIC 0x4b434150u
+#define PACK_VERSION 1
+
+// Blobs start on a cache line, which also satisfies every copy offset the
+// upload ring needs, so a mapped blob can be copied from as is
+#define PACK_BLOB_ALIGNMENT 64
+
+// Compressed blobs are cut into chunks that decode independently
+#define PACK_CHUNK_SIZE (64u << 10)
+
+#define PACK_BENCHMARK_MIN_ASSET (1u << 10)
+#define PACK_BENCHMARK_MAX_ASSET (64u << 10)
+
+typedef enum {
+    PACK_COMPRESSION_NONE,
+    PACK_COMPRESSION_LZ4
+} pack_compression;
+
+// File layout: header, blobs, then the entries sorted by name hash, the
+// chunk table and the names. The table sits at the end so the writer can
+// stream the blobs out first.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t chunk_count;
+    uint64_t toc_offset;
+    uint64_t names_size;
+    
+    // Over everything from toc_offset to the end
+    uint64_t checksum;
+} pack_header;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t offset;
+    uint64_t stored_size;
+    uint64_t size;
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t compression;
+    uint32_t first_chunk;
+} pack_entry;
+
+// Relative to the blob; a chunk stored at its full decoded size is raw
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+} pack_chunk;
+
+typedef struct {
+    const uint8_t* base;
+    size_t size;
+    size_t page_size;
+    const pack_header* header;
+    const pack_entry* entries;
+    const pack_chunk* chunks;
+    const char* names;
+} asset_pack;
+
+typedef struct {
+    const char* name;
+    const void* data;
+    uint64_t size;
+    pack_compression compression;
+} pack_source;
+
+// Nanoseconds to read every asset once, in the same shuffled order each
+// way. With cold set, the page cache was dropped for the files first.
+typedef struct {
+    uint32_t asset_count;
+    uint64_t total_bytes;
+    uint64_t lz4_bytes;
+    int cold;
+    uint64_t loose_ns;
+    uint64_t pack_ns;
+    uint64_t pack_lz4_ns;
+} pack_benchmark_result;
+
+// Writes to a temporary file and renames it into place
+int pack_write(const char* filename, const pack_source* sources, uint32_t count);
+
+// Maps the whole pack read-only; assets are read straight from the mapping
+int pack_open(const char* filename, asset_pack* pack);
+void pack_close(asset_pack* pack);
+
+const pack_entry* pack_find(const asset_pack* pack, const char* name);
+
+// The blob inside the mapping, or NULL when it is compressed
+const void* pack_data(const asset_pack* pack, const pack_entry* entry);
+
+// Asks the kernel to start reading the blob's pages in
+void pack_prefetch(const asset_pack* pack, const pack_entry* entry);
+
+// Decodes or copies the blob into dst, which holds entry->size bytes
+int pack_read(const asset_pack* pack, const pack_entry* entry, void* dst);
+
+// Uncompressed blobs are copied from the mapping straight into the staging
+// ring; compressed ones are decoded into a scratch buffer first. Returns
+// the upload ticket, or 0.
+uint64_t pack_upload_buffer(vulkan_context* ctx, const asset_pack* pack, const pack_entry* entry,
+                            VkBuffer dst, VkDeviceSize dst_offset);
+
+// Writes asset_count loose files and the same assets as a plain and an LZ4
+// pack under dir, reads them back each way and removes them again
+int pack_benchmark(const char* dir, uint32_t asset_count, pack_benchmark_result* result);
@@ -0,0 +1,849 @@
+#include "pipeline.h"
+#include "sprite.h"
+#include "descriptor.h"
+#include "jobs.h"
+#include "hash.h"
+#include "timing.h"
+#include "platform.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_TAG "vm_engine"
+
+typedef struct {
+    pipeline_system* system;
+    uint32_t index;
+} compile_job_data;
+
+static void fill_identity(vulkan_context* ctx, pipeline_cache_header* identity) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ctx->physical_device, &props);
+    
+    memset(identity, 0, sizeof(*identity));
+    identity->magic = PIPELINE_CACHE_MAGIC;
+    identity->version = PIPELINE_CACHE_VERSION;
+    identity->vendor_id = props.vendorID;
+    identity->device_id = props.deviceID;
+    identity->driver_version = props.driverVersion;
+    memcpy(identity->pipeline_cache_uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+    
+    // The driver UUID needs Vulkan 1.1; on 1.0 the driver version has to do
+    if (ctx->api_version < VK_API_VERSION_1_1 || props.apiVersion < VK_API_VERSION_1_1) {
+        return;
+    }
+    
+    PFN_vkGetPhysicalDeviceProperties2 get_properties2 =
+        (PFN_vkGetPhysicalDeviceProperties2)vkGetInstanceProcAddr(ctx->instance, "vkGetPhysicalDeviceProperties2");
+    if (!get_properties2) {
+        return;
+    }
+    
+    VkPhysicalDeviceIDProperties id_props = {0};
+    id_props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    
+    VkPhysicalDeviceProperties2 props2 = {0};
+    props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props2.pNext = &id_props;
+    get_properties2(ctx->physical_device, &props2);
+    
+    memcpy(identity->driver_uuid, id_props.driverUUID, VK_UUID_SIZE);
+}
+
+// Returns the validated driver blob, or NULL when the file is missing,
+// corrupt or was written by a different device or driver
+static void* load_cache_file(pipeline_system* system, size_t* size) {
+    FILE* file = fopen(system->cache_filename, "rb");
+    if (!file) {
+        return NULL;
+    }
+    
+    pipeline_cache_header header;
+    void* data = NULL;
+    
+    if (fread(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        return NULL;
+    }
+    
+    // Identity must match byte for byte; size and checksum describe the blob
+    pipeline_cache_header expected = system->identity;
+    expected.data_size = header.data_size;
+    expected.checksum = header.checksum;
+    
+    if (memcmp(&header, &expected, sizeof(header)) == 0 &&
+        header.data_size > 0 && header.data_size < (64ull << 20)) {
+        data = malloc((size_t)header.data_size);
+        if (data && fread(data, (size_t)header.data_size, 1, file) == 1 &&
+            hash_fnv1a64(data, (size_t)header.data_size, HASH_FNV1A64_SEED) == header.checksum) {
+            *size = (size_t)header.data_size;
+        } else {
+            free(data);
+            data = NULL;
+        }
+    }
+    
+    fclose(file);
+    
+    if (!data) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "discarding stale pipeline cache %s", system->cache_filename);
+    }
+    
+    return data;
+}
+
+static int load_shader_module(pipeline_system* system, const char* name, VkShaderModule* module) {
+    char path[PIPELINE_SHADER_PATH_MAX + 256];
+    snprintf(path, sizeof(path), "%s/%s", system->shader_dir, name);
+    
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "missing shader %s", path);
+        return 0;
+    }
+    
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    // SPIR-V is a stream of 32-bit words
+    uint32_t* code = size > 0 && size % 4 == 0 ? malloc((size_t)size) : NULL;
+    int ok = code && fread(code, (size_t)size, 1, file) == 1;
+    fclose(file);
+    
+    if (ok) {
+        VkShaderModuleCreateInfo module_info = {0};
+        module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        module_info.codeSize = (size_t)size;
+        module_info.pCode = code;
+        ok = vkCreateShaderModule(system->device, &module_info, NULL, module) == VK_SUCCESS;
+    }
+    
+    free(code);
+    return ok;
+}
+
+static VkPipeline compile_compute_pipeline(pipeline_system* system, const pipeline_state* state) {
+    VkShaderModule module = VK_NULL_HANDLE;
+    if (!load_shader_module(system, state->vertex_shader, &module)) {
+        return VK_NULL_HANDLE;
+    }
+    
+    VkComputePipelineCreateInfo pipeline_info = {0};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_info.stage.module = module;
+    pipeline_info.stage.pName = "main";
+    pipeline_info.layout = system->compute_layout;
+    pipeline_info.basePipelineIndex = -1;
+    
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (vkCreateComputePipelines(system->device, system->cache, 1, &pipeline_info, NULL, &pipeline) != VK_SUCCESS) {
+        pipeline = VK_NULL_HANDLE;
+    }
+    
+    vkDestroyShaderModule(system->device, module, NULL);
+    return pipeline;
+}
+
+static VkPipeline compile_pipeline(pipeline_system* system, const pipeline_state* state, VkRenderPass render_pass) {
+    if (state->compute) {
+        return compile_compute_pipeline(system, state);
+    }
+    
+    VkShaderModule vertex = VK_NULL_HANDLE;
+    VkShaderModule fragment = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    
+    if (!load_shader_module(system, state->vertex_shader, &vertex) ||
+        !load_shader_module(system, state->fragment_shader, &fragment)) {
+        goto done;
+    }
+    
+    VkPipelineShaderStageCreateInfo stages[2] = {{0}, {0}};
+    stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = vertex;
+    stages[0].pName = "main";
+    stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = fragment;
+    stages[1].pName = "main";
+    
+    VkPipelineVertexInputStateCreateInfo vertex_input = {0};
+    vertex_input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    
+    // Sprites are one instance each; the quad corners come from gl_VertexIndex
+    VkVertexInputBindingDescription sprite_binding = {0};
+    sprite_binding.binding = 0;
+    sprite_binding.stride = sizeof(sprite_instance);
+    sprite_binding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    
+    VkVertexInputAttributeDescription sprite_attributes[] = {
+        {0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(sprite_instance, position)},
+        {1, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(sprite_instance, size)},
+        {2, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(sprite_instance, uv)},
+        {3, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(sprite_instance, color)},
+        {4, 0, VK_FORMAT_R32_SFLOAT, offsetof(sprite_instance, rotation)},
+    };
+    
+    if (state->vertex_input == PIPELINE_VERTEX_INPUT_SPRITE) {
+        vertex_input.vertexBindingDescriptionCount = 1;
+        vertex_input.pVertexBindingDescriptions = &sprite_binding;
+        vertex_input.vertexAttributeDescriptionCount = sizeof(sprite_attributes) / sizeof(sprite_attributes[0]);
+        vertex_input.pVertexAttributeDescriptions = sprite_attributes;
+    }
+    
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = {0};
+    input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    input_assembly.topology = state->topology;
+    
+    // Viewport and scissor are dynamic so pipelines survive swapchain resizes
+    VkPipelineViewportStateCreateInfo viewport = {0};
+    viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport.viewportCount = 1;
+    viewport.scissorCount = 1;
+    
+    VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamic = {0};
+    dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic.dynamicStateCount = 2;
+    dynamic.pDynamicStates = dynamic_states;
+    
+    VkPipelineRasterizationStateCreateInfo rasterization = {0};
+    rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterization.polygonMode = state->polygon_mode;
+    rasterization.cullMode = state->cull_mode;
+    rasterization.frontFace = state->front_face;
+    rasterization.lineWidth = 1.0f;
+    
+    VkPipelineMultisampleStateCreateInfo multisample = {0};
+    multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisample.rasterizationSamples = state->samples;
+    
+    // Always provided; subpasses without a depth attachment ignore it
+    VkPipelineDepthStencilStateCreateInfo depth_stencil = {0};
+    depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil.depthTestEnable = state->depth_test ? VK_TRUE : VK_FALSE;
+    depth_stencil.depthWriteEnable = state->depth_test ? VK_TRUE : VK_FALSE;
+    depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    depth_stencil.maxDepthBounds = 1.0f;
+    
+    VkPipelineColorBlendAttachmentState blend_attachment = {0};
+    blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    if (state->blend_enable) {
+        blend_attachment.blendEnable = VK_TRUE;
+        blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+        blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    }
+    
+    VkPipelineColorBlendStateCreateInfo blend = {0};
+    blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    blend.attachmentCount = 1;
+    blend.pAttachments = &blend_attachment;
+    
+    VkGraphicsPipelineCreateInfo pipeline_info = {0};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_info.stageCount = 2;
+    pipeline_info.pStages = stages;
+    pipeline_info.pVertexInputState = &vertex_input;
+    pipeline_info.pInputAssemblyState = &input_assembly;
+    pipeline_info.pViewportState = &viewport;
+    pipeline_info.pRasterizationState = &rasterization;
+    pipeline_info.pMultisampleState = &multisample;
+    pipeline_info.pDepthStencilState = &depth_stencil;
+    pipeline_info.pColorBlendState = &blend;
+    pipeline_info.pDynamicState = &dynamic;
+    pipeline_info.layout = state->post ? system->post_layout : system->layout;
+    pipeline_info.renderPass = render_pass;
+    pipeline_info.subpass = state->subpass;
+    pipeline_info.basePipelineIndex = -1;
+    
+    // VkPipelineCache is internally synchronized, so workers share it freely
+    if (vkCreateGraphicsPipelines(system->device, system->cache, 1, &pipeline_info, NULL, &pipeline) != VK_SUCCESS) {
+        pipeline = VK_NULL_HANDLE;
+    }
+
+done:
+    if (vertex != VK_NULL_HANDLE) {
+        vkDestroyShaderModule(system->device, vertex, NULL);
+    }
+    if (fragment != VK_NULL_HANDLE) {
+        vkDestroyShaderModule(system->device, fragment, NULL);
+    }
+    return pipeline;
+}
+
+static int save_cache_file(pipeline_system* system) {
+    if (system->cache_filename[0] == '\0') {
+        return 0;
+    }
+    
+    uint64_t start = timing_now_ns();
+    
+    size_t size = 0;
+    if (vkGetPipelineCacheData(system->device, system->cache, &size, NULL) != VK_SUCCESS || size == 0) {
+        return 0;
+    }
+    
+    void* data = malloc(size);
+    if (!data || vkGetPipelineCacheData(system->device, system->cache, &size, data) != VK_SUCCESS) {
+        free(data);
+        return 0;
+    }
+    
+    pipeline_cache_header header = system->identity;
+    header.data_size = size;
+    header.checksum = hash_fnv1a64(data, size, HASH_FNV1A64_SEED);
+    
+    // Write beside the real file and rename so a crash never leaves half a cache
+    char temp_filename[sizeof(system->cache_filename) + 4];
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", system->cache_filename);
+    
+    FILE* file = fopen(temp_filename, "wb");
+    int ok = file != NULL;
+    if (ok) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data, size, 1, file) == 1;
+        ok = fclose(file) == 0 && ok;
+    }
+    ok = ok && rename(temp_filename, system->cache_filename) == 0;
+    
+    free(data);
+    
+    if (!ok) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "could not write pipeline cache %s", system->cache_filename);
+        remove(temp_filename);
+        return 0;
+    }
+    
+    pthread_mutex_lock(&system->lock);
+    system->stats.cache_size = size;
+    system->stats.cache_save_ns = timing_now_ns() - start;
+    pthread_mutex_unlock(&system->lock);
+    return 1;
+}
+
+static void report_startup(pipeline_system* system) {
+    pipeline_stats* stats = &system->stats;
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+        "pipelines (%s start): %u compiled, %u failed, first ready %.2f ms, all ready %.2f ms, cache load %.2f ms",
+        stats->warm_start ? "warm" : "cold", stats->compiled_count, stats->failed_count,
+        stats->first_ready_ns / 1e6, stats->all_ready_ns / 1e6, stats->cache_load_ns / 1e6);
+}
+
+static void compile_job(void* custom_data) {
+    compile_job_data* data = custom_data;
+    pipeline_system* system = data->system;
+    uint32_t index = data->index;
+    free(data);
+    
+    pthread_mutex_lock(&system->lock);
+    pipeline_state state = system->entries[index].state;
+    VkRenderPass render_pass = state.render_pass != VK_NULL_HANDLE ? state.render_pass : system->render_pass;
+    pthread_mutex_unlock(&system->lock);
+    
+    uint64_t start = timing_now_ns();
+    VkPipeline pipeline = compile_pipeline(system, &state, render_pass);
+    uint64_t end = timing_now_ns();
+    
+    pthread_mutex_lock(&system->lock);
+    pipeline_entry* entry = &system->entries[index];
+    entry->pipeline = pipeline;
+    entry->status = pipeline != VK_NULL_HANDLE ? PIPELINE_STATUS_READY : PIPELINE_STATUS_FAILED;
+    entry->compile_ns = end - start;
+    
+    if (pipeline != VK_NULL_HANDLE) {
+        system->stats.compiled_count++;
+        system->stats.total_compile_ns += end - start;
+        if (system->stats.first_ready_ns == 0) {
+            system->stats.first_ready_ns = end - system->start_ns;
+        }
+    } else {
+        system->stats.failed_count++;
+    }
+    
+    // The last compile of a burst persists the cache from this worker,
+    // keeping file I/O off the render thread
+    int save = --system->pending == 0 && system->stats.compiled_count > 0;
+    if (system->pending == 0) {
+        system->stats.all_ready_ns = end - system->start_ns;
+        report_startup(system);
+    }
+    if (save) {
+        system->saving++;
+    }
+    pthread_mutex_unlock(&system->lock);
+    
+    if (save) {
+        save_cache_file(system);
+        
+        pthread_mutex_lock(&system->lock);
+        system->saving--;
+        pthread_mutex_unlock(&system->lock);
+    }
+    
+    pthread_mutex_lock(&system->lock);
+    if (system->pending == 0 && system->saving == 0) {
+        pthread_cond_broadcast(&system->idle);
+    }
+    pthread_mutex_unlock(&system->lock);
+}
+
+static void queue_compile(pipeline_system* system, uint32_t index) {
+    compile_job_data* data = malloc(sizeof(compile_job_data));
+    job* compile = data ? job_create_custom(data, compile_job) : NULL;
+    if (!compile) {
+        free(data);
+        pthread_mutex_lock(&system->lock);
+        system->entries[index].status = PIPELINE_STATUS_FAILED;
+        system->stats.failed_count++;
+        if (--system->pending == 0 && system->saving == 0) {
+            pthread_cond_broadcast(&system->idle);
+        }
+        pthread_mutex_unlock(&system->lock);
+        return;
+    }
+    
+    data->system = system;
+    data->index = index;
+    job_queue_add_worker(compile);
+}
+
+// Set 3: every texture in one runtime-sized array, written while frames
+// that bound it are still in flight as long as they don't sample the slots
+// being written; shaders index it non-uniformly
+static int create_bindless_layout(vulkan_context* ctx, pipeline_system* system) {
+    VkDescriptorSetLayoutBinding binding = {0};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = ctx->caps.max_bindless_textures < DESCRIPTOR_BINDLESS_MAX ?
+                              ctx->caps.max_bindless_textures : DESCRIPTOR_BINDLESS_MAX;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    
+    VkDescriptorBindingFlags binding_flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                                             VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+                                             VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+    
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {0};
+    flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flags_info.bindingCount = 1;
+    flags_info.pBindingFlags = &binding_flags;
+    
+    VkDescriptorSetLayoutCreateInfo layout_info = {0};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.pNext = &flags_info;
+    layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layout_info.bindingCount = 1;
+    layout_info.pBindings = &binding;
+    
+    return binding.descriptorCount > 0 &&
+           vkCreateDescriptorSetLayout(ctx->device, &layout_info, NULL, &system->bindless_set_layout) == VK_SUCCESS;
+}
+
+static int create_compute_layout(vulkan_context* ctx, pipeline_system* system) {
+    VkDescriptorSetLayoutBinding binding = {0};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    
+    VkDescriptorSetLayoutCreateInfo set_layout_info = {0};
+    set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    set_layout_info.bindingCount = 1;
+    set_layout_info.pBindings = &binding;
+    
+    if (vkCreateDescriptorSetLayout(ctx->device, &set_layout_info, NULL, &system->compute_set_layout) != VK_SUCCESS) {
+        system->compute_set_layout = VK_NULL_HANDLE;
+        return 0;
+    }
+    
+    VkPushConstantRange push_range = {0};
+    push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_range.size = PIPELINE_COMPUTE_PUSH_CONSTANTS;
+    
+    VkPipelineLayoutCreateInfo layout_info = {0};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &system->compute_set_layout;
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    
+    return vkCreatePipelineLayout(ctx->device, &layout_info, NULL, &system->compute_layout) == VK_SUCCESS;
+}
+
+static int create_post_layout(vulkan_context* ctx, pipeline_system* system) {
+    VkDescriptorSetLayoutBinding binding = {0};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    
+    VkDescriptorSetLayoutCreateInfo set_layout_info = {0};
+    set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    set_layout_info.bindingCount = 1;
+    set_layout_info.pBindings = &binding;
+    
+    if (vkCreateDescriptorSetLayout(ctx->device, &set_layout_info, NULL, &system->post_set_layout) != VK_SUCCESS) {
+        system->post_set_layout = VK_NULL_HANDLE;
+        return 0;
+    }
+    
+    VkPushConstantRange push_range = {0};
+    push_range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    push_range.size = PIPELINE_POST_PUSH_CONSTANTS;
+    
+    VkPipelineLayoutCreateInfo layout_info = {0};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &system->post_set_layout;
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    
+    return vkCreatePipelineLayout(ctx->device, &layout_info, NULL, &system->post_layout) == VK_SUCCESS;
+}
+
+int pipeline_system_create(vulkan_context* ctx, const char* cache_filename, const char* shader_dir) {
+    pipeline_system* system = calloc(1, sizeof(pipeline_system));
+    if (!system) {
+        return 0;
+    }
+    
+    // Init creates the system alongside the frame graph; the render pass
+    // arrives through pipeline_system_set_render_pass before any compile
+    system->device = ctx->device;
+    system->render_pass = VK_NULL_HANDLE;
+    system->start_ns = timing_now_ns();
+    pthread_mutex_init(&system->lock, NULL);
+    pthread_cond_init(&system->idle, NULL);
+    
+    if (cache_filename) {
+        snprintf(system->cache_filename, sizeof(system->cache_filename), "%s", cache_filename);
+    }
+    snprintf(system->shader_dir, sizeof(system->shader_dir), "%s", shader_dir ? shader_dir : "shaders");
+    
+    fill_identity(ctx, &system->identity);
+    
+    size_t initial_size = 0;
+    void* initial_data = system->cache_filename[0] ? load_cache_file(system, &initial_size) : NULL;
+    
+    VkPipelineCacheCreateInfo cache_info = {0};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cache_info.initialDataSize = initial_size;
+    cache_info.pInitialData = initial_data;
+    
+    VkResult result = vkCreatePipelineCache(ctx->device, &cache_info, NULL, &system->cache);
+    if (result != VK_SUCCESS && initial_data) {
+        // Drivers may still reject a blob we validated; start cold instead
+        cache_info.initialDataSize = 0;
+        cache_info.pInitialData = NULL;
+        free(initial_data);
+        initial_data = NULL;
+        result = vkCreatePipelineCache(ctx->device, &cache_info, NULL, &system->cache);
+    }
+    
+    system->stats.warm_start = initial_data != NULL;
+    system->stats.cache_size = initial_size;
+    system->stats.cache_load_ns = timing_now_ns() - system->start_ns;
+    free(initial_data);
+    
+    // Set 0 carries the per-frame uniforms, so values that change every
+    // frame never have to be baked into recorded command buffers
+    VkDescriptorSetLayoutBinding frame_binding = {0};
+    frame_binding.binding = 0;
+    frame_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    frame_binding.descriptorCount = 1;
+    frame_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    
+    VkDescriptorSetLayoutCreateInfo set_layout_info = {0};
+    set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    set_layout_info.bindingCount = 1;
+    set_layout_info.pBindings = &frame_binding;
+    
+    // Set 1 is the draw's texture; pipelines that don't sample leave it unbound
+    VkDescriptorSetLayoutBinding texture_binding = {0};
+    texture_binding.binding = 0;
+    texture_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    texture_binding.descriptorCount = 1;
+    texture_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    
+    VkDescriptorSetLayoutCreateInfo texture_layout_info = set_layout_info;
+    texture_layout_info.pBindings = &texture_binding;
+    
+    // Set 2 is the draw's block in the per-frame uniform ring, picked by a
+    // dynamic offset at bind time
+    VkDescriptorSetLayoutBinding draw_binding = frame_binding;
+    draw_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    
+    VkDescriptorSetLayoutCreateInfo draw_layout_info = set_layout_info;
+    draw_layout_info.pBindings = &draw_binding;
+    
+    if (result == VK_SUCCESS &&
+        vkCreateDescriptorSetLayout(ctx->device, &set_layout_info, NULL, &system->frame_set_layout) == VK_SUCCESS &&
+        vkCreateDescriptorSetLayout(ctx->device, &texture_layout_info, NULL,
+                                    &system->texture_set_layout) == VK_SUCCESS &&
+        vkCreateDescriptorSetLayout(ctx->device, &draw_layout_info, NULL, &system->draw_set_layout) == VK_SUCCESS) {
+        // Without the table, pipelines simply have no set 3
+        if (ctx->bindless_textures && !create_bindless_layout(ctx, system)) {
+            system->bindless_set_layout = VK_NULL_HANDLE;
+        }
+        
+        VkDescriptorSetLayout set_layouts[] = {
+            system->frame_set_layout, system->texture_set_layout, system->draw_set_layout,
+            system->bindless_set_layout
+        };
+        
+        VkPipelineLayoutCreateInfo layout_info = {0};
+        layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_info.setLayoutCount = system->bindless_set_layout != VK_NULL_HANDLE ? 4 : 3;
+        layout_info.pSetLayouts = set_layouts;
+        result = vkCreatePipelineLayout(ctx->device, &layout_info, NULL, &system->layout);
+        if (result == VK_SUCCESS && (!create_compute_layout(ctx, system) || !create_post_layout(ctx, system))) {
+            vkDestroyPipelineLayout(ctx->device, system->layout, NULL);
+            vkDestroyPipelineLayout(ctx->device, system->compute_layout, NULL);
+            result = VK_ERROR_INITIALIZATION_FAILED;
+        }
+    } else {
+        result = VK_ERROR_INITIALIZATION_FAILED;
+    }
+    
+    if (result != VK_SUCCESS) {
+        if (system->frame_set_layout != VK_NULL_HANDLE) {
+            vkDestroyDescriptorSetLayout(ctx->device, system->frame_set_layout, NULL);
+        }
+        if (system->texture_set_layout != VK_NULL_HANDLE) {
+            vkDestroyDescriptorSetLayout(ctx->device, system->texture_set_layout, NULL);
+        }
+        if (system->draw_set_layout != VK_NULL_HANDLE) {
+            vkDestroyDescriptorSetLayout(ctx->device, system->draw_set_layout, NULL);
+        }
+        if (system->bindless_set_layout != VK_NULL_HANDLE) {
+            vkDestroyDescriptorSetLayout(ctx->device, system->bindless_set_layout, NULL);
+        }
+        if (system->compute_set_layout != VK_NULL_HANDLE) {
+            vkDestroyDescriptorSetLayout(ctx->device, system->compute_set_layout, NULL);
+        }
+        if (system->post_set_layout != VK_NULL_HANDLE) {
+            vkDestroyDescriptorSetLayout(ctx->device, system->post_set_layout, NULL);
+        }
+        if (system->cache != VK_NULL_HANDLE) {
+            vkDestroyPipelineCache(ctx->device, system->cache, NULL);
+        }
+        pthread_mutex_destroy(&system->lock);
+        pthread_cond_destroy(&system->idle);
+        free(system);
+        return 0;
+    }
+    
+    ctx->pipelines = system;
+    return 1;
+}
+
+void pipeline_wait_all(vulkan_context* ctx) {
+    pipeline_system* system = ctx->pipelines;
+    if (!system) {
+        return;
+    }
+    
+    pthread_mutex_lock(&system->lock);
+    while (system->pending > 0 || system->saving > 0) {
+        pthread_cond_wait(&system->idle, &system->lock);
+    }
+    pthread_mutex_unlock(&system->lock);
+}
+
+static void destroy_pipelines(pipeline_system* system) {
+    for (uint32_t i = 0; i < system->entry_count; i++) {
+        if (system->entries[i].pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(system->device, system->entries[i].pipeline, NULL);
+            system->entries[i].pipeline = VK_NULL_HANDLE;
+        }
+    }
+}
+
+void pipeline_system_destroy(vulkan_context* ctx) {
+    pipeline_system* system = ctx->pipelines;
+    if (!system) {
+        return;
+    }
+    
+    pipeline_wait_all(ctx);
+    save_cache_file(system);
+    destroy_pipelines(system);
+    
+    vkDestroyPipelineLayout(system->device, system->layout, NULL);
+    vkDestroyPipelineLayout(system->device, system->compute_layout, NULL);
+    vkDestroyDescriptorSetLayout(system->device, system->compute_set_layout, NULL);
+    vkDestroyPipelineLayout(system->device, system->post_layout, NULL);
+    vkDestroyDescriptorSetLayout(system->device, system->post_set_layout, NULL);
+    vkDestroyDescriptorSetLayout(system->device, system->frame_set_layout, NULL);
+    vkDestroyDescriptorSetLayout(system->device, system->texture_set_layout, NULL);
+    vkDestroyDescriptorSetLayout(system->device, system->draw_set_layout, NULL);
+    if (system->bindless_set_layout != VK_NULL_HANDLE) {
+        vkDestroyDescriptorSetLayout(system->device, system->bindless_set_layout, NULL);
+    }
+    vkDestroyPipelineCache(system->device, system->cache, NULL);
+    pthread_mutex_destroy(&system->lock);
+    pthread_cond_destroy(&system->idle);
+    free(system);
+    ctx->pipelines = NULL;
+}
+
+void pipeline_system_set_render_pass(vulkan_context* ctx) {
+    pipeline_system* system = ctx->pipelines;
+    if (!system || system->render_pass == ctx->render_pass) {
+        return;
+    }
+    
+    // Pipelines are tied to render pass compatibility; rebuild them all,
+    // which the warm cache makes cheap
+    pipeline_wait_all(ctx);
+    destroy_pipelines(system);
+    
+    pthread_mutex_lock(&system->lock);
+    system->render_pass = ctx->render_pass;
+    system->pending = system->entry_count;
+    for (uint32_t i = 0; i < system->entry_count; i++) {
+        system->entries[i].status = PIPELINE_STATUS_PENDING;
+    }
+    uint32_t count = system->entry_count;
+    pthread_mutex_unlock(&system->lock);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        queue_compile(system, i);
+    }
+}
+
+void pipeline_state_init(pipeline_state* state, const char* vertex_shader, const char* fragment_shader) {
+    memset(state, 0, sizeof(*state));
+    snprintf(state->vertex_shader, sizeof(state->vertex_shader), "%s", vertex_shader);
+    snprintf(state->fragment_shader, sizeof(state->fragment_shader), "%s", fragment_shader);
+    state->topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    state->polygon_mode = VK_POLYGON_MODE_FILL;
+    state->cull_mode = VK_CULL_MODE_NONE;
+    state->front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    state->samples = VK_SAMPLE_COUNT_1_BIT;
+}
+
+void pipeline_state_init_compute(pipeline_state* state, const char* compute_shader) {
+    memset(state, 0, sizeof(*state));
+    snprintf(state->vertex_shader, sizeof(state->vertex_shader), "%s", compute_shader);
+    state->compute = 1;
+}
+
+uint64_t pipeline_state_hash(const pipeline_state* state) {
+    return hash_fnv1a64(state, sizeof(*state), HASH_FNV1A64_SEED);
+}
+
+uint64_t pipeline_request(vulkan_context* ctx, const pipeline_state* state) {
+    pipeline_system* system = ctx->pipelines;
+    if (!system) {
+        return 0;
+    }
+    
+    uint64_t hash = pipeline_state_hash(state);
+    
+    pthread_mutex_lock(&system->lock);
+    for (uint32_t i = 0; i < system->entry_count; i++) {
+        if (system->entries[i].hash == hash) {
+            pthread_mutex_unlock(&system->lock);
+            return hash;
+        }
+    }
+    
+    if (system->entry_count >= MAX_PIPELINES) {
+        pthread_mutex_unlock(&system->lock);
+        return 0;
+    }
+    
+    uint32_t index = system->entry_count++;
+    pipeline_entry* entry = &system->entries[index];
+    entry->hash = hash;
+    entry->state = *state;
+    entry->pipeline = VK_NULL_HANDLE;
+    entry->status = PIPELINE_STATUS_PENDING;
+    system->pending++;
+    pthread_mutex_unlock(&system->lock);
+    
+    queue_compile(system, index);
+    return hash;
+}
+
+VkPipeline pipeline_get(vulkan_context* ctx, uint64_t handle) {
+    pipeline_system* system = ctx->pipelines;
+    if (!system || handle == 0) {
+        return VK_NULL_HANDLE;
+    }
+    
+    // Never waits: callers skip the draw until the worker has finished
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    pthread_mutex_lock(&system->lock);
+    for (uint32_t i = 0; i < system->entry_count; i++) {
+        if (system->entries[i].hash == handle) {
+            if (system->entries[i].status == PIPELINE_STATUS_READY) {
+                pipeline = system->entries[i].pipeline;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&system->lock);
+    
+    return pipeline;
+}
+
+VkPipelineLayout pipeline_get_layout(vulkan_context* ctx) {
+    return ctx->pipelines ? ctx->pipelines->layout : VK_NULL_HANDLE;
+}
+
+VkDescriptorSetLayout pipeline_get_frame_set_layout(vulkan_context* ctx) {
+    return ctx->pipelines ? ctx->pipelines->frame_set_layout : VK_NULL_HANDLE;
+}
+
+VkDescriptorSetLayout pipeline_get_texture_set_layout(vulkan_context* ctx) {
+    return ctx->pipelines ? ctx->pipelines->texture_set_layout : VK_NULL_HANDLE;
+}
+
+VkDescriptorSetLayout pipeline_get_draw_set_layout(vulkan_context* ctx) {
+    return ctx->pipelines ? ctx->pipelines->draw_set_layout : VK_NULL_HANDLE;
+}
+
+VkDescriptorSetLayout pipeline_get_bindless_set_layout(vulkan_context* ctx) {
+    return ctx->pipelines ? ctx->pipelines->bindless_set_layout : VK_NULL_HANDLE;
+}
+
+VkPipelineLayout pipeline_get_compute_layout(vulkan_context* ctx) {
+    return ctx->pipelines ? ctx->pipelines->compute_layout : VK_NULL_HANDLE;
+}
+
+VkDescriptorSetLayout pipeline_get_compute_set_layout(vulkan_context* ctx) {
+    return ctx->pipelines ? ctx->pipelines->compute_set_layout : VK_NULL_HANDLE;
+}
+
+VkPipelineLayout pipeline_get_post_layout(vulkan_context* ctx) {
+    return ctx->pipelines ? ctx->pipelines->post_layout : VK_NULL_HANDLE;
+}
+
+VkDescriptorSetLayout pipeline_get_post_set_layout(vulkan_context* ctx) {
+    return ctx->pipelines ? ctx->pipelines->post_set_layout : VK_NULL_HANDLE;
+}
+
+int pipeline_cache_save(vulkan_context* ctx) {
+    return ctx->pipelines ? save_cache_file(ctx->pipelines) : 0;
+}
+
+void pipeline_get_stats(vulkan_context* ctx, pipeline_stats* stats) {
+    if (!ctx->pipelines) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    
+    pthread_mutex_lock(&ctx->pipelines->lock);
+    *stats = ctx->pipelines->stats;
+    pthread_mutex_unlock(&ctx->pipelines->lock);
+}
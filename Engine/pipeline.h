@@ -0,0 +1,147 @@
+#pragma once
+
+#include "renderer.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define PIPELINE_CACHE_MAGIC 0x43505056u
+#define PIPELINE_CACHE_VERSION 1
+#define MAX_PIPELINES 64
+#define PIPELINE_SHADER_PATH_MAX 128
+
+// Sets of the layout every pipeline shares. The bindless set only exists
+// when the device has descriptor indexing.
+#define PIPELINE_SET_FRAME 0
+#define PIPELINE_SET_TEXTURE 1
+#define PIPELINE_SET_DRAW 2
+#define PIPELINE_SET_BINDLESS 3
+
+// Compute pipelines share a layout of their own: one storage buffer and
+// push constants carrying where in it to work
+#define PIPELINE_COMPUTE_PUSH_CONSTANTS 64
+
+// Post-process subpasses read the previous subpass's output through one
+// input attachment and take their parameters as push constants
+#define PIPELINE_POST_PUSH_CONSTANTS 16
+
+// Vertex layouts a pipeline can consume; NONE generates vertices in the shader
+typedef enum {
+    PIPELINE_VERTEX_INPUT_NONE,
+    PIPELINE_VERTEX_INPUT_SPRITE
+} pipeline_vertex_input;
+
+typedef enum {
+    PIPELINE_STATUS_PENDING,
+    PIPELINE_STATUS_READY,
+    PIPELINE_STATUS_FAILED
+} pipeline_status;
+
+// Everything that selects a distinct VkPipeline. Always start from
+// pipeline_state_init so padding is zeroed and the hash is stable.
+typedef struct {
+    char vertex_shader[PIPELINE_SHADER_PATH_MAX];
+    char fragment_shader[PIPELINE_SHADER_PATH_MAX];
+    VkPrimitiveTopology topology;
+    VkPolygonMode polygon_mode;
+    VkCullModeFlags cull_mode;
+    VkFrontFace front_face;
+    VkSampleCountFlagBits samples;
+    uint32_t depth_test;
+    uint32_t blend_enable;
+    uint32_t subpass;
+    uint32_t vertex_input;
+    
+    // Compute pipelines keep their shader in vertex_shader and ignore the rest
+    uint32_t compute;
+    
+    // Uses the post-process layout instead of the shared one
+    uint32_t post;
+    
+    // Compiles against this render pass instead of the scene's, for
+    // subpasses the scene pass doesn't contain
+    VkRenderPass render_pass;
+} pipeline_state;
+
+typedef struct {
+    uint64_t hash;
+    pipeline_state state;
+    VkPipeline pipeline;
+    pipeline_status status;
+    uint64_t compile_ns;
+} pipeline_entry;
+
+// On-disk header in front of the driver's VkPipelineCache data
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint32_t reserved;
+    uint8_t driver_uuid[VK_UUID_SIZE];
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+    uint64_t checksum;
+} pipeline_cache_header;
+
+typedef struct {
+    int warm_start;
+    uint64_t cache_load_ns;
+    uint64_t cache_save_ns;
+    uint64_t cache_size;
+    uint32_t compiled_count;
+    uint32_t failed_count;
+    uint64_t total_compile_ns;
+    uint64_t first_ready_ns;
+    uint64_t all_ready_ns;
+} pipeline_stats;
+
+typedef struct pipeline_system {
+    VkDevice device;
+    VkRenderPass render_pass;
+    VkPipelineCache cache;
+    VkDescriptorSetLayout frame_set_layout;
+    VkDescriptorSetLayout texture_set_layout;
+    VkDescriptorSetLayout draw_set_layout;
+    VkDescriptorSetLayout bindless_set_layout;
+    VkPipelineLayout layout;
+    VkDescriptorSetLayout compute_set_layout;
+    VkPipelineLayout compute_layout;
+    VkDescriptorSetLayout post_set_layout;
+    VkPipelineLayout post_layout;
+    pipeline_cache_header identity;
+    char cache_filename[512];
+    char shader_dir[256];
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    pipeline_entry entries[MAX_PIPELINES];
+    uint32_t entry_count;
+    uint32_t pending;
+    int saving;
+    uint64_t start_ns;
+    pipeline_stats stats;
+} pipeline_system;
+
+int pipeline_system_create(vulkan_context* ctx, const char* cache_filename, const char* shader_dir);
+void pipeline_system_destroy(vulkan_context* ctx);
+void pipeline_system_set_render_pass(vulkan_context* ctx);
+
+void pipeline_state_init(pipeline_state* state, const char* vertex_shader, const char* fragment_shader);
+void pipeline_state_init_compute(pipeline_state* state, const char* compute_shader);
+uint64_t pipeline_state_hash(const pipeline_state* state);
+
+uint64_t pipeline_request(vulkan_context* ctx, const pipeline_state* state);
+VkPipeline pipeline_get(vulkan_context* ctx, uint64_t handle);
+VkPipelineLayout pipeline_get_layout(vulkan_context* ctx);
+VkDescriptorSetLayout pipeline_get_frame_set_layout(vulkan_context* ctx);
+VkDescriptorSetLayout pipeline_get_texture_set_layout(vulkan_context* ctx);
+VkDescriptorSetLayout pipeline_get_draw_set_layout(vulkan_context* ctx);
+VkDescriptorSetLayout pipeline_get_bindless_set_layout(vulkan_context* ctx);
+VkPipelineLayout pipeline_get_compute_layout(vulkan_context* ctx);
+VkDescriptorSetLayout pipeline_get_compute_set_layout(vulkan_context* ctx);
+VkPipelineLayout pipeline_get_post_layout(vulkan_context* ctx);
+VkDescriptorSetLayout pipeline_get_post_set_layout(vulkan_context* ctx);
+void pipeline_wait_all(vulkan_context* ctx);
+
+int pipeline_cache_save(vulkan_context* ctx);
+void pipeline_get_stats(vulkan_context* ctx, pipeline_stats* stats);
@@ -0,0 +1,24 @@
+#pragma once
+
+// Android builds present to a native window and log through logcat. Other
+// platforms (Linux CI, headless servers) only render offscreen, so the window
+// type is opaque there and logging goes to stderr.
+#ifdef __ANDROID__
+#ifndef VK_USE_PLATFORM_ANDROID_KHR
+#define VK_USE_PLATFORM_ANDROID_KHR
+#endif
+#include <android/native_window.h>
+#include <android/log.h>
+#else
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct ANativeWindow ANativeWindow;
+
+static inline int32_t ANativeWindow_getWidth(ANativeWindow* window) { (void)window; return 0; }
+static inline int32_t ANativeWindow_getHeight(ANativeWindow* window) { (void)window; return 0; }
+
+#define ANDROID_LOG_DEBUG 3
+#define __android_log_print(prio, tag, ...) \
+    ((void)(prio), fprintf(stderr, "%s: ", tag), fprintf(stderr, __VA_ARGS__), fprintf(stderr, "\n"))
+#endif
@@ -0,0 +1,106 @@
+#include "profiler.h"
+#include <stdlib.h>
+#include <string.h>
+
+gpu_profiler* gpu_profiler_create(VkDevice device, uint32_t slot_count, uint32_t scope_count,
+                                  uint32_t timestamp_valid_bits, float timestamp_period) {
+    if (timestamp_valid_bits == 0 || scope_count == 0 || scope_count > GPU_PROFILER_MAX_SCOPES) {
+        return NULL;
+    }
+    
+    gpu_profiler* profiler = calloc(1, sizeof(gpu_profiler));
+    if (!profiler) {
+        return NULL;
+    }
+    
+    profiler->device = device;
+    profiler->slot_count = slot_count;
+    profiler->scope_count = scope_count;
+    profiler->timestamp_mask = timestamp_valid_bits >= 64 ? UINT64_MAX : (1ull << timestamp_valid_bits) - 1;
+    profiler->timestamp_period = timestamp_period;
+    profiler->pending = calloc(slot_count, sizeof(int));
+    
+    VkQueryPoolCreateInfo query_info = {0};
+    query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_info.queryCount = slot_count * scope_count * 2;
+    
+    if (!profiler->pending ||
+        vkCreateQueryPool(device, &query_info, NULL, &profiler->pool) != VK_SUCCESS) {
+        gpu_profiler_destroy(profiler);
+        return NULL;
+    }
+    
+    return profiler;
+}
+
+void gpu_profiler_destroy(gpu_profiler* profiler) {
+    if (!profiler) {
+        return;
+    }
+    
+    if (profiler->pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(profiler->device, profiler->pool, NULL);
+    }
+    free(profiler->pending);
+    free(profiler);
+}
+
+void gpu_profiler_reset(gpu_profiler* profiler, VkCommandBuffer cmd, uint32_t slot) {
+    if (profiler) {
+        vkCmdResetQueryPool(cmd, profiler->pool, slot * profiler->scope_count * 2, profiler->scope_count * 2);
+    }
+}
+
+void gpu_profiler_begin(gpu_profiler* profiler, VkCommandBuffer cmd, uint32_t slot, uint32_t scope) {
+    if (profiler) {
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->pool,
+                            (slot * profiler->scope_count + scope) * 2);
+    }
+}
+
+void gpu_profiler_end(gpu_profiler* profiler, VkCommandBuffer cmd, uint32_t slot, uint32_t scope) {
+    if (profiler) {
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->pool,
+                            (slot * profiler->scope_count + scope) * 2 + 1);
+    }
+}
+
+void gpu_profiler_submitted(gpu_profiler* profiler, uint32_t slot) {
+    if (profiler) {
+        profiler->pending[slot] = 1;
+    }
+}
+
+int gpu_profiler_resolve(gpu_profiler* profiler, uint32_t slot, uint64_t* scope_ns) {
+    if (!profiler || !profiler->pending[slot]) {
+        return 0;
+    }
+    profiler->pending[slot] = 0;
+    
+    // Value and availability per query; scopes that were skipped stay
+    // unavailable, which makes the call report NOT_READY but still fill
+    // in everything that was written
+    uint64_t results[GPU_PROFILER_MAX_SCOPES * 2][2];
+    uint32_t query_count = profiler->scope_count * 2;
+    VkResult result = vkGetQueryPoolResults(profiler->device, profiler->pool, slot * query_count, query_count,
+                                            sizeof(results), results, sizeof(results[0]),
+                                            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (result != VK_SUCCESS && result != VK_NOT_READY) {
+        return 0;
+    }
+    
+    int resolved = 0;
+    for (uint32_t scope = 0; scope < profiler->scope_count; scope++) {
+        uint64_t* begin = results[scope * 2];
+        uint64_t* end = results[scope * 2 + 1];
+        scope_ns[scope] = 0;
+        if (begin[1] && end[1]) {
+            uint64_t ticks = (end[0] - begin[0]) & profiler->timestamp_mask;
+            scope_ns[scope] = (uint64_t)((double)ticks * profiler->timestamp_period);
+            resolved = 1;
+        }
+    }
+    
+    return resolved;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "platform.h"
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+#define GPU_PROFILER_MAX_SCOPES 8
+
+// Begin/end timestamp pairs for a fixed set of scopes, in a ring of slots.
+// A slot is only resolved once the submission that wrote it has finished,
+// so reading results never stalls.
+typedef struct gpu_profiler {
+    VkDevice device;
+    VkQueryPool pool;
+    uint32_t slot_count;
+    uint32_t scope_count;
+    uint64_t timestamp_mask;
+    double timestamp_period;
+    int* pending;
+} gpu_profiler;
+
+// Returns NULL when the queue has no timestamp support; every other call
+// accepts a NULL profiler and does nothing
+gpu_profiler* gpu_profiler_create(VkDevice device, uint32_t slot_count, uint32_t scope_count,
+                                  uint32_t timestamp_valid_bits, float timestamp_period);
+void gpu_profiler_destroy(gpu_profiler* profiler);
+
+// Reset goes first in the slot's command buffer, outside any render pass
+void gpu_profiler_reset(gpu_profiler* profiler, VkCommandBuffer cmd, uint32_t slot);
+void gpu_profiler_begin(gpu_profiler* profiler, VkCommandBuffer cmd, uint32_t slot, uint32_t scope);
+void gpu_profiler_end(gpu_profiler* profiler, VkCommandBuffer cmd, uint32_t slot, uint32_t scope);
+void gpu_profiler_submitted(gpu_profiler* profiler, uint32_t slot);
+
+// Call once the slot's fence has signaled. Fills scope_ns (0 for scopes
+// that were not recorded) and returns 1 if anything was resolved.
+int gpu_profiler_resolve(gpu_profiler* profiler, uint32_t slot, uint64_t* scope_ns);
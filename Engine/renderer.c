@@ -1,210 +1,666 @@
 #include "renderer.h"
+#include "pipeline.h"
+#include "upload.h"
+#include "sprite.h"
+#include "stream.h"
+#include "descriptor.h"
+#include "profiler.h"
+#include "rendergraph.h"
+#include "timeline.h"
+#include "timing.h"
+#include "jobs.h"
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void renderer_init(vulkan_context* ctx, ANativeWindow* window) {
-    memset(ctx, 0, sizeof(vulkan_context));
+#define LOG_TAG "vm_engine"
+
+// One contiguous slice of the frame's draws and the secondary it goes into
+typedef struct {
+    vulkan_context* ctx;
+    job_counter* counter;
+    VkCommandBuffer cmd;
+    uint32_t image_index;
+    uint32_t first;
+    uint32_t count;
+    int ok;
+} record_range;
+
+typedef struct scene_recorder {
+    job_counter counter;
+    record_range ranges[RENDER_RECORD_SLOTS];
+    VkCommandBuffer buffers[RENDER_RECORD_SLOTS];
+    
+    // Secondaries the scene pass executes this recording; 0 records inline
+    uint32_t range_count;
+} scene_recorder;
+
+static int instance_extension_supported(const char* name) {
+    uint32_t count = 0;
+    vkEnumerateInstanceExtensionProperties(NULL, &count, NULL);
+    if (count == 0) {
+        return 0;
+    }
+    
+    VkExtensionProperties* properties = malloc(sizeof(VkExtensionProperties) * count);
+    if (!properties) {
+        return 0;
+    }
+    
+    vkEnumerateInstanceExtensionProperties(NULL, &count, properties);
+    
+    int found = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (strcmp(properties[i].extensionName, name) == 0) {
+            found = 1;
+            break;
+        }
+    }
+    free(properties);
     
+    return found;
+}
+
+// Highest supported count not above the request; color and depth must agree
+static VkSampleCountFlagBits choose_sample_count(vulkan_context* ctx, uint32_t requested) {
+    VkSampleCountFlags supported = ctx->caps.sample_counts;
+    
+    uint32_t samples = VK_SAMPLE_COUNT_64_BIT;
+    while (samples > VK_SAMPLE_COUNT_1_BIT && (samples > requested || !(supported & samples))) {
+        samples >>= 1;
+    }
+    return (VkSampleCountFlagBits)samples;
+}
+
+static int create_image_view(vulkan_context* ctx, VkImage image, VkFormat format,
+                             VkImageAspectFlags aspect, VkImageView* view) {
+    VkImageViewCreateInfo view_info = {0};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = format;
+    view_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.subresourceRange.aspectMask = aspect;
+    view_info.subresourceRange.baseMipLevel = 0;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.baseArrayLayer = 0;
+    view_info.subresourceRange.layerCount = 1;
+    
+    return vkCreateImageView(ctx->device, &view_info, NULL, view) == VK_SUCCESS;
+}
+
+static const char* init_stage_names[RENDER_INIT_STAGE_COUNT] = {
+    "instance", "device", "swapchain", "frames", "pipeline cache", "upload", "images", "assets"
+};
+
+static void init_stage_begin(vulkan_context* ctx, render_init_stage stage) {
+    ctx->init_timeline.start_ns[stage] = timing_now_ns() - ctx->init_timeline.begin_ns;
+}
+
+static void init_stage_end(vulkan_context* ctx, render_init_stage stage) {
+    ctx->init_timeline.end_ns[stage] = timing_now_ns() - ctx->init_timeline.begin_ns;
+}
+
+static int init_instance(vulkan_context* ctx, ANativeWindow* window, const renderer_config* config) {
     VkApplicationInfo app_info = {0};
     app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
     app_info.pApplicationName = "vm engine";
     app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     app_info.pEngineName = "vm engine";
     app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    app_info.apiVersion = VK_API_VERSION_1_0;
-
-    const char* extensions[] = {"VK_KHR_surface", "VK_KHR_android_surface"};
+    
+    // Vulkan 1.1 lets the pipeline cache key on the driver UUID and 1.2
+    // has timeline semaphores in core; the version query itself is missing
+    // from 1.0 loaders
+    ctx->api_version = VK_API_VERSION_1_0;
+    PFN_vkEnumerateInstanceVersion enumerate_version =
+        (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(NULL, "vkEnumerateInstanceVersion");
+    uint32_t loader_version = 0;
+    if (enumerate_version && enumerate_version(&loader_version) == VK_SUCCESS) {
+        if (loader_version >= VK_API_VERSION_1_2) {
+            ctx->api_version = VK_API_VERSION_1_2;
+        } else if (loader_version >= VK_API_VERSION_1_1) {
+            ctx->api_version = VK_API_VERSION_1_1;
+        }
+    }
+    app_info.apiVersion = ctx->api_version;
+    
+    // Without a window, render into our own image ring unless a headless
+    // surface was asked for and the loader provides one
+    const char* extensions[2];
+    uint32_t extension_count = 0;
+    if (window) {
+#ifdef __ANDROID__
+        extensions[extension_count++] = "VK_KHR_surface";
+        extensions[extension_count++] = "VK_KHR_android_surface";
+#else
+        return 0;
+#endif
+    } else if (config && config->headless_surface && instance_extension_supported("VK_EXT_headless_surface")) {
+        extensions[extension_count++] = "VK_KHR_surface";
+        extensions[extension_count++] = "VK_EXT_headless_surface";
+    } else {
+        ctx->offscreen = 1;
+    }
     
     VkInstanceCreateInfo create_info = {0};
     create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     create_info.pApplicationInfo = &app_info;
-    create_info.enabledExtensionCount = 2;
+    create_info.enabledExtensionCount = extension_count;
     create_info.ppEnabledExtensionNames = extensions;
-
+    
     VkResult result = vkCreateInstance(&create_info, NULL, &ctx->instance);
     if (result != VK_SUCCESS) {
-        return;
+        return 0;
     }
-
-    VkAndroidSurfaceCreateInfoKHR surface_info = {0};
-    surface_info.sType = VK_STRUCTURE_TYPE_ANDROID_SURFACE_CREATE_INFO_KHR;
-    surface_info.window = window;
     
-    PFN_vkCreateAndroidSurfaceKHR create_surface = 
-        (PFN_vkCreateAndroidSurfaceKHR)vkGetInstanceProcAddr(ctx->instance, "vkCreateAndroidSurfaceKHR");
-    if (!create_surface || create_surface(ctx->instance, &surface_info, NULL, &ctx->surface) != VK_SUCCESS) {
-        vkDestroyInstance(ctx->instance, NULL);
-        return;
+    if (window) {
+#ifdef __ANDROID__
+        VkAndroidSurfaceCreateInfoKHR surface_info = {0};
+        surface_info.sType = VK_STRUCTURE_TYPE_ANDROID_SURFACE_CREATE_INFO_KHR;
+        surface_info.window = window;
+        
+        PFN_vkCreateAndroidSurfaceKHR create_surface = 
+            (PFN_vkCreateAndroidSurfaceKHR)vkGetInstanceProcAddr(ctx->instance, "vkCreateAndroidSurfaceKHR");
+        if (!create_surface || create_surface(ctx->instance, &surface_info, NULL, &ctx->surface) != VK_SUCCESS) {
+            vkDestroyInstance(ctx->instance, NULL);
+            ctx->instance = VK_NULL_HANDLE;
+            return 0;
+        }
+#endif
+    } else if (!ctx->offscreen) {
+        VkHeadlessSurfaceCreateInfoEXT surface_info = {0};
+        surface_info.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+        
+        PFN_vkCreateHeadlessSurfaceEXT create_surface = 
+            (PFN_vkCreateHeadlessSurfaceEXT)vkGetInstanceProcAddr(ctx->instance, "vkCreateHeadlessSurfaceEXT");
+        if (!create_surface || create_surface(ctx->instance, &surface_info, NULL, &ctx->surface) != VK_SUCCESS) {
+            vkDestroyInstance(ctx->instance, NULL);
+            ctx->instance = VK_NULL_HANDLE;
+            return 0;
+        }
     }
+    
+    return 1;
+}
 
-    uint32_t device_count = 0;
-    vkEnumeratePhysicalDevices(ctx->instance, &device_count, NULL);
-    if (device_count == 0) {
-        vkDestroySurfaceKHR(ctx->instance, ctx->surface, NULL);
-        vkDestroyInstance(ctx->instance, NULL);
-        return;
+static int init_device(vulkan_context* ctx, const renderer_config* config) {
+    // Capabilities of devices whose driver hasn't changed come from the
+    // cache; the rest are probed and the cache rewritten
+    char caps_filename[512];
+    const char* caps_path = NULL;
+    if (config && config->cache_dir[0]) {
+        snprintf(caps_filename, sizeof(caps_filename), "%s/device_caps.bin", config->cache_dir);
+        caps_path = caps_filename;
     }
     
-    VkPhysicalDevice* devices = malloc(sizeof(VkPhysicalDevice) * device_count);
-    if (!devices) {
-        vkDestroySurfaceKHR(ctx->instance, ctx->surface, NULL);
-        vkDestroyInstance(ctx->instance, NULL);
-        return;
+    if (!device_select(ctx->instance, ctx->surface, ctx->api_version, caps_path,
+                       &ctx->physical_device, &ctx->caps, &ctx->select_stats)) {
+        return 0;
     }
     
-    vkEnumeratePhysicalDevices(ctx->instance, &device_count, devices);
+    ctx->graphics_family = ctx->caps.graphics_family;
+    ctx->timestamp_valid_bits = ctx->caps.timestamp_valid_bits;
     
-    int device_found = 0;
-    for (uint32_t i = 0; i < device_count; i++) {
-        VkPhysicalDeviceProperties device_props;
-        vkGetPhysicalDeviceProperties(devices[i], &device_props);
-        
-        if (device_props.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ||
-            device_props.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU) {
-            ctx->physical_device = devices[i];
-            device_found = 1;
-            break;
-        }
+    // A transfer-only family maps to the copy engine, which runs uploads
+    // alongside rendering instead of queueing behind it
+    ctx->transfer_family = ctx->caps.transfer_family != DEVICE_NO_FAMILY ?
+                           ctx->caps.transfer_family : ctx->graphics_family;
+    
+    float queue_priority = 1.0f;
+    VkDeviceQueueCreateInfo queue_infos[2] = {{0}, {0}};
+    uint32_t queue_info_count = ctx->transfer_family != ctx->graphics_family ? 2 : 1;
+    queue_infos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue_infos[0].queueFamilyIndex = ctx->graphics_family;
+    queue_infos[0].queueCount = 1;
+    queue_infos[0].pQueuePriorities = &queue_priority;
+    queue_infos[1] = queue_infos[0];
+    queue_infos[1].queueFamilyIndex = ctx->transfer_family;
+    
+    const char* device_extensions[5];
+    uint32_t device_extension_count = 0;
+    if (!ctx->offscreen) {
+        device_extensions[device_extension_count++] = "VK_KHR_swapchain";
     }
     
-    if (!device_found && device_count > 0) {
-        ctx->physical_device = devices[0];
-        device_found = 1;
+    // The budget query goes through vkGetPhysicalDeviceMemoryProperties2, core in 1.1
+    if (ctx->api_version >= VK_API_VERSION_1_1 && device_has_extension(&ctx->caps, DEVICE_EXT_MEMORY_BUDGET)) {
+        device_extensions[device_extension_count++] = "VK_EXT_memory_budget";
+        ctx->memory_budget_supported = 1;
     }
     
-    free(devices);
+    // Timeline semaphores are core in 1.2 and an extension before that.
+    // Without them frames sync on fences.
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features = {0};
+    timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    timeline_features.timelineSemaphore = VK_TRUE;
+    int timeline_supported = ctx->timeline_semaphores && ctx->caps.timeline_semaphore;
+    if (timeline_supported && (ctx->api_version < VK_API_VERSION_1_2 || ctx->caps.api_version < VK_API_VERSION_1_2)) {
+        device_extensions[device_extension_count++] = "VK_KHR_timeline_semaphore";
+    }
+    ctx->timeline_semaphores = timeline_supported;
     
-    if (!device_found) {
-        vkDestroySurfaceKHR(ctx->instance, ctx->surface, NULL);
-        vkDestroyInstance(ctx->instance, NULL);
-        return;
+    // The bindless texture table; without it textures are only bound per draw
+    VkPhysicalDeviceDescriptorIndexingFeatures indexing_features = {0};
+    indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    indexing_features.pNext = timeline_supported ? &timeline_features : NULL;
+    indexing_features.runtimeDescriptorArray = VK_TRUE;
+    indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+    indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    indexing_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    indexing_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    int bindless_supported = ctx->bindless_textures && ctx->caps.descriptor_indexing;
+    if (bindless_supported && (ctx->api_version < VK_API_VERSION_1_2 || ctx->caps.api_version < VK_API_VERSION_1_2)) {
+        device_extensions[device_extension_count++] = "VK_EXT_descriptor_indexing";
     }
-
-    uint32_t queue_family_count = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(ctx->physical_device, &queue_family_count, NULL);
-    if (queue_family_count == 0) {
-        vkDestroySurfaceKHR(ctx->instance, ctx->surface, NULL);
-        vkDestroyInstance(ctx->instance, NULL);
-        return;
+    ctx->bindless_textures = bindless_supported;
+    
+    // GPU culling writes draws that start at any instance; the count
+    // variant also lets it drop the draws it emptied
+    ctx->gpu_culling = ctx->gpu_culling && ctx->caps.draw_indirect_first_instance;
+    int indirect_count_supported = ctx->gpu_culling &&
+                                   device_has_extension(&ctx->caps, DEVICE_EXT_DRAW_INDIRECT_COUNT);
+    if (indirect_count_supported) {
+        device_extensions[device_extension_count++] = "VK_KHR_draw_indirect_count";
     }
     
-    VkQueueFamilyProperties* queue_families = malloc(sizeof(VkQueueFamilyProperties) * queue_family_count);
-    if (!queue_families) {
-        vkDestroySurfaceKHR(ctx->instance, ctx->surface, NULL);
-        vkDestroyInstance(ctx->instance, NULL);
-        return;
+    VkPhysicalDeviceFeatures enabled_features = {0};
+    enabled_features.multiDrawIndirect = ctx->caps.multi_draw_indirect ? VK_TRUE : VK_FALSE;
+    enabled_features.drawIndirectFirstInstance = ctx->gpu_culling ? VK_TRUE : VK_FALSE;
+    enabled_features.textureCompressionETC2 = ctx->caps.texture_compression_etc2 ? VK_TRUE : VK_FALSE;
+    enabled_features.textureCompressionASTC_LDR = ctx->caps.texture_compression_astc ? VK_TRUE : VK_FALSE;
+    enabled_features.textureCompressionBC = ctx->caps.texture_compression_bc ? VK_TRUE : VK_FALSE;
+    ctx->multi_draw_indirect = ctx->caps.multi_draw_indirect;
+    
+    VkDeviceCreateInfo device_info = {0};
+    device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    device_info.pNext = bindless_supported ? (void*)&indexing_features :
+                        timeline_supported ? (void*)&timeline_features : NULL;
+    device_info.queueCreateInfoCount = queue_info_count;
+    device_info.pQueueCreateInfos = queue_infos;
+    device_info.enabledExtensionCount = device_extension_count;
+    device_info.ppEnabledExtensionNames = device_extensions;
+    device_info.pEnabledFeatures = &enabled_features;
+    
+    if (vkCreateDevice(ctx->physical_device, &device_info, NULL, &ctx->device) != VK_SUCCESS) {
+        return 0;
+    }
+    
+    if (indirect_count_supported) {
+        ctx->draw_indirect_count =
+            (PFN_vkCmdDrawIndirectCountKHR)vkGetDeviceProcAddr(ctx->device, "vkCmdDrawIndirectCountKHR");
+    }
+    
+    vkGetDeviceQueue(ctx->device, ctx->graphics_family, 0, &ctx->graphics_queue);
+    vkGetDeviceQueue(ctx->device, ctx->transfer_family, 0, &ctx->transfer_queue);
+    
+    ctx->allocator = gpu_allocator_create(ctx->instance, ctx->physical_device, ctx->device,
+                                          ctx->memory_budget_supported);
+    if (!ctx->allocator) {
+        return 0;
+    }
+    
+    ctx->graph = render_graph_create(ctx->device, ctx->allocator);
+    if (!ctx->graph) {
+        return 0;
+    }
+    
+    ctx->recorder = calloc(1, sizeof(scene_recorder));
+    if (!ctx->recorder) {
+        return 0;
     }
+    job_counter_init(&ctx->recorder->counter);
     
-    vkGetPhysicalDeviceQueueFamilyProperties(ctx->physical_device, &queue_family_count, queue_families);
+    return 1;
+}
 
-    int found_queue = 0;
-    for (uint32_t i = 0; i < queue_family_count; i++) {
-        if (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-            VkBool32 present_support = VK_FALSE;
-            vkGetPhysicalDeviceSurfaceSupportKHR(ctx->physical_device, i, ctx->surface, &present_support);
-            if (present_support) {
-                ctx->graphics_family = i;
-                found_queue = 1;
-                break;
+typedef struct {
+    vulkan_context* ctx;
+    const renderer_config* config;
+    render_init_stage stage;
+    job_counter* counter;
+    int ok;
+} init_stage_job;
+
+static int run_init_stage(vulkan_context* ctx, const renderer_config* config, render_init_stage stage) {
+    switch (stage) {
+        case RENDER_INIT_SWAPCHAIN:
+            return create_swapchain(ctx) && create_frame_graph(ctx);
+            
+        case RENDER_INIT_FRAMES:
+            return create_sync_objects(ctx) && create_frame_pools(ctx) &&
+                   create_command_pool(ctx) && create_command_buffer(ctx);
+                   
+        case RENDER_INIT_PIPELINE_CACHE: {
+            char cache_filename[512];
+            if (config && config->cache_dir[0]) {
+                snprintf(cache_filename, sizeof(cache_filename), "%s/pipeline_cache.bin", config->cache_dir);
             }
+            return pipeline_system_create(ctx, config && config->cache_dir[0] ? cache_filename : NULL,
+                                          config && config->shader_dir[0] ? config->shader_dir : NULL);
         }
+        
+        case RENDER_INIT_UPLOAD:
+            return upload_init(ctx);
+            
+        default:
+            return 0;
     }
-    free(queue_families);
+}
+
+static void init_stage_job_run(void* data) {
+    init_stage_job* stage_job = data;
+    init_stage_begin(stage_job->ctx, stage_job->stage);
+    stage_job->ok = run_init_stage(stage_job->ctx, stage_job->config, stage_job->stage);
+    init_stage_end(stage_job->ctx, stage_job->stage);
     
-    if (!found_queue) {
-        vkDestroySurfaceKHR(ctx->instance, ctx->surface, NULL);
-        vkDestroyInstance(ctx->instance, NULL);
-        return;
+    if (stage_job->counter) {
+        job_counter_done(stage_job->counter);
     }
+}
 
-    float queue_priority = 1.0f;
-    VkDeviceQueueCreateInfo queue_info = {0};
-    queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queue_info.queueFamilyIndex = ctx->graphics_family;
-    queue_info.queueCount = 1;
-    queue_info.pQueuePriorities = &queue_priority;
-
-    const char* device_extensions[] = {"VK_KHR_swapchain"};
+// These only need the device and write disjoint parts of the context, so
+// they run side by side on the workers; the calling thread takes the first.
+// Must not be called from a worker, which could leave the rest unscheduled.
+static int init_parallel_stages(vulkan_context* ctx, const renderer_config* config) {
+    static const render_init_stage stages[] = {
+        RENDER_INIT_SWAPCHAIN, RENDER_INIT_FRAMES, RENDER_INIT_PIPELINE_CACHE, RENDER_INIT_UPLOAD
+    };
+    const uint32_t stage_count = sizeof(stages) / sizeof(stages[0]);
+    init_stage_job stage_jobs[sizeof(stages) / sizeof(stages[0])];
     
-    VkDeviceCreateInfo device_info = {0};
-    device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    device_info.queueCreateInfoCount = 1;
-    device_info.pQueueCreateInfos = &queue_info;
-    device_info.enabledExtensionCount = 1;
-    device_info.ppEnabledExtensionNames = device_extensions;
+    job_counter counter;
+    job_counter_init(&counter);
+    job_counter_add(&counter, (int)(stage_count - 1));
+    
+    for (uint32_t i = 0; i < stage_count; i++) {
+        stage_jobs[i].ctx = ctx;
+        stage_jobs[i].config = config;
+        stage_jobs[i].stage = stages[i];
+        stage_jobs[i].counter = i > 0 ? &counter : NULL;
+        stage_jobs[i].ok = 0;
+    }
+    
+    for (uint32_t i = 1; i < stage_count; i++) {
+        job* work = job_create_custom(&stage_jobs[i], init_stage_job_run);
+        if (work) {
+            job_queue_add_worker(work);
+        } else {
+            init_stage_job_run(&stage_jobs[i]);
+        }
+    }
+    
+    init_stage_job_run(&stage_jobs[0]);
+    job_counter_wait(&counter);
+    job_counter_destroy(&counter);
+    
+    int ok = 1;
+    for (uint32_t i = 0; i < stage_count; i++) {
+        ok = ok && stage_jobs[i].ok;
+    }
+    return ok;
+}
 
-    if (vkCreateDevice(ctx->physical_device, &device_info, NULL, &ctx->device) != VK_SUCCESS) {
-        vkDestroySurfaceKHR(ctx->instance, ctx->surface, NULL);
-        vkDestroyInstance(ctx->instance, NULL);
+static void report_init_timeline(vulkan_context* ctx) {
+    render_init_timeline* timeline = &ctx->init_timeline;
+    for (uint32_t stage = 0; stage < RENDER_INIT_STAGE_COUNT; stage++) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "init %-14s %8.2f .. %8.2f ms", init_stage_names[stage],
+                            timeline->start_ns[stage] / 1e6, timeline->end_ns[stage] / 1e6);
+    }
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "init done in %.2f ms", timeline->ready_ns / 1e6);
+}
+
+void renderer_init(vulkan_context* ctx, ANativeWindow* window, const renderer_config* config) {
+    uint64_t begin = timing_now_ns();
+    memset(ctx, 0, sizeof(vulkan_context));
+    ctx->init_timeline.begin_ns = begin;
+    
+    ctx->window = window;
+    ctx->frame_count = config ? config->frames_in_flight : DEFAULT_FRAMES_IN_FLIGHT;
+    if (ctx->frame_count < 1) {
+        ctx->frame_count = 1;
+    }
+    if (ctx->frame_count > MAX_FRAMES_IN_FLIGHT) {
+        ctx->frame_count = MAX_FRAMES_IN_FLIGHT;
+    }
+    
+    ctx->cache_command_buffers = config ? config->cache_command_buffers : 1;
+    ctx->parallel_recording = config ? config->parallel_recording : 0;
+    ctx->timeline_semaphores = config ? config->timeline_semaphores : 1;
+    ctx->bindless_textures = config ? config->bindless_textures : 0;
+    ctx->gpu_culling = config ? config->gpu_culling : 0;
+    ctx->dynamic_resolution = config ? config->dynamic_resolution : 0;
+    ctx->gamma = config && config->gamma > 0.0f ? config->gamma : 1.0f;
+    ctx->gamma_fused = config ? config->gamma_fused : 1;
+    ctx->compress_textures = config ? config->compress_textures : 1;
+    ctx->gpu_budget_ms = config && config->gpu_budget_ms > 0.0f ? config->gpu_budget_ms : DEFAULT_GPU_BUDGET_MS;
+    ctx->render_scale = 1.0f;
+    ctx->render_size.width = config ? config->render_width : 0;
+    ctx->render_size.height = config ? config->render_height : 0;
+    ctx->requested_extent.width = config && config->width ? config->width : 1280;
+    ctx->requested_extent.height = config && config->height ? config->height : 720;
+    
+    init_stage_begin(ctx, RENDER_INIT_INSTANCE);
+    if (!init_instance(ctx, window, config)) {
         return;
     }
+    init_stage_end(ctx, RENDER_INIT_INSTANCE);
     
-    vkGetDeviceQueue(ctx->device, ctx->graphics_family, 0, &ctx->graphics_queue);
-
-    ctx->image_available_semaphore = VK_NULL_HANDLE;
-    ctx->render_finished_semaphore = VK_NULL_HANDLE;
-    ctx->in_flight_fence = VK_NULL_HANDLE;
+    init_stage_begin(ctx, RENDER_INIT_DEVICE);
+    if (!init_device(ctx, config)) {
+        renderer_cleanup(ctx);
+        return;
+    }
+    init_stage_end(ctx, RENDER_INIT_DEVICE);
     
-    VkSemaphoreCreateInfo semaphore_info = {0};
-    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    ctx->msaa_samples = choose_sample_count(ctx, config && config->msaa_samples ? config->msaa_samples : 1);
+    
+    // The scale controller has nothing to go on without GPU timestamps
+    if (ctx->dynamic_resolution && ctx->timestamp_valid_bits == 0) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "no timestamp support, dynamic resolution disabled");
+        ctx->dynamic_resolution = 0;
+    }
+    ctx->depth_format = ctx->caps.depth_format;
+    
+    if (!init_parallel_stages(ctx, config)) {
+        renderer_cleanup(ctx);
+        return;
+    }
+    
+    // The pipeline system was created without a render pass; nothing has
+    // compiled against it yet
+    pipeline_system_set_render_pass(ctx);
     
-    VkFenceCreateInfo fence_info = {0};
-    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    render_graph_stats graph_stats;
+    render_graph_get_stats(ctx->graph, &graph_stats);
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "attachments: %ux msaa, %u of %u transients lazily allocated",
+                        (unsigned)ctx->msaa_samples, graph_stats.lazy_images, graph_stats.transient_images);
     
-    if (vkCreateSemaphore(ctx->device, &semaphore_info, NULL, &ctx->image_available_semaphore) != VK_SUCCESS ||
-        vkCreateSemaphore(ctx->device, &semaphore_info, NULL, &ctx->render_finished_semaphore) != VK_SUCCESS ||
-        vkCreateFence(ctx->device, &fence_info, NULL, &ctx->in_flight_fence) != VK_SUCCESS) {
+    init_stage_begin(ctx, RENDER_INIT_IMAGES);
+    if (!create_image_resources(ctx)) {
         renderer_cleanup(ctx);
         return;
     }
-
-    if (!create_swapchain(ctx) ||
-        !create_render_pass(ctx) ||
-        !create_framebuffers(ctx) ||
-        !create_command_pool(ctx) ||
-        !create_command_buffer(ctx)) {
+    init_stage_end(ctx, RENDER_INIT_IMAGES);
+    
+    // Compiles on a job worker; nothing waits for it
+    init_stage_begin(ctx, RENDER_INIT_ASSETS);
+    pipeline_state fullscreen;
+    pipeline_state_init(&fullscreen, "fullscreen.vert.spv", "solid.frag.spv");
+    fullscreen.samples = ctx->msaa_samples;
+    ctx->fullscreen_pipeline = pipeline_request(ctx, &fullscreen);
+    
+    // Before the sprites, whose textures go into the bindless table
+    if (!descriptor_init(ctx) || !sprite_init(ctx) || !stream_init(ctx, config ? config->texture_budget_mb : 0)) {
         renderer_cleanup(ctx);
         return;
     }
+    init_stage_end(ctx, RENDER_INIT_ASSETS);
+    
+    ctx->init_timeline.ready_ns = timing_now_ns() - begin;
+    report_init_timeline(ctx);
+}
+
+static void destroy_swapchain_resources(vulkan_context* ctx) {
+    // Framebuffers and transient images go first; they reference the views
+    render_graph_reset(ctx->graph);
+    
+    if (ctx->swap_chain_image_views) {
+        for (uint32_t i = 0; i < ctx->image_count; i++) {
+            if (ctx->swap_chain_image_views[i] != VK_NULL_HANDLE) {
+                vkDestroyImageView(ctx->device, ctx->swap_chain_image_views[i], NULL);
+            }
+        }
+        free(ctx->swap_chain_image_views);
+        ctx->swap_chain_image_views = NULL;
+    }
+    
+    // Offscreen targets are ours to destroy; swapchain images belong to the swapchain
+    if (ctx->offscreen_allocations) {
+        for (uint32_t i = 0; i < ctx->image_count; i++) {
+            gpu_destroy_image(ctx->allocator, ctx->swap_chain_images ? ctx->swap_chain_images[i] : VK_NULL_HANDLE,
+                              &ctx->offscreen_allocations[i]);
+        }
+        free(ctx->offscreen_allocations);
+        ctx->offscreen_allocations = NULL;
+    }
+    
+    if (ctx->image_command_buffers) {
+        if (ctx->image_command_buffers[0] != VK_NULL_HANDLE) {
+            vkFreeCommandBuffers(ctx->device, ctx->image_command_pool, ctx->image_count, ctx->image_command_buffers);
+        }
+        free(ctx->image_command_buffers);
+        ctx->image_command_buffers = NULL;
+    }
+    free(ctx->image_generations);
+    ctx->image_generations = NULL;
+    
+    gpu_profiler_destroy(ctx->profiler);
+    ctx->profiler = NULL;
+    
+    if (ctx->frame_descriptor_pool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(ctx->device, ctx->frame_descriptor_pool, NULL);
+        ctx->frame_descriptor_pool = VK_NULL_HANDLE;
+    }
+    free(ctx->frame_descriptor_sets);
+    ctx->frame_descriptor_sets = NULL;
+    
+    if (ctx->frame_uniform_buffer != VK_NULL_HANDLE) {
+        gpu_destroy_buffer(ctx->allocator, ctx->frame_uniform_buffer, &ctx->frame_uniform_allocation);
+        ctx->frame_uniform_buffer = VK_NULL_HANDLE;
+    }
+    
+    free(ctx->swap_chain_images);
+    ctx->swap_chain_images = NULL;
+    free(ctx->images_in_flight);
+    ctx->images_in_flight = NULL;
+}
+
+static int wants_srgb(vulkan_context* ctx) {
+    return fabsf(ctx->gamma - RENDER_GAMMA_SRGB) < RENDER_GAMMA_EPSILON;
+}
+
+// An sRGB target encodes on store, which makes RENDER_GAMMA_SRGB free
+// there; every other combination takes the post pass
+static void select_gamma(vulkan_context* ctx) {
+    int srgb = ctx->swap_chain_format == VK_FORMAT_B8G8R8A8_SRGB ||
+               ctx->swap_chain_format == VK_FORMAT_R8G8B8A8_SRGB;
+    ctx->gamma_exponent = (srgb ? RENDER_GAMMA_SRGB : 1.0f) / ctx->gamma;
+    ctx->gamma_post = fabsf(ctx->gamma_exponent - 1.0f) > RENDER_GAMMA_EPSILON;
+}
+
+// By pixel count, so a configured 1280x720 costs about the same on any
+// surface shape; without dynamic resolution the scale sits at the cap
+static void update_max_render_scale(vulkan_context* ctx) {
+    float scale = 1.0f;
+    double pixels = (double)ctx->render_size.width * ctx->render_size.height;
+    double surface = (double)ctx->swap_chain_extent.width * ctx->swap_chain_extent.height;
+    if (pixels > 0.0 && pixels < surface) {
+        scale = (float)sqrt(pixels / surface);
+    }
+    if (scale < RENDER_SCALE_MIN) scale = RENDER_SCALE_MIN;
+    
+    ctx->max_render_scale = scale;
+    if (!ctx->dynamic_resolution || ctx->render_scale > scale) {
+        ctx->render_scale = scale;
+    }
+    ctx->upscale = ctx->dynamic_resolution || scale < 1.0f;
 }
 
 int create_swapchain(vulkan_context* ctx) {
+    if (ctx->offscreen) {
+        return create_offscreen_targets(ctx);
+    }
+    
     VkSurfaceCapabilitiesKHR capabilities;
     if (vkGetPhysicalDeviceSurfaceCapabilitiesKHR(ctx->physical_device, ctx->surface, &capabilities) != VK_SUCCESS) {
         return 0;
     }
-
-    uint32_t format_count;
-    vkGetPhysicalDeviceSurfaceFormatsKHR(ctx->physical_device, ctx->surface, &format_count, NULL);
-    if (format_count == 0) {
-        return 0;
+    
+    // Device selection only keeps devices with at least one surface format.
+    // The sRGB ones are only preferred when they apply the requested gamma.
+    const VkFormat preferred[] = {VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM};
+    const uint32_t preferred_count = sizeof(preferred) / sizeof(preferred[0]);
+    const VkSurfaceFormatKHR* formats = ctx->caps.surface_formats;
+    VkSurfaceFormatKHR surface_format = formats[0];
+    int found = 0;
+    for (uint32_t p = wants_srgb(ctx) ? 0 : preferred_count - 1; p < preferred_count && !found; p++) {
+        for (uint32_t i = 0; i < ctx->caps.surface_format_count; i++) {
+            if (formats[i].format == preferred[p]) {
+                surface_format = formats[i];
+                found = 1;
+                break;
+            }
+        }
     }
     
-    VkSurfaceFormatKHR* formats = malloc(sizeof(VkSurfaceFormatKHR) * format_count);
-    if (!formats) {
+    // The surface may leave the extent to the swapchain; follow the window then
+    VkExtent2D extent = capabilities.currentExtent;
+    if (extent.width == UINT32_MAX) {
+        extent = ctx->requested_extent;
+        if (ctx->window) {
+            extent.width = (uint32_t)ANativeWindow_getWidth(ctx->window);
+            extent.height = (uint32_t)ANativeWindow_getHeight(ctx->window);
+        }
+        if (extent.width < capabilities.minImageExtent.width) extent.width = capabilities.minImageExtent.width;
+        if (extent.width > capabilities.maxImageExtent.width) extent.width = capabilities.maxImageExtent.width;
+        if (extent.height < capabilities.minImageExtent.height) extent.height = capabilities.minImageExtent.height;
+        if (extent.height > capabilities.maxImageExtent.height) extent.height = capabilities.maxImageExtent.height;
+    }
+    
+    // A minimized window has no drawable area; try again once it is resized
+    if (extent.width == 0 || extent.height == 0) {
         return 0;
     }
     
-    vkGetPhysicalDeviceSurfaceFormatsKHR(ctx->physical_device, ctx->surface, &format_count, formats);
+    ctx->swap_chain_extent = extent;
+    ctx->swap_chain_format = surface_format.format;
+    select_gamma(ctx);
+    update_max_render_scale(ctx);
     
-    VkSurfaceFormatKHR surface_format = formats[0];
-    for (uint32_t i = 0; i < format_count; i++) {
-        if (formats[i].format == VK_FORMAT_B8G8R8A8_UNORM) {
-            surface_format = formats[i];
-            break;
+    // Upscaling is a filtered blit into the swapchain image; render at full size without it
+    if (ctx->upscale) {
+        VkFormatProperties format_props;
+        vkGetPhysicalDeviceFormatProperties(ctx->physical_device, ctx->swap_chain_format, &format_props);
+        VkFormatFeatureFlags blit_features = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                             VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if (!(capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) ||
+            (format_props.optimalTilingFeatures & blit_features) != blit_features) {
+            ctx->dynamic_resolution = 0;
+            ctx->upscale = 0;
+            ctx->render_scale = 1.0f;
         }
     }
-    free(formats);
     
-    ctx->swap_chain_extent = capabilities.currentExtent;
-    ctx->swap_chain_format = surface_format.format;
-
     uint32_t image_count = capabilities.minImageCount + 1;
     if (capabilities.maxImageCount > 0 && image_count > capabilities.maxImageCount) {
         image_count = capabilities.maxImageCount;
     }
-
+    
     VkSwapchainCreateInfoKHR swap_info = {0};
     swap_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
     swap_info.surface = ctx->surface;
@@ -213,56 +669,42 @@ int create_swapchain(vulkan_context* ctx) {
     swap_info.imageColorSpace = surface_format.colorSpace;
     swap_info.imageExtent = ctx->swap_chain_extent;
     swap_info.imageArrayLayers = 1;
-    swap_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    swap_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                           (capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) |
+                           (ctx->upscale ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0);
     swap_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
     swap_info.preTransform = capabilities.currentTransform;
     swap_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     swap_info.presentMode = VK_PRESENT_MODE_FIFO_KHR;
     swap_info.clipped = VK_TRUE;
-
-    if (vkCreateSwapchainKHR(ctx->device, &swap_info, NULL, &ctx->swap_chain) != VK_SUCCESS) {
+    swap_info.oldSwapchain = ctx->swap_chain;
+    
+    VkSwapchainKHR swap_chain;
+    if (vkCreateSwapchainKHR(ctx->device, &swap_info, NULL, &swap_chain) != VK_SUCCESS) {
         return 0;
     }
-
+    
+    // The old swapchain is retired by the create call and no longer needed
+    if (ctx->swap_chain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(ctx->device, ctx->swap_chain, NULL);
+    }
+    ctx->swap_chain = swap_chain;
+    
     vkGetSwapchainImagesKHR(ctx->device, ctx->swap_chain, &ctx->image_count, NULL);
     ctx->swap_chain_images = malloc(sizeof(VkImage) * ctx->image_count);
-    if (!ctx->swap_chain_images) {
-        vkDestroySwapchainKHR(ctx->device, ctx->swap_chain, NULL);
+    ctx->images_in_flight = calloc(ctx->image_count, sizeof(uint64_t));
+    ctx->swap_chain_image_views = calloc(ctx->image_count, sizeof(VkImageView));
+    if (!ctx->swap_chain_images || !ctx->images_in_flight || !ctx->swap_chain_image_views) {
+        destroy_swapchain_resources(ctx);
         return 0;
     }
     
     vkGetSwapchainImagesKHR(ctx->device, ctx->swap_chain, &ctx->image_count, ctx->swap_chain_images);
-
-    ctx->swap_chain_image_views = malloc(sizeof(VkImageView) * ctx->image_count);
-    if (!ctx->swap_chain_image_views) {
-        free(ctx->swap_chain_images);
-        vkDestroySwapchainKHR(ctx->device, ctx->swap_chain, NULL);
-        return 0;
-    }
     
     for (uint32_t i = 0; i < ctx->image_count; i++) {
-        VkImageViewCreateInfo view_info = {0};
-        view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        view_info.image = ctx->swap_chain_images[i];
-        view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        view_info.format = ctx->swap_chain_format;
-        view_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-        view_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-        view_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-        view_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-        view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        view_info.subresourceRange.baseMipLevel = 0;
-        view_info.subresourceRange.levelCount = 1;
-        view_info.subresourceRange.baseArrayLayer = 0;
-        view_info.subresourceRange.layerCount = 1;
-        
-        if (vkCreateImageView(ctx->device, &view_info, NULL, &ctx->swap_chain_image_views[i]) != VK_SUCCESS) {
-            for (uint32_t j = 0; j < i; j++) {
-                vkDestroyImageView(ctx->device, ctx->swap_chain_image_views[j], NULL);
-            }
-            free(ctx->swap_chain_image_views);
-            free(ctx->swap_chain_images);
-            vkDestroySwapchainKHR(ctx->device, ctx->swap_chain, NULL);
+        if (!create_image_view(ctx, ctx->swap_chain_images[i], ctx->swap_chain_format,
+                               VK_IMAGE_ASPECT_COLOR_BIT, &ctx->swap_chain_image_views[i])) {
+            destroy_swapchain_resources(ctx);
             return 0;
         }
     }
@@ -270,171 +712,1342 @@ int create_swapchain(vulkan_context* ctx) {
     return 1;
 }
 
-int create_render_pass(vulkan_context* ctx) {
-    VkAttachmentDescription color_attachment = {0};
-    color_attachment.format = ctx->swap_chain_format;
-    color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-    VkAttachmentReference color_attachment_ref = {0};
-    color_attachment_ref.attachment = 0;
-    color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkSubpassDescription subpass = {0};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &color_attachment_ref;
-
-    VkSubpassDependency dependency = {0};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-    VkRenderPassCreateInfo render_pass_info = {0};
-    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    render_pass_info.attachmentCount = 1;
-    render_pass_info.pAttachments = &color_attachment;
-    render_pass_info.subpassCount = 1;
-    render_pass_info.pSubpasses = &subpass;
-    render_pass_info.dependencyCount = 1;
-    render_pass_info.pDependencies = &dependency;
-
-    if (vkCreateRenderPass(ctx->device, &render_pass_info, NULL, &ctx->render_pass) != VK_SUCCESS) {
-        return 0;
-    }
+int create_offscreen_targets(vulkan_context* ctx) {
+    ctx->swap_chain_format = wants_srgb(ctx) ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    ctx->swap_chain_extent = ctx->requested_extent;
+    select_gamma(ctx);
+    update_max_render_scale(ctx);
+    ctx->image_count = ctx->frame_count;
     
-    return 1;
-}
-
-int create_framebuffers(vulkan_context* ctx) {
-    ctx->framebuffers = malloc(sizeof(VkFramebuffer) * ctx->image_count);
-    if (!ctx->framebuffers) {
+    ctx->swap_chain_images = calloc(ctx->image_count, sizeof(VkImage));
+    ctx->images_in_flight = calloc(ctx->image_count, sizeof(uint64_t));
+    ctx->swap_chain_image_views = calloc(ctx->image_count, sizeof(VkImageView));
+    ctx->offscreen_allocations = calloc(ctx->image_count, sizeof(gpu_allocation));
+    if (!ctx->swap_chain_images || !ctx->images_in_flight ||
+        !ctx->swap_chain_image_views || !ctx->offscreen_allocations) {
+        destroy_swapchain_resources(ctx);
         return 0;
     }
     
     for (uint32_t i = 0; i < ctx->image_count; i++) {
-        VkImageView attachments[] = {ctx->swap_chain_image_views[i]};
-
-        VkFramebufferCreateInfo framebuffer_info = {0};
-        framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebuffer_info.renderPass = ctx->render_pass;
-        framebuffer_info.attachmentCount = 1;
-        framebuffer_info.pAttachments = attachments;
-        framebuffer_info.width = ctx->swap_chain_extent.width;
-        framebuffer_info.height = ctx->swap_chain_extent.height;
-        framebuffer_info.layers = 1;
-
-        if (vkCreateFramebuffer(ctx->device, &framebuffer_info, NULL, &ctx->framebuffers[i]) != VK_SUCCESS) {
-            for (uint32_t j = 0; j < i; j++) {
-                vkDestroyFramebuffer(ctx->device, ctx->framebuffers[j], NULL);
-            }
-            free(ctx->framebuffers);
+        VkImageCreateInfo image_info = {0};
+        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_info.imageType = VK_IMAGE_TYPE_2D;
+        image_info.format = ctx->swap_chain_format;
+        image_info.extent.width = ctx->swap_chain_extent.width;
+        image_info.extent.height = ctx->swap_chain_extent.height;
+        image_info.extent.depth = 1;
+        image_info.mipLevels = 1;
+        image_info.arrayLayers = 1;
+        image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                           VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        
+        if (!gpu_create_image(ctx->allocator, &image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+                              &ctx->swap_chain_images[i], &ctx->offscreen_allocations[i]) ||
+            !create_image_view(ctx, ctx->swap_chain_images[i], ctx->swap_chain_format,
+                               VK_IMAGE_ASPECT_COLOR_BIT, &ctx->swap_chain_image_views[i])) {
+            destroy_swapchain_resources(ctx);
             return 0;
         }
     }
     
+    ctx->next_offscreen_image = 0;
     return 1;
 }
 
-int create_command_pool(vulkan_context* ctx) {
-    VkCommandPoolCreateInfo pool_info = {0};
-    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    pool_info.queueFamilyIndex = ctx->graphics_family;
-
-    if (vkCreateCommandPool(ctx->device, &pool_info, NULL, &ctx->command_pool) != VK_SUCCESS) {
-        return 0;
+// Keeps the render extent a multiple of RENDER_EXTENT_ALIGN so small scale
+// changes don't turn into odd sizes
+static void update_render_extent(vulkan_context* ctx) {
+    if (!ctx->upscale) {
+        ctx->render_extent = ctx->swap_chain_extent;
+        return;
     }
     
-    return 1;
+    uint32_t width = (uint32_t)(ctx->swap_chain_extent.width * ctx->render_scale) / RENDER_EXTENT_ALIGN * RENDER_EXTENT_ALIGN;
+    uint32_t height = (uint32_t)(ctx->swap_chain_extent.height * ctx->render_scale) / RENDER_EXTENT_ALIGN * RENDER_EXTENT_ALIGN;
+    ctx->render_extent.width = width < RENDER_EXTENT_ALIGN ? ctx->swap_chain_extent.width : width;
+    ctx->render_extent.height = height < RENDER_EXTENT_ALIGN ? ctx->swap_chain_extent.height : height;
 }
 
-int create_command_buffer(vulkan_context* ctx) {
-    VkCommandBufferAllocateInfo alloc_info = {0};
-    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc_info.commandPool = ctx->command_pool;
-    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    alloc_info.commandBufferCount = 1;
-
-    if (vkAllocateCommandBuffers(ctx->device, &alloc_info, &ctx->command_buffer) != VK_SUCCESS) {
-        return 0;
+// The count variant skips the commands culling emptied; without multi-draw
+// every command is its own call
+static void record_indirect(vulkan_context* ctx, VkCommandBuffer cmd, const renderer_draw_item* item) {
+    const uint32_t stride = sizeof(VkDrawIndirectCommand);
+    if (item->count_buffer != VK_NULL_HANDLE && ctx->draw_indirect_count) {
+        ctx->draw_indirect_count(cmd, item->indirect_buffer, item->indirect_offset, item->count_buffer,
+                                 item->count_offset, item->indirect_count, stride);
+    } else if (ctx->multi_draw_indirect) {
+        vkCmdDrawIndirect(cmd, item->indirect_buffer, item->indirect_offset, item->indirect_count, stride);
+    } else {
+        for (uint32_t i = 0; i < item->indirect_count; i++) {
+            vkCmdDrawIndirect(cmd, item->indirect_buffer, item->indirect_offset + (VkDeviceSize)i * stride, 1, stride);
+        }
     }
-    
-    return 1;
 }
 
-void renderer_draw(vulkan_context* ctx, float* clear_color) {
-    vkWaitForFences(ctx->device, 1, &ctx->in_flight_fence, VK_TRUE, UINT64_MAX);
-    vkResetFences(ctx->device, 1, &ctx->in_flight_fence);
+// Background first, then the submitted draws; pipeline, vertex buffer,
+// texture and uniform offset are only rebound when they change between
+// neighbouring draws
+static void record_draws(vulkan_context* ctx, VkCommandBuffer cmd, uint32_t image_index,
+                         uint32_t first, uint32_t count) {
+    int background = first == 0 && ctx->recorded_pipeline != VK_NULL_HANDLE;
+    if (!background && count == 0) {
+        return;
+    }
     
-    uint32_t image_index;
-    VkResult result = vkAcquireNextImageKHR(ctx->device, ctx->swap_chain, UINT64_MAX, 
-                                           ctx->image_available_semaphore, VK_NULL_HANDLE, &image_index);
+    VkViewport viewport = {0};
+    viewport.width = (float)ctx->render_extent.width;
+    viewport.height = (float)ctx->render_extent.height;
+    viewport.maxDepth = 1.0f;
     
-    if (result != VK_SUCCESS) {
-        return;
+    VkRect2D scissor = {{0, 0}, ctx->render_extent};
+    
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_get_layout(ctx), PIPELINE_SET_FRAME, 1,
+                            &ctx->frame_descriptor_sets[image_index], 0, NULL);
+    
+    // Bound once: draws pick their texture by index
+    VkDescriptorSet bindless = descriptor_bindless_set(ctx);
+    if (bindless != VK_NULL_HANDLE) {
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_get_layout(ctx),
+                                PIPELINE_SET_BINDLESS, 1, &bindless, 0, NULL);
     }
-
-    vkResetCommandBuffer(ctx->command_buffer, 0);
-
+    
+    VkPipeline bound = VK_NULL_HANDLE;
+    VkBuffer bound_buffer = VK_NULL_HANDLE;
+    VkDeviceSize bound_offset = 0;
+    VkDescriptorSet bound_texture = VK_NULL_HANDLE;
+    VkDescriptorSet draw_set = descriptor_draw_set(ctx);
+    uint32_t bound_uniforms = UINT32_MAX;
+    if (background) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->recorded_pipeline);
+        vkCmdDraw(cmd, 3, 1, 0, 0);
+        bound = ctx->recorded_pipeline;
+    }
+    
+    for (uint32_t i = first; i < first + count; i++) {
+        const scene_draw* draw = &ctx->draws[i];
+        if (draw->pipeline != bound) {
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw->pipeline);
+            bound = draw->pipeline;
+        }
+        if (draw->item.vertex_buffer != VK_NULL_HANDLE &&
+            (draw->item.vertex_buffer != bound_buffer || draw->item.vertex_offset != bound_offset)) {
+            vkCmdBindVertexBuffers(cmd, 0, 1, &draw->item.vertex_buffer, &draw->item.vertex_offset);
+            bound_buffer = draw->item.vertex_buffer;
+            bound_offset = draw->item.vertex_offset;
+        }
+        if (draw->item.texture_set != VK_NULL_HANDLE && draw->item.texture_set != bound_texture) {
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_get_layout(ctx),
+                                    PIPELINE_SET_TEXTURE, 1, &draw->item.texture_set, 0, NULL);
+            bound_texture = draw->item.texture_set;
+        }
+        if (draw->item.uniform_size > 0 && draw->uniform_offset != bound_uniforms) {
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_get_layout(ctx),
+                                    PIPELINE_SET_DRAW, 1, &draw_set, 1, &draw->uniform_offset);
+            bound_uniforms = draw->uniform_offset;
+        }
+        if (draw->item.indirect_buffer != VK_NULL_HANDLE) {
+            record_indirect(ctx, cmd, &draw->item);
+        } else {
+            vkCmdDraw(cmd, draw->item.vertex_count, draw->item.instance_count, draw->item.first_vertex,
+                      draw->item.first_instance);
+        }
+    }
+}
+
+// The scene's only subpass; the color comes from the per-image uniform, so
+// it can change without re-recording
+static void record_scene(VkCommandBuffer cmd, uint32_t image_index, void* user) {
+    vulkan_context* ctx = user;
+    scene_recorder* recorder = ctx->recorder;
+    if (recorder->range_count > 0) {
+        vkCmdExecuteCommands(cmd, recorder->range_count, recorder->buffers);
+        return;
+    }
+    record_draws(ctx, cmd, image_index, 0, ctx->scene_draw_count);
+}
+
+// The graph has both images in transfer layouts by the time this runs
+static void record_upscale(VkCommandBuffer cmd, uint32_t image_index, void* user) {
+    vulkan_context* ctx = user;
+    
+    VkImageBlit blit = {0};
+    blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcSubresource.layerCount = 1;
+    blit.srcOffsets[1].x = (int32_t)ctx->render_extent.width;
+    blit.srcOffsets[1].y = (int32_t)ctx->render_extent.height;
+    blit.srcOffsets[1].z = 1;
+    blit.dstSubresource = blit.srcSubresource;
+    blit.dstOffsets[1].x = (int32_t)ctx->swap_chain_extent.width;
+    blit.dstOffsets[1].y = (int32_t)ctx->swap_chain_extent.height;
+    blit.dstOffsets[1].z = 1;
+    
+    vkCmdBlitImage(cmd, render_graph_get_image(ctx->graph, ctx->graph_scene_color, image_index),
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   render_graph_get_image(ctx->graph, ctx->graph_backbuffer, image_index),
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+}
+
+// Fullscreen triangle over the scene's linear output. Until the pipeline
+// compiles the frame shows the encoded clear color, baked in like the
+// background's.
+static void record_gamma(VkCommandBuffer cmd, uint32_t image_index, void* user) {
+    vulkan_context* ctx = user;
+    (void)image_index;
+    
+    VkPipeline pipeline = pipeline_get(ctx, ctx->gamma_pipeline);
+    if (pipeline == VK_NULL_HANDLE || ctx->gamma_set == VK_NULL_HANDLE) {
+        VkClearAttachment clear = {0};
+        clear.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        for (uint32_t c = 0; c < 3; c++) {
+            clear.clearValue.color.float32[c] = powf(ctx->recorded_clear_color[c], ctx->gamma_exponent);
+        }
+        clear.clearValue.color.float32[3] = ctx->recorded_clear_color[3];
+        
+        VkClearRect rect = {{{0, 0}, ctx->render_extent}, 0, 1};
+        vkCmdClearAttachments(cmd, 1, &clear, 1, &rect);
+        return;
+    }
+    
+    VkViewport viewport = {0};
+    viewport.width = (float)ctx->render_extent.width;
+    viewport.height = (float)ctx->render_extent.height;
+    viewport.maxDepth = 1.0f;
+    
+    VkRect2D scissor = {{0, 0}, ctx->render_extent};
+    float params[PIPELINE_POST_PUSH_CONSTANTS / sizeof(float)] = {ctx->gamma_exponent};
+    
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_get_post_layout(ctx), 0, 1,
+                            &ctx->gamma_set, 0, NULL);
+    vkCmdPushConstants(cmd, pipeline_get_post_layout(ctx), VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(params), params);
+    vkCmdDraw(cmd, 3, 1, 0, 0);
+}
+
+// The scene pass draws into the backbuffer, or into a scaled scene target
+// the upscale pass blits from. MSAA color and depth never leave the scene
+// pass, so the graph keeps them in lazily allocated memory where it can.
+// A gamma pass reads the scene's linear output as an input attachment;
+// merged into the scene pass as a subpass, that image stays in tile memory.
+int create_frame_graph(vulkan_context* ctx) {
+    render_graph* graph = ctx->graph;
+    update_render_extent(ctx);
+    
+    VkImageLayout final_layout = ctx->offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                                : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    ctx->graph_backbuffer = render_graph_import_image(graph, "backbuffer", ctx->swap_chain_format,
+                                                      ctx->swap_chain_extent, ctx->swap_chain_images,
+                                                      ctx->swap_chain_image_views, ctx->image_count,
+                                                      VK_IMAGE_LAYOUT_UNDEFINED, final_layout);
+    render_graph_output(graph, ctx->graph_backbuffer);
+    
+    // Scene targets are full size; a lower scale renders into their corner,
+    // so scale changes never reallocate
+    uint32_t resolved = ctx->graph_backbuffer;
+    ctx->graph_scene_color = RENDER_GRAPH_NONE;
+    if (ctx->upscale) {
+        ctx->graph_scene_color = render_graph_create_image(graph, "scene_color", ctx->swap_chain_format,
+                                                           ctx->swap_chain_extent, VK_SAMPLE_COUNT_1_BIT);
+        resolved = ctx->graph_scene_color;
+    }
+    
+    ctx->graph_scene_linear = RENDER_GRAPH_NONE;
+    if (ctx->gamma_post) {
+        ctx->graph_scene_linear = render_graph_create_image(graph, "scene_linear", ctx->swap_chain_format,
+                                                            ctx->swap_chain_extent, VK_SAMPLE_COUNT_1_BIT);
+    }
+    uint32_t scene_output = ctx->gamma_post ? ctx->graph_scene_linear : resolved;
+    
+    ctx->graph_scene_target = scene_output;
+    if (ctx->msaa_samples > VK_SAMPLE_COUNT_1_BIT) {
+        ctx->graph_scene_target = render_graph_create_image(graph, "msaa_color", ctx->swap_chain_format,
+                                                            ctx->swap_chain_extent, ctx->msaa_samples);
+    }
+    
+    uint32_t depth = render_graph_create_image(graph, "depth", ctx->depth_format, ctx->swap_chain_extent,
+                                               ctx->msaa_samples);
+    VkClearValue depth_clear = {0};
+    depth_clear.depthStencil.depth = 1.0f;
+    render_graph_set_clear(graph, depth, &depth_clear);
+    
+    ctx->scene_pass = render_graph_add_pass(graph, "scene", RENDER_GRAPH_PASS_GRAPHICS, record_scene, ctx);
+    render_graph_use_image(graph, ctx->scene_pass, ctx->graph_scene_target, RENDER_GRAPH_ACCESS_COLOR,
+                           VK_ATTACHMENT_LOAD_OP_CLEAR);
+    if (ctx->graph_scene_target != scene_output) {
+        render_graph_use_image(graph, ctx->scene_pass, scene_output, RENDER_GRAPH_ACCESS_RESOLVE,
+                               VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+    }
+    render_graph_use_image(graph, ctx->scene_pass, depth, RENDER_GRAPH_ACCESS_DEPTH, VK_ATTACHMENT_LOAD_OP_CLEAR);
+    render_graph_set_profile_scope(graph, ctx->scene_pass, GPU_SCOPE_SCENE);
+    
+    ctx->gamma_pass = RENDER_GRAPH_NONE;
+    if (ctx->gamma_post) {
+        ctx->gamma_pass = render_graph_add_pass(graph, "gamma", RENDER_GRAPH_PASS_GRAPHICS, record_gamma, ctx);
+        render_graph_use_image(graph, ctx->gamma_pass, ctx->graph_scene_linear, RENDER_GRAPH_ACCESS_INPUT,
+                               VK_ATTACHMENT_LOAD_OP_LOAD);
+        render_graph_use_image(graph, ctx->gamma_pass, resolved, RENDER_GRAPH_ACCESS_COLOR,
+                               VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+        render_graph_set_profile_scope(graph, ctx->gamma_pass, GPU_SCOPE_POST);
+        if (!ctx->gamma_fused) {
+            render_graph_set_standalone(graph, ctx->gamma_pass);
+        }
+    }
+    
+    if (ctx->upscale) {
+        uint32_t upscale_pass = render_graph_add_pass(graph, "upscale", RENDER_GRAPH_PASS_TRANSFER,
+                                                      record_upscale, ctx);
+        render_graph_use_image(graph, upscale_pass, ctx->graph_scene_color, RENDER_GRAPH_ACCESS_TRANSFER_SRC,
+                               VK_ATTACHMENT_LOAD_OP_LOAD);
+        render_graph_use_image(graph, upscale_pass, ctx->graph_backbuffer, RENDER_GRAPH_ACCESS_TRANSFER_DST,
+                               VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+        render_graph_set_profile_scope(graph, upscale_pass, GPU_SCOPE_UPSCALE);
+    }
+    
+    if (!render_graph_compile(graph)) {
+        return 0;
+    }
+    
+    // Cached by description, so this only changes with the format or frame shape
+    ctx->render_pass = render_graph_get_render_pass(graph, ctx->scene_pass);
+    return 1;
+}
+
+int create_command_pool(vulkan_context* ctx) {
+    VkCommandPoolCreateInfo pool_info = {0};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    pool_info.queueFamilyIndex = ctx->graphics_family;
+    
+    // Each record slot gets a pool per frame, so a range's job is the only
+    // user of its pool and no locking is needed
+    for (uint32_t i = 0; i < ctx->frame_count; i++) {
+        if (vkCreateCommandPool(ctx->device, &pool_info, NULL, &ctx->frames[i].command_pool) != VK_SUCCESS) {
+            return 0;
+        }
+        for (uint32_t slot = 0; slot < RENDER_RECORD_SLOTS; slot++) {
+            if (vkCreateCommandPool(ctx->device, &pool_info, NULL,
+                                    &ctx->frames[i].record_pools[slot]) != VK_SUCCESS) {
+                return 0;
+            }
+        }
+    }
+    
+    // Cached per-image command buffers live long and are reset individually
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    if (vkCreateCommandPool(ctx->device, &pool_info, NULL, &ctx->image_command_pool) != VK_SUCCESS) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+int create_command_buffer(vulkan_context* ctx) {
+    for (uint32_t i = 0; i < ctx->frame_count; i++) {
+        VkCommandBufferAllocateInfo alloc_info = {0};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = ctx->frames[i].command_pool;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = 1;
+        
+        if (vkAllocateCommandBuffers(ctx->device, &alloc_info, &ctx->frames[i].command_buffer) != VK_SUCCESS) {
+            return 0;
+        }
+        
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        for (uint32_t slot = 0; slot < RENDER_RECORD_SLOTS; slot++) {
+            alloc_info.commandPool = ctx->frames[i].record_pools[slot];
+            if (vkAllocateCommandBuffers(ctx->device, &alloc_info,
+                                         &ctx->frames[i].record_buffers[slot]) != VK_SUCCESS) {
+                return 0;
+            }
+        }
+    }
+    
+    return 1;
+}
+
+int create_sync_objects(vulkan_context* ctx) {
+    // Every graphics submit signals the next timeline value; acquire and
+    // present still need a binary pair per frame
+    ctx->timeline = gpu_timeline_create(ctx->device, ctx->timeline_semaphores);
+    if (!ctx->timeline) {
+        return 0;
+    }
+    
+    VkSemaphoreCreateInfo semaphore_info = {0};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    
+    for (uint32_t i = 0; i < ctx->frame_count; i++) {
+        frame_context* frame = &ctx->frames[i];
+        if (vkCreateSemaphore(ctx->device, &semaphore_info, NULL, &frame->image_available_semaphore) != VK_SUCCESS ||
+            vkCreateSemaphore(ctx->device, &semaphore_info, NULL, &frame->render_finished_semaphore) != VK_SUCCESS) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+int create_frame_pools(vulkan_context* ctx) {
+    // Per-frame scratch for vertices, indices, uniforms and indirect draws,
+    // which compute passes may rewrite in place; rewound once the
+    // frame's submit completes, so it never needs individual frees
+    for (uint32_t i = 0; i < ctx->frame_count; i++) {
+        if (!gpu_linear_pool_create(ctx->allocator, FRAME_TRANSIENT_POOL_SIZE,
+                                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                                    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                    VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                    &ctx->frames[i].transient_pool)) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+// The gamma pass's input and pipeline follow the graph, which is rebuilt
+// with the swapchain; an unchanged graph gets the same pipeline back
+static int create_gamma_resources(vulkan_context* ctx) {
+    ctx->gamma_set = VK_NULL_HANDLE;
+    if (ctx->gamma_pass == RENDER_GRAPH_NONE) {
+        return 1;
+    }
+    
+    VkDescriptorSetLayout set_layout = pipeline_get_post_set_layout(ctx);
+    
+    VkDescriptorSetAllocateInfo set_info = {0};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.descriptorPool = ctx->frame_descriptor_pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &set_layout;
+    
+    if (vkAllocateDescriptorSets(ctx->device, &set_info, &ctx->gamma_set) != VK_SUCCESS) {
+        ctx->gamma_set = VK_NULL_HANDLE;
+        return 0;
+    }
+    
+    VkDescriptorImageInfo input_info = {0};
+    input_info.imageView = render_graph_get_view(ctx->graph, ctx->graph_scene_linear, 0);
+    input_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    
+    VkWriteDescriptorSet write = {0};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = ctx->gamma_set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    write.pImageInfo = &input_info;
+    vkUpdateDescriptorSets(ctx->device, 1, &write, 0, NULL);
+    
+    pipeline_state state;
+    pipeline_state_init(&state, "fullscreen.vert.spv", "gamma.frag.spv");
+    state.post = 1;
+    state.render_pass = render_graph_get_render_pass(ctx->graph, ctx->gamma_pass);
+    state.subpass = render_graph_get_subpass(ctx->graph, ctx->gamma_pass);
+    ctx->gamma_pipeline = pipeline_request(ctx, &state);
+    return 1;
+}
+
+int create_image_resources(vulkan_context* ctx) {
+    ctx->image_command_buffers = calloc(ctx->image_count, sizeof(VkCommandBuffer));
+    ctx->image_generations = calloc(ctx->image_count, sizeof(uint64_t));
+    ctx->frame_descriptor_sets = calloc(ctx->image_count, sizeof(VkDescriptorSet));
+    if (!ctx->image_command_buffers || !ctx->image_generations || !ctx->frame_descriptor_sets) {
+        return 0;
+    }
+    
+    VkCommandBufferAllocateInfo alloc_info = {0};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = ctx->image_command_pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = ctx->image_count;
+    
+    if (vkAllocateCommandBuffers(ctx->device, &alloc_info, ctx->image_command_buffers) != VK_SUCCESS) {
+        free(ctx->image_command_buffers);
+        ctx->image_command_buffers = NULL;
+        return 0;
+    }
+    
+    // Generation 0 never matches, so every image records on first use
+    ctx->record_generation++;
+    
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ctx->physical_device, &props);
+    
+    // Profiler slots follow the images rather than the frames in flight:
+    // the cached command buffers bake in their query indices, and an
+    // image's slot is only rewritten after its last submit has completed
+    ctx->timestamp_period = props.limits.timestampPeriod;
+    if (ctx->timestamp_valid_bits > 0) {
+        ctx->profiler = gpu_profiler_create(ctx->device, ctx->image_count, GPU_SCOPE_COUNT,
+                                            ctx->timestamp_valid_bits, ctx->timestamp_period);
+        if (!ctx->profiler) {
+            return 0;
+        }
+    }
+    
+    VkDeviceSize alignment = props.limits.minUniformBufferOffsetAlignment;
+    if (alignment == 0) {
+        alignment = 1;
+    }
+    ctx->frame_uniform_stride = (sizeof(frame_uniforms) + alignment - 1) / alignment * alignment;
+    
+    VkBufferCreateInfo buffer_info = {0};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = ctx->frame_uniform_stride * ctx->image_count;
+    buffer_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    
+    if (!gpu_create_buffer(ctx->allocator, &buffer_info,
+                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                           &ctx->frame_uniform_buffer, &ctx->frame_uniform_allocation)) {
+        return 0;
+    }
+    
+    // One frame set per image, plus the gamma pass's input
+    VkDescriptorPoolSize pool_sizes[2] = {{0}, {0}};
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    pool_sizes[0].descriptorCount = ctx->image_count;
+    pool_sizes[1].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    pool_sizes[1].descriptorCount = 1;
+    
+    VkDescriptorPoolCreateInfo pool_info = {0};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets = ctx->image_count + 1;
+    pool_info.poolSizeCount = 2;
+    pool_info.pPoolSizes = pool_sizes;
+    
+    if (vkCreateDescriptorPool(ctx->device, &pool_info, NULL, &ctx->frame_descriptor_pool) != VK_SUCCESS) {
+        return 0;
+    }
+    
+    for (uint32_t i = 0; i < ctx->image_count; i++) {
+        VkDescriptorSetLayout set_layout = pipeline_get_frame_set_layout(ctx);
+        
+        VkDescriptorSetAllocateInfo set_info = {0};
+        set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        set_info.descriptorPool = ctx->frame_descriptor_pool;
+        set_info.descriptorSetCount = 1;
+        set_info.pSetLayouts = &set_layout;
+        
+        if (vkAllocateDescriptorSets(ctx->device, &set_info, &ctx->frame_descriptor_sets[i]) != VK_SUCCESS) {
+            return 0;
+        }
+        
+        VkDescriptorBufferInfo uniform_info = {0};
+        uniform_info.buffer = ctx->frame_uniform_buffer;
+        uniform_info.offset = ctx->frame_uniform_stride * i;
+        uniform_info.range = sizeof(frame_uniforms);
+        
+        VkWriteDescriptorSet write = {0};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = ctx->frame_descriptor_sets[i];
+        write.dstBinding = 0;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        write.pBufferInfo = &uniform_info;
+        vkUpdateDescriptorSets(ctx->device, 1, &write, 0, NULL);
+    }
+    
+    return create_gamma_resources(ctx);
+}
+
+void renderer_resize(vulkan_context* ctx) {
+    ctx->swapchain_dirty = 1;
+}
+
+int renderer_recreate_swapchain(vulkan_context* ctx) {
+    uint64_t start = timing_now_ns();
+    
+    // Only this context's frames can still reference the swapchain images
+    gpu_timeline_wait(ctx->timeline, gpu_timeline_last_submitted(ctx->timeline), UINT64_MAX);
+    
+    destroy_swapchain_resources(ctx);
+    
+    if (!create_swapchain(ctx) || !create_frame_graph(ctx)) {
+        return 0;
+    }
+    
+    // Same handle unless the format or the frame's shape changed; the old
+    // render pass stays cached, so in-flight compiles can still use it
+    pipeline_system_set_render_pass(ctx);
+    
+    if (!create_image_resources(ctx)) {
+        return 0;
+    }
+    
+    ctx->swapchain_dirty = 0;
+    ctx->suboptimal_frames = 0;
+    ctx->stats.swapchain_recreate_count++;
+    ctx->stats.swapchain_recreate_ns = timing_now_ns() - start;
+    return 1;
+}
+
+static void finish_frame_stats(vulkan_context* ctx, uint64_t frame_start, uint64_t fence_wait);
+
+static int ensure_readback_buffer(vulkan_context* ctx, frame_context* frame) {
+    VkDeviceSize size = (VkDeviceSize)ctx->swap_chain_extent.width * ctx->swap_chain_extent.height * 4;
+    if (frame->readback_buffer != VK_NULL_HANDLE && frame->readback_size >= size) {
+        frame->readback_extent = ctx->swap_chain_extent;
+        return 1;
+    }
+    
+    // The slot's last submit has been waited on, so its old buffer is idle
+    if (frame->readback_buffer != VK_NULL_HANDLE) {
+        gpu_destroy_buffer(ctx->allocator, frame->readback_buffer, &frame->readback_allocation);
+        frame->readback_buffer = VK_NULL_HANDLE;
+        frame->readback_data = NULL;
+    }
+    
+    VkBufferCreateInfo buffer_info = {0};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = size;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    
+    // Cached memory makes the CPU read of the pixels fast where available
+    if (!gpu_create_buffer(ctx->allocator, &buffer_info,
+                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                           VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+                           &frame->readback_buffer, &frame->readback_allocation)) {
+        return 0;
+    }
+    
+    frame->readback_data = frame->readback_allocation.mapped;
+    frame->readback_size = size;
+    frame->readback_extent = ctx->swap_chain_extent;
+    return 1;
+}
+
+static void record_readback(vulkan_context* ctx, frame_context* frame, VkCommandBuffer cmd, VkImage image) {
+    VkImageLayout layout = ctx->offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                          : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    
+    // When upscaling, the image was last written by the blit
+    VkPipelineStageFlags src_stage = ctx->upscale ? VK_PIPELINE_STAGE_TRANSFER_BIT
+                                                  : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    
+    VkImageMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = ctx->upscale ? VK_ACCESS_TRANSFER_WRITE_BIT
+                                         : VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = layout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+    
+    vkCmdPipelineBarrier(cmd, src_stage, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+    
+    VkBufferImageCopy region = {0};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width = frame->readback_extent.width;
+    region.imageExtent.height = frame->readback_extent.height;
+    region.imageExtent.depth = 1;
+    
+    vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           frame->readback_buffer, 1, &region);
+    
+    VkBufferMemoryBarrier host_barrier = {0};
+    host_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    host_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    host_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    host_barrier.buffer = frame->readback_buffer;
+    host_barrier.size = VK_WHOLE_SIZE;
+    
+    // Swapchain images go back to the layout the presentation engine expects
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = layout;
+    
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                         0, NULL, 1, &host_barrier, ctx->offscreen ? 0 : 1, &barrier);
+    
+    frame->readback_pending = 1;
+    frame->readback_serial = ++ctx->readback_serial;
+}
+
+static void record_range_job(void* data) {
+    record_range* range = data;
+    vulkan_context* ctx = range->ctx;
+    
+    VkCommandBufferInheritanceInfo inheritance = {0};
+    inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance.renderPass = ctx->render_pass;
+    inheritance.subpass = render_graph_get_subpass(ctx->graph, ctx->scene_pass);
+    inheritance.framebuffer = render_graph_get_framebuffer(ctx->graph, ctx->scene_pass, range->image_index);
+    
     VkCommandBufferBeginInfo begin_info = {0};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                       VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance;
+    
+    range->ok = 0;
+    if (vkBeginCommandBuffer(range->cmd, &begin_info) == VK_SUCCESS) {
+        record_draws(ctx, range->cmd, range->image_index, range->first, range->count);
+        range->ok = vkEndCommandBuffer(range->cmd) == VK_SUCCESS;
+    }
+    
+    if (range->counter) {
+        job_counter_done(range->counter);
+    }
+}
 
-    if (vkBeginCommandBuffer(ctx->command_buffer, &begin_info) != VK_SUCCESS) {
+// Splits the draw list into contiguous ranges, one secondary each, recorded
+// on the workers while this thread takes the last one. The primary executes
+// them in range order, so the output never depends on which job ran first.
+static void record_scene_parallel(vulkan_context* ctx, frame_context* frame, uint32_t image_index) {
+    scene_recorder* recorder = ctx->recorder;
+    recorder->range_count = 0;
+    
+    uint32_t slots = (uint32_t)jobs_worker_count() + 1;
+    uint32_t by_draws = ctx->scene_draw_count / RENDER_MIN_DRAWS_PER_SLOT;
+    if (slots > by_draws) slots = by_draws;
+    if (slots > RENDER_RECORD_SLOTS) slots = RENDER_RECORD_SLOTS;
+    if (!ctx->parallel_recording || slots < 2) {
         return;
     }
+    
+    uint32_t per_slot = ctx->scene_draw_count / slots;
+    uint32_t extra = ctx->scene_draw_count % slots;
+    uint32_t first = 0;
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        vkResetCommandPool(ctx->device, frame->record_pools[slot], 0);
+        
+        record_range* range = &recorder->ranges[slot];
+        range->ctx = ctx;
+        range->counter = NULL;
+        range->cmd = frame->record_buffers[slot];
+        range->image_index = image_index;
+        range->first = first;
+        range->count = per_slot + (slot < extra ? 1 : 0);
+        first += range->count;
+        recorder->buffers[slot] = range->cmd;
+    }
+    
+    job_counter_add(&recorder->counter, (int)(slots - 1));
+    for (uint32_t slot = 0; slot + 1 < slots; slot++) {
+        record_range* range = &recorder->ranges[slot];
+        range->counter = &recorder->counter;
+        job* work = job_create_custom(range, record_range_job);
+        if (work) {
+            job_queue_add_worker(work);
+        } else {
+            record_range_job(range);
+        }
+    }
+    
+    record_range_job(&recorder->ranges[slots - 1]);
+    job_counter_wait(&recorder->counter);
+    
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        if (!recorder->ranges[slot].ok) {
+            return;
+        }
+    }
+    
+    recorder->range_count = slots;
+    ctx->stats.parallel_record_count++;
+}
 
-    VkRenderPassBeginInfo render_pass_info = {0};
-    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    render_pass_info.renderPass = ctx->render_pass;
-    render_pass_info.framebuffer = ctx->framebuffers[image_index];
-    render_pass_info.renderArea.offset = (VkOffset2D){0, 0};
-    render_pass_info.renderArea.extent = ctx->swap_chain_extent;
+// Draws are only queued here; renderer_draw resolves their pipelines and
+// records them into the next frame
+int renderer_submit_draw(vulkan_context* ctx, const renderer_draw_item* item) {
+    if (ctx->draw_count == ctx->draw_capacity) {
+        uint32_t capacity = ctx->draw_capacity ? ctx->draw_capacity * 2 : RENDER_DRAW_LIST_INITIAL;
+        scene_draw* draws = realloc(ctx->draws, capacity * sizeof(scene_draw));
+        if (!draws) {
+            return 0;
+        }
+        ctx->draws = draws;
+        ctx->draw_capacity = capacity;
+    }
+    
+    scene_draw* draw = &ctx->draws[ctx->draw_count];
+    draw->item = *item;
+    draw->pipeline = VK_NULL_HANDLE;
+    draw->uniform_offset = 0;
+    if (item->uniform_size > 0 &&
+        !descriptor_stage_uniforms(ctx, item->uniforms, item->uniform_size, &draw->uniform_offset)) {
+        return 0;
+    }
+    draw->item.uniforms = NULL;
+    ctx->draw_count++;
+    return 1;
+}
+
+// Neighbouring draws usually share a pipeline, so only a change pays for the
+// lookup; draws whose pipeline is still compiling are dropped this frame
+static void resolve_scene_draws(vulkan_context* ctx) {
+    uint32_t count = 0;
+    uint64_t handle = 0;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    for (uint32_t i = 0; i < ctx->scene_draw_count; i++) {
+        scene_draw* draw = &ctx->draws[i];
+        if (i == 0 || draw->item.pipeline != handle) {
+            handle = draw->item.pipeline;
+            pipeline = pipeline_get(ctx, handle);
+        }
+        if (pipeline == VK_NULL_HANDLE) {
+            continue;
+        }
+        draw->pipeline = pipeline;
+        ctx->draws[count++] = *draw;
+    }
+    ctx->scene_draw_count = count;
+}
 
-    VkClearValue clear_val = {{{clear_color[0], clear_color[1], clear_color[2], clear_color[3]}}};
-    render_pass_info.clearValueCount = 1;
-    render_pass_info.pClearValues = &clear_val;
+// Everything the frame needs; cached per-image buffers replay this unchanged
+// until the pipeline, clear color (without a pipeline) or swapchain changes
+static int record_commands(vulkan_context* ctx, frame_context* frame, VkCommandBuffer cmd,
+                           uint32_t image_index, const float* clear_color,
+                           VkCommandBufferUsageFlags usage, int readback) {
+    VkCommandBufferBeginInfo begin_info = {0};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = usage;
+    
+    if (vkBeginCommandBuffer(cmd, &begin_info) != VK_SUCCESS) {
+        return 0;
+    }
+    
+    gpu_profiler_reset(ctx->profiler, cmd, image_index);
+    gpu_profiler_begin(ctx->profiler, cmd, image_index, GPU_SCOPE_FRAME);
+    
+    // Compute can't run inside the scene pass; cached buffers have no draws to cull
+    if (ctx->scene_draw_count > 0) {
+        sprite_record_cull(ctx, cmd);
+    }
+    
+    // All of these are baked into this command buffer; a change bumps the generation
+    VkClearValue clear_value = {{{clear_color[0], clear_color[1], clear_color[2], clear_color[3]}}};
+    render_graph_set_clear(ctx->graph, ctx->graph_scene_target, &clear_value);
+    render_graph_set_render_area(ctx->graph, ctx->scene_pass, ctx->render_extent);
+    render_graph_set_render_area(ctx->graph, ctx->gamma_pass, ctx->render_extent);
+    render_graph_set_contents(ctx->graph, ctx->scene_pass,
+                              ctx->recorder->range_count > 0 ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                                                             : VK_SUBPASS_CONTENTS_INLINE);
+    render_graph_execute(ctx->graph, cmd, image_index, ctx->profiler);
+    
+    gpu_profiler_end(ctx->profiler, cmd, image_index, GPU_SCOPE_FRAME);
+    
+    if (readback) {
+        record_readback(ctx, frame, cmd, ctx->swap_chain_images[image_index]);
+    }
+    
+    return vkEndCommandBuffer(cmd) == VK_SUCCESS;
+}
 
-    vkCmdBeginRenderPass(ctx->command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdEndRenderPass(ctx->command_buffer);
+// Between the headroom line and the budget nothing changes; that band and
+// the slow climb back keep the size from oscillating around the budget
+static void update_render_scale(vulkan_context* ctx, uint64_t gpu_ns) {
+    float gpu_ms = (float)gpu_ns / 1e6f;
+    if (ctx->gpu_time_avg_ms == 0.0f) {
+        ctx->gpu_time_avg_ms = gpu_ms;
+    } else {
+        ctx->gpu_time_avg_ms += (gpu_ms - ctx->gpu_time_avg_ms) * RENDER_SCALE_SMOOTHING;
+    }
     
-    if (vkEndCommandBuffer(ctx->command_buffer) != VK_SUCCESS) {
+    if (!ctx->dynamic_resolution) {
         return;
     }
+    
+    float average = ctx->gpu_time_avg_ms;
+    if (average > ctx->gpu_budget_ms) {
+        ctx->over_budget_frames++;
+        ctx->under_budget_frames = 0;
+    } else if (average < ctx->gpu_budget_ms * RENDER_SCALE_HEADROOM) {
+        ctx->under_budget_frames++;
+        ctx->over_budget_frames = 0;
+    } else {
+        ctx->over_budget_frames = 0;
+        ctx->under_budget_frames = 0;
+    }
+    
+    float scale = ctx->render_scale;
+    if (ctx->over_budget_frames >= RENDER_SCALE_DOWN_FRAMES) {
+        // GPU time follows the pixel count, which goes with the scale squared
+        float target = scale * sqrtf(ctx->gpu_budget_ms / average);
+        scale = target < scale - RENDER_SCALE_MAX_STEP_DOWN ? scale - RENDER_SCALE_MAX_STEP_DOWN : target;
+    } else if (ctx->under_budget_frames >= RENDER_SCALE_UP_FRAMES) {
+        scale += RENDER_SCALE_STEP_UP;
+    } else {
+        return;
+    }
+    
+    if (scale < RENDER_SCALE_MIN) scale = RENDER_SCALE_MIN;
+    if (scale > ctx->max_render_scale) scale = ctx->max_render_scale;
+    ctx->over_budget_frames = 0;
+    ctx->under_budget_frames = 0;
+    
+    if (scale != ctx->render_scale) {
+        ctx->render_scale = scale;
+        ctx->gpu_time_avg_ms = 0.0f;
+        update_render_extent(ctx);
+        ctx->stats.render_scale_changes++;
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "render scale %.2f (%ux%u), gpu %.2f ms",
+                            scale, ctx->render_extent.width, ctx->render_extent.height, average);
+    }
+}
+
+void renderer_request_readback(vulkan_context* ctx) {
+    ctx->readback_requested = 1;
+}
+
+const void* renderer_poll_readback(vulkan_context* ctx, uint32_t* width, uint32_t* height) {
+    frame_context* latest = NULL;
+    
+    // Never blocks: a readback is only returned once its submit has completed
+    uint64_t completed = gpu_timeline_completed(ctx->timeline);
+    for (uint32_t i = 0; i < ctx->frame_count; i++) {
+        frame_context* frame = &ctx->frames[i];
+        if (frame->readback_pending && frame->submit_value <= completed &&
+            (!latest || frame->readback_serial > latest->readback_serial)) {
+            latest = frame;
+        }
+    }
+    
+    if (!latest) {
+        return NULL;
+    }
+    
+    for (uint32_t i = 0; i < ctx->frame_count; i++) {
+        if (ctx->frames[i].readback_serial <= latest->readback_serial) {
+            ctx->frames[i].readback_pending = 0;
+        }
+    }
+    
+    if (width) *width = latest->readback_extent.width;
+    if (height) *height = latest->readback_extent.height;
+    return latest->readback_data;
+}
+
+uint64_t renderer_last_submit(vulkan_context* ctx) {
+    return gpu_timeline_last_submitted(ctx->timeline);
+}
+
+void renderer_set_view(vulkan_context* ctx, float x, float y, float width, float height) {
+    ctx->view_rect[0] = x;
+    ctx->view_rect[1] = y;
+    ctx->view_rect[2] = width;
+    ctx->view_rect[3] = height;
+}
 
-    VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+// Maps the view rectangle onto clip space; the viewport then follows the
+// render scale, so sprites need no knowledge of it
+void renderer_get_view_transform(vulkan_context* ctx, float* view) {
+    float width = ctx->view_rect[2];
+    float height = ctx->view_rect[3];
+    if (width <= 0.0f || height <= 0.0f) {
+        width = (float)ctx->swap_chain_extent.width;
+        height = (float)ctx->swap_chain_extent.height;
+    }
+    
+    view[0] = 2.0f / width;
+    view[1] = 2.0f / height;
+    view[2] = -1.0f - 2.0f * ctx->view_rect[0] / width;
+    view[3] = -1.0f - 2.0f * ctx->view_rect[1] / height;
+}
+
+// A skipped frame drops its draws; the next one is submitted from scratch
+static void discard_frame_draws(vulkan_context* ctx) {
+    ctx->draw_count = 0;
+    sprite_discard(ctx);
+    descriptor_discard(ctx);
+}
+
+// A frame that fails after vkAcquireNextImageKHR still leaves the acquire
+// semaphore pending a signal. An empty batch waits it out and takes a
+// timeline value so the slot isn't reused first; if even that submit
+// fails, the semaphore is replaced once the device is idle.
+static void release_acquire_semaphore(vulkan_context* ctx, frame_context* frame) {
+    if (ctx->offscreen) {
+        return;
+    }
+    
+    VkFence fence;
+    uint64_t value = gpu_timeline_begin_submit(ctx->timeline, &fence);
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    
+    VkTimelineSemaphoreSubmitInfo timeline_info = {0};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
     
     VkSubmitInfo submit_info = {0};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = &ctx->image_available_semaphore;
+    submit_info.pWaitSemaphores = &frame->image_available_semaphore;
+    submit_info.pWaitDstStageMask = &wait_stage;
+    
+    if (ctx->timeline->native) {
+        timeline_info.signalSemaphoreValueCount = 1;
+        timeline_info.pSignalSemaphoreValues = &value;
+        submit_info.pNext = &timeline_info;
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &ctx->timeline->semaphore;
+    }
+    
+    if (vkQueueSubmit(ctx->graphics_queue, 1, &submit_info, fence) == VK_SUCCESS) {
+        gpu_timeline_submitted(ctx->timeline, value);
+        frame->submit_value = value;
+        return;
+    }
+    
+    VkSemaphoreCreateInfo semaphore_info = {0};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    
+    vkDeviceWaitIdle(ctx->device);
+    vkDestroySemaphore(ctx->device, frame->image_available_semaphore, NULL);
+    if (vkCreateSemaphore(ctx->device, &semaphore_info, NULL, &frame->image_available_semaphore) != VK_SUCCESS) {
+        frame->image_available_semaphore = VK_NULL_HANDLE;
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "failed to replace the acquire semaphore");
+    }
+}
+
+void renderer_draw(vulkan_context* ctx, float* clear_color) {
+    uint64_t frame_start = timing_now_ns();
+    
+    ctx->recorder->range_count = 0;
+    
+    if (ctx->swapchain_dirty && !renderer_recreate_swapchain(ctx)) {
+        discard_frame_draws(ctx);
+        return;
+    }
+    
+    frame_context* frame = &ctx->frames[ctx->current_frame];
+    
+    // Only wait for the frame that last used this slot; the other slots keep the GPU busy
+    gpu_timeline_wait(ctx->timeline, frame->submit_value, UINT64_MAX);
+    uint64_t fence_wait = timing_now_ns() - frame_start;
+    
+    // Hand recorded uploads to the transfer queue; they run while we record
+    upload_flush(ctx);
+    
+    uint32_t image_index;
+    VkResult result = VK_SUCCESS;
+    if (ctx->offscreen) {
+        image_index = ctx->next_offscreen_image;
+        ctx->next_offscreen_image = (image_index + 1) % ctx->image_count;
+    } else {
+        if (frame->image_available_semaphore == VK_NULL_HANDLE) {
+            discard_frame_draws(ctx);
+            return;
+        }
+        result = vkAcquireNextImageKHR(ctx->device, ctx->swap_chain, UINT64_MAX, 
+                                       frame->image_available_semaphore, VK_NULL_HANDLE, &image_index);
+        
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            discard_frame_draws(ctx);
+            renderer_recreate_swapchain(ctx);
+            return;
+        }
+        
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            discard_frame_draws(ctx);
+            return;
+        }
+    }
+    
+    // The image may still be in use by a frame from another slot
+    if (ctx->images_in_flight[image_index] > frame->submit_value) {
+        uint64_t image_wait_start = timing_now_ns();
+        gpu_timeline_wait(ctx->timeline, ctx->images_in_flight[image_index], UINT64_MAX);
+        fence_wait += timing_now_ns() - image_wait_start;
+    }
+    
+    vkResetCommandPool(ctx->device, frame->command_pool, 0);
+    gpu_linear_pool_reset(&frame->transient_pool);
+    descriptor_begin_frame(ctx, frame);
+    
+    // Streamed images swap in before the flush picks up their sets; their
+    // sizes on screen come from the flush before
+    stream_update(ctx);
+    
+    // Sprite instances go into the pool just rewound; their batches join
+    // whatever else was submitted since the last frame
+    sprite_flush(ctx, frame);
+    ctx->scene_draw_count = ctx->draw_count;
+    ctx->draw_count = 0;
+    
+    // Budget numbers move with other processes; a periodic refresh is plenty
+    if (ctx->stats.frame_count % MEMORY_BUDGET_QUERY_FRAMES == 0) {
+        gpu_allocator_update_budget(ctx->allocator);
+    }
+    
+    // The image's fence has signaled, so the frame that last used it can be
+    // resolved; GPU numbers therefore trail the CPU ones by a few frames
+    uint64_t scope_ns[GPU_SCOPE_COUNT];
+    if (gpu_profiler_resolve(ctx->profiler, image_index, scope_ns)) {
+        ctx->stats.gpu_frame_ns = scope_ns[GPU_SCOPE_FRAME];
+        ctx->stats.gpu_scene_ns = scope_ns[GPU_SCOPE_SCENE];
+        ctx->stats.gpu_upscale_ns = scope_ns[GPU_SCOPE_UPSCALE];
+        ctx->stats.gpu_post_ns = scope_ns[GPU_SCOPE_POST];
+        ctx->stats.total_gpu_frame_ns += scope_ns[GPU_SCOPE_FRAME];
+        ctx->stats.gpu_frame_samples++;
+        update_render_scale(ctx, scope_ns[GPU_SCOPE_FRAME]);
+    }
+    
+    if (ctx->render_extent.width != ctx->recorded_extent.width ||
+        ctx->render_extent.height != ctx->recorded_extent.height) {
+        ctx->recorded_extent = ctx->render_extent;
+        ctx->record_generation++;
+    }
+    
+    // The image's fence has signaled, so its uniform slot is free to write
+    frame_uniforms* uniforms = (frame_uniforms*)((uint8_t*)ctx->frame_uniform_allocation.mapped +
+                                                 ctx->frame_uniform_stride * image_index);
+    memcpy(uniforms->clear_color, clear_color, sizeof(uniforms->clear_color));
+    renderer_get_view_transform(ctx, uniforms->view);
+    
+    // Until the pipelines compile the color is baked into the clear value
+    VkPipeline fullscreen = pipeline_get(ctx, ctx->fullscreen_pipeline);
+    if (fullscreen != ctx->recorded_pipeline) {
+        ctx->recorded_pipeline = fullscreen;
+        ctx->record_generation++;
+    }
+    VkPipeline gamma = pipeline_get(ctx, ctx->gamma_pipeline);
+    if (gamma != ctx->recorded_gamma_pipeline) {
+        ctx->recorded_gamma_pipeline = gamma;
+        ctx->record_generation++;
+    }
+    if ((fullscreen == VK_NULL_HANDLE || (ctx->gamma_post && gamma == VK_NULL_HANDLE)) &&
+        memcmp(ctx->recorded_clear_color, clear_color, sizeof(ctx->recorded_clear_color)) != 0) {
+        memcpy(ctx->recorded_clear_color, clear_color, sizeof(ctx->recorded_clear_color));
+        ctx->record_generation++;
+    }
+    
+    uint64_t record_start = timing_now_ns();
+    VkCommandBuffer command_buffer;
+    int readback = ctx->readback_requested && ensure_readback_buffer(ctx, frame);
+    
+    resolve_scene_draws(ctx);
+    
+    // Readbacks touch per-frame state and draw lists change every frame, so
+    // those frames are recorded one-off
+    if (readback || !ctx->cache_command_buffers || ctx->scene_draw_count > 0) {
+        command_buffer = frame->command_buffer;
+        record_scene_parallel(ctx, frame, image_index);
+        if (!record_commands(ctx, frame, command_buffer, image_index, clear_color,
+                             VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, readback)) {
+            release_acquire_semaphore(ctx, frame);
+            return;
+        }
+        if (readback) {
+            ctx->readback_requested = 0;
+        }
+    } else {
+        command_buffer = ctx->image_command_buffers[image_index];
+        if (ctx->image_generations[image_index] != ctx->record_generation) {
+            vkResetCommandBuffer(command_buffer, 0);
+            if (!record_commands(ctx, frame, command_buffer, image_index, clear_color, 0, 0)) {
+                ctx->image_generations[image_index] = 0;
+                release_acquire_semaphore(ctx, frame);
+                return;
+            }
+            ctx->image_generations[image_index] = ctx->record_generation;
+            ctx->stats.rerecord_count++;
+        } else {
+            ctx->stats.cached_frame_count++;
+        }
+    }
+    
+    ctx->stats.record_ns = timing_now_ns() - record_start;
+    ctx->stats.draw_count = ctx->scene_draw_count;
+    ctx->stats.record_slots = ctx->recorder->range_count;
+    ctx->stats.total_record_ns += ctx->stats.record_ns;
+    
+    // Offscreen targets have no acquire or present to synchronize with;
+    // finished uploads are waited on only by the stages that read them
+    VkFence fence;
+    uint64_t submit_value = gpu_timeline_begin_submit(ctx->timeline, &fence);
+    VkSemaphore wait_semaphores[1 + UPLOAD_MAX_BATCHES];
+    VkPipelineStageFlags wait_stages[1 + UPLOAD_MAX_BATCHES];
+    uint32_t wait_count = 0;
+    if (!ctx->offscreen) {
+        wait_semaphores[wait_count] = frame->image_available_semaphore;
+        wait_stages[wait_count] = render_graph_first_stage(ctx->graph, ctx->graph_backbuffer);
+        wait_count++;
+    }
+    wait_count += upload_take_waits(ctx, submit_value, wait_semaphores + wait_count,
+                                    wait_stages + wait_count, UPLOAD_MAX_BATCHES);
+    
+    // The timeline goes last so the binary semaphore keeps index 0; values
+    // given for binary semaphores are ignored
+    VkSemaphore signal_semaphores[2];
+    uint64_t signal_values[2] = {0};
+    uint32_t signal_count = 0;
+    if (!ctx->offscreen) {
+        signal_semaphores[signal_count++] = frame->render_finished_semaphore;
+    }
+    
+    VkTimelineSemaphoreSubmitInfo timeline_info = {0};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    
+    VkSubmitInfo submit_info = {0};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.waitSemaphoreCount = wait_count;
+    submit_info.pWaitSemaphores = wait_semaphores;
     submit_info.pWaitDstStageMask = wait_stages;
     submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &ctx->command_buffer;
-    submit_info.signalSemaphoreCount = 1;
-    submit_info.pSignalSemaphores = &ctx->render_finished_semaphore;
-
-    if (vkQueueSubmit(ctx->graphics_queue, 1, &submit_info, ctx->in_flight_fence) != VK_SUCCESS) {
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.pSignalSemaphores = signal_semaphores;
+    
+    if (ctx->timeline->native) {
+        signal_semaphores[signal_count] = ctx->timeline->semaphore;
+        signal_values[signal_count] = submit_value;
+        signal_count++;
+        
+        timeline_info.signalSemaphoreValueCount = signal_count;
+        timeline_info.pSignalSemaphoreValues = signal_values;
+        submit_info.pNext = &timeline_info;
+    }
+    submit_info.signalSemaphoreCount = signal_count;
+    
+    if (vkQueueSubmit(ctx->graphics_queue, 1, &submit_info, fence) != VK_SUCCESS) {
+        frame->readback_pending = 0;
+        upload_return_waits(ctx, submit_value);
+        release_acquire_semaphore(ctx, frame);
         return;
     }
-
+    
+    gpu_timeline_submitted(ctx->timeline, submit_value);
+    frame->submit_value = submit_value;
+    ctx->images_in_flight[image_index] = submit_value;
+    gpu_profiler_submitted(ctx->profiler, image_index);
+    
+    if (ctx->offscreen) {
+        finish_frame_stats(ctx, frame_start, fence_wait);
+        return;
+    }
+    
     VkPresentInfoKHR present_info = {0};
     present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     present_info.waitSemaphoreCount = 1;
-    present_info.pWaitSemaphores = &ctx->render_finished_semaphore;
+    present_info.pWaitSemaphores = &frame->render_finished_semaphore;
     present_info.swapchainCount = 1;
     present_info.pSwapchains = &ctx->swap_chain;
     present_info.pImageIndices = &image_index;
+    
+    VkResult present_result = vkQueuePresentKHR(ctx->graphics_queue, &present_info);
+    
+    // Suboptimal still presents correctly (e.g. mid-rotation), so only recreate
+    // once it persists; out of date is handled at the start of the next frame
+    if (present_result == VK_ERROR_OUT_OF_DATE_KHR) {
+        ctx->swapchain_dirty = 1;
+    } else if (result == VK_SUBOPTIMAL_KHR || present_result == VK_SUBOPTIMAL_KHR) {
+        if (++ctx->suboptimal_frames >= SUBOPTIMAL_RECREATE_FRAMES) {
+            ctx->swapchain_dirty = 1;
+        }
+    } else {
+        ctx->suboptimal_frames = 0;
+    }
+    
+    finish_frame_stats(ctx, frame_start, fence_wait);
+}
 
-    vkQueuePresentKHR(ctx->graphics_queue, &present_info);
+static void finish_frame_stats(vulkan_context* ctx, uint64_t frame_start, uint64_t fence_wait) {
+    ctx->current_frame = (ctx->current_frame + 1) % ctx->frame_count;
+    
+    uint64_t frame_end = timing_now_ns();
+    if (ctx->init_timeline.first_frame_ns == 0) {
+        ctx->init_timeline.first_frame_ns = frame_end - ctx->init_timeline.begin_ns;
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "first frame %.2f ms after init began",
+                            ctx->init_timeline.first_frame_ns / 1e6);
+    }
+    renderer_stats* stats = &ctx->stats;
+    stats->fence_wait_ns = fence_wait;
+    stats->cpu_frame_ns = frame_end - frame_start - fence_wait;
+    stats->total_fence_wait_ns += stats->fence_wait_ns;
+    stats->total_cpu_ns += stats->cpu_frame_ns;
+    if (stats->frame_count > 0) {
+        stats->total_frame_ns += frame_start - stats->last_frame_start_ns;
+    }
+    stats->last_frame_start_ns = frame_start;
+    stats->frame_count++;
+    stats->render_scale = ctx->render_scale;
+    stats->render_width = ctx->render_extent.width;
+    stats->render_height = ctx->render_extent.height;
+}
+
+void renderer_get_stats(vulkan_context* ctx, renderer_stats* stats) {
+    *stats = ctx->stats;
+    
+    // Upload batches run on their own queue and resolve on their own schedule
+    if (ctx->upload) {
+        upload_stats upload;
+        upload_get_stats(ctx, &upload);
+        stats->gpu_upload_ns = upload.gpu_ns;
+    }
+}
+
+void renderer_reset_stats(vulkan_context* ctx) {
+    memset(&ctx->stats, 0, sizeof(renderer_stats));
+}
+
+int renderer_gamma_benchmark(vulkan_context* ctx, uint32_t frame_count, renderer_gamma_benchmark_result* result) {
+    memset(result, 0, sizeof(*result));
+    if (!ctx->gamma_post || frame_count == 0) {
+        return 0;
+    }
+    
+    render_graph_stats graph_stats;
+    render_graph_get_stats(ctx->graph, &graph_stats);
+    result->gamma = ctx->gamma;
+    result->fused = ctx->gamma_fused;
+    result->frame_count = frame_count;
+    result->load_bytes = graph_stats.load_bytes;
+    result->store_bytes = graph_stats.store_bytes;
+    result->lazy_bytes = graph_stats.lazy_bytes;
+    
+    // Warm up until the gamma pipeline is ready so the fallback clear doesn't count
+    float clear_color[4] = {0.25f, 0.5f, 0.75f, 1.0f};
+    pipeline_wait_all(ctx);
+    renderer_draw(ctx, clear_color);
+    vkQueueWaitIdle(ctx->graphics_queue);
+    
+    renderer_stats before;
+    renderer_get_stats(ctx, &before);
+    
+    uint64_t cpu_total = 0;
+    uint64_t post_total = 0;
+    for (uint32_t frame = 0; frame < frame_count; frame++) {
+        uint64_t start = timing_now_ns();
+        renderer_draw(ctx, clear_color);
+        cpu_total += timing_now_ns() - start;
+        post_total += ctx->stats.gpu_post_ns;
+        vkQueueWaitIdle(ctx->graphics_queue);
+    }
+    
+    // Profiler results trail submission, so the idle queue lets them all resolve
+    renderer_draw(ctx, clear_color);
+    vkQueueWaitIdle(ctx->graphics_queue);
+    renderer_stats after;
+    renderer_get_stats(ctx, &after);
+    
+    result->cpu_frame_ns = cpu_total / frame_count;
+    result->gpu_post_ns = post_total / frame_count;
+    uint64_t samples = after.gpu_frame_samples - before.gpu_frame_samples;
+    if (samples > 0) {
+        result->gpu_frame_ns = (after.total_gpu_frame_ns - before.total_gpu_frame_ns) / samples;
+    }
+    return 1;
 }
 
 void renderer_cleanup(vulkan_context* ctx) {
@@ -442,56 +2055,66 @@ void renderer_cleanup(vulkan_context* ctx) {
         vkDeviceWaitIdle(ctx->device);
     }
     
-    if (ctx->framebuffers) {
-        for (uint32_t i = 0; i < ctx->image_count; i++) {
-            if (ctx->framebuffers[i] != VK_NULL_HANDLE) {
-                vkDestroyFramebuffer(ctx->device, ctx->framebuffers[i], NULL);
-            }
-        }
-        free(ctx->framebuffers);
-    }
+    // Jobs still waiting on the GPU run now, while what they touch is alive
+    gpu_timeline_destroy(ctx->timeline);
+    ctx->timeline = NULL;
+    stream_shutdown(ctx);
+    sprite_shutdown(ctx);
+    descriptor_shutdown(ctx);
+    pipeline_system_destroy(ctx);
+    destroy_swapchain_resources(ctx);
     
-    if (ctx->swap_chain_image_views) {
-        for (uint32_t i = 0; i < ctx->image_count; i++) {
-            if (ctx->swap_chain_image_views[i] != VK_NULL_HANDLE) {
-                vkDestroyImageView(ctx->device, ctx->swap_chain_image_views[i], NULL);
+    for (uint32_t i = 0; i < ctx->frame_count; i++) {
+        frame_context* frame = &ctx->frames[i];
+        
+        if (frame->command_pool != VK_NULL_HANDLE) {
+            vkDestroyCommandPool(ctx->device, frame->command_pool, NULL);
+        }
+        
+        for (uint32_t slot = 0; slot < RENDER_RECORD_SLOTS; slot++) {
+            if (frame->record_pools[slot] != VK_NULL_HANDLE) {
+                vkDestroyCommandPool(ctx->device, frame->record_pools[slot], NULL);
             }
         }
-        free(ctx->swap_chain_image_views);
+        
+        if (ctx->allocator) {
+            gpu_destroy_buffer(ctx->allocator, frame->readback_buffer, &frame->readback_allocation);
+            gpu_linear_pool_destroy(ctx->allocator, &frame->transient_pool);
+        }
+        
+        if (frame->image_available_semaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(ctx->device, frame->image_available_semaphore, NULL);
+        }
+        
+        if (frame->render_finished_semaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(ctx->device, frame->render_finished_semaphore, NULL);
+        }
     }
     
-    if (ctx->swap_chain_images) {
-        free(ctx->swap_chain_images);
+    if (ctx->image_command_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(ctx->device, ctx->image_command_pool, NULL);
     }
     
-    if (ctx->command_pool != VK_NULL_HANDLE) {
-        vkDestroyCommandPool(ctx->device, ctx->command_pool, NULL);
+    if (ctx->recorder) {
+        job_counter_destroy(&ctx->recorder->counter);
+        free(ctx->recorder);
     }
+    free(ctx->draws);
     
-    if (ctx->render_pass != VK_NULL_HANDLE) {
-        vkDestroyRenderPass(ctx->device, ctx->render_pass, NULL);
-    }
+    // Owns the cached render passes, so it outlives the pipelines
+    render_graph_destroy(ctx->graph);
     
     if (ctx->swap_chain != VK_NULL_HANDLE) {
         vkDestroySwapchainKHR(ctx->device, ctx->swap_chain, NULL);
     }
     
-    if (ctx->image_available_semaphore != VK_NULL_HANDLE) {
-        vkDestroySemaphore(ctx->device, ctx->image_available_semaphore, NULL);
-    }
-    
-    if (ctx->render_finished_semaphore != VK_NULL_HANDLE) {
-        vkDestroySemaphore(ctx->device, ctx->render_finished_semaphore, NULL);
-    }
-    
-    if (ctx->in_flight_fence != VK_NULL_HANDLE) {
-        vkDestroyFence(ctx->device, ctx->in_flight_fence, NULL);
-    }
-    
     if (ctx->surface != VK_NULL_HANDLE) {
         vkDestroySurfaceKHR(ctx->instance, ctx->surface, NULL);
     }
     
+    upload_shutdown(ctx);
+    gpu_allocator_destroy(ctx->allocator);
+    
     if (ctx->device != VK_NULL_HANDLE) {
         vkDestroyDevice(ctx->device, NULL);
     }
@@ -499,4 +2122,7 @@ void renderer_cleanup(vulkan_context* ctx) {
     if (ctx->instance != VK_NULL_HANDLE) {
         vkDestroyInstance(ctx->instance, NULL);
     }
+    
+    // A failed renderer_init leaves the context zeroed so callers can tell
+    memset(ctx, 0, sizeof(*ctx));
 }
@@ -1,35 +1,358 @@
 #pragma once
+#include "platform.h"
+#include "allocator.h"
+#include "device.h"
 #include <vulkan/vulkan.h>
-#include <android/native_window.h>
+
+#define MAX_FRAMES_IN_FLIGHT 3
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+#define SUBOPTIMAL_RECREATE_FRAMES 8
+// Also holds the frame's sprite instances: 100k sprites take about 4 MiB
+#define FRAME_TRANSIENT_POOL_SIZE (8u << 20)
+#define MEMORY_BUDGET_QUERY_FRAMES 64
+
+// Dynamic resolution: the scene renders at render_scale of the swapchain
+// extent and is blitted up. Dropping takes a few frames over budget;
+// growing again needs a long run well under it.
+#define DEFAULT_GPU_BUDGET_MS 14.0f
+#define RENDER_SCALE_MIN 0.5f
+#define RENDER_SCALE_STEP_UP 0.05f
+#define RENDER_SCALE_MAX_STEP_DOWN 0.15f
+#define RENDER_SCALE_HEADROOM 0.8f
+#define RENDER_SCALE_DOWN_FRAMES 8
+#define RENDER_SCALE_UP_FRAMES 60
+#define RENDER_SCALE_SMOOTHING 0.1f
+#define RENDER_EXTENT_ALIGN 8
+
+// Scene draws are split into contiguous ranges recorded in parallel, each
+// into a secondary buffer from its own per-frame pool. Below the minimum a
+// range isn't worth a job.
+#define RENDER_RECORD_SLOTS 8
+#define RENDER_MIN_DRAWS_PER_SLOT 64
+#define RENDER_DRAW_LIST_INITIAL 256
+
+// sRGB encoding is what a gamma of 2.2 approximates; within the epsilon a
+// gamma needs no pass of its own
+#define RENDER_GAMMA_SRGB 2.2f
+#define RENDER_GAMMA_EPSILON 0.01f
+#define RENDER_GAMMA_BENCHMARK_FRAMES 120
+#define RENDER_PATH_MAX 256
+
+typedef struct {
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    VkCommandPool record_pools[RENDER_RECORD_SLOTS];
+    VkCommandBuffer record_buffers[RENDER_RECORD_SLOTS];
+    VkSemaphore image_available_semaphore;
+    VkSemaphore render_finished_semaphore;
+    uint64_t submit_value;
+    gpu_linear_pool transient_pool;
+    VkBuffer readback_buffer;
+    gpu_allocation readback_allocation;
+    VkDeviceSize readback_size;
+    VkExtent2D readback_extent;
+    void* readback_data;
+    uint64_t readback_serial;
+    int readback_pending;
+} frame_context;
+
+typedef struct {
+    uint32_t frames_in_flight;
+    uint32_t width;
+    uint32_t height;
+    int headless_surface;
+    
+    // Copies, since renderer_init may run on another thread; empty for none
+    char cache_dir[RENDER_PATH_MAX];
+    char shader_dir[RENDER_PATH_MAX];
+    int cache_command_buffers;
+    int parallel_recording;
+    int timeline_semaphores;
+    int bindless_textures;
+    int gpu_culling;
+    uint32_t msaa_samples;
+    int dynamic_resolution;
+    float gpu_budget_ms;
+    
+    // About as many pixels as the scene renders at, in the surface's shape
+    // and never above its size; 0 renders at the surface size
+    uint32_t render_width;
+    uint32_t render_height;
+    float gamma;
+    int gamma_fused;
+    int compress_textures;
+    
+    // Memory streamed textures may hold; 0 takes the default
+    uint32_t texture_budget_mb;
+} renderer_config;
+
+// renderer_init's stages in the order they start; swapchain through upload
+// run side by side once the device exists
+typedef enum {
+    RENDER_INIT_INSTANCE,
+    RENDER_INIT_DEVICE,
+    RENDER_INIT_SWAPCHAIN,
+    RENDER_INIT_FRAMES,
+    RENDER_INIT_PIPELINE_CACHE,
+    RENDER_INIT_UPLOAD,
+    RENDER_INIT_IMAGES,
+    RENDER_INIT_ASSETS,
+    RENDER_INIT_STAGE_COUNT
+} render_init_stage;
+
+// Offsets from the start of renderer_init
+typedef struct {
+    uint64_t begin_ns;
+    uint64_t start_ns[RENDER_INIT_STAGE_COUNT];
+    uint64_t end_ns[RENDER_INIT_STAGE_COUNT];
+    uint64_t ready_ns;
+    uint64_t first_frame_ns;
+} render_init_timeline;
+
+// GPU timestamp scopes recorded into every frame
+typedef enum {
+    GPU_SCOPE_FRAME,
+    GPU_SCOPE_SCENE,
+    GPU_SCOPE_UPSCALE,
+    GPU_SCOPE_POST,
+    GPU_SCOPE_COUNT
+} gpu_scope;
+
+typedef struct {
+    uint64_t frame_count;
+    uint64_t cpu_frame_ns;
+    uint64_t fence_wait_ns;
+    uint64_t total_cpu_ns;
+    uint64_t total_fence_wait_ns;
+    uint64_t total_frame_ns;
+    uint64_t last_frame_start_ns;
+    uint64_t swapchain_recreate_count;
+    uint64_t swapchain_recreate_ns;
+    uint64_t record_ns;
+    uint64_t total_record_ns;
+    uint64_t rerecord_count;
+    uint64_t cached_frame_count;
+    uint32_t draw_count;
+    uint32_t record_slots;
+    uint64_t parallel_record_count;
+    uint64_t gpu_frame_ns;
+    uint64_t gpu_scene_ns;
+    uint64_t gpu_upscale_ns;
+    uint64_t gpu_post_ns;
+    uint64_t gpu_upload_ns;
+    uint64_t total_gpu_frame_ns;
+    uint64_t gpu_frame_samples;
+    float render_scale;
+    uint32_t render_width;
+    uint32_t render_height;
+    uint64_t render_scale_changes;
+} renderer_stats;
+
+typedef struct {
+    float gamma;
+    int fused;
+    uint32_t frame_count;
+    uint64_t cpu_frame_ns;
+    uint64_t gpu_frame_ns;
+    uint64_t gpu_post_ns;
+    
+    // Attachment traffic per frame as the render graph estimates it
+    uint64_t load_bytes;
+    uint64_t store_bytes;
+    uint64_t lazy_bytes;
+} renderer_gamma_benchmark_result;
+
+// One scene draw, recorded after the background in submission order. The
+// vertex buffer (binding 0), texture set (set 1) and uniforms (set 2) are
+// optional; uniforms are copied at submit, up to DESCRIPTOR_DRAW_UNIFORM_MAX bytes.
+// An indirect buffer replaces the counts with indirect_count
+// VkDrawIndirectCommands; a count buffer caps them at a GPU-written count.
+typedef struct {
+    uint64_t pipeline;
+    uint32_t vertex_count;
+    uint32_t instance_count;
+    uint32_t first_vertex;
+    uint32_t first_instance;
+    VkBuffer vertex_buffer;
+    VkDeviceSize vertex_offset;
+    VkDescriptorSet texture_set;
+    const void* uniforms;
+    uint32_t uniform_size;
+    VkBuffer indirect_buffer;
+    VkDeviceSize indirect_offset;
+    uint32_t indirect_count;
+    VkBuffer count_buffer;
+    VkDeviceSize count_offset;
+} renderer_draw_item;
+
+typedef struct {
+    renderer_draw_item item;
+    VkPipeline pipeline;
+    uint32_t uniform_offset;
+} scene_draw;
+
+// Values the cached command buffers read at execution time, one slot per swapchain image
+typedef struct {
+    float clear_color[4];
+    
+    // 2D view to clip space: xy scale, zw offset
+    float view[4];
+} frame_uniforms;
+
+struct pipeline_system;
+struct gpu_profiler;
+struct render_graph;
+struct scene_recorder;
+struct sprite_batcher;
+struct texture_streamer;
+struct descriptor_system;
 
 typedef struct {
     VkInstance instance;
+    uint32_t api_version;
     VkDevice device;
     VkPhysicalDevice physical_device;
+    device_caps caps;
+    device_select_stats select_stats;
     VkQueue graphics_queue;
+    VkQueue transfer_queue;
+    ANativeWindow* window;
     VkSurfaceKHR surface;
     VkSwapchainKHR swap_chain;
-    VkCommandPool command_pool;
-    VkCommandBuffer command_buffer;
     VkRenderPass render_pass;
-    VkFramebuffer* framebuffers;
+    VkSampleCountFlagBits msaa_samples;
+    VkFormat depth_format;
+    struct render_graph* graph;
+    uint32_t graph_backbuffer;
+    uint32_t graph_scene_color;
+    uint32_t graph_scene_target;
+    uint32_t graph_scene_linear;
+    uint32_t scene_pass;
+    uint32_t gamma_pass;
+    int dynamic_resolution;
+    
+    // The post pass raises the linear scene to gamma_exponent, which
+    // leaves room for the encode an sRGB target does on store
+    float gamma;
+    float gamma_exponent;
+    int gamma_post;
+    int gamma_fused;
+    uint64_t gamma_pipeline;
+    VkPipeline recorded_gamma_pipeline;
+    VkDescriptorSet gamma_set;
+    VkExtent2D render_extent;
+    VkExtent2D recorded_extent;
+    
+    // The configured render size caps the scale; below 1, or with dynamic
+    // resolution, the scene goes through the upscale pass
+    VkExtent2D render_size;
+    float max_render_scale;
+    int upscale;
+    float render_scale;
+    float gpu_budget_ms;
+    float gpu_time_avg_ms;
+    uint32_t over_budget_frames;
+    uint32_t under_budget_frames;
+    uint32_t timestamp_valid_bits;
+    float timestamp_period;
+    struct gpu_profiler* profiler;
+    struct gpu_timeline* timeline;
+    int timeline_semaphores;
+    int bindless_textures;
+    int gpu_culling;
+    int multi_draw_indirect;
+    int compress_textures;
+    PFN_vkCmdDrawIndirectCountKHR draw_indirect_count;
     VkImage* swap_chain_images;
     VkImageView* swap_chain_image_views;
     VkFormat swap_chain_format;
     VkExtent2D swap_chain_extent;
+    VkExtent2D requested_extent;
+    int offscreen;
+    gpu_allocation* offscreen_allocations;
+    uint32_t next_offscreen_image;
+    int readback_requested;
+    uint64_t readback_serial;
     uint32_t graphics_family;
+    uint32_t transfer_family;
     uint32_t image_count;
-    VkSemaphore image_available_semaphore;
-    VkSemaphore render_finished_semaphore;
-    VkFence in_flight_fence;
+    uint64_t* images_in_flight;
+    VkCommandPool image_command_pool;
+    VkCommandBuffer* image_command_buffers;
+    uint64_t* image_generations;
+    uint64_t record_generation;
+    int cache_command_buffers;
+    int parallel_recording;
+    struct scene_recorder* recorder;
+    scene_draw* draws;
+    uint32_t draw_count;
+    uint32_t draw_capacity;
+    uint32_t scene_draw_count;
+    struct sprite_batcher* sprites;
+    struct texture_streamer* streamer;
+    float view_rect[4];
+    VkPipeline recorded_pipeline;
+    float recorded_clear_color[4];
+    VkBuffer frame_uniform_buffer;
+    gpu_allocation frame_uniform_allocation;
+    VkDeviceSize frame_uniform_stride;
+    VkDescriptorPool frame_descriptor_pool;
+    VkDescriptorSet* frame_descriptor_sets;
+    struct descriptor_system* descriptors;
+    frame_context frames[MAX_FRAMES_IN_FLIGHT];
+    uint32_t frame_count;
+    uint32_t current_frame;
+    int swapchain_dirty;
+    uint32_t suboptimal_frames;
+    gpu_allocator* allocator;
+    int memory_budget_supported;
+    struct upload_context* upload;
+    struct pipeline_system* pipelines;
+    uint64_t fullscreen_pipeline;
+    renderer_stats stats;
+    render_init_timeline init_timeline;
 } vulkan_context;
 
-void renderer_init(vulkan_context* ctx, ANativeWindow* window);
+// Blocks until the renderer is ready, running independent stages on the
+// job workers; call it from a thread that isn't one of them
+void renderer_init(vulkan_context* ctx, ANativeWindow* window, const renderer_config* config);
 void renderer_draw(vulkan_context* ctx, float* clear_color);
+
+// Queues a draw for the next renderer_draw; draws whose pipeline is still
+// compiling are skipped
+int renderer_submit_draw(vulkan_context* ctx, const renderer_draw_item* item);
+
+// Visible 2D region as x, y, width, height with y down; a zero size means
+// swapchain pixels. Read from the frame uniforms, so it never re-records.
+void renderer_set_view(vulkan_context* ctx, float x, float y, float width, float height);
+
+// The view as a clip-space transform: xy scale, zw offset
+void renderer_get_view_transform(vulkan_context* ctx, float* view);
+
 void renderer_cleanup(vulkan_context* ctx);
+void renderer_resize(vulkan_context* ctx);
+int renderer_recreate_swapchain(vulkan_context* ctx);
 
 int create_swapchain(vulkan_context* ctx);
-int create_render_pass(vulkan_context* ctx);
-int create_framebuffers(vulkan_context* ctx);
+int create_frame_graph(vulkan_context* ctx);
 int create_command_pool(vulkan_context* ctx);
 int create_command_buffer(vulkan_context* ctx);
+int create_sync_objects(vulkan_context* ctx);
+int create_frame_pools(vulkan_context* ctx);
+int create_image_resources(vulkan_context* ctx);
+int create_offscreen_targets(vulkan_context* ctx);
+
+void renderer_request_readback(vulkan_context* ctx);
+const void* renderer_poll_readback(vulkan_context* ctx, uint32_t* width, uint32_t* height);
+
+// Timeline value of the last graphics submit; gpu_timeline_on_complete
+// with it runs a job once everything submitted so far has finished
+uint64_t renderer_last_submit(vulkan_context* ctx);
+
+void renderer_get_stats(vulkan_context* ctx, renderer_stats* stats);
+void renderer_reset_stats(vulkan_context* ctx);
+
+// Frame and post-pass times with the gamma pass as the context was
+// configured, fused into the scene pass or standalone. Returns 0 when the
+// gamma needs no pass.
+int renderer_gamma_benchmark(vulkan_context* ctx, uint32_t frame_count, renderer_gamma_benchmark_result* result);
@@ -0,0 +1,1260 @@
+#include "rendergraph.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_TAG "vm_engine"
+
+// Layout, stages and access a single use needs the image in
+typedef struct {
+    VkImageLayout layout;
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageUsageFlags usage;
+    int write;
+    int attachment;
+} use_info;
+
+// What the GPU last did to an image while the graph is being simulated
+typedef struct {
+    VkImageLayout layout;
+    VkPipelineStageFlags write_stages;
+    VkAccessFlags write_access;
+    VkPipelineStageFlags read_stages;
+    VkPipelineStageFlags visible_stages;
+} image_state;
+
+static use_info describe_use(const render_graph_use* use) {
+    use_info info = {0};
+    switch (use->access) {
+        case RENDER_GRAPH_ACCESS_COLOR:
+        case RENDER_GRAPH_ACCESS_RESOLVE:
+            info.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            info.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            info.access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            if (use->load_op == VK_ATTACHMENT_LOAD_OP_LOAD && use->access == RENDER_GRAPH_ACCESS_COLOR) {
+                info.access |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
+            }
+            info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+            info.write = 1;
+            info.attachment = 1;
+            break;
+        case RENDER_GRAPH_ACCESS_DEPTH:
+            info.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+            info.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            info.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+            info.write = 1;
+            info.attachment = 1;
+            break;
+        case RENDER_GRAPH_ACCESS_INPUT:
+            info.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            info.stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            info.access = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+            info.usage = VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+            info.attachment = 1;
+            break;
+        case RENDER_GRAPH_ACCESS_SAMPLED:
+            info.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            info.stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            info.access = VK_ACCESS_SHADER_READ_BIT;
+            info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+            break;
+        case RENDER_GRAPH_ACCESS_TRANSFER_SRC:
+            info.layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            info.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            info.access = VK_ACCESS_TRANSFER_READ_BIT;
+            info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            break;
+        case RENDER_GRAPH_ACCESS_TRANSFER_DST:
+            info.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            info.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            info.access = VK_ACCESS_TRANSFER_WRITE_BIT;
+            info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+            info.write = 1;
+            break;
+    }
+    return info;
+}
+
+// A use that overwrites every texel without looking at the old ones
+static int use_discards(const render_graph_use* use) {
+    if (use->access == RENDER_GRAPH_ACCESS_RESOLVE) {
+        return 1;
+    }
+    return (use->access == RENDER_GRAPH_ACCESS_COLOR || use->access == RENDER_GRAPH_ACCESS_DEPTH) &&
+           use->load_op != VK_ATTACHMENT_LOAD_OP_LOAD;
+}
+
+static int is_depth_format(VkFormat format) {
+    return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_X8_D24_UNORM_PACK32 ||
+           format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D24_UNORM_S8_UINT ||
+           format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+// Only needs to cover the formats the engine renders to; the rest are
+// counted as 32-bit
+static uint32_t format_texel_bytes(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_D16_UNORM:
+            return 2;
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            return 5;
+        default:
+            return 4;
+    }
+}
+
+static VkImageAspectFlags aspect_for_format(VkFormat format) {
+    return is_depth_format(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+}
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static const render_graph_use* find_use(const render_graph_pass* pass, uint32_t image, int last) {
+    const render_graph_use* found = NULL;
+    for (uint32_t i = 0; i < pass->use_count; i++) {
+        if (pass->uses[i].image == image) {
+            found = &pass->uses[i];
+            if (!last) {
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+static uint32_t find_attachment(const render_graph_step* step, uint32_t image) {
+    for (uint32_t i = 0; i < step->attachment_count; i++) {
+        if (step->attachments[i] == image) {
+            return i;
+        }
+    }
+    return RENDER_GRAPH_NONE;
+}
+
+render_graph* render_graph_create(VkDevice device, gpu_allocator* allocator) {
+    render_graph* graph = calloc(1, sizeof(render_graph));
+    if (!graph) {
+        return NULL;
+    }
+    
+    graph->device = device;
+    graph->allocator = allocator;
+    return graph;
+}
+
+void render_graph_reset(render_graph* graph) {
+    if (!graph) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < graph->step_count; i++) {
+        render_graph_step* step = &graph->steps[i];
+        for (uint32_t j = 0; j < step->framebuffer_count; j++) {
+            vkDestroyFramebuffer(graph->device, step->framebuffers[j], NULL);
+        }
+    }
+    
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        render_graph_image* image = &graph->images[i];
+        if (image->imported) {
+            continue;
+        }
+        if (image->views[0] != VK_NULL_HANDLE) {
+            vkDestroyImageView(graph->device, image->views[0], NULL);
+        }
+        gpu_destroy_image(graph->allocator, image->images[0], &image->allocation);
+    }
+    gpu_free(graph->allocator, &graph->pool_allocation);
+    
+    memset(graph->images, 0, sizeof(graph->images));
+    memset(graph->passes, 0, sizeof(graph->passes));
+    memset(graph->steps, 0, sizeof(graph->steps));
+    memset(&graph->final_barriers, 0, sizeof(graph->final_barriers));
+    memset(&graph->stats, 0, sizeof(graph->stats));
+    graph->image_count = 0;
+    graph->pass_count = 0;
+    graph->step_count = 0;
+    graph->invalid = 0;
+    graph->compiled = 0;
+}
+
+void render_graph_destroy(render_graph* graph) {
+    if (!graph) {
+        return;
+    }
+    
+    render_graph_reset(graph);
+    for (uint32_t i = 0; i < graph->render_pass_count; i++) {
+        vkDestroyRenderPass(graph->device, graph->render_passes[i].render_pass, NULL);
+    }
+    free(graph);
+}
+
+static render_graph_image* add_image(render_graph* graph, const char* name, VkFormat format, VkExtent2D extent,
+                                     uint32_t* index) {
+    if (graph->image_count >= RENDER_GRAPH_MAX_IMAGES) {
+        graph->invalid = 1;
+        *index = RENDER_GRAPH_NONE;
+        return NULL;
+    }
+    
+    *index = graph->image_count++;
+    render_graph_image* image = &graph->images[*index];
+    memset(image, 0, sizeof(*image));
+    strncpy(image->name, name, RENDER_GRAPH_NAME_MAX - 1);
+    image->format = format;
+    image->extent = extent;
+    image->samples = VK_SAMPLE_COUNT_1_BIT;
+    return image;
+}
+
+uint32_t render_graph_import_image(render_graph* graph, const char* name, VkFormat format, VkExtent2D extent,
+                                   const VkImage* images, const VkImageView* views, uint32_t count,
+                                   VkImageLayout initial_layout, VkImageLayout final_layout) {
+    if (count == 0 || count > RENDER_GRAPH_MAX_VIEWS) {
+        graph->invalid = 1;
+        return RENDER_GRAPH_NONE;
+    }
+    
+    uint32_t index;
+    render_graph_image* image = add_image(graph, name, format, extent, &index);
+    if (!image) {
+        return RENDER_GRAPH_NONE;
+    }
+    
+    image->imported = 1;
+    image->initial_layout = initial_layout;
+    image->final_layout = final_layout;
+    image->view_count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        image->images[i] = images[i];
+        image->views[i] = views[i];
+    }
+    return index;
+}
+
+uint32_t render_graph_create_image(render_graph* graph, const char* name, VkFormat format, VkExtent2D extent,
+                                   VkSampleCountFlagBits samples) {
+    uint32_t index;
+    render_graph_image* image = add_image(graph, name, format, extent, &index);
+    if (!image) {
+        return RENDER_GRAPH_NONE;
+    }
+    
+    image->samples = samples;
+    image->view_count = 1;
+    return index;
+}
+
+void render_graph_output(render_graph* graph, uint32_t image) {
+    if (image >= graph->image_count) {
+        graph->invalid = 1;
+        return;
+    }
+    graph->images[image].output = 1;
+}
+
+void render_graph_set_clear(render_graph* graph, uint32_t image, const VkClearValue* clear) {
+    if (image < graph->image_count) {
+        graph->images[image].clear = *clear;
+    }
+}
+
+uint32_t render_graph_add_pass(render_graph* graph, const char* name, render_graph_pass_type type,
+                               render_graph_record_fn record, void* user) {
+    if (graph->pass_count >= RENDER_GRAPH_MAX_PASSES) {
+        graph->invalid = 1;
+        return RENDER_GRAPH_NONE;
+    }
+    
+    uint32_t index = graph->pass_count++;
+    render_graph_pass* pass = &graph->passes[index];
+    memset(pass, 0, sizeof(*pass));
+    strncpy(pass->name, name, RENDER_GRAPH_NAME_MAX - 1);
+    pass->type = type;
+    pass->record = record;
+    pass->user = user;
+    pass->profile_scope = RENDER_GRAPH_NONE;
+    pass->step = RENDER_GRAPH_NONE;
+    return index;
+}
+
+void render_graph_use_image(render_graph* graph, uint32_t pass, uint32_t image, render_graph_access access,
+                            VkAttachmentLoadOp load_op) {
+    if (pass >= graph->pass_count || image >= graph->image_count ||
+        graph->passes[pass].use_count >= RENDER_GRAPH_MAX_USES) {
+        graph->invalid = 1;
+        return;
+    }
+    
+    // Attachments only make sense inside a render pass
+    render_graph_use use = {image, access, load_op};
+    if (graph->passes[pass].type == RENDER_GRAPH_PASS_TRANSFER && describe_use(&use).attachment) {
+        graph->invalid = 1;
+        return;
+    }
+    
+    graph->passes[pass].uses[graph->passes[pass].use_count++] = use;
+}
+
+void render_graph_set_profile_scope(render_graph* graph, uint32_t pass, uint32_t scope) {
+    if (pass < graph->pass_count) {
+        graph->passes[pass].profile_scope = scope;
+    }
+}
+
+void render_graph_set_render_area(render_graph* graph, uint32_t pass, VkExtent2D area) {
+    if (pass < graph->pass_count) {
+        graph->passes[pass].render_area = area;
+    }
+}
+
+void render_graph_set_standalone(render_graph* graph, uint32_t pass) {
+    if (pass < graph->pass_count) {
+        graph->passes[pass].standalone = 1;
+    }
+}
+
+void render_graph_set_contents(render_graph* graph, uint32_t pass, VkSubpassContents contents) {
+    if (pass < graph->pass_count) {
+        graph->passes[pass].contents = contents;
+    }
+}
+
+// Walk backwards from the outputs: a pass lives if something later needs
+// what it writes. Discarding writes end the need for older contents.
+static void cull_passes(render_graph* graph) {
+    int needed[RENDER_GRAPH_MAX_IMAGES] = {0};
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        needed[i] = graph->images[i].output;
+    }
+    
+    for (uint32_t n = graph->pass_count; n-- > 0;) {
+        render_graph_pass* pass = &graph->passes[n];
+        pass->live = 0;
+        for (uint32_t i = 0; i < pass->use_count; i++) {
+            if (describe_use(&pass->uses[i]).write && needed[pass->uses[i].image]) {
+                pass->live = 1;
+            }
+        }
+        
+        if (!pass->live) {
+            graph->stats.culled_passes++;
+            continue;
+        }
+        
+        for (uint32_t i = 0; i < pass->use_count; i++) {
+            if (use_discards(&pass->uses[i])) {
+                needed[pass->uses[i].image] = 0;
+            }
+        }
+        for (uint32_t i = 0; i < pass->use_count; i++) {
+            const render_graph_use* use = &pass->uses[i];
+            if (!describe_use(use).write || use->load_op == VK_ATTACHMENT_LOAD_OP_LOAD) {
+                needed[use->image] = 1;
+            }
+        }
+    }
+}
+
+// Extent shared by a graphics pass's attachments, or zero if they disagree
+static VkExtent2D pass_extent(render_graph* graph, const render_graph_pass* pass) {
+    VkExtent2D extent = {0, 0};
+    for (uint32_t i = 0; i < pass->use_count; i++) {
+        if (!describe_use(&pass->uses[i]).attachment) {
+            continue;
+        }
+        VkExtent2D image_extent = graph->images[pass->uses[i].image].extent;
+        if (extent.width == 0) {
+            extent = image_extent;
+        } else if (extent.width != image_extent.width || extent.height != image_extent.height) {
+            VkExtent2D none = {0, 0};
+            return none;
+        }
+    }
+    return extent;
+}
+
+// Consecutive graphics passes become subpasses of one render pass when they
+// cover the same area and only hand each other data through attachments,
+// which keeps the intermediate results in tile memory on mobile GPUs
+static int can_merge(render_graph* graph, const render_graph_step* step, const render_graph_pass* pass) {
+    const render_graph_pass* first = &graph->passes[step->passes[0]];
+    if (first->type != RENDER_GRAPH_PASS_GRAPHICS || pass->type != RENDER_GRAPH_PASS_GRAPHICS ||
+        first->standalone || pass->standalone || step->pass_count >= RENDER_GRAPH_MAX_PASSES) {
+        return 0;
+    }
+    
+    VkExtent2D extent = pass_extent(graph, pass);
+    if (extent.width != step->extent.width || extent.height != step->extent.height ||
+        pass->render_area.width != first->render_area.width ||
+        pass->render_area.height != first->render_area.height) {
+        return 0;
+    }
+    
+    uint32_t attachment_count = step->attachment_count;
+    for (uint32_t i = 0; i < pass->use_count; i++) {
+        const render_graph_use* use = &pass->uses[i];
+        int inside = find_attachment(step, use->image) != RENDER_GRAPH_NONE;
+        if (!describe_use(use).attachment) {
+            // Sampling an attachment of the running render pass needs a real barrier
+            if (inside) {
+                return 0;
+            }
+            continue;
+        }
+        if (!inside && find_use(pass, use->image, 0) == use) {
+            attachment_count++;
+        }
+    }
+    return attachment_count <= RENDER_GRAPH_MAX_ATTACHMENTS;
+}
+
+static int build_steps(render_graph* graph) {
+    for (uint32_t p = 0; p < graph->pass_count; p++) {
+        render_graph_pass* pass = &graph->passes[p];
+        if (!pass->live) {
+            continue;
+        }
+        
+        render_graph_step* step = NULL;
+        if (graph->step_count > 0 && can_merge(graph, &graph->steps[graph->step_count - 1], pass)) {
+            step = &graph->steps[graph->step_count - 1];
+            graph->stats.merged_passes++;
+        } else {
+            step = &graph->steps[graph->step_count++];
+            if (pass->type == RENDER_GRAPH_PASS_GRAPHICS) {
+                step->extent = pass_extent(graph, pass);
+                if (step->extent.width == 0) {
+                    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+                                        "render graph: pass '%s' has mismatched attachment sizes", pass->name);
+                    return 0;
+                }
+            }
+        }
+        
+        pass->step = (uint32_t)(step - graph->steps);
+        pass->subpass = step->pass_count;
+        step->passes[step->pass_count++] = p;
+        
+        for (uint32_t i = 0; i < pass->use_count; i++) {
+            const render_graph_use* use = &pass->uses[i];
+            if (describe_use(use).attachment && find_attachment(step, use->image) == RENDER_GRAPH_NONE) {
+                if (step->attachment_count >= RENDER_GRAPH_MAX_ATTACHMENTS) {
+                    return 0;
+                }
+                step->attachments[step->attachment_count++] = use->image;
+            }
+        }
+    }
+    
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        graph->images[i].first_step = RENDER_GRAPH_NONE;
+    }
+    
+    for (uint32_t s = 0; s < graph->step_count; s++) {
+        render_graph_step* step = &graph->steps[s];
+        for (uint32_t k = 0; k < step->pass_count; k++) {
+            render_graph_pass* pass = &graph->passes[step->passes[k]];
+            for (uint32_t i = 0; i < pass->use_count; i++) {
+                render_graph_image* image = &graph->images[pass->uses[i].image];
+                image->used = 1;
+                image->usage |= describe_use(&pass->uses[i]).usage;
+                if (image->first_step == RENDER_GRAPH_NONE) {
+                    image->first_step = s;
+                }
+                image->last_step = s;
+            }
+        }
+    }
+    return 1;
+}
+
+// A transient that lives and dies inside one render pass, starting from a
+// discard, never has to leave tile memory
+static int is_lazy_candidate(render_graph* graph, uint32_t index) {
+    render_graph_image* image = &graph->images[index];
+    if (image->imported || image->first_step != image->last_step) {
+        return 0;
+    }
+    
+    VkImageUsageFlags attachment_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                         VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                         VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+    if (image->usage & ~attachment_usage) {
+        return 0;
+    }
+    
+    const render_graph_step* step = &graph->steps[image->first_step];
+    for (uint32_t k = 0; k < step->pass_count; k++) {
+        const render_graph_use* use = find_use(&graph->passes[step->passes[k]], index, 0);
+        if (use) {
+            return use_discards(use);
+        }
+    }
+    return 0;
+}
+
+static int has_lazy_memory(render_graph* graph, uint32_t type_bits) {
+    const VkPhysicalDeviceMemoryProperties* properties = &graph->allocator->memory_properties;
+    for (uint32_t i = 0; i < properties->memoryTypeCount; i++) {
+        if ((type_bits & (1u << i)) &&
+            (properties->memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int lifetimes_overlap(const render_graph_image* a, const render_graph_image* b) {
+    return a->first_step <= b->last_step && b->first_step <= a->last_step;
+}
+
+static int memory_overlaps(const render_graph_image* a, const render_graph_image* b) {
+    return a->pooled && b->pooled &&
+           a->pool_offset < b->pool_offset + b->requirements.size &&
+           b->pool_offset < a->pool_offset + a->requirements.size;
+}
+
+// Lowest offset where the image fits without touching a placed image whose
+// lifetime overlaps its own
+static VkDeviceSize place_image(render_graph* graph, const uint32_t* placed, uint32_t placed_count,
+                                const render_graph_image* image) {
+    VkDeviceSize alignment = image->requirements.alignment ? image->requirements.alignment : 1;
+    VkDeviceSize offset = 0;
+    int moved = 1;
+    while (moved) {
+        moved = 0;
+        offset = align_up(offset, alignment);
+        for (uint32_t i = 0; i < placed_count; i++) {
+            const render_graph_image* other = &graph->images[placed[i]];
+            VkDeviceSize other_end = other->pool_offset + other->requirements.size;
+            if (lifetimes_overlap(image, other) &&
+                offset < other_end && other->pool_offset < offset + image->requirements.size) {
+                offset = other_end;
+                moved = 1;
+                break;
+            }
+        }
+    }
+    return offset;
+}
+
+static int create_transients(render_graph* graph) {
+    uint32_t order[RENDER_GRAPH_MAX_IMAGES];
+    uint32_t order_count = 0;
+    
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        render_graph_image* image = &graph->images[i];
+        if (image->imported || !image->used) {
+            continue;
+        }
+        
+        image->lazy = is_lazy_candidate(graph, i);
+        
+        VkImageCreateInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        info.imageType = VK_IMAGE_TYPE_2D;
+        info.format = image->format;
+        info.extent.width = image->extent.width;
+        info.extent.height = image->extent.height;
+        info.extent.depth = 1;
+        info.mipLevels = 1;
+        info.arrayLayers = 1;
+        info.samples = image->samples;
+        info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        info.usage = image->usage | (image->lazy ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0);
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        
+        if (vkCreateImage(graph->device, &info, NULL, &image->images[0]) != VK_SUCCESS) {
+            return 0;
+        }
+        vkGetImageMemoryRequirements(graph->device, image->images[0], &image->requirements);
+        graph->stats.transient_images++;
+        
+        // Lazily allocated memory only gets physical pages if the tile spills
+        if (image->lazy && has_lazy_memory(graph, image->requirements.memoryTypeBits) &&
+            gpu_alloc(graph->allocator, &image->requirements,
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, 0,
+                      GPU_RESOURCE_OPTIMAL, &image->allocation)) {
+            if (vkBindImageMemory(graph->device, image->images[0], image->allocation.memory,
+                                  image->allocation.offset) != VK_SUCCESS) {
+                return 0;
+            }
+            graph->stats.lazy_images++;
+            graph->stats.lazy_bytes += image->requirements.size;
+            continue;
+        }
+        image->lazy = 0;
+        
+        graph->stats.transient_bytes += image->requirements.size;
+        uint32_t slot = order_count++;
+        while (slot > 0 && graph->images[order[slot - 1]].requirements.size < image->requirements.size) {
+            order[slot] = order[slot - 1];
+            slot--;
+        }
+        order[slot] = i;
+    }
+    
+    // Largest first, each at the lowest offset free for its lifetime. Images
+    // whose memory types don't intersect the pool's get their own allocation.
+    uint32_t placed[RENDER_GRAPH_MAX_IMAGES];
+    uint32_t placed_count = 0;
+    uint32_t type_bits = UINT32_MAX;
+    VkDeviceSize pool_size = 0;
+    VkDeviceSize pool_alignment = 1;
+    
+    for (uint32_t n = 0; n < order_count; n++) {
+        render_graph_image* image = &graph->images[order[n]];
+        if (!(type_bits & image->requirements.memoryTypeBits)) {
+            if (!gpu_alloc(graph->allocator, &image->requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+                           GPU_RESOURCE_OPTIMAL, &image->allocation) ||
+                vkBindImageMemory(graph->device, image->images[0], image->allocation.memory,
+                                  image->allocation.offset) != VK_SUCCESS) {
+                return 0;
+            }
+            graph->stats.aliased_bytes += image->requirements.size;
+            continue;
+        }
+        
+        type_bits &= image->requirements.memoryTypeBits;
+        image->pool_offset = place_image(graph, placed, placed_count, image);
+        image->pooled = 1;
+        placed[placed_count++] = order[n];
+        
+        if (image->pool_offset + image->requirements.size > pool_size) {
+            pool_size = image->pool_offset + image->requirements.size;
+        }
+        if (image->requirements.alignment > pool_alignment) {
+            pool_alignment = image->requirements.alignment;
+        }
+    }
+    
+    if (pool_size > 0) {
+        VkMemoryRequirements requirements = {pool_size, pool_alignment, type_bits};
+        if (!gpu_alloc(graph->allocator, &requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+                       GPU_RESOURCE_OPTIMAL, &graph->pool_allocation)) {
+            return 0;
+        }
+        graph->stats.aliased_bytes += pool_size;
+        
+        for (uint32_t n = 0; n < placed_count; n++) {
+            render_graph_image* image = &graph->images[placed[n]];
+            if (vkBindImageMemory(graph->device, image->images[0], graph->pool_allocation.memory,
+                                  graph->pool_allocation.offset + image->pool_offset) != VK_SUCCESS) {
+                return 0;
+            }
+        }
+    }
+    
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        render_graph_image* image = &graph->images[i];
+        if (image->imported || !image->used) {
+            continue;
+        }
+        
+        VkImageViewCreateInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        info.image = image->images[0];
+        info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        info.format = image->format;
+        info.subresourceRange.aspectMask = aspect_for_format(image->format);
+        info.subresourceRange.levelCount = 1;
+        info.subresourceRange.layerCount = 1;
+        if (vkCreateImageView(graph->device, &info, NULL, &image->views[0]) != VK_SUCCESS) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// An imported image whose last use is as an attachment gets its final
+// layout from the render pass instead of a separate barrier
+static int leaves_in_final_layout(render_graph* graph, uint32_t step, uint32_t index) {
+    render_graph_image* image = &graph->images[index];
+    return image->imported && image->final_layout != VK_IMAGE_LAYOUT_UNDEFINED && image->last_step == step &&
+           find_attachment(&graph->steps[step], index) != RENDER_GRAPH_NONE;
+}
+
+// Simulate one frame and derive the barrier in front of each step from the
+// first use of every image it touches. Only writes, layout changes and reads
+// of not yet visible writes need one.
+static void plan_barriers(render_graph* graph, image_state* states, int record) {
+    for (uint32_t s = 0; s < graph->step_count; s++) {
+        render_graph_step* step = &graph->steps[s];
+        render_graph_barrier_batch* batch = &step->barriers;
+        memset(batch, 0, sizeof(*batch));
+        uint32_t seen[RENDER_GRAPH_MAX_IMAGES];
+        uint32_t seen_count = 0;
+        
+        for (uint32_t k = 0; k < step->pass_count; k++) {
+            render_graph_pass* pass = &graph->passes[step->passes[k]];
+            for (uint32_t u = 0; u < pass->use_count; u++) {
+                uint32_t index = pass->uses[u].image;
+                int already = 0;
+                for (uint32_t i = 0; i < seen_count; i++) {
+                    already |= seen[i] == index;
+                }
+                if (already) {
+                    continue;
+                }
+                seen[seen_count++] = index;
+                
+                // Everything the step does to this image
+                const render_graph_use* first_use = &pass->uses[u];
+                const render_graph_use* last_use = first_use;
+                VkPipelineStageFlags write_stages = 0;
+                VkAccessFlags write_access = 0;
+                VkPipelineStageFlags read_stages = 0;
+                for (uint32_t j = k; j < step->pass_count; j++) {
+                    const render_graph_pass* other = &graph->passes[step->passes[j]];
+                    for (uint32_t v = 0; v < other->use_count; v++) {
+                        if (other->uses[v].image != index) {
+                            continue;
+                        }
+                        use_info info = describe_use(&other->uses[v]);
+                        if (info.write) {
+                            write_stages |= info.stages;
+                            write_access |= info.access;
+                        } else {
+                            read_stages |= info.stages;
+                        }
+                        last_use = &other->uses[v];
+                    }
+                }
+                
+                image_state* state = &states[index];
+                use_info info = describe_use(first_use);
+                int transition = state->layout != info.layout;
+                int needed = transition;
+                VkPipelineStageFlags src_stages = 0;
+                VkAccessFlags src_access = 0;
+                
+                if (write_stages || transition) {
+                    src_stages = state->write_stages | state->read_stages;
+                    src_access = state->write_access;
+                    needed |= src_stages != 0;
+                } else if (state->write_stages && (state->visible_stages & info.stages) != info.stages) {
+                    src_stages = state->write_stages;
+                    src_access = state->write_access;
+                    needed = 1;
+                }
+                
+                if (needed) {
+                    // Nothing earlier in the frame: chain onto the semaphore wait instead
+                    if (!src_stages) {
+                        src_stages = info.stages;
+                    }
+                    render_graph_barrier* barrier = &batch->barriers[batch->count++];
+                    barrier->image = index;
+                    barrier->old_layout = use_discards(first_use) ? VK_IMAGE_LAYOUT_UNDEFINED : state->layout;
+                    barrier->new_layout = info.layout;
+                    barrier->src_access = src_access;
+                    barrier->dst_access = info.access;
+                    batch->src_stages |= src_stages;
+                    batch->dst_stages |= info.stages;
+                }
+                
+                if (record && graph->images[index].first_stage == 0) {
+                    graph->images[index].first_stage = info.stages;
+                }
+                
+                state->layout = leaves_in_final_layout(graph, s, index) ? graph->images[index].final_layout
+                                                                        : describe_use(last_use).layout;
+                if (write_stages) {
+                    state->write_stages = write_stages;
+                    state->write_access = write_access;
+                    state->read_stages = read_stages;
+                    state->visible_stages = 0;
+                } else {
+                    state->read_stages |= read_stages;
+                    if (needed) {
+                        state->visible_stages |= info.stages;
+                    }
+                }
+            }
+        }
+    }
+    
+    render_graph_barrier_batch* batch = &graph->final_barriers;
+    memset(batch, 0, sizeof(*batch));
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        render_graph_image* image = &graph->images[i];
+        image_state* state = &states[i];
+        if (!image->imported || !image->used || image->final_layout == VK_IMAGE_LAYOUT_UNDEFINED ||
+            state->layout == image->final_layout) {
+            continue;
+        }
+        
+        render_graph_barrier* barrier = &batch->barriers[batch->count++];
+        barrier->image = i;
+        barrier->old_layout = state->layout;
+        barrier->new_layout = image->final_layout;
+        barrier->src_access = state->write_access;
+        barrier->dst_access = 0;
+        batch->src_stages |= state->write_stages | state->read_stages;
+        batch->dst_stages |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        state->layout = image->final_layout;
+    }
+    if (batch->count > 0 && batch->src_stages == 0) {
+        batch->src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    }
+}
+
+static void build_barriers(render_graph* graph) {
+    image_state start[RENDER_GRAPH_MAX_IMAGES];
+    image_state end[RENDER_GRAPH_MAX_IMAGES];
+    memset(start, 0, sizeof(start));
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        if (graph->images[i].imported) {
+            start[i].layout = graph->images[i].initial_layout;
+        }
+    }
+    
+    // A transient's first use must wait for whatever last touched its memory:
+    // itself in the previous frame and every image aliased onto it
+    memcpy(end, start, sizeof(end));
+    plan_barriers(graph, end, 0);
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        render_graph_image* image = &graph->images[i];
+        if (image->imported) {
+            continue;
+        }
+        for (uint32_t j = 0; j < graph->image_count; j++) {
+            if (j == i || memory_overlaps(image, &graph->images[j])) {
+                start[i].write_stages |= end[j].write_stages | end[j].read_stages;
+                start[i].write_access |= end[j].write_access;
+            }
+        }
+    }
+    
+    plan_barriers(graph, start, 1);
+    
+    for (uint32_t s = 0; s < graph->step_count; s++) {
+        graph->stats.barrier_count += graph->steps[s].barriers.count;
+    }
+    graph->stats.barrier_count += graph->final_barriers.count;
+}
+
+static VkAttachmentLoadOp attachment_load_op(const render_graph_use* use) {
+    if (use->access == RENDER_GRAPH_ACCESS_RESOLVE) {
+        return VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    }
+    if (use->access == RENDER_GRAPH_ACCESS_INPUT) {
+        return VK_ATTACHMENT_LOAD_OP_LOAD;
+    }
+    return use->load_op;
+}
+
+// Identical descriptions hash the same, so rebuilding the graph (swapchain
+// resize, render scale change) returns the render pass pipelines were built for
+static VkRenderPass find_or_create_render_pass(render_graph* graph, const VkRenderPassCreateInfo* info) {
+    uint64_t hash = hash_fnv1a64(info->pAttachments, info->attachmentCount * sizeof(VkAttachmentDescription),
+                                 HASH_FNV1A64_SEED);
+    for (uint32_t i = 0; i < info->subpassCount; i++) {
+        const VkSubpassDescription* subpass = &info->pSubpasses[i];
+        uint32_t counts[4] = {subpass->colorAttachmentCount, subpass->inputAttachmentCount,
+                              subpass->preserveAttachmentCount, subpass->pResolveAttachments != NULL};
+        hash = hash_fnv1a64(counts, sizeof(counts), hash);
+        hash = hash_fnv1a64(subpass->pColorAttachments,
+                            subpass->colorAttachmentCount * sizeof(VkAttachmentReference), hash);
+        if (subpass->pResolveAttachments) {
+            hash = hash_fnv1a64(subpass->pResolveAttachments,
+                                subpass->colorAttachmentCount * sizeof(VkAttachmentReference), hash);
+        }
+        hash = hash_fnv1a64(subpass->pInputAttachments,
+                            subpass->inputAttachmentCount * sizeof(VkAttachmentReference), hash);
+        if (subpass->pDepthStencilAttachment) {
+            hash = hash_fnv1a64(subpass->pDepthStencilAttachment, sizeof(VkAttachmentReference), hash);
+        }
+        hash = hash_fnv1a64(subpass->pPreserveAttachments, subpass->preserveAttachmentCount * sizeof(uint32_t),
+                            hash);
+    }
+    hash = hash_fnv1a64(info->pDependencies, info->dependencyCount * sizeof(VkSubpassDependency), hash);
+    
+    for (uint32_t i = 0; i < graph->render_pass_count; i++) {
+        if (graph->render_passes[i].hash == hash) {
+            return graph->render_passes[i].render_pass;
+        }
+    }
+    
+    if (graph->render_pass_count >= RENDER_GRAPH_MAX_RENDER_PASSES) {
+        return VK_NULL_HANDLE;
+    }
+    
+    VkRenderPass render_pass;
+    if (vkCreateRenderPass(graph->device, info, NULL, &render_pass) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+    graph->render_passes[graph->render_pass_count].hash = hash;
+    graph->render_passes[graph->render_pass_count].render_pass = render_pass;
+    graph->render_pass_count++;
+    return render_pass;
+}
+
+static int create_step_render_pass(render_graph* graph, uint32_t s) {
+    render_graph_step* step = &graph->steps[s];
+    
+    VkAttachmentDescription attachments[RENDER_GRAPH_MAX_ATTACHMENTS];
+    memset(attachments, 0, sizeof(attachments));
+    for (uint32_t a = 0; a < step->attachment_count; a++) {
+        render_graph_image* image = &graph->images[step->attachments[a]];
+        const render_graph_use* first_use = NULL;
+        const render_graph_use* last_use = NULL;
+        for (uint32_t k = 0; k < step->pass_count; k++) {
+            const render_graph_use* use = find_use(&graph->passes[step->passes[k]], step->attachments[a], 0);
+            if (use && describe_use(use).attachment) {
+                if (!first_use) {
+                    first_use = use;
+                }
+                last_use = find_use(&graph->passes[step->passes[k]], step->attachments[a], 1);
+            }
+        }
+        
+        attachments[a].format = image->format;
+        attachments[a].samples = image->samples;
+        attachments[a].loadOp = attachment_load_op(first_use);
+        attachments[a].storeOp = image->imported || image->last_step > s ? VK_ATTACHMENT_STORE_OP_STORE
+                                                                         : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[a].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[a].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[a].initialLayout = describe_use(first_use).layout;
+        attachments[a].finalLayout = leaves_in_final_layout(graph, s, step->attachments[a])
+                                     ? image->final_layout : describe_use(last_use).layout;
+        
+        uint64_t bytes = (uint64_t)step->extent.width * step->extent.height * image->samples *
+                         format_texel_bytes(image->format);
+        if (attachments[a].loadOp == VK_ATTACHMENT_LOAD_OP_LOAD) {
+            graph->stats.load_bytes += bytes;
+        }
+        if (attachments[a].storeOp == VK_ATTACHMENT_STORE_OP_STORE) {
+            graph->stats.store_bytes += bytes;
+        }
+    }
+    
+    VkAttachmentReference color_refs[RENDER_GRAPH_MAX_PASSES][RENDER_GRAPH_MAX_ATTACHMENTS];
+    VkAttachmentReference resolve_refs[RENDER_GRAPH_MAX_PASSES][RENDER_GRAPH_MAX_ATTACHMENTS];
+    VkAttachmentReference input_refs[RENDER_GRAPH_MAX_PASSES][RENDER_GRAPH_MAX_ATTACHMENTS];
+    VkAttachmentReference depth_refs[RENDER_GRAPH_MAX_PASSES];
+    uint32_t preserve[RENDER_GRAPH_MAX_PASSES][RENDER_GRAPH_MAX_ATTACHMENTS];
+    VkSubpassDescription subpasses[RENDER_GRAPH_MAX_PASSES];
+    memset(subpasses, 0, sizeof(subpasses));
+    
+    for (uint32_t k = 0; k < step->pass_count; k++) {
+        const render_graph_pass* pass = &graph->passes[step->passes[k]];
+        VkSubpassDescription* subpass = &subpasses[k];
+        int has_resolve = 0;
+        int has_depth = 0;
+        subpass->pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        
+        for (uint32_t i = 0; i < pass->use_count; i++) {
+            const render_graph_use* use = &pass->uses[i];
+            uint32_t slot = find_attachment(step, use->image);
+            VkImageLayout layout = describe_use(use).layout;
+            switch (use->access) {
+                case RENDER_GRAPH_ACCESS_COLOR:
+                    color_refs[k][subpass->colorAttachmentCount].attachment = slot;
+                    color_refs[k][subpass->colorAttachmentCount].layout = layout;
+                    resolve_refs[k][subpass->colorAttachmentCount].attachment = VK_ATTACHMENT_UNUSED;
+                    resolve_refs[k][subpass->colorAttachmentCount].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                    subpass->colorAttachmentCount++;
+                    break;
+                case RENDER_GRAPH_ACCESS_RESOLVE:
+                    // Resolves the color attachment declared just before it
+                    if (subpass->colorAttachmentCount > 0) {
+                        resolve_refs[k][subpass->colorAttachmentCount - 1].attachment = slot;
+                        resolve_refs[k][subpass->colorAttachmentCount - 1].layout = layout;
+                        has_resolve = 1;
+                    }
+                    break;
+                case RENDER_GRAPH_ACCESS_DEPTH:
+                    depth_refs[k].attachment = slot;
+                    depth_refs[k].layout = layout;
+                    has_depth = 1;
+                    break;
+                case RENDER_GRAPH_ACCESS_INPUT:
+                    input_refs[k][subpass->inputAttachmentCount].attachment = slot;
+                    input_refs[k][subpass->inputAttachmentCount].layout = layout;
+                    subpass->inputAttachmentCount++;
+                    break;
+                default:
+                    break;
+            }
+        }
+        
+        // Attachments a later subpass reads back must survive this one
+        for (uint32_t a = 0; a < step->attachment_count; a++) {
+            int before = 0;
+            int after = 0;
+            for (uint32_t j = 0; j < step->pass_count; j++) {
+                if (j != k && find_use(&graph->passes[step->passes[j]], step->attachments[a], 0)) {
+                    before |= j < k;
+                    after |= j > k;
+                }
+            }
+            if (before && after && !find_use(pass, step->attachments[a], 0)) {
+                preserve[k][subpass->preserveAttachmentCount++] = a;
+            }
+        }
+        
+        subpass->pColorAttachments = color_refs[k];
+        subpass->pResolveAttachments = has_resolve ? resolve_refs[k] : NULL;
+        subpass->pDepthStencilAttachment = has_depth ? &depth_refs[k] : NULL;
+        subpass->pInputAttachments = input_refs[k];
+        subpass->pPreserveAttachments = preserve[k];
+    }
+    
+    // Subpasses sharing an attachment are ordered per region, which lets a
+    // tiler keep the data on chip between them
+    VkSubpassDependency dependencies[RENDER_GRAPH_MAX_PASSES * RENDER_GRAPH_MAX_ATTACHMENTS];
+    uint32_t dependency_count = 0;
+    memset(dependencies, 0, sizeof(dependencies));
+    for (uint32_t k = 1; k < step->pass_count; k++) {
+        const render_graph_pass* pass = &graph->passes[step->passes[k]];
+        for (uint32_t a = 0; a < step->attachment_count; a++) {
+            const render_graph_use* dst_use = find_use(pass, step->attachments[a], 0);
+            if (!dst_use) {
+                continue;
+            }
+            for (uint32_t j = k; j-- > 0;) {
+                const render_graph_use* src_use = find_use(&graph->passes[step->passes[j]], step->attachments[a], 1);
+                if (!src_use) {
+                    continue;
+                }
+                use_info src = describe_use(src_use);
+                use_info dst = describe_use(dst_use);
+                
+                VkSubpassDependency* dependency = NULL;
+                for (uint32_t d = 0; d < dependency_count; d++) {
+                    if (dependencies[d].srcSubpass == j && dependencies[d].dstSubpass == k) {
+                        dependency = &dependencies[d];
+                    }
+                }
+                if (!dependency) {
+                    dependency = &dependencies[dependency_count++];
+                    dependency->srcSubpass = j;
+                    dependency->dstSubpass = k;
+                    dependency->dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+                }
+                dependency->srcStageMask |= src.stages;
+                dependency->srcAccessMask |= src.write ? src.access : 0;
+                dependency->dstStageMask |= dst.stages;
+                dependency->dstAccessMask |= dst.access;
+                break;
+            }
+        }
+    }
+    
+    VkRenderPassCreateInfo info = {0};
+    info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    info.attachmentCount = step->attachment_count;
+    info.pAttachments = attachments;
+    info.subpassCount = step->pass_count;
+    info.pSubpasses = subpasses;
+    info.dependencyCount = dependency_count;
+    info.pDependencies = dependencies;
+    
+    step->render_pass = find_or_create_render_pass(graph, &info);
+    if (step->render_pass == VK_NULL_HANDLE) {
+        return 0;
+    }
+    graph->stats.render_pass_count++;
+    
+    // One framebuffer per view of a multi-view import (the swapchain)
+    step->framebuffer_count = 1;
+    for (uint32_t a = 0; a < step->attachment_count; a++) {
+        render_graph_image* image = &graph->images[step->attachments[a]];
+        if (image->view_count > step->framebuffer_count) {
+            step->framebuffer_count = image->view_count;
+        }
+    }
+    
+    for (uint32_t f = 0; f < step->framebuffer_count; f++) {
+        VkImageView views[RENDER_GRAPH_MAX_ATTACHMENTS];
+        for (uint32_t a = 0; a < step->attachment_count; a++) {
+            render_graph_image* image = &graph->images[step->attachments[a]];
+            views[a] = image->views[image->view_count > 1 ? f % image->view_count : 0];
+        }
+        
+        VkFramebufferCreateInfo framebuffer_info = {0};
+        framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebuffer_info.renderPass = step->render_pass;
+        framebuffer_info.attachmentCount = step->attachment_count;
+        framebuffer_info.pAttachments = views;
+        framebuffer_info.width = step->extent.width;
+        framebuffer_info.height = step->extent.height;
+        framebuffer_info.layers = 1;
+        if (vkCreateFramebuffer(graph->device, &framebuffer_info, NULL, &step->framebuffers[f]) != VK_SUCCESS) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int render_graph_compile(render_graph* graph) {
+    if (graph->invalid) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "render graph: invalid declaration");
+        return 0;
+    }
+    
+    graph->stats.pass_count = graph->pass_count;
+    cull_passes(graph);
+    if (!build_steps(graph) || !create_transients(graph)) {
+        return 0;
+    }
+    build_barriers(graph);
+    
+    for (uint32_t s = 0; s < graph->step_count; s++) {
+        if (graph->steps[s].attachment_count > 0 && !create_step_render_pass(graph, s)) {
+            return 0;
+        }
+    }
+    
+    graph->compiled = 1;
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+                        "render graph: %u passes (%u culled), %u render passes (%u merged), %u barriers, "
+                        "transient %llu KiB -> %llu KiB aliased, %llu KiB lazy, %llu KiB loaded, %llu KiB stored",
+                        graph->stats.pass_count, graph->stats.culled_passes, graph->stats.render_pass_count,
+                        graph->stats.merged_passes, graph->stats.barrier_count,
+                        (unsigned long long)(graph->stats.transient_bytes >> 10),
+                        (unsigned long long)(graph->stats.aliased_bytes >> 10),
+                        (unsigned long long)(graph->stats.lazy_bytes >> 10),
+                        (unsigned long long)(graph->stats.load_bytes >> 10),
+                        (unsigned long long)(graph->stats.store_bytes >> 10));
+    return 1;
+}
+
+static void record_barriers(render_graph* graph, VkCommandBuffer cmd, const render_graph_barrier_batch* batch,
+                            uint32_t image_index) {
+    if (batch->count == 0) {
+        return;
+    }
+    
+    VkImageMemoryBarrier barriers[RENDER_GRAPH_MAX_IMAGES];
+    for (uint32_t i = 0; i < batch->count; i++) {
+        const render_graph_barrier* barrier = &batch->barriers[i];
+        memset(&barriers[i], 0, sizeof(barriers[i]));
+        barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[i].srcAccessMask = barrier->src_access;
+        barriers[i].dstAccessMask = barrier->dst_access;
+        barriers[i].oldLayout = barrier->old_layout;
+        barriers[i].newLayout = barrier->new_layout;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].image = render_graph_get_image(graph, barrier->image, image_index);
+        barriers[i].subresourceRange.aspectMask = aspect_for_format(graph->images[barrier->image].format);
+        barriers[i].subresourceRange.levelCount = 1;
+        barriers[i].subresourceRange.layerCount = 1;
+    }
+    
+    vkCmdPipelineBarrier(cmd, batch->src_stages, batch->dst_stages, 0, 0, NULL, 0, NULL,
+                         batch->count, barriers);
+}
+
+// Profiler slots are swapchain image indices, matching the renderer's
+// per-image command buffers
+void render_graph_execute(render_graph* graph, VkCommandBuffer cmd, uint32_t image_index, gpu_profiler* profiler) {
+    if (!graph->compiled) {
+        return;
+    }
+    
+    for (uint32_t s = 0; s < graph->step_count; s++) {
+        render_graph_step* step = &graph->steps[s];
+        render_graph_pass* first = &graph->passes[step->passes[0]];
+        record_barriers(graph, cmd, &step->barriers, image_index);
+        
+        if (first->profile_scope != RENDER_GRAPH_NONE) {
+            gpu_profiler_begin(profiler, cmd, image_index, first->profile_scope);
+        }
+        
+        if (step->render_pass == VK_NULL_HANDLE) {
+            first->record(cmd, image_index, first->user);
+        } else {
+            VkClearValue clear_values[RENDER_GRAPH_MAX_ATTACHMENTS];
+            for (uint32_t a = 0; a < step->attachment_count; a++) {
+                clear_values[a] = graph->images[step->attachments[a]].clear;
+            }
+            
+            VkRenderPassBeginInfo begin_info = {0};
+            begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            begin_info.renderPass = step->render_pass;
+            begin_info.framebuffer = step->framebuffers[image_index % step->framebuffer_count];
+            begin_info.renderArea.extent = first->render_area.width ? first->render_area : step->extent;
+            begin_info.clearValueCount = step->attachment_count;
+            begin_info.pClearValues = clear_values;
+            vkCmdBeginRenderPass(cmd, &begin_info, first->contents);
+            
+            for (uint32_t k = 0; k < step->pass_count; k++) {
+                render_graph_pass* pass = &graph->passes[step->passes[k]];
+                if (k > 0) {
+                    vkCmdNextSubpass(cmd, pass->contents);
+                }
+                pass->record(cmd, image_index, pass->user);
+            }
+            vkCmdEndRenderPass(cmd);
+        }
+        
+        if (first->profile_scope != RENDER_GRAPH_NONE) {
+            gpu_profiler_end(profiler, cmd, image_index, first->profile_scope);
+        }
+    }
+    
+    record_barriers(graph, cmd, &graph->final_barriers, image_index);
+}
+
+VkRenderPass render_graph_get_render_pass(render_graph* graph, uint32_t pass) {
+    if (pass >= graph->pass_count || graph->passes[pass].step == RENDER_GRAPH_NONE) {
+        return VK_NULL_HANDLE;
+    }
+    return graph->steps[graph->passes[pass].step].render_pass;
+}
+
+uint32_t render_graph_get_subpass(render_graph* graph, uint32_t pass) {
+    if (pass >= graph->pass_count) {
+        return 0;
+    }
+    return graph->passes[pass].subpass;
+}
+
+VkFramebuffer render_graph_get_framebuffer(render_graph* graph, uint32_t pass, uint32_t image_index) {
+    if (pass >= graph->pass_count || graph->passes[pass].step == RENDER_GRAPH_NONE) {
+        return VK_NULL_HANDLE;
+    }
+    render_graph_step* step = &graph->steps[graph->passes[pass].step];
+    if (step->framebuffer_count == 0) {
+        return VK_NULL_HANDLE;
+    }
+    return step->framebuffers[image_index % step->framebuffer_count];
+}
+
+VkImage render_graph_get_image(render_graph* graph, uint32_t image, uint32_t image_index) {
+    if (image >= graph->image_count) {
+        return VK_NULL_HANDLE;
+    }
+    render_graph_image* entry = &graph->images[image];
+    return entry->images[entry->view_count > 1 ? image_index % entry->view_count : 0];
+}
+
+VkImageView render_graph_get_view(render_graph* graph, uint32_t image, uint32_t image_index) {
+    if (image >= graph->image_count) {
+        return VK_NULL_HANDLE;
+    }
+    render_graph_image* entry = &graph->images[image];
+    return entry->views[entry->view_count > 1 ? image_index % entry->view_count : 0];
+}
+
+VkPipelineStageFlags render_graph_first_stage(render_graph* graph, uint32_t image) {
+    if (image >= graph->image_count || graph->images[image].first_stage == 0) {
+        return VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    }
+    return graph->images[image].first_stage;
+}
+
+void render_graph_get_stats(render_graph* graph, render_graph_stats* stats) {
+    *stats = graph->stats;
+}
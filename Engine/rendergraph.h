@@ -0,0 +1,204 @@
+#pragma once
+
+#include "platform.h"
+#include "allocator.h"
+#include "profiler.h"
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+#define RENDER_GRAPH_MAX_IMAGES 16
+#define RENDER_GRAPH_MAX_PASSES 16
+#define RENDER_GRAPH_MAX_USES 8
+#define RENDER_GRAPH_MAX_VIEWS 8
+#define RENDER_GRAPH_MAX_ATTACHMENTS 8
+#define RENDER_GRAPH_MAX_RENDER_PASSES 16
+#define RENDER_GRAPH_NAME_MAX 32
+#define RENDER_GRAPH_NONE UINT32_MAX
+
+typedef enum {
+    RENDER_GRAPH_PASS_GRAPHICS,
+    RENDER_GRAPH_PASS_TRANSFER
+} render_graph_pass_type;
+
+// How a pass touches an image. Attachments are written, the rest are reads
+// except TRANSFER_DST.
+typedef enum {
+    RENDER_GRAPH_ACCESS_COLOR,
+    RENDER_GRAPH_ACCESS_RESOLVE,
+    RENDER_GRAPH_ACCESS_DEPTH,
+    RENDER_GRAPH_ACCESS_INPUT,
+    RENDER_GRAPH_ACCESS_SAMPLED,
+    RENDER_GRAPH_ACCESS_TRANSFER_SRC,
+    RENDER_GRAPH_ACCESS_TRANSFER_DST
+} render_graph_access;
+
+// Called inside the pass's subpass for graphics passes, outside any render
+// pass for transfer passes
+typedef void (*render_graph_record_fn)(VkCommandBuffer cmd, uint32_t image_index, void* user);
+
+typedef struct {
+    uint32_t image;
+    render_graph_access access;
+    VkAttachmentLoadOp load_op;
+} render_graph_use;
+
+typedef struct {
+    char name[RENDER_GRAPH_NAME_MAX];
+    render_graph_pass_type type;
+    render_graph_record_fn record;
+    void* user;
+    render_graph_use uses[RENDER_GRAPH_MAX_USES];
+    uint32_t use_count;
+    uint32_t profile_scope;
+    VkExtent2D render_area;
+    VkSubpassContents contents;
+    int standalone;
+    int live;
+    uint32_t step;
+    uint32_t subpass;
+} render_graph_pass;
+
+typedef struct {
+    char name[RENDER_GRAPH_NAME_MAX];
+    VkFormat format;
+    VkExtent2D extent;
+    VkSampleCountFlagBits samples;
+    VkImageUsageFlags usage;
+    VkClearValue clear;
+    int imported;
+    int output;
+    VkImageLayout initial_layout;
+    VkImageLayout final_layout;
+    VkImage images[RENDER_GRAPH_MAX_VIEWS];
+    VkImageView views[RENDER_GRAPH_MAX_VIEWS];
+    uint32_t view_count;
+    
+    // Filled in by render_graph_compile
+    int used;
+    int lazy;
+    int pooled;
+    uint32_t first_step;
+    uint32_t last_step;
+    VkMemoryRequirements requirements;
+    VkDeviceSize pool_offset;
+    gpu_allocation allocation;
+    VkPipelineStageFlags first_stage;
+} render_graph_image;
+
+typedef struct {
+    uint32_t image;
+    VkImageLayout old_layout;
+    VkImageLayout new_layout;
+    VkAccessFlags src_access;
+    VkAccessFlags dst_access;
+} render_graph_barrier;
+
+typedef struct {
+    render_graph_barrier barriers[RENDER_GRAPH_MAX_IMAGES];
+    uint32_t count;
+    VkPipelineStageFlags src_stages;
+    VkPipelineStageFlags dst_stages;
+} render_graph_barrier_batch;
+
+// One or more passes executed together: a render pass whose subpasses are
+// the merged graphics passes, or a single transfer pass
+typedef struct {
+    uint32_t passes[RENDER_GRAPH_MAX_PASSES];
+    uint32_t pass_count;
+    uint32_t attachments[RENDER_GRAPH_MAX_ATTACHMENTS];
+    uint32_t attachment_count;
+    VkExtent2D extent;
+    VkRenderPass render_pass;
+    VkFramebuffer framebuffers[RENDER_GRAPH_MAX_VIEWS];
+    uint32_t framebuffer_count;
+    render_graph_barrier_batch barriers;
+} render_graph_step;
+
+typedef struct {
+    uint64_t hash;
+    VkRenderPass render_pass;
+} render_graph_cached_pass;
+
+typedef struct {
+    uint32_t pass_count;
+    uint32_t culled_passes;
+    uint32_t render_pass_count;
+    uint32_t merged_passes;
+    uint32_t barrier_count;
+    uint32_t transient_images;
+    uint32_t lazy_images;
+    uint64_t transient_bytes;
+    uint64_t aliased_bytes;
+    uint64_t lazy_bytes;
+    
+    // Attachment traffic between tile memory and DRAM per frame at full
+    // extent, estimated from the load and store ops
+    uint64_t load_bytes;
+    uint64_t store_bytes;
+} render_graph_stats;
+
+typedef struct render_graph {
+    VkDevice device;
+    gpu_allocator* allocator;
+    render_graph_image images[RENDER_GRAPH_MAX_IMAGES];
+    uint32_t image_count;
+    render_graph_pass passes[RENDER_GRAPH_MAX_PASSES];
+    uint32_t pass_count;
+    render_graph_step steps[RENDER_GRAPH_MAX_PASSES];
+    uint32_t step_count;
+    render_graph_barrier_batch final_barriers;
+    gpu_allocation pool_allocation;
+    int invalid;
+    int compiled;
+    
+    // Render passes outlive resets, so rebuilding the graph for a new
+    // extent hands back the same handles and pipelines stay valid
+    render_graph_cached_pass render_passes[RENDER_GRAPH_MAX_RENDER_PASSES];
+    uint32_t render_pass_count;
+    render_graph_stats stats;
+} render_graph;
+
+render_graph* render_graph_create(VkDevice device, gpu_allocator* allocator);
+void render_graph_destroy(render_graph* graph);
+
+// Drops every declaration and compiled object except cached render passes
+void render_graph_reset(render_graph* graph);
+
+// Imported images keep their contents; views[image_index] is used when
+// several are given. Transient images are discarded between frames.
+uint32_t render_graph_import_image(render_graph* graph, const char* name, VkFormat format, VkExtent2D extent,
+                                   const VkImage* images, const VkImageView* views, uint32_t count,
+                                   VkImageLayout initial_layout, VkImageLayout final_layout);
+uint32_t render_graph_create_image(render_graph* graph, const char* name, VkFormat format, VkExtent2D extent,
+                                   VkSampleCountFlagBits samples);
+void render_graph_output(render_graph* graph, uint32_t image);
+void render_graph_set_clear(render_graph* graph, uint32_t image, const VkClearValue* clear);
+
+uint32_t render_graph_add_pass(render_graph* graph, const char* name, render_graph_pass_type type,
+                               render_graph_record_fn record, void* user);
+void render_graph_use_image(render_graph* graph, uint32_t pass, uint32_t image, render_graph_access access,
+                            VkAttachmentLoadOp load_op);
+void render_graph_set_profile_scope(render_graph* graph, uint32_t pass, uint32_t scope);
+void render_graph_set_render_area(render_graph* graph, uint32_t pass, VkExtent2D area);
+
+// Keeps the pass in a render pass of its own, so measurements can see what
+// merging it as a subpass saves
+void render_graph_set_standalone(render_graph* graph, uint32_t pass);
+
+// Like the render area, read at execute time: a pass whose callback only
+// runs vkCmdExecuteCommands switches to SECONDARY_COMMAND_BUFFERS per frame
+void render_graph_set_contents(render_graph* graph, uint32_t pass, VkSubpassContents contents);
+
+int render_graph_compile(render_graph* graph);
+void render_graph_execute(render_graph* graph, VkCommandBuffer cmd, uint32_t image_index, gpu_profiler* profiler);
+
+VkRenderPass render_graph_get_render_pass(render_graph* graph, uint32_t pass);
+uint32_t render_graph_get_subpass(render_graph* graph, uint32_t pass);
+VkFramebuffer render_graph_get_framebuffer(render_graph* graph, uint32_t pass, uint32_t image_index);
+VkImage render_graph_get_image(render_graph* graph, uint32_t image, uint32_t image_index);
+VkImageView render_graph_get_view(render_graph* graph, uint32_t image, uint32_t image_index);
+
+// Stage at which the graph first touches an image; semaphore waits on an
+// imported image should use it
+VkPipelineStageFlags render_graph_first_stage(render_graph* graph, uint32_t image);
+void render_graph_get_stats(render_graph* graph, render_graph_stats* stats);
@@ -0,0 +1,16 @@
+#version 450
+
+// The scene's linear color at this pixel, still in tile memory when the
+// pass runs as a subpass of the scene
+layout(input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput scene;
+
+layout(push_constant) uniform gamma_params {
+    float exponent;
+} params;
+
+layout(location = 0) out vec4 out_color;
+
+void main() {
+    vec4 color = subpassLoad(scene);
+    out_color = vec4(pow(color.rgb, vec3(params.exponent)), color.a);
+}
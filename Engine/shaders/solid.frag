@@ -0,0 +1,12 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform frame_uniforms {
+    vec4 clear_color;
+    vec4 view;
+} frame;
+
+layout(location = 0) out vec4 out_color;
+
+void main() {
+    out_color = frame.clear_color;
+}
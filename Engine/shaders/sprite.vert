@@ -0,0 +1,29 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform frame_uniforms {
+    vec4 clear_color;
+    vec4 view;
+} frame;
+
+// One instance per sprite
+layout(location = 0) in vec2 in_position;
+layout(location = 1) in vec2 in_size;
+layout(location = 2) in vec4 in_uv;
+layout(location = 3) in vec4 in_color;
+layout(location = 4) in float in_rotation;
+
+layout(location = 0) out vec2 out_uv;
+layout(location = 1) out vec4 out_color;
+
+// Four-vertex strip; corners come from the vertex index
+void main() {
+    vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+    vec2 local = (corner - 0.5) * in_size;
+    float s = sin(in_rotation);
+    float c = cos(in_rotation);
+    vec2 world = in_position + vec2(local.x * c - local.y * s, local.x * s + local.y * c);
+    
+    gl_Position = vec4(world * frame.view.xy + frame.view.zw, 0.0, 1.0);
+    out_uv = mix(in_uv.xy, in_uv.zw, corner);
+    out_color = in_color;
+}
@@ -0,0 +1,817 @@
+#include "sprite.h"
+#include "pipeline.h"
+#include "upload.h"
+#include "descriptor.h"
+#include "timeline.h"
+#include "timing.h"
+#include "platform.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The descriptor set stays with the slot; only replaced textures give
+// theirs back before the pool goes
+static void destroy_texture(vulkan_context* ctx, sprite_texture* texture) {
+    if (texture->view != VK_NULL_HANDLE) {
+        vkDestroyImageView(ctx->device, texture->view, NULL);
+        texture->view = VK_NULL_HANDLE;
+    }
+    if (texture->image != VK_NULL_HANDLE) {
+        gpu_destroy_image(ctx->allocator, texture->image, &texture->allocation);
+        texture->image = VK_NULL_HANDLE;
+    }
+}
+
+int sprite_init(vulkan_context* ctx) {
+    sprite_batcher* batcher = calloc(1, sizeof(sprite_batcher));
+    if (!batcher) {
+        return 0;
+    }
+    ctx->sprites = batcher;
+    
+    VkSamplerCreateInfo sampler_info = {0};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_LINEAR;
+    sampler_info.minFilter = VK_FILTER_LINEAR;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+    
+    VkDescriptorPoolSize pool_size = {0};
+    pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    pool_size.descriptorCount = SPRITE_MAX_TEXTURES + SPRITE_MAX_RETIRED;
+    
+    VkDescriptorPoolCreateInfo pool_info = {0};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    pool_info.maxSets = SPRITE_MAX_TEXTURES + SPRITE_MAX_RETIRED;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    
+    if (vkCreateSampler(ctx->device, &sampler_info, NULL, &batcher->sampler) != VK_SUCCESS ||
+        vkCreateDescriptorPool(ctx->device, &pool_info, NULL, &batcher->descriptor_pool) != VK_SUCCESS) {
+        return 0;
+    }
+    
+    // Texture 0 lets untextured sprites share the textured pipeline
+    const uint32_t white = 0xffffffffu;
+    if (sprite_create_texture(ctx, 1, 1, &white) != SPRITE_TEXTURE_WHITE) {
+        return 0;
+    }
+    
+    // Painter's order within the scene pass, so no depth test
+    pipeline_state state;
+    pipeline_state_init(&state, "sprite.vert.spv", "sprite.frag.spv");
+    state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+    state.samples = ctx->msaa_samples;
+    state.blend_enable = 1;
+    state.vertex_input = PIPELINE_VERTEX_INPUT_SPRITE;
+    batcher->default_pipeline = pipeline_request(ctx, &state);
+    
+    // Batches draw directly until these are ready; the compact pass is only
+    // worth it when the draw count can come from the GPU
+    if (ctx->gpu_culling) {
+        pipeline_state_init_compute(&state, "sprite_cull.comp.spv");
+        batcher->cull_pipeline = pipeline_request(ctx, &state);
+        if (ctx->draw_indirect_count) {
+            pipeline_state_init_compute(&state, "sprite_compact.comp.spv");
+            batcher->compact_pipeline = pipeline_request(ctx, &state);
+        }
+    }
+    
+    return batcher->default_pipeline != 0;
+}
+
+void sprite_shutdown(vulkan_context* ctx) {
+    sprite_batcher* batcher = ctx->sprites;
+    if (!batcher) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < batcher->texture_count; i++) {
+        destroy_texture(ctx, &batcher->textures[i]);
+    }
+    for (uint32_t i = 0; i < batcher->retired_count; i++) {
+        destroy_texture(ctx, &batcher->retired[i].texture);
+    }
+    
+    if (batcher->descriptor_pool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(ctx->device, batcher->descriptor_pool, NULL);
+    }
+    if (batcher->sampler != VK_NULL_HANDLE) {
+        vkDestroySampler(ctx->device, batcher->sampler, NULL);
+    }
+    
+    free(batcher->sprites);
+    free(batcher->keys);
+    free(batcher->order);
+    free(batcher->batches);
+    free(batcher);
+    ctx->sprites = NULL;
+}
+
+// View and descriptor set for a created image, made before the copy is
+// recorded so a failure can still destroy the image
+static int create_texture_view(vulkan_context* ctx, sprite_batcher* batcher, sprite_texture* texture,
+                               VkFormat format, uint32_t level_count) {
+    VkImageViewCreateInfo view_info = {0};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = texture->image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = format;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.levelCount = level_count;
+    view_info.subresourceRange.layerCount = 1;
+    
+    VkDescriptorSetLayout set_layout = pipeline_get_texture_set_layout(ctx);
+    
+    VkDescriptorSetAllocateInfo set_info = {0};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.descriptorPool = batcher->descriptor_pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &set_layout;
+    
+    return vkCreateImageView(ctx->device, &view_info, NULL, &texture->view) == VK_SUCCESS &&
+           (texture->set != VK_NULL_HANDLE ||
+            vkAllocateDescriptorSets(ctx->device, &set_info, &texture->set) == VK_SUCCESS);
+}
+
+static void write_texture_set(vulkan_context* ctx, sprite_batcher* batcher, sprite_texture* texture) {
+    VkDescriptorImageInfo image_descriptor = {0};
+    image_descriptor.sampler = batcher->sampler;
+    image_descriptor.imageView = texture->view;
+    image_descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    
+    VkWriteDescriptorSet write = {0};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = texture->set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &image_descriptor;
+    vkUpdateDescriptorSets(ctx->device, 1, &write, 0, NULL);
+    
+    texture->bindless = descriptor_bindless_add(ctx, texture->view, batcher->sampler);
+}
+
+static uint32_t publish_texture(vulkan_context* ctx, sprite_batcher* batcher, sprite_texture* texture) {
+    write_texture_set(ctx, batcher, texture);
+    return batcher->texture_count++;
+}
+
+uint32_t sprite_create_texture(vulkan_context* ctx, uint32_t width, uint32_t height, const void* pixels) {
+    sprite_batcher* batcher = ctx->sprites;
+    if (!batcher || batcher->texture_count >= SPRITE_MAX_TEXTURES || width == 0 || height == 0) {
+        return SPRITE_TEXTURE_NONE;
+    }
+    
+    sprite_texture* texture = &batcher->textures[batcher->texture_count];
+    
+    VkImageCreateInfo image_info = {0};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+    image_info.extent.width = width;
+    image_info.extent.height = height;
+    image_info.extent.depth = 1;
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    
+    if (!upload_create_image(ctx, &image_info, &texture->image, &texture->allocation)) {
+        texture->image = VK_NULL_HANDLE;
+        return SPRITE_TEXTURE_NONE;
+    }
+    
+    upload_image_level level = {0};
+    level.width = width;
+    level.height = height;
+    
+    // The copy goes last: once it is recorded the image can't be destroyed
+    // until the batch retires
+    if (!create_texture_view(ctx, batcher, texture, image_info.format, 1) ||
+        !upload_image(ctx, texture->image, VK_IMAGE_ASPECT_COLOR_BIT, &level, 1, pixels,
+                      (VkDeviceSize)width * height * 4)) {
+        destroy_texture(ctx, texture);
+        return SPRITE_TEXTURE_NONE;
+    }
+    
+    return publish_texture(ctx, batcher, texture);
+}
+
+uint32_t sprite_add_texture(vulkan_context* ctx, texture* loaded) {
+    sprite_batcher* batcher = ctx->sprites;
+    if (!batcher || batcher->texture_count >= SPRITE_MAX_TEXTURES) {
+        texture_destroy(ctx, loaded);
+        return SPRITE_TEXTURE_NONE;
+    }
+    
+    sprite_texture* texture = &batcher->textures[batcher->texture_count];
+    texture->image = loaded->image;
+    texture->allocation = loaded->allocation;
+    loaded->image = VK_NULL_HANDLE;
+    
+    if (!create_texture_view(ctx, batcher, texture, loaded->format, loaded->level_count) ||
+        !texture_upload(ctx, loaded)) {
+        texture_destroy(ctx, loaded);
+        destroy_texture(ctx, texture);
+        return SPRITE_TEXTURE_NONE;
+    }
+    
+    return publish_texture(ctx, batcher, texture);
+}
+
+uint32_t sprite_create_texture_ktx2(vulkan_context* ctx, const void* data, uint64_t size) {
+    sprite_batcher* batcher = ctx->sprites;
+    if (!batcher || batcher->texture_count >= SPRITE_MAX_TEXTURES) {
+        return SPRITE_TEXTURE_NONE;
+    }
+    
+    texture loaded;
+    if (!texture_create_ktx2(ctx, data, size, &loaded, NULL)) {
+        return SPRITE_TEXTURE_NONE;
+    }
+    return sprite_add_texture(ctx, &loaded);
+}
+
+int sprite_replace_texture(vulkan_context* ctx, uint32_t index, texture* loaded) {
+    sprite_batcher* batcher = ctx->sprites;
+    if (!batcher || index >= batcher->texture_count || batcher->retired_count >= SPRITE_MAX_RETIRED) {
+        return 0;
+    }
+    
+    sprite_texture* texture = &batcher->textures[index];
+    sprite_texture replacement = *texture;
+    replacement.image = loaded->image;
+    replacement.allocation = loaded->allocation;
+    replacement.view = VK_NULL_HANDLE;
+    replacement.set = VK_NULL_HANDLE;
+    
+    if (!create_texture_view(ctx, batcher, &replacement, loaded->format, loaded->level_count)) {
+        if (replacement.view != VK_NULL_HANDLE) {
+            vkDestroyImageView(ctx->device, replacement.view, NULL);
+        }
+        return 0;
+    }
+    write_texture_set(ctx, batcher, &replacement);
+    loaded->image = VK_NULL_HANDLE;
+    
+    // This frame's draws pick up the new set; the frames already submitted
+    // may still sample the old one
+    sprite_retired_texture* retired = &batcher->retired[batcher->retired_count++];
+    retired->texture = *texture;
+    retired->retire_value = gpu_timeline_last_submitted(ctx->timeline);
+    if (texture->bindless != DESCRIPTOR_BINDLESS_NONE) {
+        descriptor_bindless_remove(ctx, texture->bindless);
+    }
+    
+    *texture = replacement;
+    ctx->record_generation++;
+    return 1;
+}
+
+static void collect_retired(vulkan_context* ctx, sprite_batcher* batcher) {
+    if (batcher->retired_count == 0) {
+        return;
+    }
+    
+    uint64_t completed = gpu_timeline_completed(ctx->timeline);
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < batcher->retired_count; i++) {
+        sprite_retired_texture* retired = &batcher->retired[i];
+        if (retired->retire_value > completed) {
+            batcher->retired[kept++] = *retired;
+            continue;
+        }
+        
+        vkFreeDescriptorSets(ctx->device, batcher->descriptor_pool, 1, &retired->texture.set);
+        destroy_texture(ctx, &retired->texture);
+    }
+    batcher->retired_count = kept;
+}
+
+uint32_t sprite_create_texture_pack(vulkan_context* ctx, const asset_pack* pack, const char* name) {
+    const pack_entry* entry = pack_find(pack, name);
+    if (!entry) {
+        return SPRITE_TEXTURE_NONE;
+    }
+    
+    const void* data = pack_data(pack, entry);
+    if (data) {
+        return sprite_create_texture_ktx2(ctx, data, entry->size);
+    }
+    
+    void* scratch = malloc(entry->size);
+    uint32_t index = SPRITE_TEXTURE_NONE;
+    if (scratch && pack_read(pack, entry, scratch)) {
+        index = sprite_create_texture_ktx2(ctx, scratch, entry->size);
+    }
+    free(scratch);
+    return index;
+}
+
+static int reserve_sprites(sprite_batcher* batcher, uint32_t count) {
+    if (count <= batcher->capacity) {
+        return 1;
+    }
+    
+    uint32_t capacity = batcher->capacity ? batcher->capacity : SPRITE_INITIAL_CAPACITY;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    
+    sprite* sprites = realloc(batcher->sprites, capacity * sizeof(sprite));
+    if (!sprites) {
+        return 0;
+    }
+    batcher->sprites = sprites;
+    
+    // Sort scratch holds nothing between flushes, so it is replaced rather than copied
+    uint64_t* keys = malloc(2 * (size_t)capacity * sizeof(uint64_t));
+    uint32_t* order = malloc(2 * (size_t)capacity * sizeof(uint32_t));
+    sprite_batch* batches = malloc(capacity * sizeof(sprite_batch));
+    if (!keys || !order || !batches) {
+        free(keys);
+        free(order);
+        free(batches);
+        return 0;
+    }
+    
+    free(batcher->keys);
+    free(batcher->order);
+    free(batcher->batches);
+    batcher->keys = keys;
+    batcher->order = order;
+    batcher->batches = batches;
+    batcher->capacity = capacity;
+    return 1;
+}
+
+int sprite_submit(vulkan_context* ctx, const sprite* sprites, uint32_t count) {
+    sprite_batcher* batcher = ctx->sprites;
+    if (!batcher || !reserve_sprites(batcher, batcher->count + count)) {
+        return 0;
+    }
+    
+    memcpy(batcher->sprites + batcher->count, sprites, count * sizeof(sprite));
+    batcher->count += count;
+    return 1;
+}
+
+// Pipelines get a dense slot so the handle fits in the key; a full table
+// falls back to the default pipeline
+static uint32_t pipeline_slot(sprite_batcher* batcher, uint64_t handle) {
+    for (uint32_t i = 0; i < batcher->pipeline_count; i++) {
+        if (batcher->pipelines[i] == handle) {
+            return i;
+        }
+    }
+    
+    if (batcher->pipeline_count >= SPRITE_MAX_PIPELINES) {
+        return 0;
+    }
+    
+    batcher->pipelines[batcher->pipeline_count] = handle;
+    return batcher->pipeline_count++;
+}
+
+// A sprite showing a quarter of the texture at 100 pixels wants the whole
+// texture at 400
+static void note_screen_size(const sprite_batcher* batcher, sprite_texture* texture,
+                             const sprite_instance* instance) {
+    float u = fabsf(instance->uv[2] - instance->uv[0]);
+    float v = fabsf(instance->uv[3] - instance->uv[1]);
+    float width = fabsf(instance->size[0]) * batcher->pixel_scale[0] / (u > 1e-6f ? u : 1e-6f);
+    float height = fabsf(instance->size[1]) * batcher->pixel_scale[1] / (v > 1e-6f ? v : 1e-6f);
+    if (width > texture->screen_size[0]) {
+        texture->screen_size[0] = width;
+    }
+    if (height > texture->screen_size[1]) {
+        texture->screen_size[1] = height;
+    }
+}
+
+static void build_keys(sprite_batcher* batcher) {
+    if (batcher->pipeline_count == 0) {
+        pipeline_slot(batcher, batcher->default_pipeline);
+    }
+    
+    // Runs of sprites usually share a pipeline, so the slot lookup is memoized
+    uint64_t last_handle = batcher->default_pipeline;
+    uint64_t last_slot = pipeline_slot(batcher, last_handle);
+    for (uint32_t i = 0; i < batcher->count; i++) {
+        const sprite* sprite = &batcher->sprites[i];
+        uint64_t handle = sprite->pipeline ? sprite->pipeline : batcher->default_pipeline;
+        if (handle != last_handle) {
+            last_handle = handle;
+            last_slot = pipeline_slot(batcher, handle);
+        }
+        
+        uint32_t texture = sprite->texture < batcher->texture_count ? sprite->texture : SPRITE_TEXTURE_WHITE;
+        if (batcher->textures[texture].streamed) {
+            note_screen_size(batcher, &batcher->textures[texture], &sprite->instance);
+        }
+        batcher->keys[i] = (uint64_t)sprite->layer << SPRITE_KEY_LAYER_SHIFT |
+                           last_slot << SPRITE_KEY_PIPELINE_SHIFT | texture;
+        batcher->order[i] = i;
+    }
+}
+
+// LSD radix sort over bytes, which keeps equal keys in submission order.
+// Bytes every key shares are skipped, so the usual few layers, pipelines
+// and textures cost three or four passes instead of eight.
+static void sort_keys(sprite_batcher* batcher, uint64_t** sorted_keys, uint32_t** sorted_order) {
+    uint32_t count = batcher->count;
+    uint32_t histograms[8][256];
+    memset(histograms, 0, sizeof(histograms));
+    
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t key = batcher->keys[i];
+        for (uint32_t digit = 0; digit < 8; digit++) {
+            histograms[digit][(key >> (digit * 8)) & 0xff]++;
+        }
+    }
+    
+    uint64_t* keys = batcher->keys;
+    uint32_t* order = batcher->order;
+    uint64_t* scratch_keys = batcher->keys + batcher->capacity;
+    uint32_t* scratch_order = batcher->order + batcher->capacity;
+    
+    for (uint32_t digit = 0; digit < 8; digit++) {
+        uint32_t shift = digit * 8;
+        uint32_t* histogram = histograms[digit];
+        if (histogram[(keys[0] >> shift) & 0xff] == count) {
+            continue;
+        }
+        
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < 256; bucket++) {
+            uint32_t size = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += size;
+        }
+        
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t slot = histogram[(keys[i] >> shift) & 0xff]++;
+            scratch_keys[slot] = keys[i];
+            scratch_order[slot] = order[i];
+        }
+        
+        uint64_t* swap_keys = keys;
+        keys = scratch_keys;
+        scratch_keys = swap_keys;
+        uint32_t* swap_order = order;
+        order = scratch_order;
+        scratch_order = swap_order;
+    }
+    
+    *sorted_keys = keys;
+    *sorted_order = order;
+}
+
+static void add_batch(sprite_batcher* batcher, uint32_t* batch_count, uint64_t key, uint32_t first, uint32_t end) {
+    sprite_batch* batch = &batcher->batches[(*batch_count)++];
+    batch->key = key;
+    batch->first = first;
+    batch->count = end - first;
+}
+
+static void init_batch_item(sprite_batcher* batcher, const sprite_batch* batch, VkBuffer buffer,
+                            VkDeviceSize offset, renderer_draw_item* item) {
+    memset(item, 0, sizeof(*item));
+    item->pipeline = batcher->pipelines[(batch->key >> SPRITE_KEY_PIPELINE_SHIFT) & 0xffff];
+    item->vertex_count = 4;
+    item->instance_count = batch->count;
+    item->first_instance = batch->first;
+    item->vertex_buffer = buffer;
+    item->vertex_offset = offset;
+    item->texture_set = batcher->textures[batch->key & 0xffffffffu].set;
+}
+
+static void submit_batch(vulkan_context* ctx, sprite_batcher* batcher, const sprite_batch* batch,
+                         const renderer_draw_item* item) {
+    if (renderer_submit_draw(ctx, item)) {
+        batcher->stats.batch_count++;
+    } else {
+        batcher->stats.dropped_count += batch->count;
+    }
+}
+
+// Lays out one indirect command per chunk of every batch, plus the batch
+// records the compact pass needs, and submits the batches as indirect draws
+// for sprite_record_cull to trim. Returns 0, having submitted nothing, when
+// the pipelines aren't ready or the pool is out of room.
+static int queue_cull(vulkan_context* ctx, sprite_batcher* batcher, frame_context* frame,
+                      uint32_t batch_count, VkDeviceSize instance_offset) {
+    if (!ctx->gpu_culling || pipeline_get(ctx, batcher->cull_pipeline) == VK_NULL_HANDLE) {
+        return 0;
+    }
+    int compact = ctx->draw_indirect_count && pipeline_get(ctx, batcher->compact_pipeline) != VK_NULL_HANDLE;
+    
+    uint32_t chunk_count = 0;
+    for (uint32_t i = 0; i < batch_count; i++) {
+        chunk_count += (batcher->batches[i].count + SPRITE_CULL_CHUNK - 1) / SPRITE_CULL_CHUNK;
+    }
+    
+    gpu_linear_pool* pool = &frame->transient_pool;
+    VkDeviceSize command_offset = 0;
+    VkDeviceSize batch_offset = 0;
+    VkDrawIndirectCommand* commands = gpu_linear_pool_alloc(pool, chunk_count * sizeof(VkDrawIndirectCommand),
+                                                            sizeof(VkDrawIndirectCommand), &command_offset);
+    uint32_t* records = compact && commands ? gpu_linear_pool_alloc(pool, batch_count * 4 * sizeof(uint32_t),
+                                                                    4 * sizeof(uint32_t), &batch_offset) : NULL;
+    VkDescriptorSet set = commands ? descriptor_alloc_frame_set(ctx, pipeline_get_compute_set_layout(ctx))
+                                   : VK_NULL_HANDLE;
+    if (!commands || (compact && !records) || set == VK_NULL_HANDLE) {
+        return 0;
+    }
+    
+    VkDescriptorBufferInfo buffer_info = {0};
+    buffer_info.buffer = pool->buffer;
+    buffer_info.range = VK_WHOLE_SIZE;
+    
+    VkWriteDescriptorSet write = {0};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &buffer_info;
+    vkUpdateDescriptorSets(ctx->device, 1, &write, 0, NULL);
+    
+    uint32_t chunk = 0;
+    for (uint32_t i = 0; i < batch_count; i++) {
+        const sprite_batch* batch = &batcher->batches[i];
+        uint32_t first_chunk = chunk;
+        for (uint32_t first = 0; first < batch->count; first += SPRITE_CULL_CHUNK) {
+            uint32_t remaining = batch->count - first;
+            commands[chunk].vertexCount = 4;
+            commands[chunk].instanceCount = remaining < SPRITE_CULL_CHUNK ? remaining : SPRITE_CULL_CHUNK;
+            commands[chunk].firstVertex = 0;
+            commands[chunk].firstInstance = batch->first + first;
+            chunk++;
+        }
+        
+        renderer_draw_item item;
+        init_batch_item(batcher, batch, pool->buffer, instance_offset, &item);
+        item.indirect_buffer = pool->buffer;
+        item.indirect_offset = command_offset + first_chunk * sizeof(VkDrawIndirectCommand);
+        item.indirect_count = chunk - first_chunk;
+        if (compact) {
+            records[i * 4] = first_chunk;
+            records[i * 4 + 1] = chunk - first_chunk;
+            records[i * 4 + 2] = 0;
+            records[i * 4 + 3] = 0;
+            item.count_buffer = pool->buffer;
+            item.count_offset = batch_offset + (i * 4 + 2) * sizeof(uint32_t);
+        }
+        submit_batch(ctx, batcher, batch, &item);
+    }
+    
+    sprite_cull_params* params = &batcher->cull_params;
+    renderer_get_view_transform(ctx, params->view);
+    params->instance_base = (uint32_t)(instance_offset / sizeof(uint32_t));
+    params->command_base = (uint32_t)(command_offset / sizeof(uint32_t));
+    params->batch_base = (uint32_t)(batch_offset / sizeof(uint32_t));
+    params->batch_count = compact ? batch_count : 0;
+    batcher->cull_set = set;
+    batcher->cull_chunks = chunk_count;
+    batcher->stats.indirect_count = batch_count;
+    batcher->stats.cull_chunks = chunk_count;
+    return 1;
+}
+
+void sprite_flush(vulkan_context* ctx, frame_context* frame) {
+    sprite_batcher* batcher = ctx->sprites;
+    if (!batcher) {
+        return;
+    }
+    
+    batcher->cull_chunks = 0;
+    batcher->stats.sprite_count = batcher->count;
+    batcher->stats.batch_count = 0;
+    batcher->stats.indirect_count = 0;
+    batcher->stats.cull_chunks = 0;
+    batcher->stats.dropped_count = 0;
+    batcher->stats.sort_ns = 0;
+    batcher->stats.write_ns = 0;
+    collect_retired(ctx, batcher);
+    if (batcher->count == 0) {
+        return;
+    }
+    
+    // The view maps its rect onto the render target, which is what gets sampled into
+    float view[4];
+    renderer_get_view_transform(ctx, view);
+    batcher->pixel_scale[0] = view[0] * 0.5f * (float)ctx->render_extent.width;
+    batcher->pixel_scale[1] = view[1] * 0.5f * (float)ctx->render_extent.height;
+    
+    uint64_t start = timing_now_ns();
+    uint64_t* keys;
+    uint32_t* order;
+    build_keys(batcher);
+    sort_keys(batcher, &keys, &order);
+    uint64_t sorted = timing_now_ns();
+    
+    // Whatever doesn't fit in the frame's pool is dropped from the top layers down
+    gpu_linear_pool* pool = &frame->transient_pool;
+    VkDeviceSize head = (pool->head + sizeof(sprite_instance) - 1) / sizeof(sprite_instance) * sizeof(sprite_instance);
+    uint64_t room = head < pool->capacity ? (pool->capacity - head) / sizeof(sprite_instance) : 0;
+    uint32_t count = room < batcher->count ? (uint32_t)room : batcher->count;
+    batcher->stats.dropped_count = batcher->count - count;
+    
+    VkDeviceSize offset = 0;
+    sprite_instance* instances = count > 0 ? gpu_linear_pool_alloc(pool, count * sizeof(sprite_instance),
+                                                                   sizeof(sprite_instance), &offset) : NULL;
+    if (!instances) {
+        batcher->stats.dropped_count = batcher->count;
+        batcher->count = 0;
+        return;
+    }
+    
+    uint32_t batch_count = 0;
+    uint32_t batch_start = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        instances[i] = batcher->sprites[order[i]].instance;
+        if ((keys[i] & SPRITE_KEY_BATCH_MASK) != (keys[batch_start] & SPRITE_KEY_BATCH_MASK)) {
+            add_batch(batcher, &batch_count, keys[batch_start], batch_start, i);
+            batch_start = i;
+        }
+    }
+    add_batch(batcher, &batch_count, keys[batch_start], batch_start, count);
+    
+    if (!queue_cull(ctx, batcher, frame, batch_count, offset)) {
+        for (uint32_t i = 0; i < batch_count; i++) {
+            renderer_draw_item item;
+            init_batch_item(batcher, &batcher->batches[i], pool->buffer, offset, &item);
+            submit_batch(ctx, batcher, &batcher->batches[i], &item);
+        }
+    }
+    
+    batcher->stats.sort_ns = sorted - start;
+    batcher->stats.write_ns = timing_now_ns() - sorted;
+    batcher->stats.total_sprites += count;
+    batcher->stats.total_batches += batcher->stats.batch_count;
+    batcher->stats.total_indirect += batcher->stats.indirect_count;
+    batcher->count = 0;
+}
+
+void sprite_record_cull(vulkan_context* ctx, VkCommandBuffer cmd) {
+    sprite_batcher* batcher = ctx->sprites;
+    if (!batcher || batcher->cull_chunks == 0) {
+        return;
+    }
+    
+    VkPipelineLayout layout = pipeline_get_compute_layout(ctx);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_get(ctx, batcher->cull_pipeline));
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &batcher->cull_set, 0, NULL);
+    vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sprite_cull_params),
+                       &batcher->cull_params);
+    vkCmdDispatch(cmd, batcher->cull_chunks, 1, 1);
+    
+    VkMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    
+    // The compact pass reads the instance counts the cull pass wrote
+    uint32_t batch_count = batcher->cull_params.batch_count;
+    if (batch_count > 0) {
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             1, &barrier, 0, NULL, 0, NULL);
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_get(ctx, batcher->compact_pipeline));
+        vkCmdDispatch(cmd, (batch_count + SPRITE_COMPACT_GROUP - 1) / SPRITE_COMPACT_GROUP, 1, 1);
+    }
+    
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier,
+                         0, NULL, 0, NULL);
+}
+
+void sprite_discard(vulkan_context* ctx) {
+    if (ctx->sprites) {
+        ctx->sprites->count = 0;
+        ctx->sprites->cull_chunks = 0;
+    }
+}
+
+void sprite_get_stats(vulkan_context* ctx, sprite_stats* stats) {
+    if (!ctx->sprites) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = ctx->sprites->stats;
+}
+
+static uint32_t benchmark_random(uint32_t* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static float benchmark_unit(uint32_t* state) {
+    return (float)benchmark_random(state) / (float)(1u << 24);
+}
+
+int sprite_benchmark(vulkan_context* ctx, uint32_t sprite_count, uint32_t frame_count,
+                     sprite_benchmark_result* result) {
+    memset(result, 0, sizeof(*result));
+    if (!ctx->sprites || sprite_count == 0 || frame_count == 0) {
+        return 0;
+    }
+    
+    // A few small textures so batches break on texture as well as layer.
+    // Sprite textures are never released, so every run shares the same ones.
+    sprite_batcher* batcher = ctx->sprites;
+    const uint32_t* textures = batcher->benchmark_textures;
+    while (batcher->benchmark_texture_count < SPRITE_BENCHMARK_TEXTURES) {
+        uint32_t i = batcher->benchmark_texture_count;
+        uint32_t pixels[4];
+        for (uint32_t p = 0; p < 4; p++) {
+            pixels[p] = 0xff000000u | (0x3f3f3fu << (i % 3 * 8)) | (p & 1 ? 0x404040u : 0);
+        }
+        batcher->benchmark_textures[i] = sprite_create_texture(ctx, 2, 2, pixels);
+        if (batcher->benchmark_textures[i] == SPRITE_TEXTURE_NONE) {
+            return 0;
+        }
+        batcher->benchmark_texture_count++;
+    }
+    
+    sprite* sprites = malloc(sprite_count * sizeof(sprite));
+    if (!sprites) {
+        return 0;
+    }
+    
+    float width = (float)ctx->swap_chain_extent.width;
+    float height = (float)ctx->swap_chain_extent.height;
+    uint32_t random = 1;
+    for (uint32_t i = 0; i < sprite_count; i++) {
+        sprite* sprite = &sprites[i];
+        memset(sprite, 0, sizeof(*sprite));
+        sprite->instance.position[0] = benchmark_unit(&random) * width;
+        sprite->instance.position[1] = benchmark_unit(&random) * height;
+        sprite->instance.size[0] = 4.0f + benchmark_unit(&random) * 12.0f;
+        sprite->instance.size[1] = sprite->instance.size[0];
+        sprite->instance.uv[2] = 1.0f;
+        sprite->instance.uv[3] = 1.0f;
+        sprite->instance.color = 0xff000000u | benchmark_random(&random);
+        sprite->instance.rotation = benchmark_unit(&random) * 6.2831853f;
+        sprite->texture = textures[benchmark_random(&random) % SPRITE_BENCHMARK_TEXTURES];
+        sprite->layer = (uint16_t)(benchmark_random(&random) % SPRITE_BENCHMARK_LAYERS);
+    }
+    
+    float clear_color[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    
+    // Warm up until the sprite pipeline is ready so compiles don't count
+    pipeline_wait_all(ctx);
+    sprite_submit(ctx, sprites, sprite_count);
+    renderer_draw(ctx, clear_color);
+    vkQueueWaitIdle(ctx->graphics_queue);
+    
+    renderer_stats before;
+    renderer_get_stats(ctx, &before);
+    
+    uint64_t submit_total = 0;
+    uint64_t sort_total = 0;
+    uint64_t write_total = 0;
+    uint64_t cpu_total = 0;
+    uint64_t batch_total = 0;
+    for (uint32_t frame = 0; frame < frame_count; frame++) {
+        uint64_t start = timing_now_ns();
+        sprite_submit(ctx, sprites, sprite_count);
+        uint64_t submitted = timing_now_ns();
+        renderer_draw(ctx, clear_color);
+        cpu_total += timing_now_ns() - start;
+        submit_total += submitted - start;
+        sort_total += ctx->sprites->stats.sort_ns;
+        write_total += ctx->sprites->stats.write_ns;
+        batch_total += ctx->sprites->stats.batch_count;
+        vkQueueWaitIdle(ctx->graphics_queue);
+    }
+    free(sprites);
+    
+    // Profiler results trail submission, so the idle queue lets them all resolve
+    renderer_draw(ctx, clear_color);
+    vkQueueWaitIdle(ctx->graphics_queue);
+    renderer_stats after;
+    renderer_get_stats(ctx, &after);
+    
+    result->sprite_count = sprite_count;
+    result->frame_count = frame_count;
+    result->batch_count = (uint32_t)(batch_total / frame_count);
+    result->submit_ns = submit_total / frame_count;
+    result->sort_ns = sort_total / frame_count;
+    result->write_ns = write_total / frame_count;
+    result->cpu_frame_ns = cpu_total / frame_count;
+    
+    uint64_t samples = after.gpu_frame_samples - before.gpu_frame_samples;
+    if (samples > 0) {
+        result->gpu_frame_ns = (after.total_gpu_frame_ns - before.total_gpu_frame_ns) / samples;
+    }
+    return 1;
+}
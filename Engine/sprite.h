@@ -0,0 +1,194 @@
+#pragma once
+
+#include "renderer.h"
+#include "texture.h"
+#include "pack.h"
+#include <stdint.h>
+
+#define SPRITE_MAX_TEXTURES 256
+
+// Replaced images wait here until the frames that sampled them are done
+#define SPRITE_MAX_RETIRED 64
+#define SPRITE_MAX_PIPELINES 16
+#define SPRITE_INITIAL_CAPACITY 1024
+#define SPRITE_TEXTURE_WHITE 0
+#define SPRITE_TEXTURE_NONE UINT32_MAX
+#define SPRITE_BENCHMARK_FRAMES 60
+#define SPRITE_BENCHMARK_TEXTURES 4
+#define SPRITE_BENCHMARK_LAYERS 8
+
+// GPU culling splits each batch into chunks of one workgroup, each with its
+// own indirect command; the compact pass runs one invocation per batch
+#define SPRITE_CULL_CHUNK 256
+#define SPRITE_COMPACT_GROUP 64
+
+// Sort key, most significant first: layer, pipeline slot, texture. Sprites
+// with equal keys keep their submission order; neighbours that only differ
+// in layer still share a batch.
+#define SPRITE_KEY_LAYER_SHIFT 48
+#define SPRITE_KEY_PIPELINE_SHIFT 32
+#define SPRITE_KEY_BATCH_MASK ((1ull << SPRITE_KEY_LAYER_SHIFT) - 1)
+
+// One instance of the quad; the layout is the sprite pipelines' vertex input
+typedef struct {
+    float position[2];
+    float size[2];
+    float uv[4];
+    uint32_t color;
+    float rotation;
+} sprite_instance;
+
+typedef struct {
+    sprite_instance instance;
+    uint64_t pipeline;
+    uint32_t texture;
+    uint16_t layer;
+} sprite;
+
+// vm_cmd_sprites data; the caller keeps it alive until the command has run
+typedef struct {
+    const sprite* sprites;
+    uint32_t count;
+} sprite_list;
+
+typedef struct {
+    VkImage image;
+    VkImageView view;
+    gpu_allocation allocation;
+    VkDescriptorSet set;
+    
+    // Slot in the bindless table, for shaders that index it
+    uint32_t bindless;
+    
+    // Only tracked for streamed textures: the largest size in pixels the
+    // whole texture would cover at the scale of any sprite drawn with it
+    // since the streamer last looked
+    int streamed;
+    float screen_size[2];
+} sprite_texture;
+
+typedef struct {
+    sprite_texture texture;
+    uint64_t retire_value;
+} sprite_retired_texture;
+
+// One run of sprites with equal batch keys
+typedef struct {
+    uint64_t key;
+    uint32_t first;
+    uint32_t count;
+} sprite_batch;
+
+// Push constants of both cull shaders; offsets are in 32-bit words
+typedef struct {
+    float view[4];
+    uint32_t instance_base;
+    uint32_t command_base;
+    uint32_t batch_base;
+    uint32_t batch_count;
+} sprite_cull_params;
+
+typedef struct {
+    uint32_t sprite_count;
+    uint32_t batch_count;
+    uint32_t indirect_count;
+    uint32_t cull_chunks;
+    uint32_t dropped_count;
+    uint64_t sort_ns;
+    uint64_t write_ns;
+    uint64_t total_sprites;
+    uint64_t total_batches;
+    uint64_t total_indirect;
+} sprite_stats;
+
+typedef struct {
+    uint32_t sprite_count;
+    uint32_t frame_count;
+    uint32_t batch_count;
+    uint64_t submit_ns;
+    uint64_t sort_ns;
+    uint64_t write_ns;
+    uint64_t cpu_frame_ns;
+    uint64_t gpu_frame_ns;
+} sprite_benchmark_result;
+
+typedef struct sprite_batcher {
+    sprite* sprites;
+    uint32_t count;
+    uint32_t capacity;
+    
+    // Radix sort ping-pongs between the two halves of each array; batches
+    // has room for the worst case of one per sprite
+    uint64_t* keys;
+    uint32_t* order;
+    
+    sprite_batch* batches;
+    
+    uint64_t default_pipeline;
+    uint64_t pipelines[SPRITE_MAX_PIPELINES];
+    uint32_t pipeline_count;
+    
+    // Culling queued by the last flush for record_commands to dispatch
+    uint64_t cull_pipeline;
+    uint64_t compact_pipeline;
+    VkDescriptorSet cull_set;
+    sprite_cull_params cull_params;
+    uint32_t cull_chunks;
+    
+    VkSampler sampler;
+    VkDescriptorPool descriptor_pool;
+    sprite_texture textures[SPRITE_MAX_TEXTURES];
+    uint32_t texture_count;
+    sprite_retired_texture retired[SPRITE_MAX_RETIRED];
+    uint32_t retired_count;
+    
+    // Created by the first sprite_benchmark and kept for later runs
+    uint32_t benchmark_textures[SPRITE_BENCHMARK_TEXTURES];
+    uint32_t benchmark_texture_count;
+    
+    // Pixels per world unit on each axis for this flush
+    float pixel_scale[2];
+    sprite_stats stats;
+} sprite_batcher;
+
+int sprite_init(vulkan_context* ctx);
+void sprite_shutdown(vulkan_context* ctx);
+
+// RGBA8 pixels, uploaded on the transfer queue; the frames that sample it
+// wait for the copy. Returns SPRITE_TEXTURE_NONE when out of slots or ring space.
+uint32_t sprite_create_texture(vulkan_context* ctx, uint32_t width, uint32_t height, const void* pixels);
+
+// A KTX2 image with its mips, transcoded on the job workers to a format the
+// device samples; blocks the caller until the levels are queued for upload
+uint32_t sprite_create_texture_ktx2(vulkan_context* ctx, const void* data, uint64_t size);
+
+// The same for a KTX2 asset in a pack; uncompressed ones are read straight
+// from the mapping
+uint32_t sprite_create_texture_pack(vulkan_context* ctx, const asset_pack* pack, const char* name);
+
+// Takes over a created texture's image and queues its upload
+uint32_t sprite_add_texture(vulkan_context* ctx, texture* loaded);
+
+// Render thread only, before the flush: points the slot at a texture whose
+// upload has completed. The old image stays alive until the frames already
+// submitted have retired. Returns 0, leaving the image to the caller, when
+// too many replaced images are still waiting.
+int sprite_replace_texture(vulkan_context* ctx, uint32_t index, texture* loaded);
+
+// Copies the sprites into the next frame's list; 0 uses the default
+// alpha-blended pipeline and unknown textures draw white
+int sprite_submit(vulkan_context* ctx, const sprite* sprites, uint32_t count);
+
+// Render thread only, once the frame's transient pool has been rewound:
+// sorts the list, writes the instances and queues one instanced draw per batch.
+// With GPU culling each batch is an indirect draw that sprite_record_cull trims.
+void sprite_flush(vulkan_context* ctx, frame_context* frame);
+
+// Outside any render pass, before the draws of the flushed frame
+void sprite_record_cull(vulkan_context* ctx, VkCommandBuffer cmd);
+void sprite_discard(vulkan_context* ctx);
+void sprite_get_stats(vulkan_context* ctx, sprite_stats* stats);
+
+// Draws sprite_count random sprites for frame_count frames and reports per-frame averages
+int sprite_benchmark(vulkan_context* ctx, uint32_t sprite_count, uint32_t frame_count,
+                     sprite_benchmark_result* result);
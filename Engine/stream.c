@@ -0,0 +1,440 @@
+#include "stream.h"
+#include "sprite.h"
+#include "upload.h"
+#include "timing.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_NO_REQUEST UINT32_MAX
+
+typedef struct {
+    vulkan_context* ctx;
+    texture_streamer* streamer;
+    stream_texture* texture;
+} stream_job;
+
+static uint64_t bytes_from(const stream_texture* texture, uint32_t level) {
+    uint64_t bytes = 0;
+    for (uint32_t i = level; i < texture->source.level_count; i++) {
+        bytes += texture->level_bytes[i];
+    }
+    return bytes;
+}
+
+// What the texture will hold once the rebuild in flight has swapped in
+static uint64_t committed_bytes(const stream_texture* texture) {
+    return texture->state == STREAM_STATE_RESIDENT ? texture->resident_bytes
+                                                   : bytes_from(texture, texture->pending_level);
+}
+
+int stream_init(vulkan_context* ctx, uint32_t budget_mb) {
+    texture_streamer* streamer = calloc(1, sizeof(texture_streamer));
+    if (!streamer) {
+        return 0;
+    }
+    
+    pthread_mutex_init(&streamer->lock, NULL);
+    job_counter_init(&streamer->jobs);
+    streamer->budget_bytes = (uint64_t)(budget_mb ? budget_mb : STREAM_DEFAULT_BUDGET_MB) << 20;
+    streamer->stats.budget_bytes = streamer->budget_bytes;
+    ctx->streamer = streamer;
+    return 1;
+}
+
+void stream_shutdown(vulkan_context* ctx) {
+    texture_streamer* streamer = ctx->streamer;
+    if (!streamer) {
+        return;
+    }
+    
+    job_counter_wait(&streamer->jobs);
+    job_counter_destroy(&streamer->jobs);
+    
+    // The device is idle; a copy that was recorded but never submitted
+    // goes with its batch
+    for (uint32_t i = 0; i < streamer->texture_count; i++) {
+        stream_texture* texture = &streamer->textures[i];
+        if (texture->state == STREAM_STATE_UPLOADING) {
+            texture_destroy(ctx, &texture->pending);
+        }
+        free(texture->owned);
+    }
+    
+    pthread_mutex_destroy(&streamer->lock);
+    free(streamer);
+    ctx->streamer = NULL;
+}
+
+// owned is freed on failure, or with the streamer
+static uint32_t add_texture(vulkan_context* ctx, const void* data, uint64_t size, uint8_t* owned) {
+    texture_streamer* streamer = ctx->streamer;
+    if (!streamer || streamer->texture_count >= STREAM_MAX_TEXTURES) {
+        free(owned);
+        return SPRITE_TEXTURE_NONE;
+    }
+    
+    stream_texture* entry = &streamer->textures[streamer->texture_count];
+    memset(entry, 0, sizeof(*entry));
+    
+    texture_format format;
+    if (!texture_parse_ktx2(data, size, &entry->source) ||
+        !texture_select_format(&ctx->caps, &entry->source, ctx->compress_textures, &format)) {
+        free(owned);
+        return SPRITE_TEXTURE_NONE;
+    }
+    
+    const texture_source* source = &entry->source;
+    for (uint32_t i = 0; i < source->level_count; i++) {
+        entry->level_bytes[i] = texture_level_size(format, source->levels[i].width, source->levels[i].height);
+    }
+    
+    entry->tail_level = source->level_count - 1;
+    while (entry->tail_level > 0 && source->levels[entry->tail_level - 1].width <= STREAM_TAIL_SIZE &&
+           source->levels[entry->tail_level - 1].height <= STREAM_TAIL_SIZE) {
+        entry->tail_level--;
+    }
+    
+    // The tail is small enough to load here; everything above it streams
+    texture_source tail = *source;
+    texture_source_skip_levels(&tail, entry->tail_level);
+    
+    texture loaded;
+    uint32_t index = texture_create(ctx, &tail, 1, &loaded, NULL) ? sprite_add_texture(ctx, &loaded)
+                                                                   : SPRITE_TEXTURE_NONE;
+    if (index == SPRITE_TEXTURE_NONE) {
+        free(owned);
+        return SPRITE_TEXTURE_NONE;
+    }
+    
+    ctx->sprites->textures[index].streamed = 1;
+    entry->owned = owned;
+    entry->sprite_texture = index;
+    entry->base_level = entry->tail_level;
+    entry->resident_bytes = bytes_from(entry, entry->tail_level);
+    entry->frame_request = STREAM_NO_REQUEST;
+    entry->requested_level = entry->tail_level;
+    entry->request_frame = streamer->frame;
+    entry->state = STREAM_STATE_RESIDENT;
+    streamer->texture_count++;
+    return index;
+}
+
+uint32_t stream_add_ktx2(vulkan_context* ctx, const void* data, uint64_t size) {
+    return add_texture(ctx, data, size, NULL);
+}
+
+uint32_t stream_add_pack(vulkan_context* ctx, const asset_pack* pack, const char* name) {
+    const pack_entry* entry = pack_find(pack, name);
+    if (!entry) {
+        return SPRITE_TEXTURE_NONE;
+    }
+    
+    const void* data = pack_data(pack, entry);
+    if (data) {
+        return add_texture(ctx, data, entry->size, NULL);
+    }
+    
+    uint8_t* copy = malloc(entry->size);
+    if (!copy || !pack_read(pack, entry, copy)) {
+        free(copy);
+        return SPRITE_TEXTURE_NONE;
+    }
+    return add_texture(ctx, copy, entry->size, copy);
+}
+
+void stream_request_level(vulkan_context* ctx, uint32_t sprite_texture, uint32_t level) {
+    texture_streamer* streamer = ctx->streamer;
+    if (!streamer) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < streamer->texture_count; i++) {
+        stream_texture* texture = &streamer->textures[i];
+        if (texture->sprite_texture == sprite_texture) {
+            uint32_t clamped = level < texture->tail_level ? level : texture->tail_level;
+            if (clamped < texture->frame_request) {
+                texture->frame_request = clamped;
+            }
+            return;
+        }
+    }
+}
+
+// The finest level a screen footprint needs: the smallest one that still
+// has at least a texel per pixel
+static uint32_t level_for_size(const stream_texture* texture, const float* screen_size) {
+    uint32_t level = 0;
+    while (level < texture->tail_level && texture->source.levels[level + 1].width >= screen_size[0] &&
+           texture->source.levels[level + 1].height >= screen_size[1]) {
+        level++;
+    }
+    return level;
+}
+
+// Runs on a job worker, which must not wait on other jobs, so the levels
+// are transcoded on this thread
+static void build_job_run(void* data) {
+    stream_job* work = data;
+    texture_streamer* streamer = work->streamer;
+    stream_texture* texture = work->texture;
+    uint64_t begin = timing_now_ns();
+    
+    texture_source source = texture->source;
+    texture_source_skip_levels(&source, texture->pending_level);
+    
+    // A full staging ring fails the copy; the next update tries again
+    int built = texture_create(work->ctx, &source, 0, &texture->pending, NULL);
+    if (built && !texture_upload(work->ctx, &texture->pending)) {
+        texture_destroy(work->ctx, &texture->pending);
+        built = 0;
+    }
+    
+    pthread_mutex_lock(&streamer->lock);
+    texture->pending_ns = timing_now_ns() - begin;
+    texture->state = built ? STREAM_STATE_UPLOADING : STREAM_STATE_FAILED;
+    pthread_mutex_unlock(&streamer->lock);
+    
+    free(work);
+    job_counter_done(&streamer->jobs);
+}
+
+static int start_build(vulkan_context* ctx, texture_streamer* streamer, stream_texture* texture, uint32_t level) {
+    stream_job* work = malloc(sizeof(stream_job));
+    if (!work) {
+        return 0;
+    }
+    work->ctx = ctx;
+    work->streamer = streamer;
+    work->texture = texture;
+    
+    texture->pending_level = level;
+    texture->state = STREAM_STATE_LOADING;
+    job_counter_add(&streamer->jobs, 1);
+    
+    // Running it here instead would stall the frame
+    job* build = job_create_custom(work, build_job_run);
+    if (!build) {
+        texture->state = STREAM_STATE_RESIDENT;
+        job_counter_done(&streamer->jobs);
+        free(work);
+        return 0;
+    }
+    job_queue_add_worker(build);
+    return 1;
+}
+
+// Swaps in every image whose copy has landed. A job only hands the
+// texture back by moving the state on, so once it reads UPLOADING or
+// FAILED the job is done with it.
+static void finish_builds(vulkan_context* ctx, texture_streamer* streamer) {
+    stream_state states[STREAM_MAX_TEXTURES];
+    pthread_mutex_lock(&streamer->lock);
+    for (uint32_t i = 0; i < streamer->texture_count; i++) {
+        states[i] = streamer->textures[i].state;
+    }
+    pthread_mutex_unlock(&streamer->lock);
+    
+    for (uint32_t i = 0; i < streamer->texture_count; i++) {
+        stream_texture* texture = &streamer->textures[i];
+        if (states[i] == STREAM_STATE_FAILED) {
+            texture->state = STREAM_STATE_RESIDENT;
+            streamer->stats.failed++;
+            continue;
+        }
+        
+        // A full retire list holds the swap back a frame
+        if (states[i] != STREAM_STATE_UPLOADING || !upload_is_complete(ctx, texture->pending.upload_ticket) ||
+            !sprite_replace_texture(ctx, texture->sprite_texture, &texture->pending)) {
+            continue;
+        }
+        
+        uint64_t bytes = bytes_from(texture, texture->pending_level);
+        if (texture->pending_level < texture->base_level) {
+            streamer->stats.loads++;
+            streamer->stats.loaded_bytes += bytes - texture->resident_bytes;
+        } else {
+            streamer->stats.evictions++;
+            streamer->stats.evicted_bytes += texture->resident_bytes - bytes;
+        }
+        streamer->stats.build_ns += texture->pending_ns;
+        texture->base_level = texture->pending_level;
+        texture->resident_bytes = bytes;
+        texture->state = STREAM_STATE_RESIDENT;
+    }
+}
+
+// Lowered to what the heap our images live in still has room for, counting
+// what we already hold
+static uint64_t effective_budget(vulkan_context* ctx, texture_streamer* streamer, uint64_t resident) {
+    gpu_allocator_stats stats;
+    gpu_allocator_get_stats(ctx->allocator, &stats);
+    if (!stats.budget_supported || streamer->texture_count == 0) {
+        return streamer->budget_bytes;
+    }
+    
+    const sprite_texture* sample = &ctx->sprites->textures[streamer->textures[0].sprite_texture];
+    uint32_t heap = ctx->allocator->memory_properties.memoryTypes[sample->allocation.memory_type].heapIndex;
+    uint64_t room = stats.heap_budget[heap] > stats.heap_usage[heap] ? stats.heap_budget[heap] - stats.heap_usage[heap]
+                                                                     : 0;
+    return resident + room < streamer->budget_bytes ? resident + room : streamer->budget_bytes;
+}
+
+// The texture furthest from what it asked for, among the most recently
+// asked for; NULL when every texture has what it wants
+static stream_texture* next_load(texture_streamer* streamer, const uint8_t* skipped) {
+    stream_texture* best = NULL;
+    for (uint32_t i = 0; i < streamer->texture_count; i++) {
+        stream_texture* texture = &streamer->textures[i];
+        if (skipped[i] || texture->state != STREAM_STATE_RESIDENT ||
+            texture->requested_level >= texture->base_level) {
+            continue;
+        }
+        
+        if (!best || texture->request_frame > best->request_frame ||
+            (texture->request_frame == best->request_frame &&
+             texture->base_level - texture->requested_level > best->base_level - best->requested_level)) {
+            best = texture;
+        }
+    }
+    return best;
+}
+
+// The texture holding more than it asked for that was asked for longest ago
+static stream_texture* next_eviction(texture_streamer* streamer) {
+    stream_texture* oldest = NULL;
+    for (uint32_t i = 0; i < streamer->texture_count; i++) {
+        stream_texture* texture = &streamer->textures[i];
+        if (texture->state == STREAM_STATE_RESIDENT && texture->requested_level > texture->base_level &&
+            (!oldest || texture->request_frame < oldest->request_frame)) {
+            oldest = texture;
+        }
+    }
+    return oldest;
+}
+
+// Takes the sprites' screen sizes from the last flush along with the
+// explicit requests, and lets textures nothing drew for a while go idle
+static void gather_requests(vulkan_context* ctx, texture_streamer* streamer) {
+    for (uint32_t i = 0; i < streamer->texture_count; i++) {
+        stream_texture* texture = &streamer->textures[i];
+        sprite_texture* sprite = &ctx->sprites->textures[texture->sprite_texture];
+        if (sprite->screen_size[0] > 0.0f || sprite->screen_size[1] > 0.0f) {
+            uint32_t level = level_for_size(texture, sprite->screen_size);
+            if (level < texture->frame_request) {
+                texture->frame_request = level;
+            }
+            sprite->screen_size[0] = 0.0f;
+            sprite->screen_size[1] = 0.0f;
+        }
+        
+        if (texture->frame_request != STREAM_NO_REQUEST) {
+            texture->requested_level = texture->frame_request;
+            texture->request_frame = streamer->frame;
+        } else if (streamer->frame - texture->request_frame > STREAM_IDLE_FRAMES) {
+            texture->requested_level = texture->tail_level;
+        }
+        texture->frame_request = STREAM_NO_REQUEST;
+    }
+}
+
+void stream_update(vulkan_context* ctx) {
+    texture_streamer* streamer = ctx->streamer;
+    if (!streamer || !ctx->sprites) {
+        return;
+    }
+    
+    streamer->frame++;
+    finish_builds(ctx, streamer);
+    gather_requests(ctx, streamer);
+    
+    uint64_t committed = 0;
+    uint64_t resident = 0;
+    for (uint32_t i = 0; i < streamer->texture_count; i++) {
+        committed += committed_bytes(&streamer->textures[i]);
+        resident += streamer->textures[i].resident_bytes;
+    }
+    uint64_t budget = effective_budget(ctx, streamer, resident);
+    
+    // Images only shrink when the budget needs the room, so textures that
+    // drop off screen for a moment come back without a reload. While an
+    // image and its replacement both exist the budget can be exceeded for
+    // a few frames.
+    uint64_t wanted = committed;
+    for (uint32_t i = 0; i < streamer->texture_count; i++) {
+        stream_texture* texture = &streamer->textures[i];
+        if (texture->state == STREAM_STATE_RESIDENT && texture->requested_level < texture->base_level) {
+            wanted += bytes_from(texture, texture->requested_level) - texture->resident_bytes;
+        }
+    }
+    
+    uint32_t starts = 0;
+    while (wanted > budget && starts < STREAM_MAX_STARTS) {
+        stream_texture* victim = next_eviction(streamer);
+        if (!victim) {
+            break;
+        }
+        
+        uint64_t freed = victim->resident_bytes - bytes_from(victim, victim->requested_level);
+        if (!start_build(ctx, streamer, victim, victim->requested_level)) {
+            break;
+        }
+        committed -= freed;
+        wanted -= freed;
+        starts++;
+    }
+    
+    // A load that doesn't fit comes in as far as it does and tries for the
+    // rest once something has been evicted
+    uint8_t skipped[STREAM_MAX_TEXTURES] = {0};
+    while (starts < STREAM_MAX_STARTS) {
+        stream_texture* texture = next_load(streamer, skipped);
+        if (!texture) {
+            break;
+        }
+        skipped[texture - streamer->textures] = 1;
+        
+        uint32_t level = texture->requested_level;
+        while (level < texture->base_level &&
+               committed - texture->resident_bytes + bytes_from(texture, level) > budget) {
+            level++;
+        }
+        if (level != texture->requested_level) {
+            streamer->stats.deferred++;
+        }
+        if (level == texture->base_level) {
+            continue;
+        }
+        
+        uint64_t grown = bytes_from(texture, level) - texture->resident_bytes;
+        if (!start_build(ctx, streamer, texture, level)) {
+            break;
+        }
+        committed += grown;
+        starts++;
+    }
+    
+    stream_stats* stats = &streamer->stats;
+    stats->texture_count = streamer->texture_count;
+    stats->budget_bytes = budget;
+    stats->loading = 0;
+    stats->resident_bytes = 0;
+    stats->requested_bytes = 0;
+    stats->resident_levels = 0;
+    stats->requested_levels = 0;
+    for (uint32_t i = 0; i < streamer->texture_count; i++) {
+        const stream_texture* texture = &streamer->textures[i];
+        stats->loading += texture->state != STREAM_STATE_RESIDENT;
+        stats->resident_bytes += texture->resident_bytes;
+        stats->requested_bytes += bytes_from(texture, texture->requested_level);
+        stats->resident_levels += texture->source.level_count - texture->base_level;
+        stats->requested_levels += texture->source.level_count - texture->requested_level;
+    }
+}
+
+void stream_get_stats(vulkan_context* ctx, stream_stats* stats) {
+    if (ctx->streamer) {
+        *stats = ctx->streamer->stats;
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "renderer.h"
+#include "texture.h"
+#include "pack.h"
+#include "jobs.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define STREAM_MAX_TEXTURES 256
+#define STREAM_DEFAULT_BUDGET_MB 64
+
+// Levels no larger than this on either side load with the texture and are
+// never evicted, so there is always something to draw
+#define STREAM_TAIL_SIZE 64
+
+// Image rebuilds started per frame, evictions included
+#define STREAM_MAX_STARTS 2
+
+// Textures nothing asked for in this many frames fall back to their tail
+#define STREAM_IDLE_FRAMES 120
+
+#define STREAM_STATS_FRAMES 600
+
+typedef enum {
+    // Only the render thread touches the texture
+    STREAM_STATE_RESIDENT,
+    
+    // A job owns pending until it moves the state on
+    STREAM_STATE_LOADING,
+    STREAM_STATE_UPLOADING,
+    STREAM_STATE_FAILED
+} stream_state;
+
+// One streamed texture. The image holds base_level and every smaller level;
+// a change of residency builds a whole new image on a job worker and swaps
+// it in at a frame boundary.
+typedef struct {
+    texture_source source;
+    uint8_t* owned;
+    uint32_t sprite_texture;
+    
+    // Texel bytes per level in the format the device gets
+    uint64_t level_bytes[TEXTURE_MAX_LEVELS];
+    uint32_t tail_level;
+    uint32_t base_level;
+    uint64_t resident_bytes;
+    
+    // Finest level asked for since the last update, and when that last
+    // happened; requested_level is what the texture is working towards
+    uint32_t frame_request;
+    uint32_t requested_level;
+    uint64_t request_frame;
+    
+    stream_state state;
+    uint32_t pending_level;
+    texture pending;
+    uint64_t pending_ns;
+} stream_texture;
+
+typedef struct {
+    uint32_t texture_count;
+    uint32_t loading;
+    
+    // The configured budget, lowered to what the heap has room for when
+    // the device reports its budget
+    uint64_t budget_bytes;
+    uint64_t resident_bytes;
+    
+    // What every texture would take at the level it asked for
+    uint64_t requested_bytes;
+    uint32_t resident_levels;
+    uint32_t requested_levels;
+    uint64_t loads;
+    uint64_t evictions;
+    uint64_t loaded_bytes;
+    uint64_t evicted_bytes;
+    uint64_t failed;
+    
+    // Updates that cut a load short, or put it off entirely, to stay
+    // within the budget
+    uint64_t deferred;
+    uint64_t build_ns;
+} stream_stats;
+
+typedef struct texture_streamer {
+    pthread_mutex_t lock;
+    job_counter jobs;
+    stream_texture textures[STREAM_MAX_TEXTURES];
+    uint32_t texture_count;
+    uint64_t budget_bytes;
+    uint64_t frame;
+    stream_stats stats;
+} texture_streamer;
+
+// After sprite_init; budget_mb of 0 takes the default
+int stream_init(vulkan_context* ctx, uint32_t budget_mb);
+
+// Waits for the rebuilds in flight; before sprite_shutdown
+void stream_shutdown(vulkan_context* ctx);
+
+// Creates a sprite texture holding only the tail levels and streams the
+// rest in as sprites drawn with it need them. data must outlive the
+// streamer. Returns the sprite texture, or SPRITE_TEXTURE_NONE.
+uint32_t stream_add_ktx2(vulkan_context* ctx, const void* data, uint64_t size);
+
+// The same for an asset in a pack; compressed ones are decoded into a copy
+// the streamer keeps
+uint32_t stream_add_pack(vulkan_context* ctx, const asset_pack* pack, const char* name);
+
+// For callers with their own feedback, such as a sampler feedback pass:
+// asks for level and everything smaller to be resident. Sprites drawn with
+// the texture make their own requests from their size on screen.
+void stream_request_level(vulkan_context* ctx, uint32_t sprite_texture, uint32_t level);
+
+// Render thread only, before sprite_flush: swaps in the images whose copies
+// have completed, then starts the loads and evictions the requests and the
+// budget call for. Never waits on a job or the GPU.
+void stream_update(vulkan_context* ctx);
+
+void stream_get_stats(vulkan_context* ctx, stream_stats* stats);
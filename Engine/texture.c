@@ -0,0 +1,1219 @@
+#include "texture.h"
+#include "jobs.h"
+#include "timing.h"
+#include "platform.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXTURE_SIMD 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TEXTURE_SIMD 1
+#else
+#define TEXTURE_SIMD 0
+#endif
+
+#define LOG_TAG "vm_engine"
+
+static const uint8_t ktx2_identifier[12] = {
+    0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'
+};
+
+// ETC1 intensity modifiers per table, small then large; negated for the
+// upper two pixel indices
+static const int etc_modifiers[8][2] = {
+    {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}
+};
+
+// Paint distances of the ETC2 T and H modes
+static const int etc_distances[8] = {3, 6, 11, 16, 23, 32, 41, 64};
+
+// The inner loops of the BC encoders, over one 4x4 tile of RGBA8 texels
+// in row order
+typedef struct {
+    void (*bounds)(const uint8_t* tile, uint8_t* min, uint8_t* max);
+    void (*project)(const uint8_t* tile, const int16_t* axis, int32_t* dots);
+} block_kernels;
+
+typedef struct {
+    texture_format source_format;
+    int bc1_alpha;
+    texture_format format;
+    const block_kernels* kernels;
+    const uint8_t* src;
+    uint8_t* dst;
+    uint32_t width;
+    uint32_t height;
+    uint32_t first_row;
+    uint32_t row_count;
+    job_counter* counter;
+} transcode_job;
+
+static void bounds_scalar(const uint8_t* tile, uint8_t* min, uint8_t* max) {
+    for (int c = 0; c < 4; c++) {
+        min[c] = 255;
+        max[c] = 0;
+    }
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 4; c++) {
+            uint8_t value = tile[i * 4 + c];
+            min[c] = value < min[c] ? value : min[c];
+            max[c] = value > max[c] ? value : max[c];
+        }
+    }
+}
+
+static void project_scalar(const uint8_t* tile, const int16_t* axis, int32_t* dots) {
+    for (int i = 0; i < 16; i++) {
+        const uint8_t* texel = tile + i * 4;
+        dots[i] = texel[0] * axis[0] + texel[1] * axis[1] + texel[2] * axis[2] + texel[3] * axis[3];
+    }
+}
+
+static const block_kernels scalar_kernels = {bounds_scalar, project_scalar};
+
+#if defined(__SSE2__)
+// Four texels per register; the per-texel reductions fold whole registers
+// so no lane ever leaves SIMD until the final store
+static void bounds_simd(const uint8_t* tile, uint8_t* min, uint8_t* max) {
+    __m128i p0 = _mm_loadu_si128((const __m128i*)tile);
+    __m128i p1 = _mm_loadu_si128((const __m128i*)(tile + 16));
+    __m128i p2 = _mm_loadu_si128((const __m128i*)(tile + 32));
+    __m128i p3 = _mm_loadu_si128((const __m128i*)(tile + 48));
+    
+    __m128i lo = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+    __m128i hi = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+    lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+    hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+    lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+    hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+    
+    int32_t packed_min = _mm_cvtsi128_si32(lo);
+    int32_t packed_max = _mm_cvtsi128_si32(hi);
+    memcpy(min, &packed_min, 4);
+    memcpy(max, &packed_max, 4);
+}
+
+// madd leaves two partial sums per texel; the float shuffle gathers the
+// even and odd halves of two registers so one add finishes four texels
+static void project_simd(const uint8_t* tile, const int16_t* axis, int32_t* dots) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i weights = _mm_set_epi16(axis[3], axis[2], axis[1], axis[0], axis[3], axis[2], axis[1], axis[0]);
+    
+    for (int i = 0; i < 4; i++) {
+        __m128i texels = _mm_loadu_si128((const __m128i*)(tile + i * 16));
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(texels, zero), weights);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(texels, zero), weights);
+        __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_si128((__m128i*)(dots + i * 4), _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd)));
+    }
+}
+
+static const block_kernels simd_kernels = {bounds_simd, project_simd};
+#elif defined(__ARM_NEON)
+// Only pairwise ops, so the same code builds for ARMv7 and AArch64
+static void bounds_simd(const uint8_t* tile, uint8_t* min, uint8_t* max) {
+    uint8x16_t p0 = vld1q_u8(tile);
+    uint8x16_t p1 = vld1q_u8(tile + 16);
+    uint8x16_t p2 = vld1q_u8(tile + 32);
+    uint8x16_t p3 = vld1q_u8(tile + 48);
+    
+    uint8x16_t lo = vminq_u8(vminq_u8(p0, p1), vminq_u8(p2, p3));
+    uint8x16_t hi = vmaxq_u8(vmaxq_u8(p0, p1), vmaxq_u8(p2, p3));
+    uint8x8_t lo_half = vmin_u8(vget_low_u8(lo), vget_high_u8(lo));
+    uint8x8_t hi_half = vmax_u8(vget_low_u8(hi), vget_high_u8(hi));
+    lo_half = vmin_u8(lo_half, vreinterpret_u8_u32(vrev64_u32(vreinterpret_u32_u8(lo_half))));
+    hi_half = vmax_u8(hi_half, vreinterpret_u8_u32(vrev64_u32(vreinterpret_u32_u8(hi_half))));
+    
+    uint8_t lanes[8];
+    vst1_u8(lanes, lo_half);
+    memcpy(min, lanes, 4);
+    vst1_u8(lanes, hi_half);
+    memcpy(max, lanes, 4);
+}
+
+static void project_simd(const uint8_t* tile, const int16_t* axis, int32_t* dots) {
+    int16x4_t weights = vld1_s16(axis);
+    
+    for (int i = 0; i < 4; i++) {
+        uint8x16_t texels = vld1q_u8(tile + i * 16);
+        int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(texels)));
+        int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(texels)));
+        int32x4_t m0 = vmull_s16(vget_low_s16(lo), weights);
+        int32x4_t m1 = vmull_s16(vget_high_s16(lo), weights);
+        int32x4_t m2 = vmull_s16(vget_low_s16(hi), weights);
+        int32x4_t m3 = vmull_s16(vget_high_s16(hi), weights);
+        int32x2_t s0 = vpadd_s32(vget_low_s32(m0), vget_high_s32(m0));
+        int32x2_t s1 = vpadd_s32(vget_low_s32(m1), vget_high_s32(m1));
+        int32x2_t s2 = vpadd_s32(vget_low_s32(m2), vget_high_s32(m2));
+        int32x2_t s3 = vpadd_s32(vget_low_s32(m3), vget_high_s32(m3));
+        vst1q_s32(dots + i * 4, vcombine_s32(vpadd_s32(s0, s1), vpadd_s32(s2, s3)));
+    }
+}
+
+static const block_kernels simd_kernels = {bounds_simd, project_simd};
+#else
+static const block_kernels simd_kernels = {bounds_scalar, project_scalar};
+#endif
+
+static uint8_t clamp_u8(int value) {
+    return (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static uint32_t read_u32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static uint64_t read_u64(const uint8_t* bytes) {
+    return (uint64_t)read_u32(bytes) | ((uint64_t)read_u32(bytes + 4) << 32);
+}
+
+static uint32_t block_bytes(texture_format format) {
+    switch (format) {
+        case TEXTURE_FORMAT_BC1:
+        case TEXTURE_FORMAT_ETC2_RGB8:
+            return 8;
+            
+        case TEXTURE_FORMAT_BC3:
+        case TEXTURE_FORMAT_ASTC_4X4:
+            return 16;
+            
+        default:
+            return 0;
+    }
+}
+
+uint64_t texture_level_size(texture_format format, uint32_t width, uint32_t height) {
+    if (format == TEXTURE_FORMAT_RGBA8) {
+        return (uint64_t)width * height * 4;
+    }
+    return (((uint64_t)width + 3) / 4) * (((uint64_t)height + 3) / 4) * block_bytes(format);
+}
+
+VkFormat texture_vk_format(texture_format format, int srgb, int bc1_alpha) {
+    switch (format) {
+        case TEXTURE_FORMAT_RGBA8:
+            return srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+            
+        case TEXTURE_FORMAT_BC1:
+            if (bc1_alpha) {
+                return srgb ? VK_FORMAT_BC1_RGBA_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+            }
+            return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+            
+        case TEXTURE_FORMAT_BC3:
+            return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+            
+        case TEXTURE_FORMAT_ETC2_RGB8:
+            return srgb ? VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK : VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK;
+            
+        case TEXTURE_FORMAT_ASTC_4X4:
+            return srgb ? VK_FORMAT_ASTC_4x4_SRGB_BLOCK : VK_FORMAT_ASTC_4x4_UNORM_BLOCK;
+            
+        default:
+            return VK_FORMAT_UNDEFINED;
+    }
+}
+
+const char* texture_format_name(texture_format format) {
+    static const char* names[TEXTURE_FORMAT_COUNT] = {"RGBA8", "BC1", "BC3", "ETC2", "ASTC 4x4"};
+    return format < TEXTURE_FORMAT_COUNT ? names[format] : "unknown";
+}
+
+static int format_from_vk(uint32_t vk_format, texture_source* source) {
+    switch (vk_format) {
+        case VK_FORMAT_R8G8B8A8_SRGB:
+            source->srgb = 1;
+            // fall through
+        case VK_FORMAT_R8G8B8A8_UNORM:
+            source->format = TEXTURE_FORMAT_RGBA8;
+            return 1;
+            
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+            source->srgb = 1;
+            // fall through
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            source->bc1_alpha = 1;
+            source->format = TEXTURE_FORMAT_BC1;
+            return 1;
+            
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            source->srgb = 1;
+            // fall through
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            source->format = TEXTURE_FORMAT_BC1;
+            return 1;
+            
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+            source->srgb = 1;
+            // fall through
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+            source->format = TEXTURE_FORMAT_BC3;
+            return 1;
+            
+        case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+            source->srgb = 1;
+            // fall through
+        case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+            source->format = TEXTURE_FORMAT_ETC2_RGB8;
+            return 1;
+            
+        case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+            source->srgb = 1;
+            // fall through
+        case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+            source->format = TEXTURE_FORMAT_ASTC_4X4;
+            return 1;
+            
+        default:
+            return 0;
+    }
+}
+
+int texture_parse_ktx2(const void* data, uint64_t size, texture_source* source) {
+    const uint8_t* bytes = data;
+    memset(source, 0, sizeof(*source));
+    
+    if (!bytes || size < KTX2_HEADER_SIZE || memcmp(bytes, ktx2_identifier, sizeof(ktx2_identifier)) != 0) {
+        return 0;
+    }
+    
+    uint32_t vk_format = read_u32(bytes + 12);
+    uint32_t width = read_u32(bytes + 20);
+    uint32_t height = read_u32(bytes + 24);
+    uint32_t depth = read_u32(bytes + 28);
+    uint32_t layer_count = read_u32(bytes + 32);
+    uint32_t face_count = read_u32(bytes + 36);
+    uint32_t level_count = read_u32(bytes + 40);
+    uint32_t supercompression = read_u32(bytes + 44);
+    
+    // BasisLZ and the zstd/zlib schemes need their decoders, which the
+    // engine doesn't carry; such assets must be unpacked at build time
+    if (supercompression != KTX2_SUPERCOMPRESSION_NONE) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "texture: supercompression scheme %u is not supported",
+                            supercompression);
+        return 0;
+    }
+    if (!format_from_vk(vk_format, source)) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "texture: vkFormat %u is not supported", vk_format);
+        return 0;
+    }
+    
+    // A level count of 0 asks for generated mips; the base level is all there is
+    level_count = level_count ? level_count : 1;
+    if (width == 0 || height == 0 || depth != 0 || layer_count > 1 || face_count != 1 ||
+        level_count > TEXTURE_MAX_LEVELS || KTX2_HEADER_SIZE + (uint64_t)level_count * KTX2_LEVEL_INDEX_SIZE > size) {
+        return 0;
+    }
+    
+    // No more levels than halving the larger side down to 1 gives
+    uint32_t full_chain = 1;
+    for (uint32_t side = width > height ? width : height; side > 1; side >>= 1) {
+        full_chain++;
+    }
+    if (level_count > full_chain) {
+        return 0;
+    }
+    
+    source->width = width;
+    source->height = height;
+    source->level_count = level_count;
+    for (uint32_t i = 0; i < level_count; i++) {
+        const uint8_t* index = bytes + KTX2_HEADER_SIZE + i * KTX2_LEVEL_INDEX_SIZE;
+        uint64_t offset = read_u64(index);
+        uint64_t length = read_u64(index + 8);
+        
+        texture_level* level = &source->levels[i];
+        level->width = width >> i ? width >> i : 1;
+        level->height = height >> i ? height >> i : 1;
+        level->size = texture_level_size(source->format, level->width, level->height);
+        if (offset > size || length > size - offset || length < level->size) {
+            return 0;
+        }
+        level->data = bytes + offset;
+    }
+    return 1;
+}
+
+static int format_supported(const device_caps* caps, texture_format format) {
+    switch (format) {
+        case TEXTURE_FORMAT_RGBA8:
+            return 1;
+            
+        case TEXTURE_FORMAT_BC1:
+        case TEXTURE_FORMAT_BC3:
+            return caps->texture_compression_bc != 0;
+            
+        case TEXTURE_FORMAT_ETC2_RGB8:
+            return caps->texture_compression_etc2 != 0;
+            
+        case TEXTURE_FORMAT_ASTC_4X4:
+            return caps->texture_compression_astc != 0;
+            
+        default:
+            return 0;
+    }
+}
+
+// Whether every texel of the base level has full alpha; BC3 is taken as
+// translucent without looking
+static int source_opaque(const texture_source* source) {
+    switch (source->format) {
+        case TEXTURE_FORMAT_RGBA8: {
+            const texture_level* level = &source->levels[0];
+            for (uint64_t i = 3; i < level->size; i += 4) {
+                if (level->data[i] != 255) {
+                    return 0;
+                }
+            }
+            return 1;
+        }
+        
+        case TEXTURE_FORMAT_BC1:
+            return !source->bc1_alpha;
+            
+        case TEXTURE_FORMAT_ETC2_RGB8:
+            return 1;
+            
+        default:
+            return 0;
+    }
+}
+
+int texture_select_format(const device_caps* caps, const texture_source* source, int compress,
+                          texture_format* format) {
+    // Caught before any level is transcoded for an image that can't be made
+    if (source->width > caps->max_image_dimension_2d || source->height > caps->max_image_dimension_2d) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "texture: %ux%u is larger than the device's %u",
+                            source->width, source->height, caps->max_image_dimension_2d);
+        return 0;
+    }
+    
+    if (source->format != TEXTURE_FORMAT_RGBA8 && format_supported(caps, source->format)) {
+        *format = source->format;
+        return 1;
+    }
+    
+    // ASTC is too involved to decode here
+    if (source->format == TEXTURE_FORMAT_ASTC_4X4) {
+        return 0;
+    }
+    
+    // Block sources were lossy already, so they stay compressed either way;
+    // compress only decides for RGBA8 sources
+    if (source->format == TEXTURE_FORMAT_RGBA8 && !compress) {
+        *format = TEXTURE_FORMAT_RGBA8;
+        return 1;
+    }
+    
+    int opaque = source_opaque(source);
+    if (caps->texture_compression_bc) {
+        *format = opaque ? TEXTURE_FORMAT_BC1 : TEXTURE_FORMAT_BC3;
+    } else if (caps->texture_compression_etc2 && opaque) {
+        *format = TEXTURE_FORMAT_ETC2_RGB8;
+    } else {
+        *format = TEXTURE_FORMAT_RGBA8;
+    }
+    return 1;
+}
+
+static void unpack_565(uint16_t color, uint8_t* rgb) {
+    uint32_t r = (color >> 11) & 31;
+    uint32_t g = (color >> 5) & 63;
+    uint32_t b = color & 31;
+    rgb[0] = (uint8_t)((r << 3) | (r >> 2));
+    rgb[1] = (uint8_t)((g << 2) | (g >> 4));
+    rgb[2] = (uint8_t)((b << 3) | (b >> 2));
+}
+
+static uint16_t pack_565(const uint8_t* rgb) {
+    return (uint16_t)(((rgb[0] * 31 + 127) / 255) << 11 | ((rgb[1] * 63 + 127) / 255) << 5 | ((rgb[2] * 31 + 127) / 255));
+}
+
+// four_color forces the opaque palette, as BC3 color blocks always use it
+static void decode_bc1_block(const uint8_t* block, int four_color, int punch_through, uint8_t* tile) {
+    uint16_t c0 = (uint16_t)(block[0] | (block[1] << 8));
+    uint16_t c1 = (uint16_t)(block[2] | (block[3] << 8));
+    uint32_t indices = read_u32(block + 4);
+    
+    uint8_t palette[4][4];
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+    
+    for (int c = 0; c < 3; c++) {
+        if (four_color || c0 > c1) {
+            palette[2][c] = (uint8_t)((2 * palette[0][c] + palette[1][c]) / 3);
+            palette[3][c] = (uint8_t)((palette[0][c] + 2 * palette[1][c]) / 3);
+        } else {
+            palette[2][c] = (uint8_t)((palette[0][c] + palette[1][c]) / 2);
+            palette[3][c] = 0;
+        }
+    }
+    if (!four_color && c0 <= c1 && punch_through) {
+        palette[3][3] = 0;
+    }
+    
+    for (int i = 0; i < 16; i++) {
+        memcpy(tile + i * 4, palette[(indices >> (i * 2)) & 3], 4);
+    }
+}
+
+static void decode_alpha_block(const uint8_t* block, uint8_t* tile) {
+    uint8_t palette[8];
+    palette[0] = block[0];
+    palette[1] = block[1];
+    if (block[0] > block[1]) {
+        for (int i = 2; i < 8; i++) {
+            palette[i] = (uint8_t)(((8 - i) * block[0] + (i - 1) * block[1]) / 7);
+        }
+    } else {
+        for (int i = 2; i < 6; i++) {
+            palette[i] = (uint8_t)(((6 - i) * block[0] + (i - 1) * block[1]) / 5);
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+    
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++) {
+        indices |= (uint64_t)block[2 + i] << (i * 8);
+    }
+    for (int i = 0; i < 16; i++) {
+        tile[i * 4 + 3] = palette[(indices >> (i * 3)) & 7];
+    }
+}
+
+// ETC pixel indices run down the columns: bit x * 4 + y of the MSB and LSB halves
+static int etc_index(uint32_t msb, uint32_t lsb, int x, int y) {
+    int bit = x * 4 + y;
+    return (int)(((msb >> bit) & 1) << 1 | ((lsb >> bit) & 1));
+}
+
+static void etc_write_paints(int paints[4][3], uint32_t msb, uint32_t lsb, uint8_t* tile) {
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            int* paint = paints[etc_index(msb, lsb, x, y)];
+            uint8_t* texel = tile + (y * 4 + x) * 4;
+            texel[0] = clamp_u8(paint[0]);
+            texel[1] = clamp_u8(paint[1]);
+            texel[2] = clamp_u8(paint[2]);
+            texel[3] = 255;
+        }
+    }
+}
+
+static void decode_etc2_t(const uint8_t* block, uint32_t msb, uint32_t lsb, uint8_t* tile) {
+    int c1[3] = {((block[0] >> 1) & 12) | (block[0] & 3), block[1] >> 4, block[1] & 15};
+    int c2[3] = {block[2] >> 4, block[2] & 15, block[3] >> 4};
+    int distance = etc_distances[((block[3] >> 1) & 6) | (block[3] & 1)];
+    
+    int paints[4][3];
+    for (int c = 0; c < 3; c++) {
+        paints[0][c] = c1[c] * 17;
+        paints[1][c] = c2[c] * 17 + distance;
+        paints[2][c] = c2[c] * 17;
+        paints[3][c] = c2[c] * 17 - distance;
+    }
+    etc_write_paints(paints, msb, lsb, tile);
+}
+
+static void decode_etc2_h(const uint8_t* block, uint32_t msb, uint32_t lsb, uint8_t* tile) {
+    int c1[3] = {
+        (block[0] >> 3) & 15,
+        ((block[0] & 7) << 1) | ((block[1] >> 4) & 1),
+        (block[1] & 8) | ((block[1] & 3) << 1) | (block[2] >> 7)
+    };
+    int c2[3] = {(block[2] >> 3) & 15, ((block[2] & 7) << 1) | (block[3] >> 7), (block[3] >> 3) & 15};
+    
+    // The lowest distance bit is implied by the order of the two colors
+    int order = ((c1[0] << 8) | (c1[1] << 4) | c1[2]) >= ((c2[0] << 8) | (c2[1] << 4) | c2[2]);
+    int distance = etc_distances[(block[3] & 4) | ((block[3] & 1) << 1) | order];
+    
+    int paints[4][3];
+    for (int c = 0; c < 3; c++) {
+        paints[0][c] = c1[c] * 17 + distance;
+        paints[1][c] = c1[c] * 17 - distance;
+        paints[2][c] = c2[c] * 17 + distance;
+        paints[3][c] = c2[c] * 17 - distance;
+    }
+    etc_write_paints(paints, msb, lsb, tile);
+}
+
+static void decode_etc2_planar(const uint8_t* block, uint8_t* tile) {
+    uint32_t low = ((uint32_t)block[4] << 24) | ((uint32_t)block[5] << 16) | ((uint32_t)block[6] << 8) | block[7];
+    int origin[3] = {
+        (block[0] >> 1) & 63,
+        ((block[0] & 1) << 6) | ((block[1] >> 1) & 63),
+        ((block[1] & 1) << 5) | (((block[2] >> 3) & 3) << 3) | ((block[2] & 3) << 1) | (block[3] >> 7)
+    };
+    int horizontal[3] = {(((block[3] >> 2) & 31) << 1) | (block[3] & 1), (low >> 25) & 127, (low >> 19) & 63};
+    int vertical[3] = {(low >> 13) & 63, (low >> 6) & 127, low & 63};
+    
+    // Red and blue are 6 bits, green 7
+    for (int c = 0; c < 3; c++) {
+        int bits = c == 1 ? 7 : 6;
+        origin[c] = (origin[c] << (8 - bits)) | (origin[c] >> (2 * bits - 8));
+        horizontal[c] = (horizontal[c] << (8 - bits)) | (horizontal[c] >> (2 * bits - 8));
+        vertical[c] = (vertical[c] << (8 - bits)) | (vertical[c] >> (2 * bits - 8));
+    }
+    
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            uint8_t* texel = tile + (y * 4 + x) * 4;
+            for (int c = 0; c < 3; c++) {
+                texel[c] = clamp_u8((x * (horizontal[c] - origin[c]) + y * (vertical[c] - origin[c]) +
+                                     4 * origin[c] + 2) >> 2);
+            }
+            texel[3] = 255;
+        }
+    }
+}
+
+// ETC1 blocks, plus the T, H and planar modes ETC2 hides in differential
+// blocks whose red, green or blue delta overflows
+static void decode_etc2_block(const uint8_t* block, uint8_t* tile) {
+    uint32_t msb = ((uint32_t)block[4] << 8) | block[5];
+    uint32_t lsb = ((uint32_t)block[6] << 8) | block[7];
+    int flip = block[3] & 1;
+    int tables[2] = {block[3] >> 5, (block[3] >> 2) & 7};
+    
+    int base[2][3];
+    if (block[3] & 2) {
+        for (int c = 0; c < 3; c++) {
+            int value = block[c] >> 3;
+            int delta = ((block[c] & 7) ^ 4) - 4;
+            if (value + delta < 0 || value + delta > 31) {
+                if (c == 0) {
+                    decode_etc2_t(block, msb, lsb, tile);
+                } else if (c == 1) {
+                    decode_etc2_h(block, msb, lsb, tile);
+                } else {
+                    decode_etc2_planar(block, tile);
+                }
+                return;
+            }
+            base[0][c] = (value << 3) | (value >> 2);
+            base[1][c] = ((value + delta) << 3) | ((value + delta) >> 2);
+        }
+    } else {
+        for (int c = 0; c < 3; c++) {
+            base[0][c] = (block[c] >> 4) * 17;
+            base[1][c] = (block[c] & 15) * 17;
+        }
+    }
+    
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            int sub = flip ? y >= 2 : x >= 2;
+            int index = etc_index(msb, lsb, x, y);
+            int modifier = etc_modifiers[tables[sub]][index & 1];
+            modifier = index & 2 ? -modifier : modifier;
+            
+            uint8_t* texel = tile + (y * 4 + x) * 4;
+            for (int c = 0; c < 3; c++) {
+                texel[c] = clamp_u8(base[sub][c] + modifier);
+            }
+            texel[3] = 255;
+        }
+    }
+}
+
+// Bounding-box endpoints, pulled in by a sixteenth of the range so the
+// error spreads over the block instead of landing on the extremes, and one
+// projection onto their axis for the indices
+static void encode_bc1_block(const block_kernels* kernels, const uint8_t* tile, uint8_t* block) {
+    uint8_t min[4], max[4];
+    kernels->bounds(tile, min, max);
+    for (int c = 0; c < 3; c++) {
+        int inset = (max[c] - min[c]) >> 4;
+        min[c] = (uint8_t)(min[c] + inset);
+        max[c] = (uint8_t)(max[c] - inset);
+    }
+    
+    // max is at least min in every channel, so c0 >= c1 and the block
+    // decodes with the four-color palette
+    uint16_t c0 = pack_565(max);
+    uint16_t c1 = pack_565(min);
+    uint32_t indices = 0;
+    
+    if (c0 != c1) {
+        uint8_t e0[3], e1[3];
+        unpack_565(c0, e0);
+        unpack_565(c1, e1);
+        
+        int16_t axis[4] = {(int16_t)(e0[0] - e1[0]), (int16_t)(e0[1] - e1[1]), (int16_t)(e0[2] - e1[2]), 0};
+        int32_t dots[16];
+        kernels->project(tile, axis, dots);
+        
+        int32_t origin = e1[0] * axis[0] + e1[1] * axis[1] + e1[2] * axis[2];
+        int32_t range = e0[0] * axis[0] + e0[1] * axis[1] + e0[2] * axis[2] - origin;
+        
+        // Steps along the axis from c1 to c0 in palette order
+        static const uint32_t remap[4] = {1, 3, 2, 0};
+        for (int i = 0; i < 16; i++) {
+            int32_t offset = dots[i] - origin;
+            int32_t step = offset <= 0 ? 0 : (offset * 6 + range) / (range * 2);
+            indices |= remap[step > 3 ? 3 : step] << (i * 2);
+        }
+    }
+    
+    block[0] = (uint8_t)c0;
+    block[1] = (uint8_t)(c0 >> 8);
+    block[2] = (uint8_t)c1;
+    block[3] = (uint8_t)(c1 >> 8);
+    block[4] = (uint8_t)indices;
+    block[5] = (uint8_t)(indices >> 8);
+    block[6] = (uint8_t)(indices >> 16);
+    block[7] = (uint8_t)(indices >> 24);
+}
+
+// Eight-value mode between the alpha extremes
+static void encode_bc3_block(const block_kernels* kernels, const uint8_t* tile, uint8_t* block) {
+    uint8_t min[4], max[4];
+    kernels->bounds(tile, min, max);
+    
+    uint64_t indices = 0;
+    int range = max[3] - min[3];
+    if (range > 0) {
+        for (int i = 0; i < 16; i++) {
+            int step = ((tile[i * 4 + 3] - min[3]) * 7 + range / 2) / range;
+            int index = step == 7 ? 0 : (step == 0 ? 1 : 8 - step);
+            indices |= (uint64_t)index << (i * 3);
+        }
+    }
+    
+    block[0] = max[3];
+    block[1] = min[3];
+    for (int i = 0; i < 6; i++) {
+        block[2 + i] = (uint8_t)(indices >> (i * 8));
+    }
+    encode_bc1_block(kernels, tile, block + 8);
+}
+
+// Best table and per-pixel indices for one half of a block around base;
+// a table stops as soon as it can't beat the best so far
+static uint32_t etc_fit_subblock(const uint8_t* tile, int flip, int sub, const int* base, int* table,
+                                 uint32_t* msb, uint32_t* lsb) {
+    const uint8_t* texels[8];
+    int bits[8];
+    int count = 0;
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            if ((flip ? y >= 2 : x >= 2) == sub) {
+                texels[count] = tile + (y * 4 + x) * 4;
+                bits[count++] = x * 4 + y;
+            }
+        }
+    }
+    
+    uint32_t best_error = UINT32_MAX;
+    for (int t = 0; t < 8; t++) {
+        int palette[4][3];
+        for (int c = 0; c < 3; c++) {
+            palette[0][c] = clamp_u8(base[c] + etc_modifiers[t][0]);
+            palette[1][c] = clamp_u8(base[c] + etc_modifiers[t][1]);
+            palette[2][c] = clamp_u8(base[c] - etc_modifiers[t][0]);
+            palette[3][c] = clamp_u8(base[c] - etc_modifiers[t][1]);
+        }
+        
+        uint32_t error = 0;
+        uint32_t table_msb = 0;
+        uint32_t table_lsb = 0;
+        for (int i = 0; i < count && error < best_error; i++) {
+            const uint8_t* texel = texels[i];
+            uint32_t texel_error = UINT32_MAX;
+            int texel_index = 0;
+            for (int index = 0; index < 4; index++) {
+                int dr = palette[index][0] - texel[0];
+                int dg = palette[index][1] - texel[1];
+                int db = palette[index][2] - texel[2];
+                uint32_t candidate = (uint32_t)(dr * dr + dg * dg + db * db);
+                if (candidate < texel_error) {
+                    texel_error = candidate;
+                    texel_index = index;
+                }
+            }
+            
+            error += texel_error;
+            table_msb |= (uint32_t)(texel_index >> 1) << bits[i];
+            table_lsb |= (uint32_t)(texel_index & 1) << bits[i];
+        }
+        
+        if (error < best_error) {
+            best_error = error;
+            *table = t;
+            *msb = table_msb;
+            *lsb = table_lsb;
+        }
+    }
+    return best_error;
+}
+
+// ETC1 individual and differential modes only, which every ETC2 decoder
+// reads; both flips are tried around the average of each half
+static void encode_etc2_block(const uint8_t* tile, uint8_t* block) {
+    uint32_t best_error = UINT32_MAX;
+    
+    for (int flip = 0; flip < 2; flip++) {
+        int sums[2][3] = {{0}};
+        for (int y = 0; y < 4; y++) {
+            for (int x = 0; x < 4; x++) {
+                int sub = flip ? y >= 2 : x >= 2;
+                for (int c = 0; c < 3; c++) {
+                    sums[sub][c] += tile[(y * 4 + x) * 4 + c];
+                }
+            }
+        }
+        
+        int quantized[2][3];
+        int differential = 1;
+        for (int c = 0; c < 3; c++) {
+            quantized[0][c] = (sums[0][c] * 31 + 1020) / 2040;
+            quantized[1][c] = (sums[1][c] * 31 + 1020) / 2040;
+            int delta = quantized[1][c] - quantized[0][c];
+            differential = differential && delta >= -4 && delta <= 3;
+        }
+        
+        int base[2][3];
+        for (int c = 0; c < 3; c++) {
+            for (int sub = 0; sub < 2; sub++) {
+                if (differential) {
+                    base[sub][c] = (quantized[sub][c] << 3) | (quantized[sub][c] >> 2);
+                } else {
+                    quantized[sub][c] = (sums[sub][c] * 15 + 1020) / 2040;
+                    base[sub][c] = quantized[sub][c] * 17;
+                }
+            }
+        }
+        
+        int tables[2];
+        uint32_t msb[2], lsb[2];
+        uint32_t error = etc_fit_subblock(tile, flip, 0, base[0], &tables[0], &msb[0], &lsb[0]) +
+                         etc_fit_subblock(tile, flip, 1, base[1], &tables[1], &msb[1], &lsb[1]);
+        if (error >= best_error) {
+            continue;
+        }
+        best_error = error;
+        
+        for (int c = 0; c < 3; c++) {
+            if (differential) {
+                block[c] = (uint8_t)((quantized[0][c] << 3) | ((quantized[1][c] - quantized[0][c]) & 7));
+            } else {
+                block[c] = (uint8_t)((quantized[0][c] << 4) | quantized[1][c]);
+            }
+        }
+        block[3] = (uint8_t)((tables[0] << 5) | (tables[1] << 2) | (differential << 1) | flip);
+        
+        uint32_t block_msb = msb[0] | msb[1];
+        uint32_t block_lsb = lsb[0] | lsb[1];
+        block[4] = (uint8_t)(block_msb >> 8);
+        block[5] = (uint8_t)block_msb;
+        block[6] = (uint8_t)(block_lsb >> 8);
+        block[7] = (uint8_t)block_lsb;
+    }
+}
+
+// Edge blocks of RGBA8 sources repeat the last row and column
+static void load_tile(const transcode_job* work, uint32_t bx, uint32_t by, uint8_t* tile) {
+    if (work->source_format == TEXTURE_FORMAT_RGBA8) {
+        for (uint32_t y = 0; y < 4; y++) {
+            uint32_t sy = by * 4 + y < work->height ? by * 4 + y : work->height - 1;
+            for (uint32_t x = 0; x < 4; x++) {
+                uint32_t sx = bx * 4 + x < work->width ? bx * 4 + x : work->width - 1;
+                memcpy(tile + (y * 4 + x) * 4, work->src + ((uint64_t)sy * work->width + sx) * 4, 4);
+            }
+        }
+        return;
+    }
+    
+    uint32_t blocks_x = (work->width + 3) / 4;
+    const uint8_t* block = work->src + ((uint64_t)by * blocks_x + bx) * block_bytes(work->source_format);
+    switch (work->source_format) {
+        case TEXTURE_FORMAT_BC1:
+            decode_bc1_block(block, 0, work->bc1_alpha, tile);
+            break;
+            
+        case TEXTURE_FORMAT_BC3:
+            decode_bc1_block(block + 8, 1, 0, tile);
+            decode_alpha_block(block, tile);
+            break;
+            
+        case TEXTURE_FORMAT_ETC2_RGB8:
+            decode_etc2_block(block, tile);
+            break;
+            
+        default:
+            memset(tile, 0, 64);
+            break;
+    }
+}
+
+static void store_tile(const transcode_job* work, uint32_t bx, uint32_t by, const uint8_t* tile) {
+    if (work->format == TEXTURE_FORMAT_RGBA8) {
+        for (uint32_t y = 0; y < 4 && by * 4 + y < work->height; y++) {
+            for (uint32_t x = 0; x < 4 && bx * 4 + x < work->width; x++) {
+                uint64_t offset = ((uint64_t)(by * 4 + y) * work->width + bx * 4 + x) * 4;
+                memcpy(work->dst + offset, tile + (y * 4 + x) * 4, 4);
+            }
+        }
+        return;
+    }
+    
+    uint32_t blocks_x = (work->width + 3) / 4;
+    uint8_t* block = work->dst + ((uint64_t)by * blocks_x + bx) * block_bytes(work->format);
+    switch (work->format) {
+        case TEXTURE_FORMAT_BC1:
+            encode_bc1_block(work->kernels, tile, block);
+            break;
+            
+        case TEXTURE_FORMAT_BC3:
+            encode_bc3_block(work->kernels, tile, block);
+            break;
+            
+        case TEXTURE_FORMAT_ETC2_RGB8:
+            encode_etc2_block(tile, block);
+            break;
+            
+        default:
+            break;
+    }
+}
+
+static void transcode_rows(transcode_job* work) {
+    uint32_t blocks_x = (work->width + 3) / 4;
+    for (uint32_t by = work->first_row; by < work->first_row + work->row_count; by++) {
+        for (uint32_t bx = 0; bx < blocks_x; bx++) {
+            uint8_t tile[64];
+            load_tile(work, bx, by, tile);
+            store_tile(work, bx, by, tile);
+        }
+    }
+}
+
+static void transcode_job_run(void* data) {
+    transcode_job* work = data;
+    transcode_rows(work);
+    job_counter_done(work->counter);
+}
+
+// Without parallel every piece runs on the calling thread
+static int transcode_levels(const texture_source* source, texture_format format, uint8_t* dst, int parallel,
+                            uint32_t* jobs) {
+    uint32_t job_count = 0;
+    for (uint32_t i = 0; i < source->level_count; i++) {
+        uint32_t rows = (source->levels[i].height + 3) / 4;
+        job_count += (rows + TEXTURE_JOB_BLOCK_ROWS - 1) / TEXTURE_JOB_BLOCK_ROWS;
+    }
+    
+    transcode_job* work = malloc(job_count * sizeof(transcode_job));
+    if (!work) {
+        return 0;
+    }
+    
+    // Rows of the largest level come first, so the calling thread starts
+    // on the biggest piece while the workers spread over the rest
+    uint32_t job_index = 0;
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < source->level_count; i++) {
+        const texture_level* level = &source->levels[i];
+        uint32_t rows = (level->height + 3) / 4;
+        for (uint32_t row = 0; row < rows; row += TEXTURE_JOB_BLOCK_ROWS) {
+            transcode_job* piece = &work[job_index++];
+            piece->source_format = source->format;
+            piece->bc1_alpha = source->bc1_alpha;
+            piece->format = format;
+            piece->kernels = &simd_kernels;
+            piece->src = level->data;
+            piece->dst = dst + offset;
+            piece->width = level->width;
+            piece->height = level->height;
+            piece->first_row = row;
+            piece->row_count = rows - row < TEXTURE_JOB_BLOCK_ROWS ? rows - row : TEXTURE_JOB_BLOCK_ROWS;
+            piece->counter = NULL;
+        }
+        offset += texture_level_size(format, level->width, level->height);
+    }
+    
+    if (!parallel) {
+        for (uint32_t i = 0; i < job_count; i++) {
+            transcode_rows(&work[i]);
+        }
+        free(work);
+        
+        if (jobs) {
+            *jobs = 0;
+        }
+        return 1;
+    }
+    
+    job_counter counter;
+    job_counter_init(&counter);
+    job_counter_add(&counter, (int)(job_count - 1));
+    
+    for (uint32_t i = 1; i < job_count; i++) {
+        work[i].counter = &counter;
+        job* piece = job_create_custom(&work[i], transcode_job_run);
+        if (piece) {
+            job_queue_add_worker(piece);
+        } else {
+            transcode_job_run(&work[i]);
+        }
+    }
+    
+    transcode_rows(&work[0]);
+    job_counter_wait(&counter);
+    job_counter_destroy(&counter);
+    free(work);
+    
+    if (jobs) {
+        *jobs = job_count;
+    }
+    return 1;
+}
+
+int texture_transcode(const texture_source* source, texture_format format, uint8_t* dst, uint32_t* jobs) {
+    return transcode_levels(source, format, dst, 1, jobs);
+}
+
+void texture_source_skip_levels(texture_source* source, uint32_t count) {
+    if (count >= source->level_count) {
+        count = source->level_count - 1;
+    }
+    if (count == 0) {
+        return;
+    }
+    
+    memmove(source->levels, source->levels + count, (source->level_count - count) * sizeof(texture_level));
+    source->level_count -= count;
+    source->width = source->levels[0].width;
+    source->height = source->levels[0].height;
+}
+
+int texture_create(vulkan_context* ctx, const texture_source* source, int parallel, texture* result,
+                   texture_load_stats* stats) {
+    memset(result, 0, sizeof(*result));
+    
+    texture_format format;
+    if (!texture_select_format(&ctx->caps, source, ctx->compress_textures, &format)) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "texture: %s is not supported by this device",
+                            texture_format_name(source->format));
+        return 0;
+    }
+    
+    uint64_t begin = timing_now_ns();
+    uint32_t jobs = 0;
+    
+    if (format == source->format) {
+        // KTX2 stores the smallest level first, so the levels are one span
+        // of the file and upload straight from it
+        const uint8_t* first = source->levels[0].data;
+        const uint8_t* end = first + source->levels[0].size;
+        for (uint32_t i = 1; i < source->level_count; i++) {
+            const texture_level* level = &source->levels[i];
+            first = level->data < first ? level->data : first;
+            end = level->data + level->size > end ? level->data + level->size : end;
+        }
+        
+        result->pixels = first;
+        result->pixel_size = (uint64_t)(end - first);
+        for (uint32_t i = 0; i < source->level_count; i++) {
+            result->levels[i].offset = (VkDeviceSize)(source->levels[i].data - first);
+        }
+    } else {
+        for (uint32_t i = 0; i < source->level_count; i++) {
+            result->levels[i].offset = result->pixel_size;
+            result->pixel_size += texture_level_size(format, source->levels[i].width, source->levels[i].height);
+        }
+        
+        result->transcoded = malloc(result->pixel_size);
+        if (!result->transcoded || !transcode_levels(source, format, result->transcoded, parallel, &jobs)) {
+            texture_destroy(ctx, result);
+            return 0;
+        }
+        result->pixels = result->transcoded;
+    }
+    
+    for (uint32_t i = 0; i < source->level_count; i++) {
+        result->levels[i].mip_level = i;
+        result->levels[i].width = source->levels[i].width;
+        result->levels[i].height = source->levels[i].height;
+    }
+    
+    result->format = texture_vk_format(format, source->srgb, source->bc1_alpha && format == TEXTURE_FORMAT_BC1);
+    result->width = source->width;
+    result->height = source->height;
+    result->level_count = source->level_count;
+    
+    VkImageCreateInfo image_info = {0};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = result->format;
+    image_info.extent.width = source->width;
+    image_info.extent.height = source->height;
+    image_info.extent.depth = 1;
+    image_info.mipLevels = source->level_count;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    
+    if (!upload_create_image(ctx, &image_info, &result->image, &result->allocation)) {
+        result->image = VK_NULL_HANDLE;
+        texture_destroy(ctx, result);
+        return 0;
+    }
+    
+    if (stats) {
+        stats->transcode_ns = timing_now_ns() - begin;
+        stats->source_bytes = 0;
+        for (uint32_t i = 0; i < source->level_count; i++) {
+            stats->source_bytes += source->levels[i].size;
+        }
+        stats->upload_bytes = result->pixel_size;
+        stats->jobs = jobs;
+        stats->source_format = source->format;
+        stats->format = format;
+    }
+    return 1;
+}
+
+int texture_create_ktx2(vulkan_context* ctx, const void* data, uint64_t size, texture* result,
+                        texture_load_stats* stats) {
+    memset(result, 0, sizeof(*result));
+    
+    texture_source source;
+    return texture_parse_ktx2(data, size, &source) && texture_create(ctx, &source, 1, result, stats);
+}
+
+int texture_upload(vulkan_context* ctx, texture* texture) {
+    texture->upload_ticket = upload_image(ctx, texture->image, VK_IMAGE_ASPECT_COLOR_BIT, texture->levels,
+                                          texture->level_count, texture->pixels, texture->pixel_size);
+    free(texture->transcoded);
+    texture->transcoded = NULL;
+    texture->pixels = NULL;
+    return texture->upload_ticket != 0;
+}
+
+void texture_destroy(vulkan_context* ctx, texture* texture) {
+    free(texture->transcoded);
+    texture->transcoded = NULL;
+    texture->pixels = NULL;
+    if (texture->image != VK_NULL_HANDLE) {
+        gpu_destroy_image(ctx->allocator, texture->image, &texture->allocation);
+        texture->image = VK_NULL_HANDLE;
+    }
+}
+
+// Smooth gradients with a little noise and a few hard edges, closer to
+// real art than either flat color or pure noise
+static void fill_benchmark_image(uint8_t* rgba, uint32_t width, uint32_t height) {
+    uint32_t seed = 0x9e3779b9u;
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            seed = seed * 1664525u + 1013904223u;
+            int noise = (int)(seed >> 28) - 8;
+            int edge = ((x / 64) + (y / 64)) & 1 ? 48 : 0;
+            
+            uint8_t* texel = rgba + ((uint64_t)y * width + x) * 4;
+            texel[0] = clamp_u8((int)(x * 255 / width) + noise + edge);
+            texel[1] = clamp_u8((int)(y * 255 / height) + noise);
+            texel[2] = clamp_u8(255 - (int)((x + y) * 127 / width) + noise - edge);
+            texel[3] = clamp_u8((int)((x ^ y) & 255) + noise);
+        }
+    }
+}
+
+// Best of the rounds on the calling thread alone
+static uint64_t time_conversion(texture_format source_format, texture_format format, const block_kernels* kernels,
+                                const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height) {
+    transcode_job work = {0};
+    work.source_format = source_format;
+    work.format = format;
+    work.kernels = kernels;
+    work.src = src;
+    work.dst = dst;
+    work.width = width;
+    work.height = height;
+    work.row_count = (height + 3) / 4;
+    
+    uint64_t best = UINT64_MAX;
+    for (uint32_t round = 0; round < TEXTURE_BENCHMARK_ROUNDS; round++) {
+        uint64_t begin = timing_now_ns();
+        transcode_rows(&work);
+        uint64_t elapsed = timing_now_ns() - begin;
+        best = elapsed < best ? elapsed : best;
+    }
+    return best;
+}
+
+int texture_benchmark(texture_benchmark_result* result) {
+    memset(result, 0, sizeof(*result));
+    const uint32_t size = TEXTURE_BENCHMARK_SIZE;
+    
+    uint8_t* rgba = malloc(texture_level_size(TEXTURE_FORMAT_RGBA8, size, size));
+    uint8_t* decoded = malloc(texture_level_size(TEXTURE_FORMAT_RGBA8, size, size));
+    uint8_t* bc1 = malloc(texture_level_size(TEXTURE_FORMAT_BC1, size, size));
+    uint8_t* bc3 = malloc(texture_level_size(TEXTURE_FORMAT_BC3, size, size));
+    uint8_t* etc2 = malloc(texture_level_size(TEXTURE_FORMAT_ETC2_RGB8, size, size));
+    if (!rgba || !decoded || !bc1 || !bc3 || !etc2) {
+        free(rgba);
+        free(decoded);
+        free(bc1);
+        free(bc3);
+        free(etc2);
+        return 0;
+    }
+    
+    fill_benchmark_image(rgba, size, size);
+    result->width = size;
+    result->height = size;
+    result->simd = TEXTURE_SIMD;
+    result->workers = (uint32_t)jobs_worker_count();
+    
+    result->encode_bc1_scalar_ns = time_conversion(TEXTURE_FORMAT_RGBA8, TEXTURE_FORMAT_BC1, &scalar_kernels,
+                                                   rgba, bc1, size, size);
+    result->encode_bc1_simd_ns = time_conversion(TEXTURE_FORMAT_RGBA8, TEXTURE_FORMAT_BC1, &simd_kernels,
+                                                 rgba, bc1, size, size);
+    result->encode_bc3_scalar_ns = time_conversion(TEXTURE_FORMAT_RGBA8, TEXTURE_FORMAT_BC3, &scalar_kernels,
+                                                   rgba, bc3, size, size);
+    result->encode_bc3_simd_ns = time_conversion(TEXTURE_FORMAT_RGBA8, TEXTURE_FORMAT_BC3, &simd_kernels,
+                                                 rgba, bc3, size, size);
+    result->encode_etc2_ns = time_conversion(TEXTURE_FORMAT_RGBA8, TEXTURE_FORMAT_ETC2_RGB8, &simd_kernels,
+                                             rgba, etc2, size, size);
+    result->decode_bc1_ns = time_conversion(TEXTURE_FORMAT_BC1, TEXTURE_FORMAT_RGBA8, &simd_kernels,
+                                            bc1, decoded, size, size);
+    result->decode_bc3_ns = time_conversion(TEXTURE_FORMAT_BC3, TEXTURE_FORMAT_RGBA8, &simd_kernels,
+                                            bc3, decoded, size, size);
+    result->decode_etc2_ns = time_conversion(TEXTURE_FORMAT_ETC2_RGB8, TEXTURE_FORMAT_RGBA8, &simd_kernels,
+                                             etc2, decoded, size, size);
+    
+    texture_source source = {0};
+    source.format = TEXTURE_FORMAT_BC1;
+    source.width = size;
+    source.height = size;
+    source.level_count = 1;
+    source.levels[0].data = bc1;
+    source.levels[0].size = texture_level_size(TEXTURE_FORMAT_BC1, size, size);
+    source.levels[0].width = size;
+    source.levels[0].height = size;
+    
+    result->transcode_parallel_ns = UINT64_MAX;
+    for (uint32_t round = 0; round < TEXTURE_BENCHMARK_ROUNDS; round++) {
+        uint64_t begin = timing_now_ns();
+        texture_transcode(&source, TEXTURE_FORMAT_ETC2_RGB8, etc2, NULL);
+        uint64_t elapsed = timing_now_ns() - begin;
+        result->transcode_parallel_ns = elapsed < result->transcode_parallel_ns ? elapsed : result->transcode_parallel_ns;
+    }
+    
+    free(rgba);
+    free(decoded);
+    free(bc1);
+    free(bc3);
+    free(etc2);
+    return 1;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "renderer.h"
+#include "upload.h"
+#include <stdint.h>
+
+#define TEXTURE_MAX_LEVELS 16
+
+// Block rows per transcode job; a 2048 level is split into 16 jobs
+#define TEXTURE_JOB_BLOCK_ROWS 32
+
+#define TEXTURE_BENCHMARK_SIZE 1024
+#define TEXTURE_BENCHMARK_ROUNDS 4
+
+// KTX2 supercompression schemes
+#define KTX2_SUPERCOMPRESSION_NONE 0
+#define KTX2_SUPERCOMPRESSION_BASISLZ 1
+#define KTX2_SUPERCOMPRESSION_ZSTD 2
+#define KTX2_SUPERCOMPRESSION_ZLIB 3
+
+#define KTX2_HEADER_SIZE 80
+#define KTX2_LEVEL_INDEX_SIZE 24
+
+// What the loader understands. Block formats are 4x4 texels; everything but
+// ASTC can be decoded on the CPU for devices without the format.
+typedef enum {
+    TEXTURE_FORMAT_RGBA8,
+    TEXTURE_FORMAT_BC1,
+    TEXTURE_FORMAT_BC3,
+    TEXTURE_FORMAT_ETC2_RGB8,
+    TEXTURE_FORMAT_ASTC_4X4,
+    TEXTURE_FORMAT_COUNT
+} texture_format;
+
+typedef struct {
+    const uint8_t* data;
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+} texture_level;
+
+// A parsed container; level data points into the caller's bytes and level 0
+// is the largest
+typedef struct {
+    texture_format format;
+    int srgb;
+    
+    // BC1 with punch-through alpha rather than opaque black for index 3
+    int bc1_alpha;
+    uint32_t width;
+    uint32_t height;
+    uint32_t level_count;
+    texture_level levels[TEXTURE_MAX_LEVELS];
+} texture_source;
+
+// An image whose levels are ready to upload. pixels is either the
+// transcoded copy the texture owns or, when the source format passes
+// through, the caller's bytes.
+typedef struct {
+    VkImage image;
+    gpu_allocation allocation;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t level_count;
+    upload_image_level levels[TEXTURE_MAX_LEVELS];
+    const uint8_t* pixels;
+    uint64_t pixel_size;
+    uint8_t* transcoded;
+    uint64_t upload_ticket;
+} texture;
+
+typedef struct {
+    uint64_t transcode_ns;
+    uint64_t source_bytes;
+    uint64_t upload_bytes;
+    uint32_t jobs;
+    texture_format source_format;
+    texture_format format;
+} texture_load_stats;
+
+// Nanoseconds per TEXTURE_BENCHMARK_SIZE square image, the best of
+// TEXTURE_BENCHMARK_ROUNDS. The SIMD fields repeat the scalar ones when no
+// SIMD path is compiled in.
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    int simd;
+    uint32_t workers;
+    uint64_t encode_bc1_scalar_ns;
+    uint64_t encode_bc1_simd_ns;
+    uint64_t encode_bc3_scalar_ns;
+    uint64_t encode_bc3_simd_ns;
+    uint64_t encode_etc2_ns;
+    uint64_t decode_bc1_ns;
+    uint64_t decode_bc3_ns;
+    uint64_t decode_etc2_ns;
+    
+    // BC1 to ETC2 through the job workers, as a BC asset loads on mobile
+    uint64_t transcode_parallel_ns;
+} texture_benchmark_result;
+
+// Fails on anything but a single 2D image without supercompression
+int texture_parse_ktx2(const void* data, uint64_t size, texture_source* source);
+
+// What source becomes on a device with these caps: block formats the device
+// samples pass through, others are decoded and, with compress set, RGBA8 is
+// re-encoded to the smallest format the device has. Returns 0 when there is
+// no way to show it (ASTC without ASTC support, or a side larger than the
+// device's largest image).
+int texture_select_format(const device_caps* caps, const texture_source* source, int compress,
+                          texture_format* format);
+
+uint64_t texture_level_size(texture_format format, uint32_t width, uint32_t height);
+
+// Converts every level into dst, packed level after level, on the job
+// workers and the calling thread; blocks until done. Not from a worker.
+int texture_transcode(const texture_source* source, texture_format format, uint8_t* dst, uint32_t* jobs);
+
+// Drops the count largest levels so the image starts further down the chain;
+// at least one level is always kept
+void texture_source_skip_levels(texture_source* source, uint32_t count);
+
+// Transcodes the source's levels and creates the image; the level data must
+// stay valid until texture_upload. Job workers pass parallel as 0 and
+// transcode on their own thread, since they must not wait on other jobs.
+// stats may be NULL.
+int texture_create(vulkan_context* ctx, const texture_source* source, int parallel, texture* result,
+                   texture_load_stats* stats);
+
+// Parses data and creates the image from all of its levels in parallel
+int texture_create_ktx2(vulkan_context* ctx, const void* data, uint64_t size, texture* result,
+                        texture_load_stats* stats);
+
+// Queues the copy of every level and releases the pixels either way. Once
+// it succeeds the image can't be destroyed until the upload retires; the
+// frames that sample it wait for the copy.
+int texture_upload(vulkan_context* ctx, texture* texture);
+
+// Only before texture_upload or once the upload has retired
+void texture_destroy(vulkan_context* ctx, texture* texture);
+
+VkFormat texture_vk_format(texture_format format, int srgb, int bc1_alpha);
+const char* texture_format_name(texture_format format);
+
+// CPU only, so it runs on Linux CI without a device
+int texture_benchmark(texture_benchmark_result* result);
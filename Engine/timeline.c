@@ -0,0 +1,325 @@
+#include "timeline.h"
+#include "jobs.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Caller holds the lock. Fences on one queue signal in submission order,
+// so the first unsignaled one ends the scan.
+static void refresh_completed(gpu_timeline* timeline) {
+    if (!timeline->native) {
+        while (timeline->completed < timeline->submitted) {
+            VkFence fence = timeline->fences[(timeline->completed + 1) % GPU_TIMELINE_FENCES];
+            if (vkGetFenceStatus(timeline->device, fence) != VK_SUCCESS) {
+                break;
+            }
+            timeline->completed++;
+        }
+        return;
+    }
+    
+    uint64_t value;
+    if (timeline->get_counter_value(timeline->device, timeline->semaphore, &value) == VK_SUCCESS &&
+        value > timeline->completed) {
+        timeline->completed = value;
+    }
+}
+
+// Oldest first, so jobs waiting on the same value run in the order they were added
+static struct job* pop_ready(gpu_timeline* timeline, int all) {
+    struct job* ready = NULL;
+    
+    pthread_mutex_lock(&timeline->lock);
+    for (uint32_t i = 0; i < timeline->wait_count; i++) {
+        if (all || timeline->waits[i].value <= timeline->completed) {
+            ready = timeline->waits[i].job;
+            memmove(&timeline->waits[i], &timeline->waits[i + 1],
+                    (timeline->wait_count - i - 1) * sizeof(gpu_timeline_pending));
+            timeline->wait_count--;
+            timeline->stats.jobs_released++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&timeline->lock);
+    
+    return ready;
+}
+
+// Outside the lock: without workers a job runs inline and may add waits of its own
+static void release_ready(gpu_timeline* timeline, int all) {
+    struct job* ready;
+    while ((ready = pop_ready(timeline, all)) != NULL) {
+        job_queue_add_worker(ready);
+    }
+}
+
+// Earliest wait whose value has been submitted, or 0 when there is none
+static uint64_t next_target(gpu_timeline* timeline) {
+    uint64_t target = 0;
+    for (uint32_t i = 0; i < timeline->wait_count; i++) {
+        uint64_t value = timeline->waits[i].value;
+        if (value <= timeline->submitted && (target == 0 || value < target)) {
+            target = value;
+        }
+    }
+    return target;
+}
+
+static void* waiter_main(void* arg) {
+    gpu_timeline* timeline = arg;
+    
+    pthread_mutex_lock(&timeline->lock);
+    while (!timeline->stopping) {
+        uint64_t target = next_target(timeline);
+        if (target == 0) {
+            pthread_cond_wait(&timeline->wake, &timeline->lock);
+            continue;
+        }
+        
+        pthread_mutex_unlock(&timeline->lock);
+        gpu_timeline_wait(timeline, target, GPU_TIMELINE_POLL_NS);
+        release_ready(timeline, 0);
+        pthread_mutex_lock(&timeline->lock);
+    }
+    pthread_mutex_unlock(&timeline->lock);
+    
+    return NULL;
+}
+
+static int create_semaphore(gpu_timeline* timeline) {
+    timeline->wait_semaphores = (PFN_vkWaitSemaphores)vkGetDeviceProcAddr(timeline->device, "vkWaitSemaphores");
+    timeline->get_counter_value =
+        (PFN_vkGetSemaphoreCounterValue)vkGetDeviceProcAddr(timeline->device, "vkGetSemaphoreCounterValue");
+    
+    // Devices below 1.2 only have the extension's names
+    if (!timeline->wait_semaphores || !timeline->get_counter_value) {
+        timeline->wait_semaphores =
+            (PFN_vkWaitSemaphores)vkGetDeviceProcAddr(timeline->device, "vkWaitSemaphoresKHR");
+        timeline->get_counter_value = (PFN_vkGetSemaphoreCounterValue)vkGetDeviceProcAddr(
+            timeline->device, "vkGetSemaphoreCounterValueKHR");
+    }
+    
+    if (!timeline->wait_semaphores || !timeline->get_counter_value) {
+        return 0;
+    }
+    
+    VkSemaphoreTypeCreateInfo type_info = {0};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+    
+    VkSemaphoreCreateInfo semaphore_info = {0};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = &type_info;
+    
+    return vkCreateSemaphore(timeline->device, &semaphore_info, NULL, &timeline->semaphore) == VK_SUCCESS;
+}
+
+gpu_timeline* gpu_timeline_create(VkDevice device, int native) {
+    gpu_timeline* timeline = calloc(1, sizeof(gpu_timeline));
+    if (!timeline) {
+        return NULL;
+    }
+    
+    timeline->device = device;
+    pthread_mutex_init(&timeline->lock, NULL);
+    pthread_cond_init(&timeline->wake, NULL);
+    pthread_cond_init(&timeline->fence_idle, NULL);
+    
+    timeline->native = native && create_semaphore(timeline);
+    if (!timeline->native) {
+        VkFenceCreateInfo fence_info = {0};
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        
+        for (uint32_t i = 0; i < GPU_TIMELINE_FENCES; i++) {
+            if (vkCreateFence(device, &fence_info, NULL, &timeline->fences[i]) != VK_SUCCESS) {
+                gpu_timeline_destroy(timeline);
+                return NULL;
+            }
+        }
+    }
+    timeline->stats.native = timeline->native;
+    
+    if (pthread_create(&timeline->waiter, NULL, waiter_main, timeline) != 0) {
+        gpu_timeline_destroy(timeline);
+        return NULL;
+    }
+    timeline->waiter_running = 1;
+    
+    return timeline;
+}
+
+void gpu_timeline_destroy(gpu_timeline* timeline) {
+    if (!timeline) {
+        return;
+    }
+    
+    if (timeline->waiter_running) {
+        pthread_mutex_lock(&timeline->lock);
+        timeline->stopping = 1;
+        pthread_cond_broadcast(&timeline->wake);
+        pthread_mutex_unlock(&timeline->lock);
+        pthread_join(timeline->waiter, NULL);
+    }
+    
+    // Everything submitted has finished by now; waits on values that were
+    // never submitted are released too rather than leaked
+    release_ready(timeline, 1);
+    
+    if (timeline->semaphore != VK_NULL_HANDLE) {
+        vkDestroySemaphore(timeline->device, timeline->semaphore, NULL);
+    }
+    for (uint32_t i = 0; i < GPU_TIMELINE_FENCES; i++) {
+        if (timeline->fences[i] != VK_NULL_HANDLE) {
+            vkDestroyFence(timeline->device, timeline->fences[i], NULL);
+        }
+    }
+    
+    pthread_mutex_destroy(&timeline->lock);
+    pthread_cond_destroy(&timeline->wake);
+    pthread_cond_destroy(&timeline->fence_idle);
+    free(timeline->waits);
+    free(timeline);
+}
+
+uint64_t gpu_timeline_begin_submit(gpu_timeline* timeline, VkFence* fence) {
+    // Only the render thread submits, so the count can't move under us
+    uint64_t value = gpu_timeline_last_submitted(timeline) + 1;
+    *fence = VK_NULL_HANDLE;
+    if (timeline->native) {
+        return value;
+    }
+    
+    // The ring slot last carried value - N; once that is done, wait out any
+    // thread still inside vkWaitForFences on it before the reset
+    if (value > GPU_TIMELINE_FENCES) {
+        gpu_timeline_wait(timeline, value - GPU_TIMELINE_FENCES, UINT64_MAX);
+    }
+    
+    uint32_t slot = value % GPU_TIMELINE_FENCES;
+    pthread_mutex_lock(&timeline->lock);
+    while (timeline->fence_waiters[slot] > 0) {
+        pthread_cond_wait(&timeline->fence_idle, &timeline->lock);
+    }
+    vkResetFences(timeline->device, 1, &timeline->fences[slot]);
+    pthread_mutex_unlock(&timeline->lock);
+    
+    *fence = timeline->fences[slot];
+    return value;
+}
+
+void gpu_timeline_submitted(gpu_timeline* timeline, uint64_t value) {
+    pthread_mutex_lock(&timeline->lock);
+    timeline->submitted = value;
+    timeline->stats.submitted = value;
+    pthread_cond_broadcast(&timeline->wake);
+    pthread_mutex_unlock(&timeline->lock);
+}
+
+uint64_t gpu_timeline_last_submitted(gpu_timeline* timeline) {
+    pthread_mutex_lock(&timeline->lock);
+    uint64_t value = timeline->submitted;
+    pthread_mutex_unlock(&timeline->lock);
+    return value;
+}
+
+uint64_t gpu_timeline_completed(gpu_timeline* timeline) {
+    pthread_mutex_lock(&timeline->lock);
+    refresh_completed(timeline);
+    uint64_t value = timeline->completed;
+    pthread_mutex_unlock(&timeline->lock);
+    return value;
+}
+
+int gpu_timeline_wait(gpu_timeline* timeline, uint64_t value, uint64_t timeout_ns) {
+    pthread_mutex_lock(&timeline->lock);
+    if (value > timeline->completed) {
+        refresh_completed(timeline);
+    }
+    
+    // An unsubmitted value could never signal
+    if (value <= timeline->completed || value > timeline->submitted) {
+        int done = value <= timeline->completed;
+        pthread_mutex_unlock(&timeline->lock);
+        return done;
+    }
+    
+    timeline->stats.blocking_waits++;
+    VkResult result;
+    if (timeline->native) {
+        pthread_mutex_unlock(&timeline->lock);
+        
+        VkSemaphoreWaitInfo wait_info = {0};
+        wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        wait_info.semaphoreCount = 1;
+        wait_info.pSemaphores = &timeline->semaphore;
+        wait_info.pValues = &value;
+        result = timeline->wait_semaphores(timeline->device, &wait_info, timeout_ns);
+        
+        pthread_mutex_lock(&timeline->lock);
+    } else {
+        // The count keeps begin_submit from resetting the fence under us
+        uint32_t slot = value % GPU_TIMELINE_FENCES;
+        timeline->fence_waiters[slot]++;
+        pthread_mutex_unlock(&timeline->lock);
+        
+        result = vkWaitForFences(timeline->device, 1, &timeline->fences[slot], VK_TRUE, timeout_ns);
+        
+        pthread_mutex_lock(&timeline->lock);
+        if (--timeline->fence_waiters[slot] == 0) {
+            pthread_cond_broadcast(&timeline->fence_idle);
+        }
+    }
+    
+    if (result == VK_SUCCESS && value > timeline->completed) {
+        timeline->completed = value;
+    }
+    int done = value <= timeline->completed;
+    pthread_mutex_unlock(&timeline->lock);
+    return done;
+}
+
+void gpu_timeline_on_complete(gpu_timeline* timeline, uint64_t value, struct job* job) {
+    if (!job) {
+        return;
+    }
+    
+    pthread_mutex_lock(&timeline->lock);
+    if (value > timeline->completed) {
+        refresh_completed(timeline);
+    }
+    
+    if (value <= timeline->completed) {
+        timeline->stats.jobs_released++;
+        pthread_mutex_unlock(&timeline->lock);
+        job_queue_add_worker(job);
+        return;
+    }
+    
+    if (timeline->wait_count == timeline->wait_capacity) {
+        uint32_t capacity = timeline->wait_capacity ? timeline->wait_capacity * 2 : GPU_TIMELINE_INITIAL_WAITS;
+        gpu_timeline_pending* waits = realloc(timeline->waits, capacity * sizeof(gpu_timeline_pending));
+        if (!waits) {
+            // Late is better than never: run it once the device is idle
+            pthread_mutex_unlock(&timeline->lock);
+            gpu_timeline_wait(timeline, value, UINT64_MAX);
+            job_queue_add_worker(job);
+            return;
+        }
+        timeline->waits = waits;
+        timeline->wait_capacity = capacity;
+    }
+    
+    timeline->waits[timeline->wait_count].value = value;
+    timeline->waits[timeline->wait_count].job = job;
+    timeline->wait_count++;
+    pthread_cond_broadcast(&timeline->wake);
+    pthread_mutex_unlock(&timeline->lock);
+}
+
+void gpu_timeline_get_stats(gpu_timeline* timeline, gpu_timeline_stats* stats) {
+    pthread_mutex_lock(&timeline->lock);
+    refresh_completed(timeline);
+    *stats = timeline->stats;
+    stats->completed = timeline->completed;
+    pthread_mutex_unlock(&timeline->lock);
+}
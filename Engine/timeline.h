@@ -0,0 +1,79 @@
+#pragma once
+
+#include "platform.h"
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stdint.h>
+
+// Fallback fences are reused every this many submits, far more than can be in flight
+#define GPU_TIMELINE_FENCES 16
+
+// The waiter rechecks for shutdown at least this often
+#define GPU_TIMELINE_POLL_NS (10ull * 1000 * 1000)
+#define GPU_TIMELINE_INITIAL_WAITS 16
+
+struct job;
+
+typedef struct {
+    uint64_t value;
+    struct job* job;
+} gpu_timeline_pending;
+
+typedef struct {
+    int native;
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t jobs_released;
+    uint64_t blocking_waits;
+} gpu_timeline_stats;
+
+// Numbers the graphics submits 1, 2, 3... A native timeline semaphore
+// carries the count; without one, each value gets a fence from a ring.
+typedef struct gpu_timeline {
+    VkDevice device;
+    int native;
+    VkSemaphore semaphore;
+    PFN_vkWaitSemaphores wait_semaphores;
+    PFN_vkGetSemaphoreCounterValue get_counter_value;
+    VkFence fences[GPU_TIMELINE_FENCES];
+    uint32_t fence_waiters[GPU_TIMELINE_FENCES];
+    uint64_t submitted;
+    uint64_t completed;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t fence_idle;
+    gpu_timeline_pending* waits;
+    uint32_t wait_count;
+    uint32_t wait_capacity;
+    pthread_t waiter;
+    int waiter_running;
+    int stopping;
+    gpu_timeline_stats stats;
+} gpu_timeline;
+
+// native asks for a timeline semaphore; the device must have the feature
+// enabled. Falls back to fences when the entry points are missing.
+gpu_timeline* gpu_timeline_create(VkDevice device, int native);
+
+// The device must be idle; jobs still waiting are released
+void gpu_timeline_destroy(gpu_timeline* timeline);
+
+// The value the next submit signals. Native timelines signal the semaphore
+// with it; the fallback passes *fence to vkQueueSubmit instead. Only
+// gpu_timeline_submitted commits the value, so a failed submit reuses it.
+uint64_t gpu_timeline_begin_submit(gpu_timeline* timeline, VkFence* fence);
+void gpu_timeline_submitted(gpu_timeline* timeline, uint64_t value);
+
+uint64_t gpu_timeline_last_submitted(gpu_timeline* timeline);
+
+// Never blocks; polls the GPU for progress
+uint64_t gpu_timeline_completed(gpu_timeline* timeline);
+
+// Returns 1 once value has completed, 0 on timeout
+int gpu_timeline_wait(gpu_timeline* timeline, uint64_t value, uint64_t timeout_ns);
+
+// Hands job to the workers once the GPU reaches value, or right away if it
+// already has. Values not yet submitted wait for their submit.
+void gpu_timeline_on_complete(gpu_timeline* timeline, uint64_t value, struct job* job);
+
+void gpu_timeline_get_stats(gpu_timeline* timeline, gpu_timeline_stats* stats);
@@ -0,0 +1,482 @@
+#include "upload.h"
+#include "timeline.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define UPLOAD_NO_VALUE UINT64_MAX
+
+// Retire submitted batches whose copies have finished, returning their
+// ring space. The semaphore may still be owed to a graphics submit.
+static void reclaim_batches(upload_context* upload) {
+    for (uint32_t n = 1; n <= UPLOAD_MAX_BATCHES; n++) {
+        // Oldest first, so the ring tail only ever moves forward
+        upload_batch* batch = &upload->batches[(upload->current_batch + n) % UPLOAD_MAX_BATCHES];
+        if (batch->state != UPLOAD_BATCH_SUBMITTED || batch->retired) {
+            continue;
+        }
+        
+        if (vkGetFenceStatus(upload->device, batch->fence) != VK_SUCCESS) {
+            break;
+        }
+        
+        upload->ring_used -= batch->ring_bytes;
+        upload->ring_tail = batch->ring_end;
+        upload->stats.last_completed_serial = batch->serial;
+        batch->retired = 1;
+        
+        uint64_t gpu_ns;
+        if (gpu_profiler_resolve(upload->profiler, (uint32_t)(batch - upload->batches), &gpu_ns)) {
+            upload->stats.gpu_ns = gpu_ns;
+            upload->stats.total_gpu_ns += gpu_ns;
+            upload->stats.timed_batches++;
+        }
+    }
+}
+
+// A binary semaphore can only be signaled again once the graphics submit
+// that waited on it has completed
+static int batch_reusable(upload_batch* batch, uint64_t completed) {
+    return batch->state == UPLOAD_BATCH_SUBMITTED && batch->retired && batch->wait_taken &&
+           batch->consumed_value <= completed;
+}
+
+static int ring_alloc(upload_context* upload, VkDeviceSize size, VkDeviceSize* offset) {
+    VkDeviceSize alignment = upload->copy_alignment;
+    
+    if (upload->ring_used == 0) {
+        upload->ring_head = 0;
+        upload->ring_tail = 0;
+    }
+    
+    VkDeviceSize head = upload->ring_head;
+    if (upload->ring_used > 0 && head == upload->ring_tail) {
+        return 0;
+    }
+    
+    VkDeviceSize start = (head + alignment - 1) / alignment * alignment;
+    VkDeviceSize end;
+    
+    if (head >= upload->ring_tail) {
+        // Free space is [head, size) followed by [0, tail)
+        if (start + size <= upload->ring_size) {
+            end = start + size;
+        } else if (size <= upload->ring_tail) {
+            start = 0;
+            end = size;
+        } else {
+            return 0;
+        }
+    } else {
+        if (start + size > upload->ring_tail) {
+            return 0;
+        }
+        end = start + size;
+    }
+    
+    // Alignment padding and skipped tail space count as used until the batch retires
+    VkDeviceSize consumed = end >= head ? end - head : upload->ring_size - head + end;
+    upload->ring_used += consumed;
+    upload->batches[upload->current_batch].ring_bytes += consumed;
+    upload->ring_head = end;
+    *offset = start;
+    return 1;
+}
+
+static upload_batch* open_batch(upload_context* upload) {
+    upload_batch* batch = &upload->batches[upload->current_batch];
+    if (batch->state == UPLOAD_BATCH_RECORDING) {
+        return batch;
+    }
+    
+    if (batch->state != UPLOAD_BATCH_FREE) {
+        return NULL;
+    }
+    
+    vkResetCommandPool(upload->device, batch->command_pool, 0);
+    
+    VkCommandBufferBeginInfo begin_info = {0};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    
+    if (vkBeginCommandBuffer(batch->command_buffer, &begin_info) != VK_SUCCESS) {
+        return NULL;
+    }
+    
+    uint32_t slot = (uint32_t)(batch - upload->batches);
+    gpu_profiler_reset(upload->profiler, batch->command_buffer, slot);
+    gpu_profiler_begin(upload->profiler, batch->command_buffer, slot, 0);
+    
+    batch->state = UPLOAD_BATCH_RECORDING;
+    batch->serial = ++upload->next_serial;
+    batch->retired = 0;
+    batch->wait_taken = 0;
+    batch->consumed_value = UPLOAD_NO_VALUE;
+    batch->ring_begin = upload->ring_head;
+    batch->ring_bytes = 0;
+    batch->copy_count = 0;
+    return batch;
+}
+
+// Reserves ring space and a recording batch together; holds the lock on success
+static upload_batch* begin_copy(upload_context* upload, VkDeviceSize size, uint32_t copies, VkDeviceSize* offset) {
+    pthread_mutex_lock(&upload->lock);
+    reclaim_batches(upload);
+    
+    upload_batch* batch = open_batch(upload);
+    if (!batch || batch->copy_count + copies > UPLOAD_MAX_COPIES || !ring_alloc(upload, size, offset)) {
+        upload->stats.ring_full_count++;
+        pthread_mutex_unlock(&upload->lock);
+        return NULL;
+    }
+    
+    return batch;
+}
+
+int upload_init(vulkan_context* ctx) {
+    upload_context* upload = calloc(1, sizeof(upload_context));
+    if (!upload) {
+        return 0;
+    }
+    
+    upload->device = ctx->device;
+    upload->queue = ctx->transfer_queue;
+    upload->queue_families[0] = ctx->graphics_family;
+    upload->queue_families[1] = ctx->transfer_family;
+    upload->queue_family_count = ctx->transfer_family != ctx->graphics_family ? 2 : 1;
+    upload->stats.transfer_queue = upload->queue_family_count == 2;
+    pthread_mutex_init(&upload->lock, NULL);
+    ctx->upload = upload;
+    
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ctx->physical_device, &props);
+    
+    // Copy offsets must be a multiple of 4 and of the texel size; 16 covers
+    // every uncompressed and block-compressed format we use
+    upload->copy_alignment = props.limits.optimalBufferCopyOffsetAlignment > 16 ?
+                             props.limits.optimalBufferCopyOffsetAlignment : 16;
+    
+    // Query resets need a graphics or compute queue, so batches on a
+    // transfer-only family go untimed
+    if (upload->queue_family_count == 1) {
+        upload->profiler = gpu_profiler_create(ctx->device, UPLOAD_MAX_BATCHES, 1,
+                                               ctx->timestamp_valid_bits, props.limits.timestampPeriod);
+        upload->stats.gpu_timing = upload->profiler != NULL;
+    }
+    
+    VkBufferCreateInfo buffer_info = {0};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = UPLOAD_RING_SIZE;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    
+    if (!gpu_create_buffer(ctx->allocator, &buffer_info,
+                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0,
+                           &upload->ring_buffer, &upload->ring_allocation)) {
+        upload_shutdown(ctx);
+        return 0;
+    }
+    upload->ring_size = UPLOAD_RING_SIZE;
+    
+    VkCommandPoolCreateInfo pool_info = {0};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    pool_info.queueFamilyIndex = ctx->transfer_family;
+    
+    VkSemaphoreCreateInfo semaphore_info = {0};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    
+    VkFenceCreateInfo fence_info = {0};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    
+    for (uint32_t i = 0; i < UPLOAD_MAX_BATCHES; i++) {
+        upload_batch* batch = &upload->batches[i];
+        
+        VkCommandBufferAllocateInfo alloc_info = {0};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = 1;
+        
+        if (vkCreateCommandPool(ctx->device, &pool_info, NULL, &batch->command_pool) != VK_SUCCESS) {
+            upload_shutdown(ctx);
+            return 0;
+        }
+        
+        alloc_info.commandPool = batch->command_pool;
+        if (vkAllocateCommandBuffers(ctx->device, &alloc_info, &batch->command_buffer) != VK_SUCCESS ||
+            vkCreateSemaphore(ctx->device, &semaphore_info, NULL, &batch->semaphore) != VK_SUCCESS ||
+            vkCreateFence(ctx->device, &fence_info, NULL, &batch->fence) != VK_SUCCESS) {
+            upload_shutdown(ctx);
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+void upload_shutdown(vulkan_context* ctx) {
+    upload_context* upload = ctx->upload;
+    if (!upload) {
+        return;
+    }
+    
+    // Callers have already waited for the device to go idle
+    for (uint32_t i = 0; i < UPLOAD_MAX_BATCHES; i++) {
+        upload_batch* batch = &upload->batches[i];
+        if (batch->fence != VK_NULL_HANDLE) {
+            vkDestroyFence(upload->device, batch->fence, NULL);
+        }
+        if (batch->semaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(upload->device, batch->semaphore, NULL);
+        }
+        if (batch->command_pool != VK_NULL_HANDLE) {
+            vkDestroyCommandPool(upload->device, batch->command_pool, NULL);
+        }
+    }
+    
+    gpu_profiler_destroy(upload->profiler);
+    gpu_destroy_buffer(ctx->allocator, upload->ring_buffer, &upload->ring_allocation);
+    pthread_mutex_destroy(&upload->lock);
+    free(upload);
+    ctx->upload = NULL;
+}
+
+int upload_create_buffer(vulkan_context* ctx, VkDeviceSize size, VkBufferUsageFlags usage,
+                         VkBuffer* buffer, gpu_allocation* allocation) {
+    upload_context* upload = ctx->upload;
+    
+    VkBufferCreateInfo buffer_info = {0};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = size;
+    buffer_info.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    
+    // Concurrent sharing avoids queue family ownership transfers on every upload
+    buffer_info.sharingMode = upload->queue_family_count > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = upload->queue_family_count > 1 ? upload->queue_family_count : 0;
+    buffer_info.pQueueFamilyIndices = upload->queue_families;
+    
+    return gpu_create_buffer(ctx->allocator, &buffer_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+                             buffer, allocation);
+}
+
+int upload_create_image(vulkan_context* ctx, VkImageCreateInfo* info, VkImage* image, gpu_allocation* allocation) {
+    upload_context* upload = ctx->upload;
+    
+    info->usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    info->sharingMode = upload->queue_family_count > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+    info->queueFamilyIndexCount = upload->queue_family_count > 1 ? upload->queue_family_count : 0;
+    info->pQueueFamilyIndices = upload->queue_families;
+    
+    return gpu_create_image(ctx->allocator, info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, image, allocation);
+}
+
+uint64_t upload_buffer(vulkan_context* ctx, VkBuffer dst, VkDeviceSize dst_offset,
+                       const void* data, VkDeviceSize size) {
+    upload_context* upload = ctx->upload;
+    
+    VkDeviceSize ring_offset;
+    upload_batch* batch = begin_copy(upload, size, 1, &ring_offset);
+    if (!batch) {
+        return 0;
+    }
+    
+    memcpy((char*)upload->ring_allocation.mapped + ring_offset, data, size);
+    
+    VkBufferCopy region = {0};
+    region.srcOffset = ring_offset;
+    region.dstOffset = dst_offset;
+    region.size = size;
+    vkCmdCopyBuffer(batch->command_buffer, upload->ring_buffer, dst, 1, &region);
+    
+    batch->copy_count++;
+    upload->stats.copies++;
+    upload->stats.bytes_uploaded += size;
+    uint64_t ticket = batch->serial;
+    pthread_mutex_unlock(&upload->lock);
+    return ticket;
+}
+
+static void record_level_barrier(upload_batch* batch, VkImage image, VkImageAspectFlags aspect,
+                                 const upload_image_level* level, int to_transfer) {
+    VkImageMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = aspect;
+    barrier.subresourceRange.baseMipLevel = level->mip_level;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = level->array_layer;
+    barrier.subresourceRange.layerCount = 1;
+    
+    // Whole levels are overwritten, so their old contents can be discarded.
+    // Stages stay within what a transfer-only queue supports; the graphics
+    // side is ordered by the batch semaphore.
+    if (to_transfer) {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+    } else {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+    }
+}
+
+uint64_t upload_image(vulkan_context* ctx, VkImage dst, VkImageAspectFlags aspect,
+                      const upload_image_level* levels, uint32_t level_count,
+                      const void* data, VkDeviceSize size) {
+    upload_context* upload = ctx->upload;
+    
+    VkDeviceSize ring_offset;
+    upload_batch* batch = begin_copy(upload, size, level_count, &ring_offset);
+    if (!batch) {
+        return 0;
+    }
+    
+    memcpy((char*)upload->ring_allocation.mapped + ring_offset, data, size);
+    
+    for (uint32_t i = 0; i < level_count; i++) {
+        record_level_barrier(batch, dst, aspect, &levels[i], 1);
+        
+        // Whole-level copies also satisfy minImageTransferGranularity on transfer queues
+        VkBufferImageCopy region = {0};
+        region.bufferOffset = ring_offset + levels[i].offset;
+        region.imageSubresource.aspectMask = aspect;
+        region.imageSubresource.mipLevel = levels[i].mip_level;
+        region.imageSubresource.baseArrayLayer = levels[i].array_layer;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent.width = levels[i].width;
+        region.imageExtent.height = levels[i].height;
+        region.imageExtent.depth = 1;
+        vkCmdCopyBufferToImage(batch->command_buffer, upload->ring_buffer, dst,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        
+        record_level_barrier(batch, dst, aspect, &levels[i], 0);
+    }
+    
+    batch->copy_count += level_count;
+    upload->stats.copies += level_count;
+    upload->stats.bytes_uploaded += size;
+    uint64_t ticket = batch->serial;
+    pthread_mutex_unlock(&upload->lock);
+    return ticket;
+}
+
+void upload_flush(vulkan_context* ctx) {
+    upload_context* upload = ctx->upload;
+    if (!upload) {
+        return;
+    }
+    
+    uint64_t completed = gpu_timeline_completed(ctx->timeline);
+    
+    pthread_mutex_lock(&upload->lock);
+    reclaim_batches(upload);
+    
+    for (uint32_t i = 0; i < UPLOAD_MAX_BATCHES; i++) {
+        upload_batch* batch = &upload->batches[i];
+        if (batch_reusable(batch, completed)) {
+            batch->state = UPLOAD_BATCH_FREE;
+        }
+    }
+    
+    upload_batch* batch = &upload->batches[upload->current_batch];
+    if (batch->state != UPLOAD_BATCH_RECORDING) {
+        pthread_mutex_unlock(&upload->lock);
+        return;
+    }
+    
+    gpu_profiler_end(upload->profiler, batch->command_buffer, upload->current_batch, 0);
+    if (vkEndCommandBuffer(batch->command_buffer) != VK_SUCCESS) {
+        pthread_mutex_unlock(&upload->lock);
+        return;
+    }
+    
+    VkSubmitInfo submit_info = {0};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch->command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &batch->semaphore;
+    
+    vkResetFences(upload->device, 1, &batch->fence);
+    if (vkQueueSubmit(upload->queue, 1, &submit_info, batch->fence) != VK_SUCCESS) {
+        // Nothing was submitted; drop the batch rather than wedge the ring
+        upload->ring_used -= batch->ring_bytes;
+        upload->ring_head = batch->ring_begin;
+        batch->state = UPLOAD_BATCH_FREE;
+        pthread_mutex_unlock(&upload->lock);
+        return;
+    }
+    
+    batch->state = UPLOAD_BATCH_SUBMITTED;
+    batch->ring_end = upload->ring_head;
+    gpu_profiler_submitted(upload->profiler, upload->current_batch);
+    upload->stats.batches_submitted++;
+    upload->current_batch = (upload->current_batch + 1) % UPLOAD_MAX_BATCHES;
+    pthread_mutex_unlock(&upload->lock);
+}
+
+uint32_t upload_take_waits(vulkan_context* ctx, uint64_t submit_value, VkSemaphore* semaphores,
+                           VkPipelineStageFlags* stages, uint32_t max_waits) {
+    upload_context* upload = ctx->upload;
+    if (!upload) {
+        return 0;
+    }
+    
+    uint32_t count = 0;
+    pthread_mutex_lock(&upload->lock);
+    for (uint32_t i = 0; i < UPLOAD_MAX_BATCHES && count < max_waits; i++) {
+        upload_batch* batch = &upload->batches[i];
+        if (batch->state == UPLOAD_BATCH_SUBMITTED && !batch->wait_taken) {
+            semaphores[count] = batch->semaphore;
+            stages[count] = UPLOAD_WAIT_STAGES;
+            batch->wait_taken = 1;
+            batch->consumed_value = submit_value;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&upload->lock);
+    
+    return count;
+}
+
+void upload_return_waits(vulkan_context* ctx, uint64_t submit_value) {
+    upload_context* upload = ctx->upload;
+    if (!upload) {
+        return;
+    }
+    
+    pthread_mutex_lock(&upload->lock);
+    for (uint32_t i = 0; i < UPLOAD_MAX_BATCHES; i++) {
+        upload_batch* batch = &upload->batches[i];
+        if (batch->wait_taken && batch->consumed_value == submit_value) {
+            batch->wait_taken = 0;
+            batch->consumed_value = UPLOAD_NO_VALUE;
+        }
+    }
+    pthread_mutex_unlock(&upload->lock);
+}
+
+int upload_is_complete(vulkan_context* ctx, uint64_t ticket) {
+    upload_context* upload = ctx->upload;
+    
+    pthread_mutex_lock(&upload->lock);
+    reclaim_batches(upload);
+    int complete = ticket != 0 && ticket <= upload->stats.last_completed_serial;
+    pthread_mutex_unlock(&upload->lock);
+    
+    return complete;
+}
+
+void upload_get_stats(vulkan_context* ctx, upload_stats* stats) {
+    pthread_mutex_lock(&ctx->upload->lock);
+    *stats = ctx->upload->stats;
+    pthread_mutex_unlock(&ctx->upload->lock);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "renderer.h"
+#include "profiler.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define UPLOAD_RING_SIZE (32u << 20)
+#define UPLOAD_MAX_BATCHES 4
+#define UPLOAD_MAX_COPIES 256
+
+// Stages in the graphics submit that wait for a finished upload batch
+#define UPLOAD_WAIT_STAGES (VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | \
+                            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | \
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+
+typedef enum {
+    UPLOAD_BATCH_FREE,
+    UPLOAD_BATCH_RECORDING,
+    UPLOAD_BATCH_SUBMITTED
+} upload_batch_state;
+
+typedef struct {
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    VkSemaphore semaphore;
+    upload_batch_state state;
+    uint64_t serial;
+    uint64_t consumed_value;
+    int retired;
+    int wait_taken;
+    VkDeviceSize ring_begin;
+    VkDeviceSize ring_end;
+    VkDeviceSize ring_bytes;
+    uint32_t copy_count;
+} upload_batch;
+
+// One whole mip level (or array layer) of an image, located in the source data
+typedef struct {
+    uint32_t mip_level;
+    uint32_t array_layer;
+    uint32_t width;
+    uint32_t height;
+    VkDeviceSize offset;
+} upload_image_level;
+
+typedef struct {
+    uint64_t bytes_uploaded;
+    uint64_t copies;
+    uint64_t batches_submitted;
+    uint64_t ring_full_count;
+    uint64_t last_completed_serial;
+    int transfer_queue;
+    int gpu_timing;
+    uint64_t gpu_ns;
+    uint64_t total_gpu_ns;
+    uint64_t timed_batches;
+} upload_stats;
+
+typedef struct upload_context {
+    VkDevice device;
+    VkQueue queue;
+    uint32_t queue_families[2];
+    uint32_t queue_family_count;
+    VkBuffer ring_buffer;
+    gpu_allocation ring_allocation;
+    VkDeviceSize ring_size;
+    VkDeviceSize ring_head;
+    VkDeviceSize ring_tail;
+    VkDeviceSize ring_used;
+    VkDeviceSize copy_alignment;
+    upload_batch batches[UPLOAD_MAX_BATCHES];
+    uint32_t current_batch;
+    uint64_t next_serial;
+    gpu_profiler* profiler;
+    pthread_mutex_t lock;
+    upload_stats stats;
+} upload_context;
+
+int upload_init(vulkan_context* ctx);
+void upload_shutdown(vulkan_context* ctx);
+
+// Resources written by uploads must be shared with the transfer family
+int upload_create_buffer(vulkan_context* ctx, VkDeviceSize size, VkBufferUsageFlags usage,
+                         VkBuffer* buffer, gpu_allocation* allocation);
+int upload_create_image(vulkan_context* ctx, VkImageCreateInfo* info, VkImage* image, gpu_allocation* allocation);
+
+// Copy into the staging ring and record the transfer. Returns a ticket for
+// upload_is_complete, or 0 when the ring or batch is full; retry next frame.
+uint64_t upload_buffer(vulkan_context* ctx, VkBuffer dst, VkDeviceSize dst_offset,
+                       const void* data, VkDeviceSize size);
+uint64_t upload_image(vulkan_context* ctx, VkImage dst, VkImageAspectFlags aspect,
+                      const upload_image_level* levels, uint32_t level_count,
+                      const void* data, VkDeviceSize size);
+
+// Render thread only: submit the recording batch, then hand its semaphore
+// to the graphics submit that will signal submit_value
+void upload_flush(vulkan_context* ctx);
+uint32_t upload_take_waits(vulkan_context* ctx, uint64_t submit_value, VkSemaphore* semaphores,
+                           VkPipelineStageFlags* stages, uint32_t max_waits);
+// Undoes upload_take_waits when the submit for submit_value failed, so the
+// next one waits on those batches instead
+void upload_return_waits(vulkan_context* ctx, uint64_t submit_value);
+
+int upload_is_complete(vulkan_context* ctx, uint64_t ticket);
+void upload_get_stats(vulkan_context* ctx, upload_stats* stats);
@@ -1,20 +1,215 @@
 #include "vm_engine.h"
 #include "renderer.h"
 #include "checkinstance.h"
+#include "sprite.h"
+#include "texture.h"
+#include "stream.h"
+#include "pack.h"
+#include "ecs.h"
+#include "jobs.h"
 #include "flags.h"
+#include "timing.h"
+#include "platform.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define LOG_TAG "vm_engine"
+
+// An unset flag leaves dest empty
+static void copy_flag_string(char* dest, size_t size, const char* name) {
+    const char* value = flag_get_string(name);
+    snprintf(dest, size, "%s", value ? value : "");
+}
+
+// Measurements run on an offscreen target of the same size so they never
+// show up on screen or compete with the live swapchain for images
+static void offscreen_config(vm_state* state, renderer_config* config) {
+    memset(config, 0, sizeof(*config));
+    config->frames_in_flight = flag_get_int("frames_in_flight");
+    config->width = state->vk.swap_chain_extent.width;
+    config->height = state->vk.swap_chain_extent.height;
+    copy_flag_string(config->shader_dir, sizeof(config->shader_dir), "shader_dir");
+    config->cache_command_buffers = flag_get_bool("cache_command_buffers");
+    config->parallel_recording = flag_get_bool("parallel_recording");
+    config->timeline_semaphores = flag_get_bool("timeline_semaphores");
+    config->bindless_textures = flag_get_bool("bindless_textures");
+    config->gpu_culling = flag_get_bool("gpu_culling");
+    config->msaa_samples = (uint32_t)flag_get_int("msaa");
+    config->gamma = flag_get_float("gamma");
+    config->gamma_fused = flag_get_bool("gamma_fused");
+    config->compress_textures = flag_get_bool("compress_textures");
+    config->texture_budget_mb = (uint32_t)flag_get_int("texture_budget_mb");
+    
+    // They measure fixed quality levels, so the scale must not move
+    config->dynamic_resolution = 0;
+}
+
+static void vm_sprite_benchmark(vm_state* state, uint32_t sprite_count) {
+    renderer_config config;
+    offscreen_config(state, &config);
+    
+    vulkan_context offscreen = {0};
+    renderer_init(&offscreen, NULL, &config);
+    if (offscreen.device == VK_NULL_HANDLE) {
+        return;
+    }
+    
+    sprite_benchmark_result result;
+    int measured = sprite_benchmark(&offscreen, sprite_count, SPRITE_BENCHMARK_FRAMES, &result);
+    renderer_cleanup(&offscreen);
+    if (!measured) {
+        return;
+    }
+    
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+        "sprite benchmark: %u sprites in %u batches, submit %llu ns, sort %llu ns, write %llu ns, "
+        "cpu %llu ns, gpu %llu ns per frame",
+        result.sprite_count, result.batch_count, (unsigned long long)result.submit_ns,
+        (unsigned long long)result.sort_ns, (unsigned long long)result.write_ns,
+        (unsigned long long)result.cpu_frame_ns, (unsigned long long)result.gpu_frame_ns);
+}
+
+// The same gamma pass merged into the scene pass and on its own; the
+// difference is what keeping the scene in tile memory saves
+static void vm_gamma_benchmark(vm_state* state) {
+    renderer_gamma_benchmark_result results[2];
+    for (int fused = 1; fused >= 0; fused--) {
+        renderer_config config;
+        offscreen_config(state, &config);
+        config.gamma_fused = fused;
+        
+        vulkan_context offscreen = {0};
+        renderer_init(&offscreen, NULL, &config);
+        if (offscreen.device == VK_NULL_HANDLE) {
+            return;
+        }
+        
+        renderer_gamma_benchmark_result* result = &results[fused];
+        int measured = renderer_gamma_benchmark(&offscreen, RENDER_GAMMA_BENCHMARK_FRAMES, result);
+        renderer_cleanup(&offscreen);
+        if (!measured) {
+            __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+                                "gamma benchmark: gamma %.2f needs no post pass", config.gamma);
+            return;
+        }
+        
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+            "gamma benchmark (%s): gamma %.2f, gpu %llu ns per frame, post %llu ns, "
+            "attachments load %llu KiB, store %llu KiB, lazy %llu KiB",
+            fused ? "subpass" : "separate pass", result->gamma, (unsigned long long)result->gpu_frame_ns,
+            (unsigned long long)result->gpu_post_ns, (unsigned long long)(result->load_bytes >> 10),
+            (unsigned long long)(result->store_bytes >> 10), (unsigned long long)(result->lazy_bytes >> 10));
+    }
+    
+    long long traffic = (long long)(results[0].load_bytes + results[0].store_bytes) -
+                        (long long)(results[1].load_bytes + results[1].store_bytes);
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+        "gamma benchmark: the subpass saves %lld KiB of attachment traffic and %lld ns of gpu time per frame",
+        traffic / 1024, (long long)results[0].gpu_frame_ns - (long long)results[1].gpu_frame_ns);
+}
+
+// Needs no device, only the job workers
+static void vm_texture_benchmark(void) {
+    texture_benchmark_result result;
+    if (!texture_benchmark(&result)) {
+        return;
+    }
+    
+    // Megapixels per second from nanoseconds per image
+    double pixels = (double)result.width * result.height * 1000.0;
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+        "texture benchmark: %ux%u, %s, MPix/s: encode bc1 %.1f (scalar %.1f), bc3 %.1f (scalar %.1f), "
+        "etc2 %.1f, decode bc1 %.1f, bc3 %.1f, etc2 %.1f, bc1 to etc2 on %u workers %.1f",
+        result.width, result.height, result.simd ? "simd" : "no simd",
+        pixels / result.encode_bc1_simd_ns, pixels / result.encode_bc1_scalar_ns,
+        pixels / result.encode_bc3_simd_ns, pixels / result.encode_bc3_scalar_ns,
+        pixels / result.encode_etc2_ns, pixels / result.decode_bc1_ns, pixels / result.decode_bc3_ns,
+        pixels / result.decode_etc2_ns, result.workers, pixels / result.transcode_parallel_ns);
+}
+
+// Loose files against the same assets in a pack, written to and removed
+// from the cache directory
+static void vm_pack_benchmark(uint32_t asset_count) {
+    pack_benchmark_result result;
+    if (!pack_benchmark(flag_get_string("cache_dir"), asset_count, &result)) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "pack benchmark: could not write the assets");
+        return;
+    }
+    
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+        "pack benchmark: %u assets, %llu KiB (lz4 %llu KiB), %s cache: loose files %llu us, "
+        "mapped pack %llu us, lz4 pack %llu us",
+        result.asset_count, (unsigned long long)(result.total_bytes >> 10),
+        (unsigned long long)(result.lz4_bytes >> 10), result.cold ? "cold" : "warm",
+        (unsigned long long)(result.loose_ns / 1000), (unsigned long long)(result.pack_ns / 1000),
+        (unsigned long long)(result.pack_lz4_ns / 1000));
+}
+
+// Needs no device, only the job workers
+static void vm_ecs_benchmark(uint32_t entity_count) {
+    ecs_benchmark_result result;
+    if (!ecs_benchmark(entity_count, &result)) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "ecs benchmark: could not create the entities");
+        return;
+    }
+    
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+        "ecs benchmark: %u entities in %u chunks, created in %llu us; per update of 3 systems in %u waves: "
+        "array of structs %llu us, chunks %llu us, chunks on %u workers %llu us",
+        result.entity_count, result.chunk_count, (unsigned long long)(result.create_ns / 1000), result.waves,
+        (unsigned long long)(result.aos_ns / 1000), (unsigned long long)(result.serial_ns / 1000),
+        result.workers, (unsigned long long)(result.parallel_ns / 1000));
+}
+
+static void vm_log_stream_stats(vm_state* state) {
+    stream_stats stats;
+    stream_get_stats(&state->vk, &stats);
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+        "texture streaming: %u textures, %u KiB of %u KiB budget resident (%u KiB requested), "
+        "%u of %u requested levels, %u loading, %llu loads (%llu KiB), %llu evictions (%llu KiB), "
+        "%llu deferred, %llu failed, %llu us building",
+        stats.texture_count, (uint32_t)(stats.resident_bytes >> 10), (uint32_t)(stats.budget_bytes >> 10),
+        (uint32_t)(stats.requested_bytes >> 10), stats.resident_levels, stats.requested_levels, stats.loading,
+        (unsigned long long)stats.loads, (unsigned long long)(stats.loaded_bytes >> 10),
+        (unsigned long long)stats.evictions, (unsigned long long)(stats.evicted_bytes >> 10),
+        (unsigned long long)stats.deferred, (unsigned long long)stats.failed,
+        (unsigned long long)(stats.build_ns / 1000));
+}
+
 vm_state* vm_create(ANativeWindow* window) {
     flags_init();
     flag_register_bool("limitfps30", false);
     flag_register_bool("vsync", true);
     flag_register_bool("fullscreen", false);
     flag_register_int("msaa", 4);
+    flag_register_int("frames_in_flight", DEFAULT_FRAMES_IN_FLIGHT);
     flag_register_int("resolution_width", 1280);
     flag_register_int("resolution_height", 720);
     flag_register_float("gamma", 1.0f);
+    flag_register_bool("gamma_fused", true);
+    flag_register_bool("gamma_benchmark", false);
     flag_register_string("renderer", "vulkan");
+    flag_register_bool("autotune", false);
+    flag_register_string("calibration_device", "");
+    flag_register_string("cache_dir", ".");
+    flag_register_string("shader_dir", "shaders");
+    flag_register_int("job_workers", DEFAULT_JOB_WORKERS);
+    flag_register_bool("cache_command_buffers", true);
+    flag_register_bool("parallel_recording", true);
+    flag_register_bool("timeline_semaphores", true);
+    flag_register_bool("bindless_textures", true);
+    flag_register_bool("gpu_culling", true);
+    flag_register_bool("dynamic_resolution", true);
+    flag_register_float("gpu_budget_ms", DEFAULT_GPU_BUDGET_MS);
+    flag_register_int("sprite_benchmark", 0);
+    flag_register_bool("compress_textures", true);
+    flag_register_bool("texture_benchmark", false);
+    flag_register_int("texture_budget_mb", STREAM_DEFAULT_BUDGET_MB);
+    flag_register_bool("texture_stream_stats", false);
+    flag_register_int("pack_benchmark", 0);
+    flag_register_int("ecs_benchmark", 0);
+    flag_register_bool("async_init", true);
     
     check_instance_init();
     check_instance_register(window);
@@ -26,7 +221,12 @@ vm_state* vm_create(ANativeWindow* window) {
     state->stack.capacity = 256;
     state->stack.items = malloc(sizeof(vm_stack_item) * state->stack.capacity);
     state->stack.top = -1;
+    state->deferred.capacity = 256;
+    state->deferred.items = malloc(sizeof(vm_stack_item) * state->deferred.capacity);
+    state->deferred.top = -1;
+    pthread_mutex_init(&state->init_lock, NULL);
     state->clear_color[3] = 1.0f;
+    state->world = ecs_create_world();
     
     return state;
 }
@@ -36,11 +236,23 @@ void vm_destroy(vm_state* state) {
     
     check_instance_unregister(state->window);
     
+    // An init still running owns the context; let it finish before tearing down
+    if (state->init_pending) {
+        pthread_join(state->init_thread, NULL);
+        state->init_pending = 0;
+        state->initialized = 1;
+    }
+    
     if (state->initialized) {
         renderer_cleanup(&state->vk);
+        jobs_stop_workers();
+        jobs_shutdown();
     }
     
+    ecs_destroy_world(state->world);
+    pthread_mutex_destroy(&state->init_lock);
     free(state->stack.items);
+    free(state->deferred.items);
     free(state);
     
     flags_cleanup();
@@ -55,7 +267,195 @@ void vm_push(vm_state* state, vm_command_type type, void* data, void (*callback)
     state->stack.items[state->stack.top].callback = callback;
 }
 
+// On the init thread, so the VM never waits for it. Settings chosen for
+// this device and surface came in with the flags and are already live;
+// otherwise the live context is rebuilt when the result changes it.
+static void vm_calibrate(vm_state* state) {
+    if (state->vk.device == VK_NULL_HANDLE) {
+        return;
+    }
+    
+    char key[CALIBRATION_KEY_SIZE];
+    calibrate_device_key(&state->vk, key, sizeof(key));
+    if (strcmp(key, state->calibration_device) == 0) {
+        return;
+    }
+    
+    calibration_result* result = &state->calibration;
+    if (!calibrate_run(&state->vk, &state->init_config, CALIBRATION_FRAMES, result)) {
+        return;
+    }
+    state->calibrated = 1;
+    
+    __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG,
+        "calibration: cpu %llu ns, gpu %llu ns -> %dx%d msaa %d%s",
+        (unsigned long long)result->cpu_frame_ns, (unsigned long long)result->gpu_frame_ns,
+        result->resolution_width, result->resolution_height, result->msaa,
+        result->limitfps30 ? " limitfps30" : "");
+    
+    renderer_config* config = &state->init_config;
+    if (config->msaa_samples != (uint32_t)result->msaa ||
+        config->render_width != (uint32_t)result->resolution_width ||
+        config->render_height != (uint32_t)result->resolution_height) {
+        config->msaa_samples = (uint32_t)result->msaa;
+        config->render_width = (uint32_t)result->resolution_width;
+        config->render_height = (uint32_t)result->resolution_height;
+        renderer_cleanup(&state->vk);
+        renderer_init(&state->vk, state->window, config);
+    }
+}
+
+// Its own thread rather than a job: renderer_init hands stages to the
+// workers and waits on them
+static void* vm_init_main(void* arg) {
+    vm_state* state = arg;
+    renderer_init(&state->vk, state->window, &state->init_config);
+    if (state->autotune) {
+        vm_calibrate(state);
+    }
+    
+    pthread_mutex_lock(&state->init_lock);
+    state->init_done = 1;
+    pthread_mutex_unlock(&state->init_lock);
+    
+    return NULL;
+}
+
+static void vm_start_init(vm_state* state) {
+    renderer_config* config = &state->init_config;
+    memset(config, 0, sizeof(renderer_config));
+    config->frames_in_flight = (uint32_t)flag_get_int("frames_in_flight");
+    
+    // The init thread reads these while the VM thread may reload the flags
+    copy_flag_string(config->cache_dir, sizeof(config->cache_dir), "cache_dir");
+    copy_flag_string(config->shader_dir, sizeof(config->shader_dir), "shader_dir");
+    config->cache_command_buffers = flag_get_bool("cache_command_buffers");
+    config->parallel_recording = flag_get_bool("parallel_recording");
+    config->timeline_semaphores = flag_get_bool("timeline_semaphores");
+    config->bindless_textures = flag_get_bool("bindless_textures");
+    config->gpu_culling = flag_get_bool("gpu_culling");
+    config->msaa_samples = (uint32_t)flag_get_int("msaa");
+    config->dynamic_resolution = flag_get_bool("dynamic_resolution");
+    config->gpu_budget_ms = flag_get_float("gpu_budget_ms");
+    config->render_width = (uint32_t)flag_get_int("resolution_width");
+    config->render_height = (uint32_t)flag_get_int("resolution_height");
+    config->gamma = flag_get_float("gamma");
+    config->gamma_fused = flag_get_bool("gamma_fused");
+    config->compress_textures = flag_get_bool("compress_textures");
+    config->texture_budget_mb = (uint32_t)flag_get_int("texture_budget_mb");
+    
+    state->autotune = flag_get_bool("autotune");
+    state->calibrated = 0;
+    copy_flag_string(state->calibration_device, sizeof(state->calibration_device), "calibration_device");
+    
+    jobs_init();
+    jobs_start_workers(flag_get_int("job_workers"));
+    
+    state->init_done = 0;
+    state->init_pending = 1;
+    if (!flag_get_bool("async_init") ||
+        pthread_create(&state->init_thread, NULL, vm_init_main, state) != 0) {
+        vm_init_main(state);
+        state->init_pending = 0;
+    }
+}
+
+// Frames missed during init are gone; one render catches up for all of
+// them. Back-to-back updates merge too, since the next one takes the whole
+// time since the last.
+static void vm_defer(vm_state* state, vm_stack_item item) {
+    vm_stack* deferred = &state->deferred;
+    if ((item.type == vm_cmd_render || item.type == vm_cmd_update) && deferred->top >= 0 &&
+        deferred->items[deferred->top].type == item.type) {
+        return;
+    }
+    if (deferred->top >= deferred->capacity - 1) return;
+    
+    deferred->top++;
+    deferred->items[deferred->top] = item;
+}
+
+static void vm_execute_item(vm_state* state, vm_stack_item item);
+
+// Systems get the time since the previous update; the first one gets none
+static void vm_update(vm_state* state) {
+    uint64_t now = timing_now_ns();
+    float dt = state->last_update_ns ? (float)(now - state->last_update_ns) * 1e-9f : 0.0f;
+    state->last_update_ns = now;
+    if (state->world) {
+        ecs_update(state->world, dt);
+    }
+}
+
+// Runs what had to wait for the renderer, then the held commands in arrival order
+static void vm_finish_init(vm_state* state) {
+    if (state->init_pending) {
+        pthread_mutex_lock(&state->init_lock);
+        int done = state->init_done;
+        pthread_mutex_unlock(&state->init_lock);
+        if (!done) return;
+        
+        pthread_join(state->init_thread, NULL);
+        state->init_pending = 0;
+    }
+    state->initialized = 1;
+    state->renderer_ready = state->vk.device != VK_NULL_HANDLE;
+    if (!state->renderer_ready) {
+        __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "renderer init failed, nothing will be drawn");
+    }
+    
+    if (state->calibrated) {
+        calibrate_apply(&state->calibration);
+    }
+    
+    // Sprite count per frame, e.g. 100000; 0 skips the benchmark
+    if (state->renderer_ready && flag_get_int("sprite_benchmark") > 0) {
+        vm_sprite_benchmark(state, (uint32_t)flag_get_int("sprite_benchmark"));
+    }
+    
+    if (state->renderer_ready && flag_get_bool("gamma_benchmark")) {
+        vm_gamma_benchmark(state);
+    }
+    
+    if (flag_get_bool("texture_benchmark")) {
+        vm_texture_benchmark();
+    }
+    
+    // Asset count, e.g. 2000; 0 skips the benchmark
+    if (flag_get_int("pack_benchmark") > 0) {
+        vm_pack_benchmark((uint32_t)flag_get_int("pack_benchmark"));
+    }
+    
+    // Entity count, e.g. 1000000; 0 skips the benchmark
+    if (flag_get_int("ecs_benchmark") > 0) {
+        vm_ecs_benchmark((uint32_t)flag_get_int("ecs_benchmark"));
+    }
+    
+    for (int i = 0; i <= state->deferred.top; i++) {
+        vm_execute_item(state, state->deferred.items[i]);
+    }
+    state->deferred.top = -1;
+}
+
+static int vm_needs_renderer(vm_command_type type) {
+    return type == vm_cmd_render || type == vm_cmd_resize || type == vm_cmd_sprites;
+}
+
+// Commands run as they arrive until the first one that needs the renderer
+// is held; everything after it is held too, so the replay keeps arrival
+// order. Cleanup never waits, since it ends the VM.
+static int vm_must_defer(vm_state* state, vm_command_type type) {
+    if (!state->init_pending || type == vm_cmd_cleanup || type == vm_cmd_init) {
+        return 0;
+    }
+    return vm_needs_renderer(type) || state->deferred.top >= 0;
+}
+
 int vm_execute_next(vm_state* state) {
+    if (state->init_pending) {
+        vm_finish_init(state);
+    }
+    
     if (state->stack.top < 0) return 0;
     
     check_instance_validate();
@@ -63,16 +463,28 @@ int vm_execute_next(vm_state* state) {
     vm_stack_item item = state->stack.items[state->stack.top];
     state->stack.top--;
     
+    if (vm_must_defer(state, item.type)) {
+        vm_defer(state, item);
+        return 1;
+    }
+    
+    vm_execute_item(state, item);
+    return 1;
+}
+
+static void vm_execute_item(vm_state* state, vm_stack_item item) {
     switch (item.type) {
         case vm_cmd_init:
-            if (!state->initialized) {
-                renderer_init(&state->vk, state->window);
-                state->initialized = 1;
+            if (!state->initialized && !state->init_pending) {
+                vm_start_init(state);
+                if (!state->init_pending) {
+                    vm_finish_init(state);
+                }
             }
             break;
             
         case vm_cmd_render:
-            if (state->initialized) {
+            if (state->renderer_ready) {
                 if (flag_get_bool("limitfps30")) {
                     state->frame_time = 33333333;
                 } else {
@@ -86,10 +498,15 @@ int vm_execute_next(vm_state* state) {
                 }
                 
                 renderer_draw(&state->vk, state->clear_color);
+                if (flag_get_bool("texture_stream_stats") &&
+                    state->vk.stats.frame_count % STREAM_STATS_FRAMES == 0) {
+                    vm_log_stream_stats(state);
+                }
             }
             break;
             
         case vm_cmd_update:
+            vm_update(state);
             break;
             
         case vm_cmd_clear_color:
@@ -107,9 +524,20 @@ int vm_execute_next(vm_state* state) {
                 item.callback();
             }
             break;
+            
+        case vm_cmd_resize:
+            if (state->renderer_ready) {
+                renderer_resize(&state->vk);
+            }
+            break;
+            
+        case vm_cmd_sprites:
+            if (state->renderer_ready && item.data) {
+                const sprite_list* list = item.data;
+                sprite_submit(&state->vk, list->sprites, list->count);
+            }
+            break;
     }
-    
-    return 1;
 }
 
 void vm_execute_all(vm_state* state) {
@@ -163,3 +591,7 @@ void vm_parse_flags_from_args(int argc, char** argv) {
 void vm_parse_flags_from_file(const char* filename) {
     flags_parse_file(filename);
 }
+
+bool vm_load_flags_config(const char* filename, const char* blob_filename) {
+    return flags_load_config(filename, blob_filename);
+}
@@ -1,6 +1,11 @@
 #pragma once
 #include "renderer.h"
-#include <android/native_window.h>
+#include "calibrate.h"
+#include "platform.h"
+#include <pthread.h>
+#include <stdint.h>
+
+struct ecs_world;
 
 typedef enum {
     vm_cmd_render,
@@ -8,7 +13,9 @@ typedef enum {
     vm_cmd_init,
     vm_cmd_cleanup,
     vm_cmd_clear_color,
-    vm_cmd_custom
+    vm_cmd_custom,
+    vm_cmd_resize,
+    vm_cmd_sprites
 } vm_command_type;
 
 typedef struct {
@@ -28,12 +35,44 @@ typedef struct {
     vulkan_context vk;
     ANativeWindow* window;
     int initialized;
+    
+    // Init ran but renderer_init failed when this is 0 with initialized
+    // set; commands that need the renderer are then dropped
+    int renderer_ready;
+    
+    // renderer_init runs on init_thread while the VM keeps taking commands;
+    // the first that needs the renderer and all after it wait in deferred,
+    // oldest first
+    pthread_t init_thread;
+    pthread_mutex_t init_lock;
+    int init_pending;
+    int init_done;
+    renderer_config init_config;
+    vm_stack deferred;
+    
+    // With autotune, the init thread calibrates when the config's settings
+    // were chosen for another device or surface; the VM thread then writes
+    // the result into the flags
+    int autotune;
+    char calibration_device[CALIBRATION_KEY_SIZE];
+    int calibrated;
+    calibration_result calibration;
+    
+    int frame_time;
+    int vsync_enabled;
     float clear_color[4];
+    
+    // Advanced by vm_cmd_update with the time since the previous one
+    struct ecs_world* world;
+    uint64_t last_update_ns;
 } vm_state;
 
 vm_state* vm_create(ANativeWindow* window);
 void vm_destroy(vm_state* state);
 void vm_push(vm_state* state, vm_command_type type, void* data, void (*callback)(void));
+// From the first command that needs the renderer on, commands are held
+// until a pending init finishes, cleanup aside; the data they point to
+// must stay alive until then
 int vm_execute_next(vm_state* state);
 void vm_execute_all(vm_state* state);
 int vm_is_empty(vm_state* state);